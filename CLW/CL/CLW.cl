@@ -1106,6 +1106,52 @@ __kernel void copy(__global int4* in_input,
     safe_store_int4(value, out_output, global_id, in_size);
 }
 
+// 64-bit keys are sorted by two stable passes of the 32-bit sort, low half first,
+// carrying the permutation as values
+__kernel void split_keys_64(__global ulong const* in_keys,
+    uint in_size,
+    __global int* out_lo_keys,
+    __global int* out_permutation)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < in_size)
+    {
+        out_lo_keys[global_id] = (int)(in_keys[global_id] & 0xFFFFFFFFUL);
+        out_permutation[global_id] = global_id;
+    }
+}
+
+__kernel void gather_hi_keys_64(__global ulong const* in_keys,
+    __global int const* in_permutation,
+    uint in_size,
+    __global int* out_hi_keys)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < in_size)
+    {
+        out_hi_keys[global_id] = (int)(in_keys[in_permutation[global_id]] >> 32);
+    }
+}
+
+__kernel void gather_keys_values_64(__global ulong const* in_keys,
+    __global int const* in_values,
+    __global int const* in_permutation,
+    uint in_size,
+    __global ulong* out_keys,
+    __global int* out_values)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < in_size)
+    {
+        int idx = in_permutation[global_id];
+        out_keys[global_id] = in_keys[idx];
+        out_values[global_id] = in_values[idx];
+    }
+}
+
 
 #define FLAG(x) (flags[(x)] & 0x1)
 #define FLAG_COMBINED(x) (flags[(x)])
@@ -1358,7 +1404,10 @@ __kernel void segmented_scan_exclusive_int_nocut(__global int const* in_array,
 
     group_segmented_scan_exclusive_int_nocut(localId, groupSize, keys, flags);
 
-    out_array[globalId] = keys[localId];
+    if (globalId < numelems)
+    {
+        out_array[globalId] = keys[localId];
+    }
 }
 
 __kernel void segmented_scan_exclusive_int(__global int const* in_array,
@@ -1382,7 +1431,10 @@ __kernel void segmented_scan_exclusive_int(__global int const* in_array,
 
     group_segmented_scan_exclusive_int(localId, groupSize, keys, flags);
 
-    out_array[globalId] = keys[localId];
+    if (globalId < numelems)
+    {
+        out_array[globalId] = keys[localId];
+    }
 }
 
 __kernel void segmented_scan_exclusive_int_part(__global int const* in_array,
@@ -1408,7 +1460,10 @@ __kernel void segmented_scan_exclusive_int_part(__global int const* in_array,
 
     group_segmented_scan_exclusive_int_part(localId, groupId, groupSize, keys, flags, out_part_sums, out_part_flags);
 
-    out_array[globalId] = keys[localId];
+    if (globalId < numelems)
+    {
+        out_array[globalId] = keys[localId];
+    }
 }
 
 __kernel void segmented_scan_exclusive_int_nocut_part(__global int const* in_array,
@@ -1434,7 +1489,10 @@ __kernel void segmented_scan_exclusive_int_nocut_part(__global int const* in_arr
 
     group_segmented_scan_exclusive_int_nocut_part(localId, groupId, groupSize, keys, flags, out_part_sums, out_part_flags);
 
-    out_array[globalId] = keys[localId];
+    if (globalId < numelems)
+    {
+        out_array[globalId] = keys[localId];
+    }
 }
 
 
@@ -1455,12 +1513,9 @@ __kernel void segmented_distribute_part_sum_int(
 
     if (localId == 0)
     {
-        for (int i = 0; in_flags[globalId + i] == 0 && i < groupSize; ++i)
+        for (int i = 0; i < groupSize && globalId + i < numelems && in_flags[globalId + i] == 0; ++i)
         {
-            if (globalId + i < numelems)
-            {
-                inout_array[globalId + i] += sum;
-            }
+            inout_array[globalId + i] += sum;
         }
     }
 }
@@ -1575,6 +1630,26 @@ __kernel void reduction_##bin_op##_##type(const __global type* buffer,\
         atomic_##bin_op##_##type(out + out_offset, shared_mem[0]);\
 }
 
+// --------------------- SEGMENTED REDUCTION ------------------------
+
+// One work item per segment, segment i spans [offsets[i], offsets[i + 1]),
+// elements are summed in order to keep float results reproducible
+#define DEFINE_SEGMENTED_REDUCTION_ADD(type)\
+__kernel void segmented_reduction_add_##type(const __global type* buffer,\
+                                             const __global int* offsets,\
+                                             int num_segments,\
+                                             __global type* out)\
+{\
+    int global_id = get_global_id(0);\
+    if (global_id < num_segments)\
+    {\
+        type sum = 0;\
+        for (int i = offsets[global_id]; i < offsets[global_id + 1]; ++i)\
+            sum += buffer[i];\
+        out[global_id] = sum;\
+    }\
+}
+
 // --------------------- NORMALIZATION ------------------------
 
 #define DEFINE_BUFFER_NORMALIZATION(type)\
@@ -1602,6 +1677,9 @@ DEFINE_REDUCTION(max, int)
 DEFINE_REDUCTION(max, float)
 DEFINE_REDUCTION(max, float3)
 
+DEFINE_SEGMENTED_REDUCTION_ADD(int)
+DEFINE_SEGMENTED_REDUCTION_ADD(float)
+
 DEFINE_BUFFER_NORMALIZATION(int)
 DEFINE_BUFFER_NORMALIZATION(float)
 DEFINE_BUFFER_NORMALIZATION(float3)
\ No newline at end of file
@@ -47,6 +47,7 @@ public:
     static CLWBuffer<T> Create(cl_context context, cl_mem_flags flags, size_t elementCount);
     static CLWBuffer<T> Create(cl_context context, cl_mem_flags flags, size_t elementCount, void* data);
     static CLWBuffer<T> CreateFromClBuffer(cl_mem buffer);
+    static CLWBuffer<T> CreateFromClBuffer(cl_mem buffer, size_t elementCount);
 
     CLWBuffer() = default;
     virtual ~CLWBuffer() = default;
@@ -115,6 +116,11 @@ template <typename T> CLWBuffer<T> CLWBuffer<T>::CreateFromClBuffer(cl_mem buffe
     return CLWBuffer(buffer, bufferSize / sizeof(T));
 }
 
+template <typename T> CLWBuffer<T> CLWBuffer<T>::CreateFromClBuffer(cl_mem buffer, size_t elementCount)
+{
+    return CLWBuffer(buffer, elementCount);
+}
+
 template <typename T> CLWBuffer<T>::CLWBuffer(cl_mem buffer, size_t elementCount)
 : ReferenceCounter<cl_mem, clRetainMemObject, clReleaseMemObject>(buffer)
 , elementCount_(elementCount)
@@ -814,6 +814,82 @@ CLWEvent CLWParallelPrimitives::SortRadix(unsigned int deviceIdx, CLWBuffer<cl_i
     return event;
 }
 
+CLWEvent CLWParallelPrimitives::SortRadix(unsigned int deviceIdx, CLWBuffer<cl_ulong> inputKeys, CLWBuffer<cl_ulong> outputKeys,
+    CLWBuffer<cl_int> inputValues, CLWBuffer<cl_int> outputValues, int numElems)
+{
+    int NUM_BLOCKS = (int)((numElems + WG_SIZE - 1) / WG_SIZE);
+
+    auto deviceKeys = GetTempIntBuffer(numElems);
+    auto deviceSortedKeys = GetTempIntBuffer(numElems);
+    auto devicePermutation = GetTempIntBuffer(numElems);
+    auto deviceSortedPermutation = GetTempIntBuffer(numElems);
+
+    CLWKernel splitKernel = program_.GetKernel("split_keys_64");
+    CLWKernel gatherKeysKernel = program_.GetKernel("gather_hi_keys_64");
+    CLWKernel gatherKernel = program_.GetKernel("gather_keys_values_64");
+
+    // Sort by low halves
+    splitKernel.SetArg(0, inputKeys);
+    splitKernel.SetArg(1, (cl_uint)numElems);
+    splitKernel.SetArg(2, deviceKeys);
+    splitKernel.SetArg(3, devicePermutation);
+    context_.Launch1D(deviceIdx, NUM_BLOCKS * WG_SIZE, WG_SIZE, splitKernel);
+
+    SortRadix(deviceIdx, deviceKeys, deviceSortedKeys, devicePermutation, deviceSortedPermutation, numElems);
+
+    // Stable sort by high halves preserves the order of equal ones
+    gatherKeysKernel.SetArg(0, inputKeys);
+    gatherKeysKernel.SetArg(1, deviceSortedPermutation);
+    gatherKeysKernel.SetArg(2, (cl_uint)numElems);
+    gatherKeysKernel.SetArg(3, deviceKeys);
+    context_.Launch1D(deviceIdx, NUM_BLOCKS * WG_SIZE, WG_SIZE, gatherKeysKernel);
+
+    SortRadix(deviceIdx, deviceKeys, deviceSortedKeys, deviceSortedPermutation, devicePermutation, numElems);
+
+    gatherKernel.SetArg(0, inputKeys);
+    gatherKernel.SetArg(1, inputValues);
+    gatherKernel.SetArg(2, devicePermutation);
+    gatherKernel.SetArg(3, (cl_uint)numElems);
+    gatherKernel.SetArg(4, outputKeys);
+    gatherKernel.SetArg(5, outputValues);
+
+    /// TODO: unsafe as it is used in the kernel, may have problems on DMA devices
+    ReclaimTempIntBuffer(deviceKeys);
+    ReclaimTempIntBuffer(deviceSortedKeys);
+    ReclaimTempIntBuffer(devicePermutation);
+    ReclaimTempIntBuffer(deviceSortedPermutation);
+
+    return context_.Launch1D(deviceIdx, NUM_BLOCKS * WG_SIZE, WG_SIZE, gatherKernel);
+}
+
+CLWEvent CLWParallelPrimitives::SegmentedReduceAdd(unsigned int deviceIdx, CLWBuffer<cl_int> input, CLWBuffer<cl_int> offsets, CLWBuffer<cl_int> output, int numSegments)
+{
+    int NUM_BLOCKS = (int)((numSegments + WG_SIZE - 1) / WG_SIZE);
+
+    CLWKernel reduceKernel = program_.GetKernel("segmented_reduction_add_int");
+
+    reduceKernel.SetArg(0, input);
+    reduceKernel.SetArg(1, offsets);
+    reduceKernel.SetArg(2, numSegments);
+    reduceKernel.SetArg(3, output);
+
+    return context_.Launch1D(deviceIdx, NUM_BLOCKS * WG_SIZE, WG_SIZE, reduceKernel);
+}
+
+CLWEvent CLWParallelPrimitives::SegmentedReduceAdd(unsigned int deviceIdx, CLWBuffer<cl_float> input, CLWBuffer<cl_int> offsets, CLWBuffer<cl_float> output, int numSegments)
+{
+    int NUM_BLOCKS = (int)((numSegments + WG_SIZE - 1) / WG_SIZE);
+
+    CLWKernel reduceKernel = program_.GetKernel("segmented_reduction_add_float");
+
+    reduceKernel.SetArg(0, input);
+    reduceKernel.SetArg(1, offsets);
+    reduceKernel.SetArg(2, numSegments);
+    reduceKernel.SetArg(3, output);
+
+    return context_.Launch1D(deviceIdx, NUM_BLOCKS * WG_SIZE, WG_SIZE, reduceKernel);
+}
+
 void CLWParallelPrimitives::ReclaimDeviceMemory()
 {
     intBufferCache_.clear();
@@ -49,6 +49,14 @@ public:
 
     CLWEvent SortRadix(unsigned int deviceIdx, CLWBuffer<cl_int> inputKeys, CLWBuffer<cl_int> outputKeys);
 
+    // Stable sort by unsigned 64-bit keys
+    CLWEvent SortRadix(unsigned int deviceIdx, CLWBuffer<cl_ulong> inputKeys, CLWBuffer<cl_ulong> outputKeys,
+        CLWBuffer<cl_int> inputValues, CLWBuffer<cl_int> outputValues, int numElems);
+
+    // Sums of segments [offsets[i], offsets[i + 1]) for i in [0, numSegments)
+    CLWEvent SegmentedReduceAdd(unsigned int deviceIdx, CLWBuffer<cl_int> input, CLWBuffer<cl_int> offsets, CLWBuffer<cl_int> output, int numSegments);
+    CLWEvent SegmentedReduceAdd(unsigned int deviceIdx, CLWBuffer<cl_float> input, CLWBuffer<cl_int> offsets, CLWBuffer<cl_float> output, int numSegments);
+
     CLWEvent Compact(unsigned int deviceIdx, CLWBuffer<cl_int> predicate, CLWBuffer<cl_int> input, CLWBuffer<cl_int> output, int numElems, cl_int& newSize);
     CLWEvent Compact(unsigned int deviceIdx, CLWBuffer<cl_int> predicate, CLWBuffer<cl_int> input, CLWBuffer<cl_int> output, int numElems, CLWBuffer<cl_int> newSize);
     CLWEvent Copy(unsigned int deviceIdx, CLWBuffer<cl_int> input, CLWBuffer<cl_int> output, int numElems);
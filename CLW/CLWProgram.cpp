@@ -345,20 +345,19 @@ void CLWProgram::GetBinaries(int device, std::vector<std::uint8_t>& data) const
     }
 
     status = clGetProgramInfo(*this, CL_PROGRAM_BINARIES,
-        sizeof(char*),
+        sizeof(char*) * num_devices,
         temp,
         nullptr);
 
-    // TODO: fix potential leak here
-    ThrowIf(status != CL_SUCCESS, status, "clGetProgramInfo failed");
-
     for (auto i = 0u; i < num_devices; ++i)
     {
         if (i != device)
         {
-            delete temp[i];
+            delete [] temp[i];
         }
     }
 
     delete [] temp;
+
+    ThrowIf(status != CL_SUCCESS, status, "clGetProgramInfo failed");
 }
@@ -0,0 +1,59 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#if USE_HOST
+
+#include <cstdint>
+#include <cstddef>
+
+#include "calc_common.h"
+#include "device.h"
+
+namespace Calc
+{
+    // Host-native kernel entry point.
+    // The kernel processes work items in [begin, end) range. Arguments are
+    // passed in the order they have been set with Function::SetArg: buffers
+    // as pointers to their host storage, values as pointers to their copies.
+    using HostKernel = void (*)(void* const* args, std::size_t begin, std::size_t end);
+
+    // Named host-native kernel
+    struct HostKernelEntry
+    {
+        char const* name;
+        HostKernel kernel;
+    };
+
+    class DeviceHost : public Device
+    {
+    public:
+        DeviceHost() = default;
+        virtual ~DeviceHost() = default;
+
+        // Host device is not able to compile sources, so executables
+        // are created out of tables of natively compiled kernels.
+        virtual Executable* CreateExecutable(HostKernelEntry const* kernels, std::size_t num_kernels) = 0;
+    };
+}
+
+#endif // USE_HOST
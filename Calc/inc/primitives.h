@@ -33,8 +33,29 @@ namespace Calc
         Primitives() = default;
         virtual ~Primitives() = default;
 
+        // Stable sort of 32-bit values by 32-bit keys compared as unsigned integers
         virtual void SortRadixInt32(std::uint32_t queueidx, Buffer const* from_key, Buffer* to_key, Buffer const* from_value, Buffer* to_value, std::size_t size) = 0;
 
+        // Stable sort of 32-bit values by 64-bit keys compared as unsigned integers
+        virtual void SortRadixUint64(std::uint32_t queueidx, Buffer const* from_key, Buffer* to_key, Buffer const* from_value, Buffer* to_value, std::size_t size) = 0;
+
+        virtual void ScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) = 0;
+
+        virtual void ScanExclusiveAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) = 0;
+
+        // Exclusive scan restarting from zero at each element with non-zero head flag
+        virtual void SegmentedScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* heads, Buffer* to, std::size_t size) = 0;
+
+        // Sum of each segment in element order, segment i spans [offsets[i], offsets[i + 1]),
+        // so offsets holds num_segments + 1 entries
+        virtual void SegmentedReduceAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) = 0;
+
+        virtual void SegmentedReduceAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) = 0;
+
+        // Stable compaction of the elements with predicate 1 (predicates are either 0 or 1),
+        // number of elements written goes into to_size without host synchronization
+        virtual void CompactInt32(std::uint32_t queueidx, Buffer const* predicate, Buffer const* from, Buffer* to, Buffer* to_size, std::size_t size) = 0;
+
 
     private:
         Primitives(Primitives const&) = delete;
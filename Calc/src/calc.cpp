@@ -27,6 +27,9 @@ THE SOFTWARE.
 #include "calc_vk.h"
 #include "calc_vkw.h"
 #endif
+#if USE_HOST
+#include "calc_host.h"
+#endif
 
 // Create corresponding calc
 Calc::Calc* CreateCalc(Calc::Platform inPlatform, int reserved)
@@ -45,6 +48,13 @@ Calc::Calc* CreateCalc(Calc::Platform inPlatform, int reserved)
         }
         else
 #endif // USE_VULKAN
+#if USE_HOST
+        if (inPlatform & Calc::Platform::kHost)
+        {
+            return new Calc::CalcHost();
+        }
+        else
+#endif // USE_HOST
         {
             return nullptr;
         }
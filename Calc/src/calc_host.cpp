@@ -0,0 +1,62 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#if USE_HOST
+#include "calc_host.h"
+#include "device_host.h"
+#include "device_host_impl.h"
+#include "except_host.h"
+
+namespace Calc
+{
+    std::uint32_t CalcHost::GetDeviceCount() const
+    {
+        // Host is exposed as a single device using all hardware threads
+        return 1;
+    }
+
+    void CalcHost::GetDeviceSpec(std::uint32_t idx, DeviceSpec& spec) const
+    {
+        if (idx >= GetDeviceCount())
+        {
+            throw ExceptionHost("Index is out of bounds");
+        }
+
+        DeviceHostImpl::GetHostSpec(spec);
+    }
+
+    Device* CalcHost::CreateDevice(std::uint32_t idx) const
+    {
+        if (idx >= GetDeviceCount())
+        {
+            throw ExceptionHost("Index is out of bounds");
+        }
+
+        return new DeviceHostImpl();
+    }
+
+    void CalcHost::DeleteDevice(Device* device)
+    {
+        delete device;
+    }
+}
+
+#endif // USE_HOST
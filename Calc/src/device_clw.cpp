@@ -29,6 +29,8 @@ THE SOFTWARE.
 #include "except_clw.h"
 #include "calc_clw_common.h"
 
+#include <algorithm>
+
 namespace Calc
 {    
     // Buffer implementation with CLW
@@ -176,6 +178,8 @@ namespace Calc
         Function* CreateFunction(char const* name) override;
         void DeleteFunction(Function* func) override;
 
+        CLWProgram GetProgram() const { return m_program; }
+
     private:
         CLWProgram m_program;
     };
@@ -461,7 +465,21 @@ namespace Calc
 
     Executable* DeviceClw::CompileExecutable(std::uint8_t const* binary_code, std::size_t size, char const* options)
     {
-        return nullptr;
+        // Binaries are device specific, so we only support single device contexts
+        if (m_context.GetDeviceCount() != 1)
+        {
+            return nullptr;
+        }
+
+        try
+        {
+            auto binary = const_cast<std::uint8_t*>(binary_code);
+            return new ExecutableClw(CLWProgram::CreateFromBinary(&binary, &size, m_context));
+        }
+        catch (CLWException& e)
+        {
+            throw ExceptionClw(e.what());
+        }
     }
 
     void DeviceClw::DeleteExecutable(Executable* executable)
@@ -471,12 +489,40 @@ namespace Calc
 
     size_t DeviceClw::GetExecutableBinarySize(Executable const* executable) const
     {
-        return 0;
+        if (m_context.GetDeviceCount() != 1)
+        {
+            return 0;
+        }
+
+        try
+        {
+            std::vector<std::uint8_t> data;
+            static_cast<ExecutableClw const*>(executable)->GetProgram().GetBinaries(0, data);
+            return data.size();
+        }
+        catch (CLWException& e)
+        {
+            throw ExceptionClw(e.what());
+        }
     }
 
     void DeviceClw::GetExecutableBinary(Executable const* executable, std::uint8_t* binary) const
     {
+        if (m_context.GetDeviceCount() != 1)
+        {
+            return;
+        }
 
+        try
+        {
+            std::vector<std::uint8_t> data;
+            static_cast<ExecutableClw const*>(executable)->GetProgram().GetBinaries(0, data);
+            std::copy(data.cbegin(), data.cend(), binary);
+        }
+        catch (CLWException& e)
+        {
+            throw ExceptionClw(e.what());
+        }
     }
 
     void DeviceClw::Execute(Function const* func, std::uint32_t queue, size_t global_size, size_t local_size, Event** e)
@@ -624,6 +670,75 @@ namespace Calc
             m_pp.SortRadix((int)queueidx, from_key_clw->GetData(), to_key_clw->GetData(), from_value_clw->GetData(), to_value_clw->GetData(), (int)size);
         }
 
+        void ScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) override
+        {
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto to_clw = static_cast<BufferClw*>(to);
+
+            m_pp.ScanExclusiveAdd((int)queueidx, CLWBuffer<cl_int>::CreateFromClBuffer(from_clw->GetData()), CLWBuffer<cl_int>::CreateFromClBuffer(to_clw->GetData()), (int)size);
+        }
+
+        void SortRadixUint64(std::uint32_t queueidx, Buffer const* from_key, Buffer* to_key, Buffer const* from_value, Buffer* to_value, std::size_t size) override
+        {
+            auto from_key_clw = static_cast<BufferClw const*>(from_key);
+            auto to_key_clw = static_cast<BufferClw*>(to_key);
+            auto from_value_clw = static_cast<BufferClw const*>(from_value);
+            auto to_value_clw = static_cast<BufferClw*>(to_value);
+
+            m_pp.SortRadix((int)queueidx, CLWBuffer<cl_ulong>::CreateFromClBuffer(from_key_clw->GetData()), CLWBuffer<cl_ulong>::CreateFromClBuffer(to_key_clw->GetData()),
+                CLWBuffer<cl_int>::CreateFromClBuffer(from_value_clw->GetData()), CLWBuffer<cl_int>::CreateFromClBuffer(to_value_clw->GetData()), (int)size);
+        }
+
+        void ScanExclusiveAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) override
+        {
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto to_clw = static_cast<BufferClw*>(to);
+
+            m_pp.ScanExclusiveAdd((int)queueidx, CLWBuffer<cl_float>::CreateFromClBuffer(from_clw->GetData()), CLWBuffer<cl_float>::CreateFromClBuffer(to_clw->GetData()), (int)size);
+        }
+
+        void SegmentedScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* heads, Buffer* to, std::size_t size) override
+        {
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto heads_clw = static_cast<BufferClw const*>(heads);
+            auto to_clw = static_cast<BufferClw*>(to);
+
+            // Segmented scan takes the number of elements from the buffers
+            m_pp.SegmentedScanExclusiveAdd((int)queueidx, CLWBuffer<cl_int>::CreateFromClBuffer(from_clw->GetData(), size),
+                CLWBuffer<cl_int>::CreateFromClBuffer(heads_clw->GetData(), size), CLWBuffer<cl_int>::CreateFromClBuffer(to_clw->GetData(), size));
+        }
+
+        void SegmentedReduceAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) override
+        {
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto offsets_clw = static_cast<BufferClw const*>(offsets);
+            auto to_clw = static_cast<BufferClw*>(to);
+
+            m_pp.SegmentedReduceAdd((int)queueidx, CLWBuffer<cl_int>::CreateFromClBuffer(from_clw->GetData()), CLWBuffer<cl_int>::CreateFromClBuffer(offsets_clw->GetData()),
+                CLWBuffer<cl_int>::CreateFromClBuffer(to_clw->GetData()), (int)num_segments);
+        }
+
+        void SegmentedReduceAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) override
+        {
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto offsets_clw = static_cast<BufferClw const*>(offsets);
+            auto to_clw = static_cast<BufferClw*>(to);
+
+            m_pp.SegmentedReduceAdd((int)queueidx, CLWBuffer<cl_float>::CreateFromClBuffer(from_clw->GetData()), CLWBuffer<cl_int>::CreateFromClBuffer(offsets_clw->GetData()),
+                CLWBuffer<cl_float>::CreateFromClBuffer(to_clw->GetData()), (int)num_segments);
+        }
+
+        void CompactInt32(std::uint32_t queueidx, Buffer const* predicate, Buffer const* from, Buffer* to, Buffer* to_size, std::size_t size) override
+        {
+            auto predicate_clw = static_cast<BufferClw const*>(predicate);
+            auto from_clw = static_cast<BufferClw const*>(from);
+            auto to_clw = static_cast<BufferClw*>(to);
+            auto to_size_clw = static_cast<BufferClw*>(to_size);
+
+            m_pp.Compact((int)queueidx, CLWBuffer<cl_int>::CreateFromClBuffer(predicate_clw->GetData()), CLWBuffer<cl_int>::CreateFromClBuffer(from_clw->GetData()),
+                CLWBuffer<cl_int>::CreateFromClBuffer(to_clw->GetData()), (int)size, CLWBuffer<cl_int>::CreateFromClBuffer(to_size_clw->GetData()));
+        }
+
     private:
         CLWParallelPrimitives m_pp;
     };
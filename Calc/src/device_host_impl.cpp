@@ -0,0 +1,764 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#if USE_HOST
+#include "calc.h"
+#include "primitives.h"
+#include "device_host_impl.h"
+#include "buffer.h"
+#include "event.h"
+#include "executable.h"
+#include "except_host.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Calc
+{
+    // Buffer implementation in host memory
+    class BufferHost : public Buffer
+    {
+    public:
+        BufferHost(std::size_t size) : m_data(new char[size]), m_size(size) {}
+        ~BufferHost() override = default;
+
+        std::size_t GetSize() const override { return m_size; }
+
+        char* GetData() const { return m_data.get(); }
+
+    private:
+        std::unique_ptr<char[]> m_data;
+        std::size_t m_size;
+    };
+
+    // All host commands are complete by the time they return
+    class EventHost : public Event
+    {
+    public:
+        EventHost() = default;
+        ~EventHost() = default;
+
+        void Wait() override {}
+        bool IsComplete() const override { return true; }
+    };
+
+    class FunctionHost : public Function
+    {
+    public:
+        FunctionHost(HostKernel kernel);
+        ~FunctionHost() = default;
+
+        // Argument setters
+        void SetArg(std::uint32_t idx, std::size_t arg_size, void* arg) override;
+        void SetArg(std::uint32_t idx, Buffer const* arg) override;
+        void SetArg(std::uint32_t idx, std::size_t size, SharedMemory shmem) override;
+
+        HostKernel GetKernel() const { return m_kernel; }
+        void* const* GetArgs() const { return m_args.data(); }
+
+    private:
+        void Reserve(std::uint32_t idx);
+
+        HostKernel m_kernel;
+        // Argument pointers passed to the kernel
+        std::vector<void*> m_args;
+        // Storage for arguments passed by value
+        std::vector<std::vector<char>> m_values;
+    };
+
+    FunctionHost::FunctionHost(HostKernel kernel)
+        : m_kernel(kernel)
+    {
+    }
+
+    void FunctionHost::Reserve(std::uint32_t idx)
+    {
+        if (idx >= m_args.size())
+        {
+            m_args.resize(idx + 1, nullptr);
+            m_values.resize(idx + 1);
+        }
+    }
+
+    void FunctionHost::SetArg(std::uint32_t idx, std::size_t arg_size, void* arg)
+    {
+        Reserve(idx);
+        auto data = static_cast<char const*>(arg);
+        m_values[idx].assign(data, data + arg_size);
+        m_args[idx] = m_values[idx].data();
+    }
+
+    void FunctionHost::SetArg(std::uint32_t idx, Buffer const* arg)
+    {
+        Reserve(idx);
+        m_args[idx] = arg ? static_cast<BufferHost const*>(arg)->GetData() : nullptr;
+    }
+
+    void FunctionHost::SetArg(std::uint32_t idx, std::size_t size, SharedMemory shmem)
+    {
+        throw ExceptionHost("Shared memory arguments are not supported by host device");
+    }
+
+    // Executable implementation
+    class ExecutableHost : public Executable
+    {
+    public:
+        ExecutableHost(HostKernelEntry const* kernels, std::size_t num_kernels);
+        ~ExecutableHost() = default;
+
+        // Function management
+        Function* CreateFunction(char const* name) override;
+        void DeleteFunction(Function* func) override;
+
+    private:
+        std::map<std::string, HostKernel> m_kernels;
+    };
+
+    ExecutableHost::ExecutableHost(HostKernelEntry const* kernels, std::size_t num_kernels)
+    {
+        for (auto i = 0U; i < num_kernels; ++i)
+        {
+            m_kernels[kernels[i].name] = kernels[i].kernel;
+        }
+    }
+
+    Function* ExecutableHost::CreateFunction(char const* name)
+    {
+        auto iter = m_kernels.find(name);
+
+        if (iter == m_kernels.cend())
+        {
+            throw ExceptionHost(std::string("Host kernel not found: ") + name);
+        }
+
+        return new FunctionHost(iter->second);
+    }
+
+    void ExecutableHost::DeleteFunction(Function* func)
+    {
+        delete func;
+    }
+
+    static BufferHost const* CheckRange(Buffer const* buffer, std::size_t offset, std::size_t size)
+    {
+        auto buffer_host = static_cast<BufferHost const*>(buffer);
+
+        if (!buffer_host || offset + size > buffer_host->GetSize())
+        {
+            throw ExceptionHost("Buffer access is out of bounds");
+        }
+
+        return buffer_host;
+    }
+
+    // Device
+    DeviceHostImpl::DeviceHostImpl()
+        : m_kernel(nullptr)
+        , m_args(nullptr)
+        , m_global_size(0)
+        , m_chunk_size(0)
+        , m_next_chunk(0)
+        , m_num_busy(0)
+        , m_generation(0)
+        , m_shutdown(false)
+    {
+        auto num_threads = std::max(std::thread::hardware_concurrency(), 1U);
+
+        for (auto i = 1U; i < num_threads; ++i)
+        {
+            m_workers.emplace_back(&DeviceHostImpl::WorkerLoop, this);
+        }
+    }
+
+    DeviceHostImpl::~DeviceHostImpl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+
+        m_launch_cv.notify_all();
+
+        for (auto& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    void DeviceHostImpl::GetHostSpec(DeviceSpec& spec)
+    {
+        spec.name = "Host CPU";
+        spec.vendor = "Native";
+        spec.sourceTypes = SourceType::kHostNative;
+        spec.type = DeviceType::kCpu;
+
+        // Host memory is only limited by the OS
+        spec.global_mem_size = ~0ULL;
+        spec.local_mem_size = 0;
+        spec.min_alignment = alignof(std::max_align_t);
+        spec.max_alloc_size = ~0ULL;
+        spec.max_local_size = 1024;
+        spec.max_num_queues = 1;
+        spec.has_fp16 = false;
+    }
+
+    void DeviceHostImpl::GetSpec(DeviceSpec& spec)
+    {
+        GetHostSpec(spec);
+    }
+
+    Buffer* DeviceHostImpl::CreateBuffer(std::size_t size, std::uint32_t flags)
+    {
+        if (size == 0)
+        {
+            throw ExceptionHost("Buffer size should be greater than zero");
+        }
+
+        return new BufferHost(size);
+    }
+
+    Buffer* DeviceHostImpl::CreateBuffer(std::size_t size, std::uint32_t flags, void* initdata)
+    {
+        auto buffer = static_cast<BufferHost*>(CreateBuffer(size, flags));
+        std::memcpy(buffer->GetData(), initdata, size);
+        return buffer;
+    }
+
+    void DeviceHostImpl::DeleteBuffer(Buffer* buffer)
+    {
+        delete buffer;
+    }
+
+    void DeviceHostImpl::ReadBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, void* dst, Event** e) const
+    {
+        auto buffer_host = CheckRange(buffer, offset, size);
+
+        std::memcpy(dst, buffer_host->GetData() + offset, size);
+
+        if (e)
+        {
+            *e = new EventHost();
+        }
+    }
+
+    void DeviceHostImpl::WriteBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, void* src, Event** e)
+    {
+        auto buffer_host = CheckRange(buffer, offset, size);
+
+        std::memcpy(buffer_host->GetData() + offset, src, size);
+
+        if (e)
+        {
+            *e = new EventHost();
+        }
+    }
+
+    void DeviceHostImpl::MapBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, std::uint32_t map_type, void** mapdata, Event** e)
+    {
+        auto buffer_host = CheckRange(buffer, offset, size);
+
+        // Host buffers are mapped in place
+        *mapdata = buffer_host->GetData() + offset;
+
+        if (e)
+        {
+            *e = new EventHost();
+        }
+    }
+
+    void DeviceHostImpl::UnmapBuffer(Buffer const* buffer, std::uint32_t queue, void* mapdata, Event** e)
+    {
+        if (e)
+        {
+            *e = new EventHost();
+        }
+    }
+
+    Executable* DeviceHostImpl::CompileExecutable(char const* source_code, std::size_t size, char const* options)
+    {
+        throw ExceptionHost("Host device can't compile kernel sources");
+    }
+
+    Executable* DeviceHostImpl::CompileExecutable(std::uint8_t const* binary_code, std::size_t size, char const* options)
+    {
+        throw ExceptionHost("Host device can't compile kernel binaries");
+    }
+
+    Executable* DeviceHostImpl::CompileExecutable(char const* filename, char const** headernames, int numheaders, char const* options)
+    {
+        throw ExceptionHost("Host device can't compile kernel sources");
+    }
+
+    Executable* DeviceHostImpl::CreateExecutable(HostKernelEntry const* kernels, std::size_t num_kernels)
+    {
+        return new ExecutableHost(kernels, num_kernels);
+    }
+
+    void DeviceHostImpl::DeleteExecutable(Executable* executable)
+    {
+        delete executable;
+    }
+
+    size_t DeviceHostImpl::GetExecutableBinarySize(Executable const* executable) const
+    {
+        return 0;
+    }
+
+    void DeviceHostImpl::GetExecutableBinary(Executable const* executable, std::uint8_t* binary) const
+    {
+    }
+
+    void DeviceHostImpl::Execute(Function const* func, std::uint32_t queue, size_t global_size, size_t local_size, Event** e)
+    {
+        auto func_host = static_cast<FunctionHost const*>(func);
+
+        Launch(func_host->GetKernel(), func_host->GetArgs(), global_size, local_size);
+
+        if (e)
+        {
+            *e = new EventHost();
+        }
+    }
+
+    void DeviceHostImpl::Launch(HostKernel kernel, void* const* args, std::size_t global_size, std::size_t local_size)
+    {
+        local_size = std::max<std::size_t>(local_size, 1);
+
+        // Split the launch into several chunks per thread to balance the load,
+        // chunks are kept multiple of work group size.
+        auto num_threads = m_workers.size() + 1;
+        auto num_groups = (global_size + local_size - 1) / local_size;
+        auto groups_per_chunk = std::max<std::size_t>(num_groups / (num_threads * 4), 1);
+        auto chunk_size = groups_per_chunk * local_size;
+
+        if (m_workers.empty() || global_size <= chunk_size)
+        {
+            // Not worth waking up workers
+            kernel(args, 0, global_size);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> launch_lock(m_launch_mutex);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_kernel = kernel;
+                m_args = args;
+                m_global_size = global_size;
+                m_chunk_size = chunk_size;
+                m_next_chunk = 0;
+                m_num_busy = m_workers.size();
+                ++m_generation;
+            }
+
+            m_launch_cv.notify_all();
+
+            ProcessChunks();
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done_cv.wait(lock, [this]() { return m_num_busy == 0; });
+        }
+    }
+
+    void DeviceHostImpl::ProcessChunks()
+    {
+        for (;;)
+        {
+            auto begin = m_next_chunk.fetch_add(m_chunk_size);
+
+            if (begin >= m_global_size)
+            {
+                break;
+            }
+
+            m_kernel(m_args, begin, std::min(begin + m_chunk_size, m_global_size));
+        }
+    }
+
+    void DeviceHostImpl::WorkerLoop()
+    {
+        std::uint64_t generation = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_launch_cv.wait(lock, [this, generation]() { return m_shutdown || m_generation != generation; });
+
+                if (m_shutdown)
+                {
+                    return;
+                }
+
+                generation = m_generation;
+            }
+
+            ProcessChunks();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_num_busy;
+            }
+
+            m_done_cv.notify_one();
+        }
+    }
+
+    void DeviceHostImpl::WaitForEvent(Event* e)
+    {
+        e->Wait();
+    }
+
+    void DeviceHostImpl::WaitForMultipleEvents(Event** e, std::size_t num_events)
+    {
+        for (auto i = 0U; i < num_events; ++i)
+        {
+            e[i]->Wait();
+        }
+    }
+
+    void DeviceHostImpl::DeleteEvent(Event* e)
+    {
+        delete e;
+    }
+
+    void DeviceHostImpl::Flush(std::uint32_t queue)
+    {
+    }
+
+    void DeviceHostImpl::Finish(std::uint32_t queue)
+    {
+    }
+
+    // Primitives implementation operating directly on host buffers. Arrays are split
+    // into fixed size blocks processed by the worker threads of the device, so the
+    // results do not depend on the number of threads.
+    class PrimitivesHost : public Primitives
+    {
+    public:
+        PrimitivesHost(DeviceHostImpl& device)
+            : m_device(device)
+        {
+        }
+
+        // Keys are ordered as unsigned integers, the same way device radix sorts do
+        void SortRadixInt32(std::uint32_t queueidx, Buffer const* from_key, Buffer* to_key, Buffer const* from_value, Buffer* to_value, std::size_t size) override
+        {
+            SortRadix(GetData<std::uint32_t const>(from_key), GetData<std::uint32_t>(to_key), GetData<std::uint32_t const>(from_value), GetData<std::uint32_t>(to_value), size);
+        }
+
+        void SortRadixUint64(std::uint32_t queueidx, Buffer const* from_key, Buffer* to_key, Buffer const* from_value, Buffer* to_value, std::size_t size) override
+        {
+            SortRadix(GetData<std::uint64_t const>(from_key), GetData<std::uint64_t>(to_key), GetData<std::uint32_t const>(from_value), GetData<std::uint32_t>(to_value), size);
+        }
+
+        void ScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) override
+        {
+            ScanExclusiveAdd(GetData<std::int32_t const>(from), GetData<std::int32_t>(to), size);
+        }
+
+        void ScanExclusiveAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer* to, std::size_t size) override
+        {
+            ScanExclusiveAdd(GetData<float const>(from), GetData<float>(to), size);
+        }
+
+        void SegmentedScanExclusiveAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* heads, Buffer* to, std::size_t size) override
+        {
+            auto in = GetData<std::int32_t const>(from);
+            auto flags = GetData<std::int32_t const>(heads);
+            auto out = GetData<std::int32_t>(to);
+
+            // Sum since the last head of each block and whether there is one
+            auto const numblocks = GetNumBlocks(size);
+            std::vector<std::int32_t> sums(numblocks);
+            std::vector<char> has_head(numblocks);
+
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    std::int32_t sum = 0;
+                    for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                    {
+                        if (flags[i])
+                        {
+                            sum = 0;
+                            has_head[block] = 1;
+                        }
+                        sum += in[i];
+                    }
+                    sums[block] = sum;
+                }
+            });
+
+            // Carry into each block stops at heads
+            std::int32_t carry = 0;
+            for (std::size_t block = 0; block < numblocks; ++block)
+            {
+                std::int32_t const sum = sums[block];
+                sums[block] = carry;
+                carry = has_head[block] ? sum : carry + sum;
+            }
+
+            // In-place scan is allowed
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    std::int32_t sum = sums[block];
+                    for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                    {
+                        std::int32_t const value = in[i];
+                        sum = flags[i] ? 0 : sum;
+                        out[i] = sum;
+                        sum += value;
+                    }
+                }
+            });
+        }
+
+        void SegmentedReduceAddInt32(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) override
+        {
+            SegmentedReduceAdd(GetData<std::int32_t const>(from), GetData<std::int32_t const>(offsets), GetData<std::int32_t>(to), num_segments);
+        }
+
+        void SegmentedReduceAddFloat(std::uint32_t queueidx, Buffer const* from, Buffer const* offsets, Buffer* to, std::size_t num_segments) override
+        {
+            SegmentedReduceAdd(GetData<float const>(from), GetData<std::int32_t const>(offsets), GetData<float>(to), num_segments);
+        }
+
+        void CompactInt32(std::uint32_t queueidx, Buffer const* predicate, Buffer const* from, Buffer* to, Buffer* to_size, std::size_t size) override
+        {
+            auto flags = GetData<std::int32_t const>(predicate);
+            auto in = GetData<std::int32_t const>(from);
+            auto out = GetData<std::int32_t>(to);
+
+            // Number of elements kept by each block turned into block output offsets
+            auto const numblocks = GetNumBlocks(size);
+            std::vector<std::int32_t> offsets(numblocks);
+
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    offsets[block] = (std::int32_t)std::count_if(flags + block * kBlockSize, flags + std::min((block + 1) * kBlockSize, size),
+                        [](std::int32_t flag) { return flag != 0; });
+                }
+            });
+
+            std::int32_t total = 0;
+            for (auto& offset : offsets)
+            {
+                std::int32_t const count = offset;
+                offset = total;
+                total += count;
+            }
+
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    auto dst = offsets[block];
+                    for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                    {
+                        if (flags[i])
+                        {
+                            out[dst++] = in[i];
+                        }
+                    }
+                }
+            });
+
+            *GetData<std::int32_t>(to_size) = total;
+        }
+
+    private:
+        // Elements processed by a single task
+        static std::size_t const kBlockSize = 16384;
+        // Bits sorted per radix sort pass
+        static int const kRadixBits = 8;
+        static std::size_t const kRadixBins = 1 << kRadixBits;
+
+        template <typename T>
+        static T* GetData(Buffer const* buffer)
+        {
+            return reinterpret_cast<T*>(static_cast<BufferHost const*>(buffer)->GetData());
+        }
+
+        static std::size_t GetNumBlocks(std::size_t size)
+        {
+            return (size + kBlockSize - 1) / kBlockSize;
+        }
+
+        // Parallel LSD radix sort of unsigned keys, stable
+        template <typename Key>
+        void SortRadix(Key const* in_keys, Key* out_keys, std::uint32_t const* in_values, std::uint32_t* out_values, std::size_t size)
+        {
+            // Ping-pong between temporary arrays, so input and output may alias
+            std::vector<Key> keys(in_keys, in_keys + size);
+            std::vector<std::uint32_t> values(in_values, in_values + size);
+            std::vector<Key> sorted_keys(size);
+            std::vector<std::uint32_t> sorted_values(size);
+
+            auto const numblocks = GetNumBlocks(size);
+            std::vector<std::size_t> histograms(numblocks * kRadixBins);
+
+            for (int shift = 0; shift < (int)sizeof(Key) * 8; shift += kRadixBits)
+            {
+                // Per block digit histograms
+                m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+                {
+                    for (auto block = begin; block < end; ++block)
+                    {
+                        auto histogram = &histograms[block * kRadixBins];
+                        std::fill(histogram, histogram + kRadixBins, 0);
+
+                        for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                        {
+                            ++histogram[(keys[i] >> shift) & (kRadixBins - 1)];
+                        }
+                    }
+                });
+
+                // Turn histograms into scatter offsets, digit major to keep the sort stable
+                std::size_t offset = 0;
+                std::size_t max_count = 0;
+                for (std::size_t digit = 0; digit < kRadixBins; ++digit)
+                {
+                    std::size_t const digit_start = offset;
+                    for (std::size_t block = 0; block < numblocks; ++block)
+                    {
+                        auto const count = histograms[block * kRadixBins + digit];
+                        histograms[block * kRadixBins + digit] = offset;
+                        offset += count;
+                    }
+                    max_count = std::max(max_count, offset - digit_start);
+                }
+
+                // All keys share the digit
+                if (max_count == size)
+                {
+                    continue;
+                }
+
+                m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+                {
+                    for (auto block = begin; block < end; ++block)
+                    {
+                        auto offsets = &histograms[block * kRadixBins];
+
+                        for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                        {
+                            auto const dst = offsets[(keys[i] >> shift) & (kRadixBins - 1)]++;
+                            sorted_keys[dst] = keys[i];
+                            sorted_values[dst] = values[i];
+                        }
+                    }
+                });
+
+                keys.swap(sorted_keys);
+                values.swap(sorted_values);
+            }
+
+            std::copy(keys.cbegin(), keys.cend(), out_keys);
+            std::copy(values.cbegin(), values.cend(), out_values);
+        }
+
+        // Scan of block sums followed by per block scans with block offsets
+        template <typename T>
+        void ScanExclusiveAdd(T const* in, T* out, std::size_t size)
+        {
+            auto const numblocks = GetNumBlocks(size);
+            std::vector<T> sums(numblocks);
+
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    sums[block] = std::accumulate(in + block * kBlockSize, in + std::min((block + 1) * kBlockSize, size), T(0));
+                }
+            });
+
+            T sum = T(0);
+            for (auto& block_sum : sums)
+            {
+                T const value = block_sum;
+                block_sum = sum;
+                sum += value;
+            }
+
+            // In-place scan is allowed
+            m_device.ParallelFor(numblocks, 1, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto block = begin; block < end; ++block)
+                {
+                    T sum = sums[block];
+                    for (auto i = block * kBlockSize; i < std::min((block + 1) * kBlockSize, size); ++i)
+                    {
+                        T const value = in[i];
+                        out[i] = sum;
+                        sum += value;
+                    }
+                }
+            });
+        }
+
+        // Segments are summed sequentially, so floating point results are reproducible
+        template <typename T>
+        void SegmentedReduceAdd(T const* in, std::int32_t const* offsets, T* out, std::size_t num_segments)
+        {
+            m_device.ParallelFor(num_segments, 64, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto segment = begin; segment < end; ++segment)
+                {
+                    out[segment] = std::accumulate(in + offsets[segment], in + offsets[segment + 1], T(0));
+                }
+            });
+        }
+
+        DeviceHostImpl& m_device;
+    };
+
+    bool DeviceHostImpl::HasBuiltinPrimitives() const
+    {
+        return true;
+    }
+
+    Primitives* DeviceHostImpl::CreatePrimitives() const
+    {
+        // Primitives launch their work on the threads of the device
+        return new PrimitivesHost(const_cast<DeviceHostImpl&>(*this));
+    }
+
+    void DeviceHostImpl::DeletePrimitives(Primitives* prims)
+    {
+        delete prims;
+    }
+}
+
+#endif // USE_HOST
@@ -0,0 +1,135 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "device.h"
+#include "device_host.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Calc
+{
+    // Device implementation running kernels natively on the host.
+    // Commands are executed eagerly at the moment they are submitted,
+    // kernel launches are split into chunks processed by a pool of worker threads.
+    class DeviceHostImpl : public DeviceHost
+    {
+    public:
+        DeviceHostImpl();
+        ~DeviceHostImpl();
+
+        // Fill the specification of a host device
+        static void GetHostSpec(DeviceSpec& spec);
+
+        // Device overrides
+        // Return specification of the device
+        void GetSpec(DeviceSpec& spec) override;
+
+        // Buffer creation and deletion
+        Buffer* CreateBuffer(std::size_t size, std::uint32_t flags) override;
+        Buffer* CreateBuffer(std::size_t size, std::uint32_t flags, void* initdata) override;
+        void DeleteBuffer(Buffer* buffer) override;
+
+        // Data movement
+        void ReadBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, void* dst, Event** e) const override;
+        void WriteBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, void* src, Event** e) override;
+
+        // Buffer mapping
+        void MapBuffer(Buffer const* buffer, std::uint32_t queue, std::size_t offset, std::size_t size, std::uint32_t map_type, void** mapdata, Event** e) override;
+        void UnmapBuffer(Buffer const* buffer, std::uint32_t queue, void* mapdata, Event** e) override;
+
+        // Kernel compilation
+        Executable* CompileExecutable(char const* source_code, std::size_t size, char const* options) override;
+        Executable* CompileExecutable(std::uint8_t const* binary_code, std::size_t size, char const* options) override;
+        Executable* CompileExecutable(char const* filename, char const** headernames, int numheaders, char const* options) override;
+
+        void DeleteExecutable(Executable* executable) override;
+
+        // Executable management
+        size_t GetExecutableBinarySize(Executable const* executable) const override;
+        void GetExecutableBinary(Executable const* executable, std::uint8_t* binary) const override;
+
+        // Execution
+        void Execute(Function const* func, std::uint32_t queue, size_t global_size, size_t local_size, Event** e) override;
+
+        // Events handling
+        void WaitForEvent(Event* e) override;
+        void WaitForMultipleEvents(Event** e, std::size_t num_events) override;
+        void DeleteEvent(Event* e) override;
+
+        // Queue management functions
+        void Flush(std::uint32_t queue) override;
+        void Finish(std::uint32_t queue) override;
+
+        // Parallel prims handling
+        bool HasBuiltinPrimitives() const override;
+        Primitives* CreatePrimitives() const override;
+        void DeletePrimitives(Primitives* prims) override;
+
+        // DeviceHost overrides
+        Executable* CreateExecutable(HostKernelEntry const* kernels, std::size_t num_kernels) override;
+
+        Platform GetPlatform() const override { return Platform::kHost; }
+
+        // Call f(begin, end) for chunks of [0, size) on all threads, chunks are multiple of grain
+        template <typename F>
+        void ParallelFor(std::size_t size, std::size_t grain, F const& f)
+        {
+            void* args[] = { const_cast<F*>(&f) };
+            Launch([](void* const* args, std::size_t begin, std::size_t end) { (*static_cast<F const*>(args[0]))(begin, end); },
+                args, size, grain);
+        }
+
+    private:
+        // Split [0, global_size) into chunks and run kernel over them on all threads
+        void Launch(HostKernel kernel, void* const* args, std::size_t global_size, std::size_t local_size);
+        // Worker thread entry point
+        void WorkerLoop();
+        // Process chunks of the current launch until none is left
+        void ProcessChunks();
+
+        // Worker threads, calling thread participates in each launch as well
+        std::vector<std::thread> m_workers;
+        // Serializes concurrent launches
+        std::mutex m_launch_mutex;
+        // Protects launch state below
+        std::mutex m_mutex;
+        std::condition_variable m_launch_cv;
+        std::condition_variable m_done_cv;
+
+        // Current launch
+        HostKernel m_kernel;
+        void* const* m_args;
+        std::size_t m_global_size;
+        std::size_t m_chunk_size;
+        std::atomic<std::size_t> m_next_chunk;
+        // Number of workers still processing current launch
+        std::size_t m_num_busy;
+        // Incremented for each launch to wake up workers
+        std::uint64_t m_generation;
+        bool m_shutdown;
+    };
+}
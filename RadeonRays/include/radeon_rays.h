@@ -68,6 +68,7 @@ namespace RadeonRays
             kOpenCL = 0x1,
             kVulkan = 0x2,
             kEmbree = 0x4,
+            kHost = 0x8,
 
             kAny = 0xFF
         };
@@ -153,12 +154,48 @@ namespace RadeonRays
         Intersection();
     };
 
+    // Compact description of the sky hemisphere used by QueryOccluded2dSumLinearSky
+    // to generate directions on the device instead of reading them from a buffer.
+    // Patches are enumerated ring by ring from the horizon up, within a ring
+    // counter-clockwise around zenith starting at zero azimuth. Ray direction is
+    // the center of the patch.
+    // must match SkyPatches struct on the GPU side exactly!
+    struct SkyPatches
+    {
+        enum Type
+        {
+            // Tregenza sky with each patch split into subdivision x subdivision ones (Reinhart),
+            // subdivision of 1 gives 145 Tregenza patches, zenith cap is never split
+            kReinhart = 0,
+            // subdivision rings of equal cos(zenith angle) span, num_azimuths patches each
+            kEqualArea = 1
+        };
+
+        int type;
+        int subdivision;
+        int num_azimuths;
+        int padding;
+
+        // Unit zenith and zero azimuth directions of the sky frame
+        float4 zenith;
+        float4 azimuth;
+
+        SkyPatches();
+
+        // Number of generated directions
+        int GetNumPatches() const;
+    };
+
     enum MapType
     {
         kMapRead = 0x1,
         kMapWrite = 0x2
     };
 
+    // Kernel binary cache notification, key identifies the cached binary,
+    // hit is false if the kernel had to be compiled from sources
+    typedef void (*KernelCacheCallback)(char const* key, bool hit, void* user_data);
+
     // IntersectionApi is designed to provide fast means for ray-scene intersection
     // for AMD architectures. It effectively absracts underlying AMD hardware and
     // software stack and allows user to issue low-latency batched ray queries.
@@ -177,12 +214,22 @@ namespace RadeonRays
         // By default RadeonRays will any platform with potential GPU accelerations,
         // if you prefer to specify which platform call SetPlatform before 
         // GetDeviceInfo/GetDeviceCount for each specific platform
-        // By default will choose OpenCL if available, and if not Vulkan
+        // By default will choose OpenCL if available, and if not Vulkan,
+        // falling back to native multithreaded host backend (kHost) otherwise
         // Note: this may be sub optimal in some case. to avoid enum all devices
         // across all platforms explicitly before deciding on platform and 
         // device(s) to use
         static void SetPlatform(const DeviceInfo::Platform platform);
 
+        // Store compiled kernel binaries in the specified directory and load
+        // them instead of compiling sources when the API is created next time.
+        // Binaries are keyed by kernel sources, build options and device,
+        // so changing any of those results in recompilation.
+        // Call before Create, nullptr directory disables the cache (default).
+        // Optional callback is notified about each cache hit or miss.
+        // Only OpenCL devices currently provide binaries.
+        static void SetKernelCache(char const* directory, KernelCacheCallback callback = nullptr, void* user_data = nullptr);
+
 
         /******************************************
         Device management
@@ -235,6 +282,13 @@ namespace RadeonRays
         virtual void DetachAll() = 0;
         // Commit all geometry creations/changes
         virtual void Commit() = 0;
+        // Save acceleration structure of the committed scene into a file
+        // (supported by "bvh", "fatbvh" and 2-level intersectors)
+        virtual void SaveAccelerationStructure(char const* filename) const = 0;
+        // Use acceleration structure saved by SaveAccelerationStructure instead of Commit.
+        // Attached shapes (geometry, transforms and IDs) and intersector selection
+        // options must be the same as at the time of saving, otherwise throws.
+        virtual void LoadAccelerationStructure(char const* filename) = 0;
         //Sets the shape id allocator to its default value (1)
         virtual void ResetIdCounter() = 0;
         //Returns true if no shapes are in the world
@@ -273,6 +327,19 @@ namespace RadeonRays
         virtual void QueryOccluded2dSumLinear2(Buffer const* origins, Buffer const* directions, Buffer const* koeffs, Buffer const* offset_directions, Buffer const* offset_koeffs, int numorigins, int numdirections, int directions_stride, Buffer* hitresults, Event const* waitevent, Event** event) const = 0;
 
         virtual void QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* hitresults, Event const* waitevent, Event** event) const = 0;
+
+        // Same as QueryOccluded2dCellString, but writes the number of occluded points (as float) per
+        // cell-string and direction instead of the any hit flag. Optional point_masks (nullptr to skip)
+        // receives visibility bits in the same pass, bit (direction_id * numorigins + point_id) of the
+        // array of 32-bit words is set if the point is occluded and cleared otherwise. Bits of the
+        // points outside of any cell-string are left untouched. The mask buffer has to hold
+        // (numorigins * numdirections + 31) / 32 words.
+        virtual void QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const = 0;
+
+        // Same as QueryOccluded2dSumLinear2 with directions generated from the sky description,
+        // direction_id runs over sky.GetNumPatches() patches. Optional frames buffer (nullptr to use
+        // the sky frame for all origins) keeps per origin zenith and zero azimuth directions, 2 float4 each.
+        virtual void QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koeffs, Buffer const* offset_koeffs, int numorigins, int directions_stride, Buffer* hitresults, Event const* waitevent, Event** event) const = 0;
       
         // Find closest intersection, number of rays is in remote memory
         // The call is asynchronous. Event pointers might be nullptrs.
@@ -289,13 +356,31 @@ namespace RadeonRays
         // option "bvh.force2level" values {0(default), 1}
         //         by default 2-level BVH is used only if there is instancing in the scene or
         //         motion blur is enabled. 1 forces 2-level BVH for all cases.
-        // option "bvh.builder" values {"sah" (use surface area heuristic), "median" (use spatial median, faster to build, default)}
+        // option "bvh.builder" values {"sah" (use surface area heuristic), "median" (use spatial median, faster to build, default),
+        //         "hlbvh" (build LBVH on the device, OpenCL and host only, leaves of up to 4 faces, no refits or incremental updates)}
+        // option "bvh.hlbvh.restructure_iterations" values {int, default = 0} (treelet restructuring passes lowering SAH cost of "hlbvh" trees)
         // option "bvh.sah.use_splits" values {0(default),1} (allow spatial splits for BVH)
         // option "bvh.sah.traversal_cost" values {float, default = 10.f for GPU } (cost of node traversal vs triangle intersection)
         // option "bvh.sah.min_overlap" values { float < 1.f, default = 0.005f } 
         //         (overlap area which is considered for a spatial splits, fraction of parent bbox)
         // option "bvh.sah.max_split_depth" values {int, default = 10} (max depth in the tree where spatial split can happen)
         // option "bvh.sah.extra_node_budget" values {float, default = 1.f} (maximum node memory budget compared to normal bvh (2*num_tris - 1), for ex. 0.3 = 30% more nodes allowed
+        // option "bvh.cellstring.traversal" values {"serial" (default), "frustum" (traverse BVH once per cell-string using bounding frustum),
+        //         "flat" (one work item per point and direction, needs device parallel primitives)} (QueryOccluded2dCellString traversal mode)
+        // option "bvh.sumlinear.accumulation" values {"atomic" (default), "deterministic" (reproducible sums via per ray scratch buffer)}
+        //         (QueryOccluded2dSumLinear2 koef accumulation mode)
+        //         both options above only affect skip-links BVH, other intersectors use "serial" and "atomic"
+        // option "bvh.2d.rays_per_dispatch" values {int, default = 0 (device limit)} (rays per dispatch of
+        //         QueryOccluded2dSumLinear2 and QueryOccluded2dSumLinearSky, origins x directions may exceed 32 bits,
+        //         capped by the batch and stack limits of the intersector)
+        // option "bvh.refit.sah_threshold" values {float, default = 1.5f, 0 disables refit} (when only shape transforms change
+        //         the BVH is refitted instead of rebuilt unless its SAH cost grows by more than this factor,
+        //         shapes attached to unchanged scene are added as a subtree under the same limit, detached shapes are
+        //         patched out until their faces exceed (threshold - 1) times the remaining ones, not on Vulkan)
+        // option "bvh.max_leaf_prims" values {int 1-15, default = 4} (max number of triangles in a BVH leaf, leaf triangles
+        //         are intersected 4 at a time, Vulkan backend always uses 1)
+        // option "bvh.node_format" values {"full" (default), "quantized" (16-bit node bounds, half the node memory,
+        //         boxes are slightly looser)} (BVH node layout, Vulkan backend always uses "full")
         // Set API global option: string
         virtual void SetOption(char const* name, char const* value) = 0;
         // Set API global option: float
@@ -315,6 +400,21 @@ namespace RadeonRays
     {
     }
 
+    inline SkyPatches::SkyPatches()
+        : type(kReinhart)
+        , subdivision(1)
+        , num_azimuths(0)
+        , padding(0)
+        , zenith(0.f, 0.f, 1.f)
+        , azimuth(1.f, 0.f, 0.f)
+    {
+    }
+
+    inline int SkyPatches::GetNumPatches() const
+    {
+        return type == kReinhart ? 144 * subdivision * subdivision + 1 : subdivision * num_azimuths;
+    }
+
 }
 
 
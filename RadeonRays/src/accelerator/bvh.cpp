@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 #include "bvh.h"
+#include "../async/task_scheduler.h"
 
 #include <algorithm>
 #include <thread>
@@ -31,7 +32,10 @@ THE SOFTWARE.
 
 namespace RadeonRays
 {
-    static int constexpr kMaxPrimitivesPerLeaf = 1;
+    // Subtrees with more primitives are built as separate tasks
+    static int constexpr kParallelBuildThreshold = 4096;
+    // Nodes with more primitives compute SAH histograms in parallel
+    static int constexpr kParallelBinningThreshold = 65536;
 
     static bool is_nan(float v)
     {
@@ -65,64 +69,50 @@ namespace RadeonRays
         return &m_nodes[m_nodecnt++];
     }
 
+    void Bvh::UpdateHeight(int level)
+    {
+        int height = m_height;
+        while (height < level && !m_height.compare_exchange_weak(height, level));
+    }
+
     void Bvh::BuildNode(SplitRequest const& req, bbox const* bounds, float3 const* centroids, int* primindices)
     {
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         Node* node = AllocateNode();
         node->bounds = req.bounds;
         node->index = req.index;
 
-        // Create leaf node if we have enough prims
-        if (req.numprims < 2)
+        // Choose the maximum extent
+        int axis = req.centroid_bounds.maxdim();
+        float border = req.centroid_bounds.center()[axis];
+
+        // Create leaf node if we have enough prims, SAH builder
+        // only keeps the leaf if it is cheaper than the best split
+        bool leaf = req.numprims < 2 || req.numprims <= m_max_leaf_prims;
+
+        if (req.numprims >= 2 && m_usesah)
         {
-#ifdef USE_TBB
-            primitive_mutex_.lock();
-#endif
-            node->type = kLeaf;
-            node->startidx = static_cast<int>(m_packed_indices.size());
-            node->numprims = req.numprims;
+            SahSplit ss = FindSahSplit(req, bounds, centroids, primindices);
 
-            for (auto i = 0; i < req.numprims; ++i)
+            if (!is_nan(ss.split))
             {
-                m_packed_indices.push_back(primindices[req.startidx + i]);
+                axis = ss.dim;
+                border = ss.split;
+                leaf = leaf && req.numprims < ss.sah;
             }
-#ifdef USE_TBB
-            primitive_mutex_.unlock();
-#endif
+        }
+
+        // Leaves point directly into partitioned index array,
+        // so subtrees can be built concurrently
+        if (leaf)
+        {
+            node->type = kLeaf;
+            node->startidx = req.startidx;
+            node->numprims = req.numprims;
         }
         else
         {
-            // Choose the maximum extent
-            int axis = req.centroid_bounds.maxdim();
-            float border = req.centroid_bounds.center()[axis];
-
-            if (m_usesah)
-            {
-                SahSplit ss = FindSahSplit(req, bounds, centroids, primindices);
-
-                if (!is_nan(ss.split))
-                {
-                    axis = ss.dim;
-                    border = ss.split;
-
-                    if (req.numprims < ss.sah && req.numprims < kMaxPrimitivesPerLeaf)
-                    {
-                        node->type = kLeaf;
-                        node->startidx = static_cast<int>(m_packed_indices.size());
-                        node->numprims = req.numprims;
-
-                        for (auto i = 0; i < req.numprims; ++i)
-                        {
-                            m_packed_indices.push_back(primindices[req.startidx + i]);
-                        }
-
-                        if (req.ptr) *req.ptr = node;
-                        return;
-                    }
-                }
-            }
-
             node->type = kInternal;
 
             // Start partitioning and updating extents for children at the same time
@@ -228,12 +218,17 @@ namespace RadeonRays
             // Right request
             SplitRequest rightrequest = { splitidx, req.numprims - (splitidx - req.startidx), &node->rc, rightbounds, rightcentroid_bounds, req.level + 1, (req.index << 1) + 1 };
 
+            // Children work on disjoint index ranges, so big ones are forked
+            if (req.numprims > kParallelBuildThreshold)
             {
-                // Put those to stack
-                BuildNode(leftrequest, bounds, centroids, primindices);
+                task_scheduler::task_group group;
+                group.run([=]() { BuildNode(leftrequest, bounds, centroids, primindices); });
+                BuildNode(rightrequest, bounds, centroids, primindices);
+                group.wait();
             }
-
+            else
             {
+                BuildNode(leftrequest, bounds, centroids, primindices);
                 BuildNode(rightrequest, bounds, centroids, primindices);
             }
         }
@@ -283,33 +278,94 @@ namespace RadeonRays
         // Precompute min point
         float3 rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
+        // Calc primitive refs histogram for all dimensions of [begin, end) range
+        auto calc_histogram = [&](int begin, int end, std::vector<Bin>* histogram)
         {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            float centroid_rng = centroid_extents[axis];
-            float invcentroid_rng = 1.f / centroid_rng;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                // Initialize bins
+                for (int i = 0; i < m_num_bins; ++i)
+                {
+                    histogram[axis][i].count = 0;
+                    histogram[axis][i].bounds = bbox();
+                }
 
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
+                // If the box is degenerate in that dimension skip it
+                if (centroid_extents[axis] == 0.f) continue;
+
+                float rootminc = rootmin[axis];
+                float invcentroid_rng = 1.f / centroid_extents[axis];
+
+                for (int i = begin; i < end; ++i)
+                {
+                    int idx = primindices[i];
+                    int binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((centroids[idx][axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
+
+                    ++histogram[axis][binidx].count;
+                    histogram[axis][binidx].bounds.grow(bounds[idx]);
+                }
+            }
+        };
 
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
+        if (req.numprims < kParallelBinningThreshold)
+        {
+            calc_histogram(req.startidx, req.startidx + req.numprims, bins);
+        }
+        else
+        {
+            // Top level nodes: bin chunks in parallel and merge histograms
+            auto& scheduler = task_scheduler::instance();
+            int numchunks = scheduler.num_threads();
+            int chunksize = (req.numprims + numchunks - 1) / numchunks;
+
+            std::vector<Bin> chunkbins[3];
+            for (int axis = 0; axis < 3; ++axis)
             {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
+                chunkbins[axis].resize(numchunks * m_num_bins);
             }
 
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+            scheduler.parallel_for(0, numchunks, 1, [&](int begin, int end)
+            {
+                for (int c = begin; c < end; ++c)
+                {
+                    std::vector<Bin> histogram[3];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        histogram[axis].resize(m_num_bins);
+                    }
+
+                    int first = req.startidx + c * chunksize;
+                    int last = std::min(first + chunksize, req.startidx + req.numprims);
+                    calc_histogram(first, std::max(first, last), histogram);
+
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        std::copy(histogram[axis].cbegin(), histogram[axis].cend(), chunkbins[axis].begin() + c * m_num_bins);
+                    }
+                }
+            });
+
+            for (int axis = 0; axis < 3; ++axis)
             {
-                int idx = primindices[i];
-                int binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((centroids[idx][axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
+                for (int i = 0; i < m_num_bins; ++i)
+                {
+                    bins[axis][i].count = 0;
+                    bins[axis][i].bounds = bbox();
 
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(bounds[idx]);
+                    for (int c = 0; c < numchunks; ++c)
+                    {
+                        bins[axis][i].count += chunkbins[axis][c * m_num_bins + i].count;
+                        bins[axis][i].bounds.grow(chunkbins[axis][c * m_num_bins + i].bounds);
+                    }
+                }
             }
+        }
+
+        // Evaluate all dimensions
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // If the box is degenerate in that dimension skip it
+            if (centroid_extents[axis] == 0.f) continue;
 
             std::vector<bbox> rightbounds(m_num_bins - 1);
 
@@ -485,6 +541,9 @@ namespace RadeonRays
         }
 #else
         BuildNode(init, bounds, &centroids[0], &m_indices[0]);
+
+        // Leaves reference ranges of partitioned indices
+        m_packed_indices = m_indices;
 #endif
 
         // Set root_ pointer
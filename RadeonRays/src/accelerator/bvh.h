@@ -39,12 +39,13 @@ namespace RadeonRays
     class Bvh
     {
     public:
-        Bvh(float traversal_cost, int num_bins = 64, bool usesah = false)
+        Bvh(float traversal_cost, int num_bins = 64, bool usesah = false, int max_leaf_prims = 1)
             : m_root(nullptr)
             , m_num_bins(num_bins)
             , m_usesah(usesah)
             , m_height(0)
             , m_traversal_cost(traversal_cost)
+            , m_max_leaf_prims(max_leaf_prims)
         {
         }
 
@@ -106,6 +107,8 @@ namespace RadeonRays
         };
 
         void BuildNode(SplitRequest const& req, bbox const* bounds, float3 const* centroids, int* primindices);
+        // Thread safe tree height update
+        void UpdateHeight(int level);
 
         SahSplit FindSahSplit(SplitRequest const& req, bbox const* bounds, float3 const* centroids, int* primindices) const;
 
@@ -132,12 +135,14 @@ namespace RadeonRays
         Node* m_root;
         // SAH flag
         bool m_usesah;
-        // Tree height
-        int m_height;
+        // Tree height, atomic since subtrees are built in parallel
+        std::atomic<int> m_height;
         // Node traversal cost
         float m_traversal_cost;
         // Number of spatial bins to use for SAH
         int m_num_bins;
+        // Maximum number of primitives in a leaf
+        int m_max_leaf_prims;
 
 
     private:
@@ -20,9 +20,9 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 #include "bvh2.h"
+#include "../async/task_scheduler.h"
 
-#include <atomic>
-#include <mutex>
+#include <functional>
 #include <numeric>
 
 #define PARALLEL_BUILD
@@ -217,114 +217,66 @@ namespace RadeonRays
             }
         }
 #else
-        // Parallel build variables
-        // Global requests stack
-        std::stack<SplitRequest> requests;
-        // Condition to wait on the global stack
-        std::condition_variable cv;
-        // Mutex to guard cv
-        std::mutex mutex;
-        // Indicates if we need to shutdown all the threads
-        std::atomic<bool> shutdown;
-        // Number of primitives processed so far
-        std::atomic<std::uint32_t> num_refs_processed;
-
-        num_refs_processed.store(0);
-        shutdown.store(false);
-
-        requests.push(SplitRequest{
-            scene_min,
-            scene_max,
-            centroid_scene_min,
-            centroid_scene_max,
-            0,
-            num_aabbs,
-            0u,
-            0u
-        });
+        // Parallel build: big right subtrees are forked into the shared scheduler,
+        // the rest is processed depth first by the task which has split them
+        task_scheduler::task_group group;
 
-        auto worker_thread = [&]()
+        std::function<void(SplitRequest const&)> process_subtree = [&](SplitRequest const& root)
         {
-            thread_local std::stack<SplitRequest> local_requests;
+            std::stack<SplitRequest> local_requests;
+            local_requests.push(root);
 
-            for (;;)
+            _MM_ALIGN16 SplitRequest request;
+            _MM_ALIGN16 SplitRequest request_left;
+            _MM_ALIGN16 SplitRequest request_right;
+
+            while (!local_requests.empty())
             {
-                // Wait for signal
+                request = local_requests.top();
+                local_requests.pop();
+
+                auto node_type = HandleRequest(
+                    request,
+                    aabb_min,
+                    aabb_max,
+                    aabb_centroid,
+                    metadata,
+                    refs,
+                    num_aabbs,
+                    request_left,
+                    request_right);
+
+                if (node_type == kLeaf)
                 {
-                    std::unique_lock<std::mutex> lock(mutex);
-                    cv.wait(lock, [&]() { return !requests.empty() || shutdown; });
-
-                    if (shutdown) return;
-
-                    local_requests.push(requests.top());
-                    requests.pop();
+                    continue;
                 }
 
-                _MM_ALIGN16 SplitRequest request;
-                _MM_ALIGN16 SplitRequest request_left;
-                _MM_ALIGN16 SplitRequest request_right;
-
-                // Process local requests
-                while (!local_requests.empty())
+                if (request_right.num_refs > 4096u)
                 {
-                    request = local_requests.top();
-                    local_requests.pop();
-
-                    auto node_type = HandleRequest(
-                        request,
-                        aabb_min,
-                        aabb_max,
-                        aabb_centroid,
-                        metadata,
-                        refs,
-                        num_aabbs,
-                        request_left,
-                        request_right);
-
-                    if (node_type == kLeaf)
-                    {
-                        num_refs_processed += static_cast<std::uint32_t>(request.num_refs);
-                        continue;
-                    }
-
-                    if (request_right.num_refs > 4096u)
-                    {
-                        std::unique_lock<std::mutex> lock(mutex);
-                        requests.push(request_right);
-                        cv.notify_one();
-                    }
-                    else
-                    {
-                        local_requests.push(request_right);
-                    }
-
-                    local_requests.push(request_left);
+                    group.run([&process_subtree, request_right]() { process_subtree(request_right); });
                 }
+                else
+                {
+                    local_requests.push(request_right);
+                }
+
+                local_requests.push(request_left);
             }
         };
 
-        auto num_threads = std::thread::hardware_concurrency();
-        std::vector<std::thread> threads(num_threads);
-
-        for (auto i = 0u; i < num_threads; ++i)
-        {
-            threads[i] = std::thread(worker_thread);
-        }
-
-        while (num_refs_processed != num_aabbs)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
-        }
+        process_subtree(SplitRequest{
+            scene_min,
+            scene_max,
+            centroid_scene_min,
+            centroid_scene_max,
+            0,
+            num_aabbs,
+            0u,
+            0u
+        });
 
-         // Signal shutdown and wake up all the threads
-        shutdown.store(true);
-        cv.notify_all();
-            
-        // Wait for all the threads to finish
-        for (auto i = 0u; i < num_threads; ++i)
-        {
-            threads[i].join();
-        }
+        // Calling thread helps with forked subtrees and parks when there is nothing to steal
+        group.wait();
 #endif
     }
 
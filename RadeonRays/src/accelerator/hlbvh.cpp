@@ -24,8 +24,12 @@ THE SOFTWARE.
 #include "primitives.h"
 #include "executable.h"
 #include "../except/except.h"
+#include "../device/kernel_cache.h"
 #include "calc.h"
 #include "event.h"
+#if USE_HOST
+#include "../kernels/CPU/kernels_host.h"
+#endif
 
 #include <vector>
 #include <numeric>
@@ -53,18 +57,21 @@ namespace RadeonRays
     Hlbvh::Hlbvh(Calc::Device* device)
     : m_device(device)
     , m_gpudata(new GpuData(device))
+    , m_numprims(0)
     {
         InitGpuData();
     }
     
     void Hlbvh::AllocateBuffers(size_t num_prims)
     {
+        if (m_gpudata->positions)
+        {
+            m_gpudata->DeleteBuffers();
+        }
+
         // * 3 since only triangles are supported just yet
         m_gpudata->positions = m_device->CreateBuffer(num_prims * sizeof(float3), Calc::BufferType::kWrite);
-        // * 3 since 3 vertex indices + 1 material idx
-        m_gpudata->morton_codes = m_device->CreateBuffer(num_prims * sizeof(int), Calc::BufferType::kWrite);
-        
-        
+
         std::vector<int> iota(num_prims);
         std::iota(iota.begin(), iota.end(), 0);
         
@@ -77,21 +84,33 @@ namespace RadeonRays
         // Bounds
         m_gpudata->bounds = m_device->CreateBuffer(num_prims * sizeof(bbox), Calc::BufferType::kWrite);
         m_gpudata->scene_bound = m_device->CreateBuffer(sizeof(bbox), Calc::BufferType::kRead);
-        m_gpudata->sorted_bounds = m_device->CreateBuffer(num_prims * sizeof(bbox), Calc::BufferType::kWrite);
+        // Internal nodes followed by leaves
+        m_gpudata->sorted_bounds = m_device->CreateBuffer(2 * num_prims * sizeof(bbox), Calc::BufferType::kWrite);
         // Propagation flags
         m_gpudata->flags = m_device->CreateBuffer(2 * num_prims * sizeof(int), Calc::BufferType::kWrite);
+        m_gpudata->leaf_counts = m_device->CreateBuffer(2 * num_prims * sizeof(int), Calc::BufferType::kWrite);
+        m_gpudata->cluster_counts = m_device->CreateBuffer(2 * num_prims * sizeof(int), Calc::BufferType::kWrite);
     }
     
     void Hlbvh::InitGpuData()
     {
-        
+        m_gpudata->executable = nullptr;
+
+#if USE_HOST
+        // Host kernels are always compiled in
+        if (m_device->GetPlatform() == Calc::Platform::kHost)
+        {
+            m_gpudata->executable = static_cast<Calc::DeviceHost*>(m_device)->CreateExecutable(g_build_hlbvh_host, g_build_hlbvh_host_size);
+        }
+#endif
+
 #ifndef RR_EMBED_KERNELS
-        if ( m_device->GetPlatform() == Calc::Platform::kOpenCL )
+        if ( m_gpudata->executable == nullptr && m_device->GetPlatform() == Calc::Platform::kOpenCL )
         {
-            m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/CL/build_hlbvh.cl", nullptr, 0, nullptr );
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/build_hlbvh.cl", nullptr, 0, nullptr );
         }
 
-        else
+        else if ( m_gpudata->executable == nullptr )
         {
             assert( m_device->GetPlatform() == Calc::Platform::kVulkan );
             m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/GLSL/hlbvh_build.comp", nullptr, 0, nullptr );
@@ -99,9 +118,9 @@ namespace RadeonRays
 #else
         auto& device = m_device;
 #if USE_OPENCL
-        if (device->GetPlatform() == Calc::Platform::kOpenCL)
+        if (m_gpudata->executable == nullptr && device->GetPlatform() == Calc::Platform::kOpenCL)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_build_hlbvh_opencl, std::strlen(g_build_hlbvh_opencl), nullptr);
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, g_build_hlbvh_opencl, std::strlen(g_build_hlbvh_opencl), nullptr);
         }
 #endif
 
@@ -117,6 +136,13 @@ namespace RadeonRays
         m_gpudata->build_func = m_gpudata->executable->CreateFunction("emit_hierarchy_main");
         m_gpudata->refit_func = m_gpudata->executable->CreateFunction("refit_bounds_main");
 
+        // GLSL build has no restructuring and skip-links emission
+        if (m_device->GetPlatform() != Calc::Platform::kVulkan)
+        {
+            m_gpudata->restructure_func = m_gpudata->executable->CreateFunction("restructure_treelets_main");
+            m_gpudata->skiplinks_func = m_gpudata->executable->CreateFunction("emit_skiplinks_main");
+        }
+
         // Allocate GPU buffers
         AllocateBuffers(INITIAL_TRIANGLE_CAPACITY);
         
@@ -132,17 +158,17 @@ namespace RadeonRays
     // Build function
     void Hlbvh::Build(bbox const* bounds, int numbounds)
     {
-//#ifdef _DEBUG
+#ifdef RR_PROFILE
         auto s = std::chrono::high_resolution_clock::now();
-//#endif
+#endif
         BuildImpl(bounds, numbounds);
-//#ifdef _DEBUG
+#ifdef RR_PROFILE
         m_device->Finish(0);
         // Note, that this is total time spent for setup and construction 
         // including the time spent waiting in the queue.
         auto d = std::chrono::high_resolution_clock::now() - s;
         std::cout << "HLBVH setup + construction CPU time: " << std::chrono::duration_cast<std::chrono::milliseconds>(d).count() << "ms\n";
-//#endif
+#endif
     }
     
     
@@ -162,11 +188,13 @@ namespace RadeonRays
         // Make sure to allocate enough mem on GPU
         // We are trying to reuse space as reallocation takes time
         // but this call might be really frequent
-        if (static_cast<size_t>(size) > m_gpudata->positions->GetSize())
+        if (static_cast<size_t>(size) * sizeof(int) > m_gpudata->morton_codes->GetSize())
         {
             AllocateBuffers(size);
         }
 
+        m_numprims = size;
+
         // Evaluate scene bouds
         bbox scene_bound = bbox();
         for (auto i = 0; i < numbounds; ++i)
@@ -185,14 +213,7 @@ namespace RadeonRays
         }
         
         // Initialize flags with zero 
-        {
-            int* tmp = nullptr;
-            m_device->MapBuffer(m_gpudata->flags, 0, 0, sizeof(int) * 2 * numbounds, Calc::kMapWrite, (void**)&tmp, nullptr);
-            m_device->Finish(0);
-            std::memset(tmp, 0, sizeof(int) * numbounds * 2);
-            m_device->UnmapBuffer(m_gpudata->flags, 0, tmp, nullptr);
-            m_device->Finish(0);
-        }
+        ResetFlags();
 
         // Calculate Morton codes array
         int arg = 0;
@@ -211,10 +232,6 @@ namespace RadeonRays
         // Sort primitives according to their Morton codes
         m_gpudata->pp->SortRadixInt32(0, m_gpudata->morton_codes, m_gpudata->sorted_morton_codes, m_gpudata->prim_indices, m_gpudata->sorted_prim_indices, size);
 
-        std::vector<int> codes(size);
-        m_device->ReadBuffer(m_gpudata->sorted_prim_indices, 0, 0, sizeof(int) * size, &codes[0], nullptr);
-        m_device->Finish(0);
-       
         // Prepare tree construction kernel
         arg = 0;
         m_gpudata->build_func->SetArg(arg++, m_gpudata->sorted_morton_codes);
@@ -242,4 +259,83 @@ namespace RadeonRays
         // Launch refit kernel
         m_device->Execute(m_gpudata->refit_func, 0, globalsize, kWorkGroupSize, nullptr);
     }
+
+    void Hlbvh::ResetFlags() const
+    {
+        int* tmp = nullptr;
+        m_device->MapBuffer(m_gpudata->flags, 0, 0, sizeof(int) * 2 * m_numprims, Calc::kMapWrite, (void**)&tmp, nullptr);
+        m_device->Finish(0);
+        std::memset(tmp, 0, sizeof(int) * m_numprims * 2);
+        m_device->UnmapBuffer(m_gpudata->flags, 0, tmp, nullptr);
+        m_device->Finish(0);
+    }
+
+    void Hlbvh::PropagateBounds(bool optimize, int max_leaf_prims) const
+    {
+        ResetFlags();
+
+        int size = m_numprims;
+        int opt = optimize ? 1 : 0;
+
+        int arg = 0;
+        m_gpudata->restructure_func->SetArg(arg++, sizeof(size), &size);
+        m_gpudata->restructure_func->SetArg(arg++, m_gpudata->nodes);
+        m_gpudata->restructure_func->SetArg(arg++, m_gpudata->sorted_bounds);
+        m_gpudata->restructure_func->SetArg(arg++, m_gpudata->leaf_counts);
+        m_gpudata->restructure_func->SetArg(arg++, m_gpudata->cluster_counts);
+        m_gpudata->restructure_func->SetArg(arg++, sizeof(max_leaf_prims), &max_leaf_prims);
+        m_gpudata->restructure_func->SetArg(arg++, m_gpudata->flags);
+        m_gpudata->restructure_func->SetArg(arg++, sizeof(opt), &opt);
+
+        int globalsize = ((size + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(m_gpudata->restructure_func, 0, globalsize, kWorkGroupSize, nullptr);
+        m_device->Finish(0);
+    }
+
+    void Hlbvh::RestructureTreelets(int num_iterations)
+    {
+        ThrowIf(!m_gpudata->restructure_func, "Treelet restructuring is not supported on this device");
+
+        for (int i = 0; i < num_iterations; ++i)
+        {
+            PropagateBounds(true, 1);
+        }
+    }
+
+    int Hlbvh::CountSkipLinksLeaves(int max_leaf_prims) const
+    {
+        ThrowIf(!m_gpudata->skiplinks_func, "Skip-links emission is not supported on this device");
+        // Leaf primitive count is packed into 4 bits of the node
+        ThrowIf(max_leaf_prims < 1 || max_leaf_prims > 15, "Skip-links leaf size is out of range");
+
+        // Final refit, also counts leaves needed for the addresses
+        PropagateBounds(false, max_leaf_prims);
+
+        int numleaves = 0;
+        m_device->ReadBuffer(m_gpudata->cluster_counts, 0, 0, sizeof(int), &numleaves, nullptr);
+        m_device->Finish(0);
+        return numleaves;
+    }
+
+    void Hlbvh::EmitSkipLinks(Calc::Buffer* nodes, Calc::Buffer* leaf_prims, int max_leaf_prims) const
+    {
+        ThrowIf(!m_gpudata->skiplinks_func, "Skip-links emission is not supported on this device");
+
+        int size = m_numprims;
+
+        int arg = 0;
+        m_gpudata->skiplinks_func->SetArg(arg++, m_gpudata->leaf_counts);
+        m_gpudata->skiplinks_func->SetArg(arg++, m_gpudata->cluster_counts);
+        m_gpudata->skiplinks_func->SetArg(arg++, sizeof(size), &size);
+        m_gpudata->skiplinks_func->SetArg(arg++, sizeof(max_leaf_prims), &max_leaf_prims);
+        m_gpudata->skiplinks_func->SetArg(arg++, m_gpudata->nodes);
+        m_gpudata->skiplinks_func->SetArg(arg++, m_gpudata->sorted_bounds);
+        m_gpudata->skiplinks_func->SetArg(arg++, nodes);
+        m_gpudata->skiplinks_func->SetArg(arg++, leaf_prims);
+
+        int globalsize = ((2 * size - 1 + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(m_gpudata->skiplinks_func, 0, globalsize, kWorkGroupSize, nullptr);
+    }
 }
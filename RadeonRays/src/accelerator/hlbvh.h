@@ -56,6 +56,24 @@ namespace RadeonRays
         // Get reordered indices
         int const* GetIndices() const { return &m_prim_indices[0]; }
 
+        // Rearrange small treelets of the tree built last to lower its SAH cost,
+        // each iteration is a bottom-up pass over the whole tree. Not supported on Vulkan.
+        void RestructureTreelets(int num_iterations);
+
+        // Refit the tree built last and count the leaves of its skip-links layout,
+        // subtrees of up to max_leaf_prims primitives are collapsed into a leaf.
+        // Not supported on Vulkan.
+        int CountSkipLinksLeaves(int max_leaf_prims) const;
+
+        // Write the tree counted last with the same max_leaf_prims into nodes buffer
+        // in skip-links layout (2 * numleaves - 1 nodes). STARTIDX of the leaf is its
+        // index, leaf_prims receives max_leaf_prims primitive indices per leaf padded
+        // with -1. Not supported on Vulkan.
+        void EmitSkipLinks(Calc::Buffer* nodes, Calc::Buffer* leaf_prims, int max_leaf_prims) const;
+
+        // Number of primitives of the last build
+        int GetNumPrims() const { return m_numprims; }
+
     
     protected:
         // Build function
@@ -64,6 +82,10 @@ namespace RadeonRays
     private:
         void InitGpuData();
         void AllocateBuffers(size_t numprims);
+        // Zero propagation flags of bottom-up passes
+        void ResetFlags() const;
+        // Bottom-up pass computing bounds and leaf counts, optionally restructuring treelets
+        void PropagateBounds(bool optimize, int max_leaf_prims) const;
         
         Hlbvh(Hlbvh const&) = delete;
         Hlbvh& operator = (Hlbvh const&) = delete;
@@ -81,6 +103,9 @@ namespace RadeonRays
         
         // Primitive indices
         std::vector<int> m_prim_indices;
+
+        // Number of primitives of the last build
+        int m_numprims;
     };
     
     // BVH node
@@ -105,6 +130,9 @@ namespace RadeonRays
         Calc::Function* morton_code_func;
         Calc::Function* build_func;
         Calc::Function* refit_func;
+        // Treelet restructuring and skip-links layout emission (nullptr on Vulkan)
+        Calc::Function* restructure_func;
+        Calc::Function* skiplinks_func;
         
         // Parallel primitives instance
         //CLWParallelPrimitives pp_;
@@ -131,18 +159,22 @@ namespace RadeonRays
         // Atomic flags
         Calc::Buffer*  flags;
 
+        // Number of leaves under each node
+        Calc::Buffer* leaf_counts;
+        // Number of skip-links leaves under each node
+        Calc::Buffer* cluster_counts;
+
         GpuData(Calc::Device* dev)
             : device(dev)
+            , restructure_func(nullptr)
+            , skiplinks_func(nullptr)
+            , positions(nullptr)
         {
         }
 
-        ~GpuData()
+        // Release buffers sized by primitive count
+        void DeleteBuffers()
         {
-            executable->DeleteFunction(morton_code_func);
-            executable->DeleteFunction(build_func);
-            executable->DeleteFunction(refit_func);
-            device->DeleteExecutable(executable);
-            device->DeletePrimitives(pp);
             device->DeleteBuffer(positions);
             device->DeleteBuffer(morton_codes);
             device->DeleteBuffer(prim_indices);
@@ -153,6 +185,23 @@ namespace RadeonRays
             device->DeleteBuffer(sorted_bounds);
             device->DeleteBuffer(scene_bound);
             device->DeleteBuffer(flags);
+            device->DeleteBuffer(leaf_counts);
+            device->DeleteBuffer(cluster_counts);
+        }
+
+        ~GpuData()
+        {
+            executable->DeleteFunction(morton_code_func);
+            executable->DeleteFunction(build_func);
+            executable->DeleteFunction(refit_func);
+            if (skiplinks_func)
+            {
+                executable->DeleteFunction(restructure_func);
+                executable->DeleteFunction(skiplinks_func);
+            }
+            device->DeleteExecutable(executable);
+            device->DeletePrimitives(pp);
+            DeleteBuffers();
         }
     };
 }
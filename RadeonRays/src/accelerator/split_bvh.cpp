@@ -1,9 +1,15 @@
 #include "split_bvh.h"
 #include "math/mathutils.h"
+#include "../async/task_scheduler.h"
 #include <cassert>
 
 namespace RadeonRays
 {
+    // Subtrees with more references are built as separate tasks
+    static int constexpr kParallelBuildThreshold = 4096;
+    // Nodes with more references compute SAH histograms in parallel
+    static int constexpr kParallelBinningThreshold = 65536;
+
     static float3 clamp3(float3 val, float3 a, float3 b)
     {
         return float3{ clamp(val.x, a.x, b.x), clamp(val.y, a.y, b.y), clamp(val.z, a.z, b.z) };
@@ -40,15 +46,27 @@ namespace RadeonRays
     void SplitBvh::BuildNode(SplitRequest& req, PrimRefArray& primrefs)
     {
         // Update current height
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         // Allocate new node
         Node* node = AllocateNode();
         node->bounds = req.bounds;
 
-        // Create leaf node if we have enough prims
-        if (req.numprims < 2)
+        // Create leaf node if we have enough prims, keep bigger leaves
+        // only if those are cheaper than the best object split
+        SahSplit os;
+        bool leaf = req.numprims < 2;
+
+        if (!leaf)
         {
+            os = FindObjectSahSplit(req, primrefs);
+            leaf = req.numprims <= m_max_leaf_prims && (is_nan(os.split) || req.numprims < os.sah);
+        }
+
+        if (leaf)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
             node->type = kLeaf;
             node->startidx = (int)m_packed_indices.size();
             node->numprims = req.numprims;
@@ -66,7 +84,6 @@ namespace RadeonRays
             int axis = req.centroid_bounds.maxdim();
             float border = req.centroid_bounds.center()[axis];
 
-            SahSplit os = FindObjectSahSplit(req, primrefs);
             SahSplit ss;
             auto split_type = SplitType::kObject;
 
@@ -183,12 +200,27 @@ namespace RadeonRays
 
 
             // The order is very important here since right node uses the space at the end of the array to partition
+            if (req.numprims > kParallelBuildThreshold)
             {
+                // Forked left subtree gets its own copy of references,
+                // so the right one is free to grow into the shared array
+                task_scheduler::task_group group;
+                auto leftrefs = std::make_shared<PrimRefArray>(primrefs.cbegin() + leftrequest.startidx,
+                    primrefs.cbegin() + leftrequest.startidx + leftrequest.numprims);
+
+                group.run([this, leftrequest, leftrefs]()
+                {
+                    auto req = leftrequest;
+                    req.startidx = 0;
+                    BuildNode(req, *leftrefs);
+                });
+
                 BuildNode(rightrequest, primrefs);
+                group.wait();
             }
-
+            else
             {
-                // Put those to stack
+                BuildNode(rightrequest, primrefs);
                 BuildNode(leftrequest, primrefs);
             }
         }
@@ -238,33 +270,93 @@ namespace RadeonRays
         // Precompute min point
         auto rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
+        // Calc primitive refs histogram for all dimensions of [begin, end) range
+        auto calc_histogram = [&](int begin, int end, std::vector<Bin>* histogram)
         {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            auto centroid_rng = centroid_extents[axis];
-            auto invcentroid_rng = 1.f / centroid_rng;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                // Initialize bins
+                for (int i = 0; i < m_num_bins; ++i)
+                {
+                    histogram[axis][i].count = 0;
+                    histogram[axis][i].bounds = bbox();
+                }
 
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
+                // If the box is degenerate in that dimension skip it
+                if (centroid_extents[axis] == 0.f) continue;
+
+                float rootminc = rootmin[axis];
+                auto invcentroid_rng = 1.f / centroid_extents[axis];
+
+                for (int i = begin; i < end; ++i)
+                {
+                    auto binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((refs[i].center[axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
+
+                    ++histogram[axis][binidx].count;
+                    histogram[axis][binidx].bounds.grow(refs[i].bounds);
+                }
+            }
+        };
+
+        if (req.numprims < kParallelBinningThreshold)
+        {
+            calc_histogram(req.startidx, req.startidx + req.numprims, bins);
+        }
+        else
+        {
+            // Top level nodes: bin chunks in parallel and merge histograms
+            auto& scheduler = task_scheduler::instance();
+            int numchunks = scheduler.num_threads();
+            int chunksize = (req.numprims + numchunks - 1) / numchunks;
 
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
+            std::vector<Bin> chunkbins[3];
+            for (int axis = 0; axis < 3; ++axis)
             {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
+                chunkbins[axis].resize(numchunks * m_num_bins);
             }
 
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+            scheduler.parallel_for(0, numchunks, 1, [&](int begin, int end)
+            {
+                for (int c = begin; c < end; ++c)
+                {
+                    std::vector<Bin> histogram[3];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        histogram[axis].resize(m_num_bins);
+                    }
+
+                    int first = req.startidx + c * chunksize;
+                    int last = std::min(first + chunksize, req.startidx + req.numprims);
+                    calc_histogram(first, std::max(first, last), histogram);
+
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        std::copy(histogram[axis].cbegin(), histogram[axis].cend(), chunkbins[axis].begin() + c * m_num_bins);
+                    }
+                }
+            });
+
+            for (int axis = 0; axis < 3; ++axis)
             {
-                auto idx = i;
-                auto binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((refs[idx].center[axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
+                for (int i = 0; i < m_num_bins; ++i)
+                {
+                    bins[axis][i].count = 0;
+                    bins[axis][i].bounds = bbox();
 
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(refs[idx].bounds);
+                    for (int c = 0; c < numchunks; ++c)
+                    {
+                        bins[axis][i].count += chunkbins[axis][c * m_num_bins + i].count;
+                        bins[axis][i].bounds.grow(chunkbins[axis][c * m_num_bins + i].bounds);
+                    }
+                }
             }
+        }
+
+        // Evaluate all dimensions
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // If the box is degenerate in that dimension skip it
+            if (centroid_extents[axis] == 0.f) continue;
 
             std::vector<bbox> rightbounds(m_num_bins - 1);
 
@@ -499,6 +591,8 @@ namespace RadeonRays
 
     SplitBvh::Node* SplitBvh::AllocateNode()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
         if (m_nodecnt - m_num_nodes_archived >= m_num_nodes_for_regular)
         {
             m_node_archive.push_back(std::move(m_nodes));
@@ -23,6 +23,8 @@
 
 #include "bvh.h"
 
+#include <mutex>
+
 
 namespace RadeonRays
 {
@@ -33,8 +35,9 @@ namespace RadeonRays
                  int num_bins,
                  int max_split_depth, 
                  float min_overlap,
-                 float extra_refs_budget)
-        : Bvh(traversal_cost, num_bins, true)
+                 float extra_refs_budget,
+                 int max_leaf_prims = 1)
+        : Bvh(traversal_cost, num_bins, true, max_leaf_prims)
         , m_max_split_depth(max_split_depth)
         , m_min_overlap(min_overlap)
         , m_extra_refs_budget(extra_refs_budget)
@@ -89,6 +92,8 @@ namespace RadeonRays
         int m_num_nodes_archived;
         // Container for archived chunks
         std::list<std::vector<Node>> m_node_archive;
+        // Guards node archive and leaf indices as subtrees are built in parallel
+        std::mutex m_mutex;
 
         SplitBvh(SplitBvh const&) = delete;
         SplitBvh& operator = (SplitBvh const&) = delete;
@@ -26,6 +26,7 @@ THE SOFTWARE.
 #include "device.h"
 
 #include "../device/calc_intersection_device.h"
+#include "../device/kernel_cache.h"
 #include <cassert>
 
 #if USE_OPENCL
@@ -126,6 +127,9 @@ namespace RadeonRays
     //GetCalc_impl(OpenCL)
 
     GetCalc_impl(Vulkan)
+#if USE_HOST
+    GetCalc_impl(Host)
+#endif
 #undef GetCalc_impl
 
     static Calc::Calc* GetCalcOpenCL()
@@ -153,7 +157,8 @@ namespace RadeonRays
     static Calc::Calc* GetCalc()
     {
         // if CL allowed see if we have any devices if not
-        // try Vulkan if allowed, if neither try embree if allowed
+        // try Vulkan if allowed, then native host backend,
+        // if none of them try embree if allowed
 #if USE_OPENCL
         if( s_calc_platform & DeviceInfo::Platform::kOpenCL )
         {
@@ -169,6 +174,14 @@ namespace RadeonRays
             if (calc != nullptr) { return calc; }
         }
 #endif
+
+#if USE_HOST
+        if ( s_calc_platform & DeviceInfo::Platform::kHost )
+        {
+            auto* calc = GetCalcHost();
+            if (calc != nullptr) { return calc; }
+        }
+#endif
         return nullptr;
     }
 
@@ -177,6 +190,12 @@ namespace RadeonRays
         s_calc_platform = platform;
     }
 
+    void IntersectionApi::SetKernelCache(char const* directory, KernelCacheCallback callback, void* user_data)
+    {
+        KernelCache::SetDirectory(directory);
+        KernelCache::SetCallback(callback, user_data);
+    }
+
     std::uint32_t IntersectionApi::GetDeviceCount()
     {
         auto* calc = GetCalc();
@@ -241,6 +260,22 @@ namespace RadeonRays
         devinfo.name = spec.name;
         devinfo.vendor = spec.vendor;
         devinfo.type = spec.type == Calc::DeviceType::kGpu ? DeviceInfo::kGpu : DeviceInfo::kCpu;
+
+        switch (calc->GetPlatform())
+        {
+        case Calc::Platform::kOpenCL:
+            devinfo.platform = DeviceInfo::kOpenCL;
+            break;
+        case Calc::Platform::kVulkan:
+            devinfo.platform = DeviceInfo::kVulkan;
+            break;
+        case Calc::Platform::kHost:
+            devinfo.platform = DeviceInfo::kHost;
+            break;
+        default:
+            devinfo.platform = DeviceInfo::kAny;
+            break;
+        }
     }
 
     IntersectionApi* IntersectionApi::Create(std::uint32_t devidx)
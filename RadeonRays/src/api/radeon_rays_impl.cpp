@@ -116,6 +116,21 @@ namespace RadeonRays
         world_.OnCommit();
     }
 
+    void IntersectionApiImpl::SaveAccelerationStructure(char const* filename) const
+    {
+        ThrowIf(world_.shapes_.empty(), "Scene is empty.");
+        ThrowIf(world_.has_changed() || world_.GetStateChange() != ShapeImpl::kStateChangeNone, "Scene has to be committed before saving.");
+        m_device->SaveAccelerationStructure(world_, filename);
+    }
+
+    void IntersectionApiImpl::LoadAccelerationStructure(char const* filename)
+    {
+        ThrowIf(world_.shapes_.empty(), "Scene is empty.");
+        m_device->LoadAccelerationStructure(world_, filename);
+
+        world_.OnCommit();
+    }
+
     void IntersectionApiImpl::DeleteBuffer(Buffer* buffer) const
     {
         m_device->DeleteBuffer(buffer);
@@ -141,6 +156,16 @@ namespace RadeonRays
         m_device->QueryOccluded2dCellString(origins, directions, numorigins, numdirections, cell_string_inds, num_cell_strings, hitresults, waitevent, event);
     }
 
+    void IntersectionApiImpl::QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const
+    {
+        m_device->QueryOccluded2dCellStringCount(origins, directions, numorigins, numdirections, cell_string_inds, num_cell_strings, counts, point_masks, waitevent, event);
+    }
+
+    void IntersectionApiImpl::QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koeffs, Buffer const* offset_koeffs, int numorigins, int directions_stride, Buffer* hitresults, Event const* waitevent, Event** event) const
+    {
+        m_device->QueryOccluded2dSumLinearSky(origins, sky, frames, koeffs, offset_koeffs, numorigins, directions_stride, hitresults, waitevent, event);
+    }
+
 
     void IntersectionApiImpl::QueryIntersection(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hitinfos, Event const* waitevent, Event** event) const
     {
@@ -75,6 +75,10 @@ namespace RadeonRays
         void DetachAll() override;
         // Commit all geometry creations/changes
         void Commit() override;
+        // Save acceleration structure of the committed scene
+        void SaveAccelerationStructure(char const* filename) const override;
+        // Load acceleration structure instead of Commit
+        void LoadAccelerationStructure(char const* filename) override;
 
         //Sets the shape id allocator to its default value (1)
         void ResetIdCounter() override;
@@ -116,6 +120,10 @@ namespace RadeonRays
 
         void QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* hitresults, Event const* waitevent, Event** event) const override;
 
+        void QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const override;
+
+        void QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koeffs, Buffer const* offset_koeffs, int numorigins, int directions_stride, Buffer* hitresults, Event const* waitevent, Event** event) const override;
+
         // Find closest intersection, number of rays is in remote memory
         // TODO: do we need to modify rays' intersection range?
         // TODO: SoA vs AoS?
@@ -0,0 +1,295 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+namespace RadeonRays
+{
+    ///< Work stealing scheduler for fork-join parallelism.
+    ///< Each worker owns a deque: it pushes and pops its own
+    ///< tasks from the back while idle workers steal from the front.
+    ///< Threads waiting for a task group help executing tasks,
+    ///< so tasks are free to fork and wait for nested work.
+    ///<
+    class task_scheduler
+    {
+    public:
+        class task_group;
+
+        explicit task_scheduler(int num_threads = 0)
+            : done_(false)
+            , num_queued_(0)
+        {
+            if (num_threads <= 0)
+            {
+                num_threads = std::thread::hardware_concurrency();
+                num_threads = num_threads == 0 ? 2 : num_threads;
+            }
+
+            queues_.resize(num_threads);
+            for (auto& queue : queues_)
+            {
+                queue.reset(new worker_queue);
+            }
+
+            for (int i = 0; i < num_threads; ++i)
+            {
+                threads_.push_back(std::thread(&task_scheduler::run_loop, this, i));
+            }
+        }
+
+        ~task_scheduler()
+        {
+            {
+                std::lock_guard<std::mutex> lock(park_mutex_);
+                done_ = true;
+            }
+
+            park_cv_.notify_all();
+            std::for_each(threads_.begin(), threads_.end(), std::mem_fn(&std::thread::join));
+        }
+
+        // Scheduler shared by all the clients in the process
+        static task_scheduler& instance()
+        {
+            static task_scheduler scheduler;
+            return scheduler;
+        }
+
+        int num_threads() const
+        {
+            return static_cast<int>(threads_.size());
+        }
+
+        // Call f(begin, end) for subranges of [begin, end) of at most grain elements
+        // in parallel and wait for all of them to finish
+        template <typename F> void parallel_for(int begin, int end, int grain, F const& f);
+
+    private:
+        struct task
+        {
+            std::function<void()> f;
+            std::atomic<int>* pending;
+        };
+
+        struct worker_queue
+        {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        void push(task&& t)
+        {
+            // Workers push into their own deque, others go round robin
+            auto idx = worker_index() >= 0 ? worker_index() :
+                static_cast<int>(next_queue_++ % queues_.size());
+
+            {
+                std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+                queues_[idx]->tasks.push_back(std::move(t));
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(park_mutex_);
+                ++num_queued_;
+            }
+
+            park_cv_.notify_one();
+        }
+
+        // Pop from own deque first, steal from others otherwise
+        bool try_pop(task& t)
+        {
+            auto self = worker_index();
+            auto numqueues = static_cast<int>(queues_.size());
+
+            if (self >= 0)
+            {
+                std::lock_guard<std::mutex> lock(queues_[self]->mutex);
+                if (!queues_[self]->tasks.empty())
+                {
+                    t = std::move(queues_[self]->tasks.back());
+                    queues_[self]->tasks.pop_back();
+                    --num_queued_;
+                    return true;
+                }
+            }
+
+            auto start = self >= 0 ? self + 1 : 0;
+            for (int i = 0; i < numqueues; ++i)
+            {
+                auto idx = (start + i) % numqueues;
+                if (idx == self) continue;
+
+                std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+                if (!queues_[idx]->tasks.empty())
+                {
+                    t = std::move(queues_[idx]->tasks.front());
+                    queues_[idx]->tasks.pop_front();
+                    --num_queued_;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void execute(task& t)
+        {
+            t.f();
+
+            // Last task of a group wakes up its waiter if parked
+            if (--(*t.pending) == 0)
+            {
+                std::lock_guard<std::mutex> lock(park_mutex_);
+                park_cv_.notify_all();
+            }
+        }
+
+        // Help executing tasks until pending drops to zero, park if there is nothing to steal
+        void wait_for(std::atomic<int> const& pending)
+        {
+            task t;
+            while (pending > 0)
+            {
+                if (try_pop(t))
+                {
+                    execute(t);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(park_mutex_);
+                park_cv_.wait(lock, [this, &pending]() { return pending == 0 || num_queued_ > 0; });
+            }
+        }
+
+        void run_loop(int idx)
+        {
+            worker_index() = idx;
+
+            task t;
+            while (true)
+            {
+                if (try_pop(t))
+                {
+                    execute(t);
+                    continue;
+                }
+
+                // Park until there is something to do
+                std::unique_lock<std::mutex> lock(park_mutex_);
+                park_cv_.wait(lock, [this]() { return done_ || num_queued_ > 0; });
+
+                if (done_)
+                {
+                    break;
+                }
+            }
+        }
+
+        // Index of the current worker or -1 for external threads
+        static int& worker_index()
+        {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        std::vector<std::unique_ptr<worker_queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::mutex park_mutex_;
+        std::condition_variable park_cv_;
+        bool done_;
+        std::atomic<int> num_queued_;
+        std::atomic<unsigned> next_queue_{ 0 };
+    };
+
+    ///< Set of tasks which can be waited for together.
+    ///< Waiting thread executes pending tasks and only parks
+    ///< when there is nothing left to steal.
+    ///<
+    class task_scheduler::task_group
+    {
+    public:
+        explicit task_group(task_scheduler& scheduler = task_scheduler::instance())
+            : scheduler_(scheduler)
+            , pending_(0)
+        {
+        }
+
+        ~task_group()
+        {
+            wait();
+        }
+
+        void run(std::function<void()>&& f)
+        {
+            ++pending_;
+            scheduler_.push(task{ std::move(f), &pending_ });
+        }
+
+        void wait()
+        {
+            scheduler_.wait_for(pending_);
+        }
+
+    private:
+        task_group(task_group const&) = delete;
+        task_group& operator = (task_group const&) = delete;
+
+        task_scheduler& scheduler_;
+        std::atomic<int> pending_;
+    };
+
+    template <typename F> inline void task_scheduler::parallel_for(int begin, int end, int grain, F const& f)
+    {
+        grain = std::max(grain, 1);
+
+        if (end - begin <= grain)
+        {
+            if (end > begin) f(begin, end);
+            return;
+        }
+
+        task_group group(*this);
+        for (int i = begin + grain; i < end; i += grain)
+        {
+            auto rangeend = std::min(i + grain, end);
+            group.run([&f, i, rangeend]() { f(i, rangeend); });
+        }
+
+        // First range is processed by the calling thread
+        f(begin, begin + grain);
+        group.wait();
+    }
+}
+
+#endif // TASK_SCHEDULER_H
@@ -66,6 +66,34 @@ namespace RadeonRays
     }
 
     void CalcIntersectionDevice::Preprocess(World const& world)
+    {
+        UpdateIntersector(world);
+
+        try
+        {
+            // Let intersector to do its preprocessing job
+            m_intersector->SetWorld(world);
+        }
+        catch (Exception& e)
+        {
+            std::cout << e.what();
+            throw;
+        }
+    }
+
+    void CalcIntersectionDevice::SaveAccelerationStructure(World const& world, char const* filename) const
+    {
+        m_intersector->SaveAccelerationStructure(world, filename);
+    }
+
+    void CalcIntersectionDevice::LoadAccelerationStructure(World const& world, char const* filename)
+    {
+        // Pick the same intersector Preprocess would
+        UpdateIntersector(world);
+        m_intersector->LoadAccelerationStructure(world, filename);
+    }
+
+    void CalcIntersectionDevice::UpdateIntersector(World const& world)
     {
         bool use2level = false;
 
@@ -96,7 +124,16 @@ namespace RadeonRays
             }
         }
 
-        if (use2level)
+        if (m_device->GetPlatform() == Calc::Platform::kHost && !use2level)
+        {
+            // Native host backend implements skip links and two-level kernels only
+            if (m_intersector_string != "bvh")
+            {
+                m_intersector.reset(new IntersectorSkipLinks(m_device.get()));
+                m_intersector_string = "bvh";
+            }
+        }
+        else if (use2level)
         {
             if (m_intersector_string != "bvh2l")
             {
@@ -149,17 +186,6 @@ namespace RadeonRays
                 }*/
             }
         }
-
-        try
-        {
-            // Let intersector to do its preprocessing job
-            m_intersector->SetWorld(world);
-        }
-        catch (Exception& e)
-        {
-            std::cout << e.what();
-            throw;
-        }
     }
 
     Buffer* CalcIntersectionDevice::CreateBuffer(size_t size, void* initdata) const
@@ -318,6 +344,34 @@ namespace RadeonRays
         }
     }
 
+    void CalcIntersectionDevice::QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koefs, Buffer const* offset_koefs, int numorigins, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const
+    {
+        // Extract Calc buffers from their holders, frames are optional
+        auto origins_buffer = static_cast<CalcBufferHolder const*>(origins)->m_buffer.get();
+        auto frames_buffer = frames ? static_cast<CalcBufferHolder const*>(frames)->m_buffer.get() : nullptr;
+        auto koefs_buffer = static_cast<CalcBufferHolder const*>(koefs)->m_buffer.get();
+        auto offset_koefs_buffer = static_cast<CalcBufferHolder const*>(offset_koefs)->m_buffer.get();
+
+        auto hit_buffer = static_cast<CalcBufferHolder const*>(hits)->m_buffer.get();
+        // If waitevent is passed in we have to extract it as well
+        auto e = waitevent ? static_cast<CalcEventHolder const*>(waitevent)->m_event.get() : nullptr;
+
+        if (event)
+        {
+            // event pointer has been provided, so construct holder and return event to the user
+            Calc::Event* calc_event = nullptr;
+            m_intersector->QueryOccluded2dSumLinearSky(0, origins_buffer, sky, frames_buffer, koefs_buffer, offset_koefs_buffer, numorigins, directions_stride, hit_buffer, e, &calc_event);
+
+            auto holder = CreateEventHolder();
+            holder->Set(m_device.get(), calc_event);
+            *event = holder;
+        }
+        else
+        {
+            m_intersector->QueryOccluded2dSumLinearSky(0, origins_buffer, sky, frames_buffer, koefs_buffer, offset_koefs_buffer, numorigins, directions_stride, hit_buffer, e, nullptr);
+        }
+    }
+
     void CalcIntersectionDevice::QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* hit, Event const* waitevent, Event** event) const
     {
         // Extract Calc buffers from their holders
@@ -346,6 +400,34 @@ namespace RadeonRays
         }
     }
 
+    void CalcIntersectionDevice::QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const
+    {
+        // Extract Calc buffers from their holders, point masks are optional
+        auto origins_buffer = static_cast<CalcBufferHolder const*>(origins)->m_buffer.get();
+        auto directions_buffer = static_cast<CalcBufferHolder const*>(directions)->m_buffer.get();
+        auto cell_string_inds_buffer = static_cast<CalcBufferHolder const*>(cell_string_inds)->m_buffer.get();
+        auto counts_buffer = static_cast<CalcBufferHolder const*>(counts)->m_buffer.get();
+        auto point_masks_buffer = point_masks ? static_cast<CalcBufferHolder const*>(point_masks)->m_buffer.get() : nullptr;
+
+        // If waitevent is passed in we have to extract it as well
+        auto e = waitevent ? static_cast<CalcEventHolder const*>(waitevent)->m_event.get() : nullptr;
+
+        if (event)
+        {
+            // event pointer has been provided, so construct holder and return event to the user
+            Calc::Event* calc_event = nullptr;
+            m_intersector->QueryOccluded2dCellStringCount(0, origins_buffer, directions_buffer, numorigins, numdirections, cell_string_inds_buffer, num_cell_strings, counts_buffer, point_masks_buffer, e, &calc_event);
+
+            auto holder = CreateEventHolder();
+            holder->Set(m_device.get(), calc_event);
+            *event = holder;
+        }
+        else
+        {
+            m_intersector->QueryOccluded2dCellStringCount(0, origins_buffer, directions_buffer, numorigins, numdirections, cell_string_inds_buffer, num_cell_strings, counts_buffer, point_masks_buffer, e, nullptr);
+        }
+    }
+
     void CalcIntersectionDevice::QueryIntersection(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hits, Event const* waitevent, Event** event) const
     {
         // Extract Calc buffers from their holders
@@ -48,6 +48,10 @@ namespace RadeonRays
 
         void Preprocess(World const& world) override;
 
+        void SaveAccelerationStructure(World const& world, char const* filename) const override;
+
+        void LoadAccelerationStructure(World const& world, char const* filename) override;
+
         Buffer* CreateBuffer(size_t size, void* initdata) const override;
 
         void DeleteBuffer(Buffer* const) const override;
@@ -63,15 +67,22 @@ namespace RadeonRays
         void QueryOcclusion(Buffer const* rays, int numrays, Buffer* hitresults, Event const* waitevent, Event** event) const override;
       
         void QueryOccluded2dSumLinear2(Buffer const* origins, Buffer const* directions, Buffer const* koefs, Buffer const* offset_directions, Buffer const* offset_koefs, int numorigins, int numdirections, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const override;
+
+        void QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koefs, Buffer const* offset_koefs, int numorigins, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const override;
       
         void QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* hit, Event const* waitevent, Event** event) const override;
 
+        void QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const override;
+
         void QueryIntersection(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hitinfos, Event const* waitevent, Event** event) const override;
 
         void QueryOcclusion(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hitresults, Event const* waitevent, Event** event) const override;
 
         Calc::Platform GetPlatform() const { return m_device->GetPlatform(); }
     protected:
+        // Select intersector suitable for the world and options
+        void UpdateIntersector(World const& world);
+
         CalcEventHolder* CreateEventHolder() const;
         void      ReleaseEventHolder(CalcEventHolder* e) const;
 
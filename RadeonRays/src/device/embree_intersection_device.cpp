@@ -24,6 +24,10 @@ THE SOFTWARE.
 #include <iostream>
 #include <future>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
 #include "../world/world.h"
 #include "../primitive/mesh.h"
 #include "../primitive/instance.h"
@@ -33,7 +37,8 @@ THE SOFTWARE.
 #include "../except/except.h"
 #include "embree2/rtcore.h"
 #include "embree2/rtcore_ray.h"
-#include "../async/thread_pool.h"
+#include "../async/task_scheduler.h"
+#include "../kernels/CPU/common.h"
 
 #include <xmmintrin.h>
 #include <pmmintrin.h>
@@ -44,6 +49,21 @@ THE SOFTWARE.
 //switch between rtcIntersect4 and rtcIntercetN
 //#define INTERSECTN
 
+//switch between rtcOccluded8 and rtcOccluded16 for 2d queries
+//#define OCCLUDED16
+
+#ifdef OCCLUDED16
+#define PACKET_SIZE 16
+#define PACKET_ALIGN 64
+typedef RTCRay16 RTCRayPacket;
+#define rtcOccludedPacket rtcOccluded16
+#else
+#define PACKET_SIZE 8
+#define PACKET_ALIGN 32
+typedef RTCRay8 RTCRayPacket;
+#define rtcOccludedPacket rtcOccluded8
+#endif // OCCLUDED16
+
 
 namespace RadeonRays
 {
@@ -108,8 +128,57 @@ namespace RadeonRays
         std::future<void> m_ftr;
     };
 
+    namespace
+    {
+        //disable all lanes of the packet
+        void ClearRTCRayPacket(RTCRayPacket& dst, int* valid)
+        {
+            for (int j = 0; j < PACKET_SIZE; ++j)
+            {
+                valid[j] = 0;
+                dst.orgx[j] = dst.orgy[j] = dst.orgz[j] = 0;
+                dst.dirx[j] = dst.diry[j] = dst.dirz[j] = 0;
+                dst.tnear[j] = 0;
+                dst.tfar[j] = 0;
+                dst.geomID[j] = RTC_INVALID_GEOMETRY_ID;
+                dst.primID[j] = RTC_INVALID_GEOMETRY_ID;
+                dst.instID[j] = RTC_INVALID_GEOMETRY_ID;
+                dst.time[j] = 0;
+                dst.mask[j] = 0xFFFFFFFF;
+            }
+        }
+
+        //fill lane i with the 2d ray built from origin/direction pair,
+        //origin.w holds max t and direction.w holds time (same as RadeonRays::ray)
+        void FillRTCRay2d(RTCRayPacket& dst, int i, const float4& o, const float4& d)
+        {
+            dst.orgx[i] = o.x;
+            dst.orgy[i] = o.y;
+            dst.orgz[i] = o.z;
+
+            dst.dirx[i] = d.x;
+            dst.diry[i] = d.y;
+            dst.dirz[i] = d.z;
+
+            dst.tnear[i] = 0;
+            dst.tfar[i] = o.w;
+            dst.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+            dst.primID[i] = RTC_INVALID_GEOMETRY_ID;
+            dst.instID[i] = RTC_INVALID_GEOMETRY_ID;
+            dst.time[i] = d.w;
+            dst.mask[i] = 0xFFFFFFFF;
+        }
+
+        //number of jobs used for queries with per job accumulators
+        int GetNumJobs()
+        {
+            int num_jobs = std::thread::hardware_concurrency();
+            return num_jobs == 0 ? 2 : num_jobs;
+        }
+    }
+
     EmbreeIntersectionDevice::EmbreeIntersectionDevice()
-        : m_pool(1)
+        : m_scheduler(task_scheduler::instance())
     {
         m_device = rtcNewDevice(nullptr);
         RTCError result = rtcDeviceGetError(m_device);
@@ -220,6 +289,16 @@ namespace RadeonRays
         CheckEmbreeError();
     }
 
+    void EmbreeIntersectionDevice::SaveAccelerationStructure(World const& world, char const* filename) const
+    {
+        Throw("Acceleration structure serialization is not supported by Embree device");
+    }
+
+    void EmbreeIntersectionDevice::LoadAccelerationStructure(World const& world, char const* filename)
+    {
+        Throw("Acceleration structure serialization is not supported by Embree device");
+    }
+
     Buffer* EmbreeIntersectionDevice::CreateBuffer(size_t size, void* initdata) const
     {
         return new EmbreeBuffer(size, initdata);
@@ -279,13 +358,11 @@ namespace RadeonRays
 
         EmbreeEvent* ev = new EmbreeEvent([this, fireRays, fireHits, numrays]() 
         {
-            m_pool.setSleepTime(0);
             //processing buffers workflow:
             //1. convert RadeonRays::ray to RTCRay
             //2. rtcIntersect
             //3. convert RTCRay hit result to RadeonRays::Intersection
-            std::vector<std::future<void> > jobs;
-            jobs.reserve(numrays / TASK_SIZE);
+            task_scheduler::task_group jobs(m_scheduler);
 #ifndef INTERSECTN
             for (int i = 0; i < numrays; i += TASK_SIZE)
             {
@@ -293,7 +370,7 @@ namespace RadeonRays
                 Intersection* hit = &static_cast<Intersection*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
 
-                jobs.push_back(std::move(m_pool.submit(([this, src_ray, hit, count]()
+                jobs.run([this, src_ray, hit, count]()
                 {
                     RTCRay4 data;
                     for (int i = 0; i < count; i+=4)
@@ -309,7 +386,7 @@ namespace RadeonRays
                         for (int j = 0; j < rays_count; ++j)
                             FillIntersection(hit[i+j], data, j);
                     }
-                }))));
+                });
             }
 #else
             std::vector<RTCRay> data(numrays);
@@ -319,14 +396,13 @@ namespace RadeonRays
                 RTCRay* dst_ray = &data[i];
                 Intersection* hit = &static_cast<Intersection*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
-                jobs.push_back(std::move(m_pool.submit([this, dst_ray, src_ray, count]()
+                jobs.run([this, dst_ray, src_ray, count]()
                 {
                     for (int j = 0; j < count; ++j)
                         FillRTCRay(dst_ray[j], src_ray[j]);
-                })));
+                });
             }
-            std::for_each(jobs.begin(), jobs.end(), [](std::future<void>& j) {j.wait(); });
-            jobs.clear();
+            jobs.wait();
             rtcIntersectN(m_scene, &data[0], numrays, sizeof(RTCRay));
             CheckEmbreeError();
             for (int i = 0; i < numrays; i += TASK_SIZE)
@@ -336,20 +412,19 @@ namespace RadeonRays
                 Intersection* hit = &static_cast<Intersection*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
 
-                jobs.push_back(std::move(m_pool.submit([this, hit, src_hit, src_ray, count]()
+                jobs.run([this, hit, src_hit, src_ray, count]()
                 {
                     for (int i = 0; i < count; ++i)
                         if (src_ray[i].IsActive())
                         {
                             FillIntersection(hit[i], src_hit[i]);
                         }
-                })));
+                });
             }
             
 #endif // INTERSECTN
 
-            std::for_each(jobs.begin(), jobs.end(), [](std::future<void>& j) {j.wait(); });
-            m_pool.setSleepTime(1);
+            jobs.wait();
         });
 
         if (event)
@@ -370,13 +445,11 @@ namespace RadeonRays
 
         EmbreeEvent* ev = new EmbreeEvent([this, fireRays, fireHits, numrays]()
         {
-            m_pool.setSleepTime(0);
             //processing buffers workflow:
             //1. convert RadeonRays::ray to RTCRay
             //2. rtcOccluded
             //3. convert RTCRay hit result
-            std::vector<std::future<void> > jobs;
-            jobs.reserve(numrays / TASK_SIZE);
+            task_scheduler::task_group jobs(m_scheduler);
 #ifndef INTERSECTN
             for (int i = 0; i < numrays; i += TASK_SIZE)
             {
@@ -385,7 +458,7 @@ namespace RadeonRays
                 int* hit = &static_cast<int*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
 
-                jobs.push_back(std::move(m_pool.submit(([this, src_ray, hit, count]()
+                jobs.run([this, src_ray, hit, count]()
                 {
                     RTCRay4 data;
                     for (int i = 0; i < count; i += 4)
@@ -428,7 +501,7 @@ namespace RadeonRays
                             hit[i + j] = data->mesh_id;
                         }
                     }
-                }))));
+                });
             }
 #else
             std::vector<RTCRay> data(numrays);
@@ -438,14 +511,13 @@ namespace RadeonRays
                 RTCRay* dst_ray = &data[i];
                 Intersection* hit = &static_cast<Intersection*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
-                jobs.push_back(std::move(m_pool.submit([this, dst_ray, src_ray, count]()
+                jobs.run([this, dst_ray, src_ray, count]()
                 {
                     for (int j = 0; j < count; ++j)
                         FillRTCRay(dst_ray[j], src_ray[j]);
-                })));
+                });
             }
-            std::for_each(jobs.begin(), jobs.end(), [](std::future<void>& j) {j.wait(); });
-            jobs.clear();
+            jobs.wait();
             rtcOccludedN(m_scene, &data[0], numrays, sizeof(RTCRay));
             CheckEmbreeError();
             for (int i = 0; i < numrays; i += TASK_SIZE)
@@ -454,7 +526,7 @@ namespace RadeonRays
                 int* hit = &static_cast<int*>(fireHits->GetData())[i];
                 int count = (i + TASK_SIZE) < numrays ? TASK_SIZE : numrays - i;
                 RTCRay* hit_src = &data[i];
-                jobs.push_back(std::move(m_pool.submit([this, hit, hit_src, src_ray, count]()
+                jobs.run([this, hit, hit_src, src_ray, count]()
                 {
                     for (int i = 0; i < count; ++i)
                     {
@@ -467,12 +539,11 @@ namespace RadeonRays
                         EmbreeSceneData* data = static_cast<EmbreeSceneData*>(rtcGetUserData(m_scene, hit[i]));
                         hit[i] = data->mesh_id;
                     }
-                })));
+                });
             }
 #endif // INTERSECTN
 
-            std::for_each(jobs.begin(), jobs.end(), [](std::future<void>& j) {j.wait(); });
-            m_pool.setSleepTime(1);
+            jobs.wait();
         });
 
         if (event)
@@ -488,12 +559,313 @@ namespace RadeonRays
 
     void EmbreeIntersectionDevice::QueryIntersection(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hits, Event const* waitevent, Event** event) const
     {
-        Throw("Not implemented for embree device.");
+        //buffers live in host memory, so ray count is available right away
+        const EmbreeBuffer* count = dynamic_cast<const EmbreeBuffer*>(numrays); ThrowIf(!count, "Invalid embree buffer.");
+        int num = std::min(*static_cast<const int*>(count->GetData()), maxrays);
+        QueryIntersection(rays, std::max(num, 0), hits, waitevent, event);
     }
 
     void EmbreeIntersectionDevice::QueryOcclusion(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hits, Event const* waitevent, Event** event) const
     {
-        Throw("Not implemented for embree device.");
+        //buffers live in host memory, so ray count is available right away
+        const EmbreeBuffer* count = dynamic_cast<const EmbreeBuffer*>(numrays); ThrowIf(!count, "Invalid embree buffer.");
+        int num = std::min(*static_cast<const int*>(count->GetData()), maxrays);
+        QueryOcclusion(rays, std::max(num, 0), hits, waitevent, event);
+    }
+
+    template <typename DirectionFn>
+    void EmbreeIntersectionDevice::Occluded2dSumLinear(const float4* o, const float4* k, const int* offset_k, float* hit, int numorigins, int numdirections, int directions_stride, DirectionFn const& direction) const
+    {
+        //processing workflow:
+        //1. split outputs (direction slot x origin) between jobs, so every output has a single owner
+        //2. generate rays of owned outputs on the fly in packets of origins sharing a direction
+        //3. rtcOccluded
+        //4. accumulate koefs into hits in direction order, independent of the number of jobs
+        size_t numrays = static_cast<size_t>(numorigins) * numdirections;
+        size_t numoutputs = static_cast<size_t>(numorigins) * std::min(directions_stride, numdirections);
+        if (numrays == 0)
+        {
+            return;
+        }
+
+        size_t num_jobs = std::min<size_t>(std::min<size_t>(GetNumJobs(), (numrays + TASK_SIZE - 1) / TASK_SIZE), numoutputs);
+        size_t job_size = (numoutputs + num_jobs - 1) / num_jobs;
+        task_scheduler::task_group jobs(m_scheduler);
+
+        for (size_t begin = 0; begin < numoutputs; begin += job_size)
+        {
+            size_t end = std::min(begin + job_size, numoutputs);
+
+            jobs.run([this, o, k, offset_k, hit, &direction, numorigins, numdirections, directions_stride, begin, end]()
+            {
+                RTCRayPacket data;
+                RTCORE_ALIGN(PACKET_ALIGN) int valid[PACKET_SIZE];
+                for (size_t first = begin; first < end;)
+                {
+                    //outputs of the same slot are consecutive origins
+                    int slot = static_cast<int>(first / numorigins);
+                    int origin_begin = static_cast<int>(first % numorigins);
+                    int origin_end = static_cast<int>(std::min<size_t>(numorigins, origin_begin + (end - first)));
+                    for (int direction_id = slot; direction_id < numdirections; direction_id += directions_stride)
+                    {
+                        for (int i = origin_begin; i < origin_end; i += PACKET_SIZE)
+                        {
+                            int rays_count = std::min(PACKET_SIZE, origin_end - i); // count of valid rays
+                            ClearRTCRayPacket(data, valid);
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                valid[j] = -1;
+                                FillRTCRay2d(data, j, o[i + j], direction(i + j, direction_id));
+                            }
+                            rtcOccludedPacket(valid, m_scene, data); CheckEmbreeError();
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                size_t output_id = static_cast<size_t>(slot) * numorigins + i + j;
+                                const float4& koef = k[direction_id + offset_k[i + j]];
+                                bool occluded = data.geomID[j] != RTC_INVALID_GEOMETRY_ID;
+                                float k0 = occluded ? koef.x : koef.y;
+                                float k1 = occluded ? koef.z : koef.w;
+                                if (std::fabs(k0) > 1e-4f)
+                                    hit[output_id * 2] += k0;
+                                if (std::fabs(k1) > 1e-4f)
+                                    hit[output_id * 2 + 1] += k1;
+                            }
+                        }
+                    }
+                    first += origin_end - origin_begin;
+                }
+            });
+        }
+        jobs.wait();
+    }
+
+    void EmbreeIntersectionDevice::QueryOccluded2dSumLinear2(Buffer const* origins, Buffer const* directions, Buffer const* koefs, Buffer const* offset_directions, Buffer const* offset_koefs, int numorigins, int numdirections, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const
+    {
+        const EmbreeBuffer* fireOrigins = dynamic_cast<const EmbreeBuffer*>(origins); ThrowIf(!fireOrigins, "Invalid embree buffer.");
+        const EmbreeBuffer* fireDirections = dynamic_cast<const EmbreeBuffer*>(directions); ThrowIf(!fireDirections, "Invalid embree buffer.");
+        const EmbreeBuffer* fireKoefs = dynamic_cast<const EmbreeBuffer*>(koefs); ThrowIf(!fireKoefs, "Invalid embree buffer.");
+        const EmbreeBuffer* fireOffsetDirections = dynamic_cast<const EmbreeBuffer*>(offset_directions); ThrowIf(!fireOffsetDirections, "Invalid embree buffer.");
+        const EmbreeBuffer* fireOffsetKoefs = dynamic_cast<const EmbreeBuffer*>(offset_koefs); ThrowIf(!fireOffsetKoefs, "Invalid embree buffer.");
+        EmbreeBuffer* fireHits = dynamic_cast<EmbreeBuffer*>(hits); ThrowIf(!fireHits, "Invalid embree buffer.");
+        ThrowIf(directions_stride <= 0, "Invalid directions stride.");
+
+        EmbreeEvent* ev = new EmbreeEvent([=]()
+        {
+            const float4* o = static_cast<const float4*>(fireOrigins->GetData());
+            const float4* d = static_cast<const float4*>(fireDirections->GetData());
+            const float4* k = static_cast<const float4*>(fireKoefs->GetData());
+            const int* offset_d = static_cast<const int*>(fireOffsetDirections->GetData());
+            const int* offset_k = static_cast<const int*>(fireOffsetKoefs->GetData());
+            float* hit = static_cast<float*>(fireHits->GetData());
+
+            Occluded2dSumLinear(o, k, offset_k, hit, numorigins, numdirections, directions_stride, [d, offset_d](int origin_id, int direction_id)
+            {
+                return d[direction_id + offset_d[origin_id]];
+            });
+        });
+
+        if (event)
+        {
+            *event = ev;
+        }
+        else
+        {
+            ev->Wait();
+            DeleteEvent(ev);
+        }
+    }
+
+    void EmbreeIntersectionDevice::QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koefs, Buffer const* offset_koefs, int numorigins, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const
+    {
+        const EmbreeBuffer* fireOrigins = dynamic_cast<const EmbreeBuffer*>(origins); ThrowIf(!fireOrigins, "Invalid embree buffer.");
+        const EmbreeBuffer* fireFrames = frames ? dynamic_cast<const EmbreeBuffer*>(frames) : nullptr; ThrowIf(frames && !fireFrames, "Invalid embree buffer.");
+        const EmbreeBuffer* fireKoefs = dynamic_cast<const EmbreeBuffer*>(koefs); ThrowIf(!fireKoefs, "Invalid embree buffer.");
+        const EmbreeBuffer* fireOffsetKoefs = dynamic_cast<const EmbreeBuffer*>(offset_koefs); ThrowIf(!fireOffsetKoefs, "Invalid embree buffer.");
+        EmbreeBuffer* fireHits = dynamic_cast<EmbreeBuffer*>(hits); ThrowIf(!fireHits, "Invalid embree buffer.");
+        ThrowIf(directions_stride <= 0, "Invalid directions stride.");
+
+        EmbreeEvent* ev = new EmbreeEvent([=]()
+        {
+            //same workflow as QueryOccluded2dSumLinear2, directions come from sky patches
+            const float4* o = static_cast<const float4*>(fireOrigins->GetData());
+            const float4* f = fireFrames ? static_cast<const float4*>(fireFrames->GetData()) : nullptr;
+            const float4* k = static_cast<const float4*>(fireKoefs->GetData());
+            const int* offset_k = static_cast<const int*>(fireOffsetKoefs->GetData());
+            float* hit = static_cast<float*>(fireHits->GetData());
+
+            int numdirections = static_cast<int>(sky.GetNumPatches());
+            Occluded2dSumLinear(o, k, offset_k, hit, numorigins, numdirections, directions_stride, [f, &sky](int origin_id, int direction_id)
+            {
+                const float4& zenith = f ? f[origin_id * 2] : sky.zenith;
+                const float4& azimuth = f ? f[origin_id * 2 + 1] : sky.azimuth;
+                return HostKernels::sky_patch_direction(sky, zenith, azimuth, direction_id);
+            });
+        });
+
+        if (event)
+        {
+            *event = ev;
+        }
+        else
+        {
+            ev->Wait();
+            DeleteEvent(ev);
+        }
+    }
+
+    void EmbreeIntersectionDevice::QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const* cell_string_inds, int num_cell_strings, Buffer* hits, Event const* waitevent, Event** event) const
+    {
+        const EmbreeBuffer* fireOrigins = dynamic_cast<const EmbreeBuffer*>(origins); ThrowIf(!fireOrigins, "Invalid embree buffer.");
+        const EmbreeBuffer* fireDirections = dynamic_cast<const EmbreeBuffer*>(directions); ThrowIf(!fireDirections, "Invalid embree buffer.");
+        const EmbreeBuffer* fireCellStrings = dynamic_cast<const EmbreeBuffer*>(cell_string_inds); ThrowIf(!fireCellStrings, "Invalid embree buffer.");
+        EmbreeBuffer* fireHits = dynamic_cast<EmbreeBuffer*>(hits); ThrowIf(!fireHits, "Invalid embree buffer.");
+
+        EmbreeEvent* ev = new EmbreeEvent([=]()
+        {
+            //processing workflow:
+            //1. for each cell string and direction generate rays from string points in packets
+            //2. rtcOccluded until any point of the string is occluded
+            //3. write 1 for shaded string and 0 otherwise
+            const float4* o = static_cast<const float4*>(fireOrigins->GetData());
+            const float4* d = static_cast<const float4*>(fireDirections->GetData());
+            const int* cs = static_cast<const int*>(fireCellStrings->GetData());
+            float* hit = static_cast<float*>(fireHits->GetData());
+
+            int numbatches = num_cell_strings * numdirections;
+            task_scheduler::task_group jobs(m_scheduler);
+            for (int i = 0; i < numbatches; i += TASK_SIZE)
+            {
+                int count = (i + TASK_SIZE) < numbatches ? TASK_SIZE : numbatches - i;
+
+                jobs.run([this, o, d, cs, hit, num_cell_strings, i, count]()
+                {
+                    RTCRayPacket data;
+                    RTCORE_ALIGN(PACKET_ALIGN) int valid[PACKET_SIZE];
+                    for (int b = i; b < i + count; ++b)
+                    {
+                        int cell_string_id = b % num_cell_strings;
+                        int direction_id = b / num_cell_strings;
+                        int pt_start = cs[cell_string_id * 2];
+                        int pt_end = cs[cell_string_id * 2 + 1];
+
+                        float result = 0.f;
+                        //rays of the string share direction, so packets are coherent
+                        for (int p = pt_start; p < pt_end && result == 0.f; p += PACKET_SIZE)
+                        {
+                            int rays_count = (p + PACKET_SIZE) < pt_end ? PACKET_SIZE : pt_end - p; // count of valid rays
+                            ClearRTCRayPacket(data, valid);
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                valid[j] = -1;
+                                FillRTCRay2d(data, j, o[p + j], d[direction_id]);
+                            }
+                            rtcOccludedPacket(valid, m_scene, data); CheckEmbreeError();
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                if (data.geomID[j] != RTC_INVALID_GEOMETRY_ID)
+                                {
+                                    result = 1.f;
+                                    break;
+                                }
+                            }
+                        }
+                        hit[cell_string_id + direction_id * num_cell_strings] = result;
+                    }
+                });
+            }
+
+            jobs.wait();
+        });
+
+        if (event)
+        {
+            *event = ev;
+        }
+        else
+        {
+            ev->Wait();
+            DeleteEvent(ev);
+        }
+    }
+
+    void EmbreeIntersectionDevice::QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const* cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const
+    {
+        const EmbreeBuffer* fireOrigins = dynamic_cast<const EmbreeBuffer*>(origins); ThrowIf(!fireOrigins, "Invalid embree buffer.");
+        const EmbreeBuffer* fireDirections = dynamic_cast<const EmbreeBuffer*>(directions); ThrowIf(!fireDirections, "Invalid embree buffer.");
+        const EmbreeBuffer* fireCellStrings = dynamic_cast<const EmbreeBuffer*>(cell_string_inds); ThrowIf(!fireCellStrings, "Invalid embree buffer.");
+        EmbreeBuffer* fireCounts = dynamic_cast<EmbreeBuffer*>(counts); ThrowIf(!fireCounts, "Invalid embree buffer.");
+        EmbreeBuffer* fireMasks = point_masks ? dynamic_cast<EmbreeBuffer*>(point_masks) : nullptr; ThrowIf(point_masks && !fireMasks, "Invalid embree buffer.");
+
+        EmbreeEvent* ev = new EmbreeEvent([=]()
+        {
+            //same workflow as QueryOccluded2dCellString, all points are traced and counted
+            const float4* o = static_cast<const float4*>(fireOrigins->GetData());
+            const float4* d = static_cast<const float4*>(fireDirections->GetData());
+            const int* cs = static_cast<const int*>(fireCellStrings->GetData());
+            float* count = static_cast<float*>(fireCounts->GetData());
+            std::atomic<std::uint32_t>* masks = fireMasks ? static_cast<std::atomic<std::uint32_t>*>(fireMasks->GetData()) : nullptr;
+
+            int numbatches = num_cell_strings * numdirections;
+            task_scheduler::task_group jobs(m_scheduler);
+            for (int i = 0; i < numbatches; i += TASK_SIZE)
+            {
+                int batches = (i + TASK_SIZE) < numbatches ? TASK_SIZE : numbatches - i;
+
+                jobs.run([this, o, d, cs, count, masks, numorigins, num_cell_strings, i, batches]()
+                {
+                    RTCRayPacket data;
+                    RTCORE_ALIGN(PACKET_ALIGN) int valid[PACKET_SIZE];
+                    for (int b = i; b < i + batches; ++b)
+                    {
+                        int cell_string_id = b % num_cell_strings;
+                        int direction_id = b / num_cell_strings;
+                        int pt_start = cs[cell_string_id * 2];
+                        int pt_end = cs[cell_string_id * 2 + 1];
+
+                        int result = 0;
+                        for (int p = pt_start; p < pt_end; p += PACKET_SIZE)
+                        {
+                            int rays_count = (p + PACKET_SIZE) < pt_end ? PACKET_SIZE : pt_end - p; // count of valid rays
+                            ClearRTCRayPacket(data, valid);
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                valid[j] = -1;
+                                FillRTCRay2d(data, j, o[p + j], d[direction_id]);
+                            }
+                            rtcOccludedPacket(valid, m_scene, data); CheckEmbreeError();
+                            for (int j = 0; j < rays_count; ++j)
+                            {
+                                bool occluded = data.geomID[j] != RTC_INVALID_GEOMETRY_ID;
+                                result += occluded ? 1 : 0;
+                                if (masks)
+                                {
+                                    //neighbouring strings might share the word
+                                    size_t bit = static_cast<size_t>(direction_id) * numorigins + p + j;
+                                    std::uint32_t mask = 1u << (bit & 31);
+                                    if (occluded)
+                                        masks[bit >> 5].fetch_or(mask, std::memory_order_relaxed);
+                                    else
+                                        masks[bit >> 5].fetch_and(~mask, std::memory_order_relaxed);
+                                }
+                            }
+                        }
+                        count[cell_string_id + direction_id * num_cell_strings] = static_cast<float>(result);
+                    }
+                });
+            }
+
+            jobs.wait();
+        });
+
+        if (event)
+        {
+            *event = ev;
+        }
+        else
+        {
+            ev->Wait();
+            DeleteEvent(ev);
+        }
     }
 
     RTCScene EmbreeIntersectionDevice::GetEmbreeMesh(const RadeonRays::Mesh* mesh)
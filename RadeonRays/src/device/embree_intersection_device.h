@@ -25,7 +25,7 @@ THE SOFTWARE.
 #include <map>
 
 #include <embree2/rtcore.h>
-#include "../async/thread_pool.h"
+#include "../async/task_scheduler.h"
 
 namespace RadeonRays
 {
@@ -44,6 +44,8 @@ namespace RadeonRays
 
         //IntersectionDevice
         void Preprocess(World const& world) override;
+        void SaveAccelerationStructure(World const& world, char const* filename) const override;
+        void LoadAccelerationStructure(World const& world, char const* filename) override;
         Buffer* CreateBuffer(size_t size, void* initdata) const override;
         void DeleteBuffer(Buffer* const) const override;
         void DeleteEvent(Event* const) const override;
@@ -53,6 +55,10 @@ namespace RadeonRays
         void QueryOcclusion(Buffer const* rays, int numrays, Buffer* hitresults, Event const* waitevent, Event** event) const override;
         void QueryIntersection(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hitinfos, Event const* waitevent, Event** event) const override;
         void QueryOcclusion(Buffer const* rays, Buffer const* numrays, int maxrays, Buffer* hitresults, Event const* waitevent, Event** event) const override;
+        void QueryOccluded2dSumLinear2(Buffer const* origins, Buffer const* directions, Buffer const* koefs, Buffer const* offset_directions, Buffer const* offset_koefs, int numorigins, int numdirections, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const override;
+        void QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koefs, Buffer const* offset_koefs, int numorigins, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const override;
+        void QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const* cell_string_inds, int num_cell_strings, Buffer* hits, Event const* waitevent, Event** event) const override;
+        void QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const* cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const override;
     
     protected:
         RTCScene GetEmbreeMesh(const Mesh*);
@@ -62,6 +68,9 @@ namespace RadeonRays
         void FillIntersection(Intersection& dst, const RTCRay& src) const;
         void FillIntersection(Intersection& dst, const RTCRay4& src, int i) const;
         void CheckEmbreeError() const;
+        //sum-linear accumulation shared by 2d queries, direction(origin_id, direction_id) gives ray direction
+        template <typename DirectionFn>
+        void Occluded2dSumLinear(const float4* o, const float4* k, const int* offset_k, float* hit, int numorigins, int numdirections, int directions_stride, DirectionFn const& direction) const;
         
         // embree device
         RTCDevice m_device;
@@ -69,8 +78,8 @@ namespace RadeonRays
         // scene for intersection
         RTCScene m_scene; 
 
-        //thread pool for parallelizing work with buffers
-        mutable thread_pool<void> m_pool;
+        //scheduler for parallelizing work with buffers, shared with BVH builds
+        task_scheduler& m_scheduler;
 
         struct EmbreeMesh
         {
@@ -41,6 +41,12 @@ namespace RadeonRays
         // The call is blocking.
         virtual void Preprocess(World const& world) = 0;
 
+        // Save acceleration structure built by the last Preprocess call.
+        virtual void SaveAccelerationStructure(World const& world, char const* filename) const = 0;
+
+        // Load acceleration structure saved for the same world instead of Preprocess.
+        virtual void LoadAccelerationStructure(World const& world, char const* filename) = 0;
+
         // Create a buffer of a specified size with specified initial data.
         // if initdata == nullptr the buffer is allocated, but not initialized.
         virtual Buffer* CreateBuffer(size_t size, void* initdata) const = 0;
@@ -77,6 +83,12 @@ namespace RadeonRays
       
         virtual void QueryOccluded2dCellString(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* hit, Event const* waitevent, Event** event) const = 0;
 
+        // Same as QueryOccluded2dCellString, writes occluded point counts and optional per point bits.
+        virtual void QueryOccluded2dCellStringCount(Buffer const* origins, Buffer const* directions, int numorigins, int numdirections, Buffer const *cell_string_inds, int num_cell_strings, Buffer* counts, Buffer* point_masks, Event const* waitevent, Event** event) const = 0;
+
+        // Same as QueryOccluded2dSumLinear2, directions are generated from sky patches, frames might be nullptr.
+        virtual void QueryOccluded2dSumLinearSky(Buffer const* origins, SkyPatches const& sky, Buffer const* frames, Buffer const* koefs, Buffer const* offset_koefs, int numorigins, int directions_stride, Buffer* hits, Event const* waitevent, Event** event) const = 0;
+
         // Find intersection for the rays in rays buffer and write them into hits buffer. Take the number of rays from the buffer in remote memory.
         // rays is assumed AOS with elements of type RadeonRays::ray.
         // numrays is assumed an array with a single int element.
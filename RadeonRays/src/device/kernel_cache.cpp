@@ -0,0 +1,223 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "kernel_cache.h"
+#include "../util/hash.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace RadeonRays
+{
+    // Bump to invalidate binaries written by older versions
+    static char const* const kKernelCacheVersion = "rrkc1";
+
+    static std::mutex s_kernel_cache_mutex;
+    static std::string s_kernel_cache_directory;
+    static KernelCacheCallback s_kernel_cache_callback = nullptr;
+    static void* s_kernel_cache_user_data = nullptr;
+
+    static bool ReadFile(std::string const& filename, std::vector<char>& data)
+    {
+        std::ifstream in(filename, std::ios::in | std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Cache key is computed from everything affecting the binary
+    static std::string CalculateKey(Calc::Device* device, std::vector<char> const& source, char const* options)
+    {
+        Calc::DeviceSpec spec;
+        device->GetSpec(spec);
+
+        Hash hash;
+        hash.Append(kKernelCacheVersion);
+        hash.Append(spec.name);
+        hash.Append(spec.vendor);
+        hash.AppendValue(static_cast<int>(spec.type));
+        hash.AppendValue(static_cast<int>(device->GetPlatform()));
+        hash.Append(options);
+        hash.Append(source.data(), source.size());
+
+        std::ostringstream key;
+        key << std::hex << hash.GetValue();
+        return key.str();
+    }
+
+    static void Report(char const* key, bool hit)
+    {
+        KernelCacheCallback callback;
+        void* user_data;
+        {
+            std::lock_guard<std::mutex> lock(s_kernel_cache_mutex);
+            callback = s_kernel_cache_callback;
+            user_data = s_kernel_cache_user_data;
+        }
+
+        if (callback)
+        {
+            callback(key, hit, user_data);
+        }
+    }
+
+    // Look up the binary, compile it with compile() and store on miss
+    template <typename F>
+    static Calc::Executable* CompileCached(Calc::Device* device, std::vector<char> const& source, char const* options, F const& compile)
+    {
+        std::string directory;
+        {
+            std::lock_guard<std::mutex> lock(s_kernel_cache_mutex);
+            directory = s_kernel_cache_directory;
+        }
+
+        if (directory.empty())
+        {
+            return compile();
+        }
+
+        auto const key = CalculateKey(device, source, options);
+        auto const filename = directory + "/" + key + ".bin";
+
+        std::vector<char> binary;
+        if (ReadFile(filename, binary) && !binary.empty())
+        {
+            Calc::Executable* executable = nullptr;
+
+            try
+            {
+                executable = device->CompileExecutable(reinterpret_cast<std::uint8_t const*>(binary.data()), binary.size(), options);
+            }
+            catch (Calc::Exception&)
+            {
+                // Driver has been updated or the file is broken, recompile
+                executable = nullptr;
+            }
+
+            if (executable)
+            {
+                Report(key.c_str(), true);
+                return executable;
+            }
+        }
+
+        auto executable = compile();
+        Report(key.c_str(), false);
+
+        auto const size = device->GetExecutableBinarySize(executable);
+        if (size == 0)
+        {
+            // Device can't provide binaries
+            return executable;
+        }
+
+        std::vector<std::uint8_t> data(size);
+        device->GetExecutableBinary(executable, data.data());
+
+        // Several processes may share the cache, write to unique file
+        // first and then move it in place, so readers never see partial data
+        std::random_device rd;
+        std::ostringstream tmpname;
+        tmpname << filename << "." << std::hex << rd() << rd() << ".tmp";
+
+        {
+            std::ofstream out(tmpname.str(), std::ios::out | std::ios::binary);
+            out.write(reinterpret_cast<char const*>(data.data()), data.size());
+            if (!out)
+            {
+                out.close();
+                std::remove(tmpname.str().c_str());
+                return executable;
+            }
+        }
+
+        if (std::rename(tmpname.str().c_str(), filename.c_str()) != 0)
+        {
+            // Another process might have won the race
+            std::remove(tmpname.str().c_str());
+        }
+
+        return executable;
+    }
+
+    void KernelCache::SetDirectory(char const* directory)
+    {
+        std::lock_guard<std::mutex> lock(s_kernel_cache_mutex);
+        s_kernel_cache_directory = directory ? directory : "";
+    }
+
+    void KernelCache::SetCallback(KernelCacheCallback callback, void* user_data)
+    {
+        std::lock_guard<std::mutex> lock(s_kernel_cache_mutex);
+        s_kernel_cache_callback = callback;
+        s_kernel_cache_user_data = user_data;
+    }
+
+    Calc::Executable* KernelCache::CompileExecutable(Calc::Device* device, char const* source_code, std::size_t size, char const* options)
+    {
+        std::vector<char> source(source_code, source_code + size);
+
+        return CompileCached(device, source, options, [&]()
+        {
+            return device->CompileExecutable(source_code, size, options);
+        });
+    }
+
+    Calc::Executable* KernelCache::CompileExecutable(Calc::Device* device, char const* filename, char const** headernames, int numheaders, char const* options)
+    {
+        auto compile = [&]()
+        {
+            return device->CompileExecutable(filename, headernames, numheaders, options);
+        };
+
+        // Kernel and all its headers make up the key
+        std::vector<char> source;
+        if (!ReadFile(filename, source))
+        {
+            // Let the device report missing file
+            return compile();
+        }
+
+        for (int i = 0; i < numheaders; ++i)
+        {
+            std::vector<char> header;
+            if (!ReadFile(headernames[i], header))
+            {
+                return compile();
+            }
+
+            source.insert(source.end(), header.begin(), header.end());
+        }
+
+        return CompileCached(device, source, options, compile);
+    }
+}
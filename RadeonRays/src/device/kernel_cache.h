@@ -0,0 +1,62 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file kernel_cache.h
+    \version 1.0
+    \brief On-disk cache of compiled kernel binaries.
+
+    Executables are stored in the cache directory under the hash of kernel
+    sources, build options and device spec. Following processes load the
+    binary instead of compiling the sources. Stale or broken binaries are
+    silently recompiled and overwritten.
+ */
+#pragma once
+
+#include "radeon_rays.h"
+
+#include "calc.h"
+#include "device.h"
+#include "executable.h"
+#include "except.h"
+
+#include <cstddef>
+
+namespace RadeonRays
+{
+    ///< Compiles executables through the on-disk binary cache.
+    ///< Cache is disabled until the directory is set, in which case
+    ///< the calls go straight to the device.
+    ///<
+    class KernelCache
+    {
+    public:
+        // Set cache directory, nullptr or empty string disables the cache
+        static void SetDirectory(char const* directory);
+        // Set callback notified about cache hits and misses
+        static void SetCallback(KernelCacheCallback callback, void* user_data);
+
+        // Compile executable from source code
+        static Calc::Executable* CompileExecutable(Calc::Device* device, char const* source_code, std::size_t size, char const* options);
+        // Compile executable from file, headers are hashed into the key along with the file
+        static Calc::Executable* CompileExecutable(Calc::Device* device, char const* filename, char const** headernames, int numheaders, char const* options);
+    };
+}
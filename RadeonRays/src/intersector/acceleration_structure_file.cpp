@@ -0,0 +1,231 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "acceleration_structure_file.h"
+
+#include "../primitive/mesh.h"
+#include "../primitive/instance.h"
+#include "../util/hash.h"
+#include "../world/world.h"
+
+#include "buffer.h"
+#include "device.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace RadeonRays
+{
+    // Bump on any layout change of the file or of the stored sections
+    static std::uint32_t const kAccelerationStructureVersion = 3;
+    static char const kAccelerationStructureMagic[4] = { 'R', 'R', 'A', 'S' };
+    // Section data alignment
+    static std::uint64_t const kSectionAlignment = 16;
+
+    struct FileHeader
+    {
+        char magic[4];
+        std::uint32_t version;
+        // Intersector type, zero terminated
+        char type[16];
+        std::uint64_t scene_hash;
+        std::uint32_t num_sections;
+        std::uint32_t padding;
+    };
+
+    struct SectionEntry
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    static std::uint64_t Align(std::uint64_t value)
+    {
+        return (value + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+    }
+
+    static void HashMesh(Hash& hash, Mesh const* mesh)
+    {
+        hash.AppendValue(mesh->num_vertices());
+        hash.AppendValue(mesh->num_faces());
+
+        float3 const* vertices = mesh->GetVertexData();
+        for (int i = 0; i < mesh->num_vertices(); ++i)
+        {
+            // w is not used by the geometry
+            hash.Append(&vertices[i].x, 3 * sizeof(float));
+        }
+
+        Mesh::Face const* faces = mesh->GetFaceData();
+        for (int i = 0; i < mesh->num_faces(); ++i)
+        {
+            hash.Append(faces[i].idx, 3 * sizeof(int));
+        }
+    }
+
+    std::uint64_t CalculateSceneHash(World const& world)
+    {
+        Hash hash;
+        hash.AppendValue(world.shapes_.size());
+
+        for (auto shape : world.shapes_)
+        {
+            auto shapeimpl = static_cast<ShapeImpl const*>(shape);
+
+            matrix m, minv;
+            shapeimpl->GetTransform(m, minv);
+            float3 const linear = shapeimpl->GetLinearVelocity();
+            quaternion const angular = shapeimpl->GetAngularVelocity();
+
+            hash.AppendValue(shapeimpl->GetId());
+            hash.AppendValue(shapeimpl->is_instance());
+            hash.Append(m.m, sizeof(m.m));
+            hash.Append(&linear.x, 3 * sizeof(float));
+            hash.Append(&angular.x, 4 * sizeof(float));
+
+            if (shapeimpl->is_instance())
+            {
+                // Base shape might be missing in the world
+                auto base = static_cast<Instance const*>(shapeimpl)->GetBaseShape();
+                hash.AppendValue(base->GetId());
+                HashMesh(hash, static_cast<Mesh const*>(base));
+            }
+            else
+            {
+                HashMesh(hash, static_cast<Mesh const*>(shapeimpl));
+            }
+        }
+
+        return hash.GetValue();
+    }
+
+    AccelerationStructureWriter::AccelerationStructureWriter(char const* type, std::uint64_t scene_hash)
+        : m_type(type)
+        , m_scene_hash(scene_hash)
+    {
+        ThrowIf(m_type.size() >= sizeof(FileHeader::type), "Intersector type name is too long");
+    }
+
+    void AccelerationStructureWriter::AddSection(void const* data, std::size_t size)
+    {
+        auto bytes = static_cast<char const*>(data);
+        m_sections.emplace_back(bytes, bytes + size);
+    }
+
+    void AccelerationStructureWriter::AddSection(Calc::Device* device, Calc::Buffer const* buffer)
+    {
+        std::vector<char> data(buffer->GetSize());
+        device->ReadBuffer(buffer, 0, 0, data.size(), data.data(), nullptr);
+        device->Finish(0);
+        m_sections.push_back(std::move(data));
+    }
+
+    void AccelerationStructureWriter::Write(char const* filename) const
+    {
+        FileHeader header = {};
+        std::copy(kAccelerationStructureMagic, kAccelerationStructureMagic + 4, header.magic);
+        header.version = kAccelerationStructureVersion;
+        std::copy(m_type.cbegin(), m_type.cend(), header.type);
+        header.scene_hash = m_scene_hash;
+        header.num_sections = static_cast<std::uint32_t>(m_sections.size());
+
+        // Lay out sections after the table
+        std::vector<SectionEntry> table(m_sections.size());
+        std::uint64_t offset = Align(sizeof(FileHeader) + table.size() * sizeof(SectionEntry));
+        for (std::size_t i = 0; i < m_sections.size(); ++i)
+        {
+            table[i].offset = offset;
+            table[i].size = m_sections[i].size();
+            offset = Align(offset + table[i].size);
+        }
+
+        std::vector<char> data(offset, 0);
+        std::memcpy(&data[0], &header, sizeof(FileHeader));
+        if (!table.empty())
+        {
+            std::memcpy(&data[sizeof(FileHeader)], table.data(), table.size() * sizeof(SectionEntry));
+        }
+
+        for (std::size_t i = 0; i < m_sections.size(); ++i)
+        {
+            std::copy(m_sections[i].cbegin(), m_sections[i].cend(), data.begin() + table[i].offset);
+        }
+
+        std::ofstream out(filename, std::ios::out | std::ios::binary);
+        ThrowIf(!out, std::string("Can't open file for writing: ") + filename);
+
+        out.write(data.data(), data.size());
+        ThrowIf(!out, std::string("Failed to write file: ") + filename);
+    }
+
+    AccelerationStructureReader::AccelerationStructureReader(char const* filename)
+        : m_scene_hash(0)
+    {
+        std::ifstream in(filename, std::ios::in | std::ios::binary);
+        ThrowIf(!in, std::string("Can't open file: ") + filename);
+
+        m_data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        FileHeader header;
+        ThrowIf(m_data.size() < sizeof(FileHeader), "Acceleration structure file is corrupted");
+        std::memcpy(&header, m_data.data(), sizeof(FileHeader));
+
+        ThrowIf(!std::equal(kAccelerationStructureMagic, kAccelerationStructureMagic + 4, header.magic), "Not an acceleration structure file");
+        ThrowIf(header.version != kAccelerationStructureVersion, "Unsupported acceleration structure file version");
+
+        header.type[sizeof(header.type) - 1] = 0;
+        m_type = header.type;
+        m_scene_hash = header.scene_hash;
+
+        std::uint64_t const table_end = sizeof(FileHeader) + (std::uint64_t)header.num_sections * sizeof(SectionEntry);
+        ThrowIf(m_data.size() < table_end, "Acceleration structure file is corrupted");
+
+        m_sections.resize(header.num_sections);
+        for (std::uint32_t i = 0; i < header.num_sections; ++i)
+        {
+            SectionEntry entry;
+            std::memcpy(&entry, &m_data[sizeof(FileHeader) + i * sizeof(SectionEntry)], sizeof(SectionEntry));
+            ThrowIf(entry.offset > m_data.size() || entry.size > m_data.size() - entry.offset, "Acceleration structure file is corrupted");
+            m_sections[i] = std::make_pair(entry.offset, entry.size);
+        }
+    }
+
+    void AccelerationStructureReader::GetSection(std::size_t idx, void const** data, std::size_t* size) const
+    {
+        ThrowIf(idx >= m_sections.size(), "Acceleration structure file is missing data");
+
+        *data = m_data.data() + m_sections[idx].first;
+        *size = static_cast<std::size_t>(m_sections[idx].second);
+    }
+
+    Calc::Buffer* AccelerationStructureReader::CreateBuffer(Calc::Device* device, std::size_t idx) const
+    {
+        void const* data = nullptr;
+        std::size_t size = 0;
+        GetSection(idx, &data, &size);
+
+        ThrowIf(size == 0, "Acceleration structure file is corrupted");
+
+        return device->CreateBuffer(size, Calc::BufferType::kRead, const_cast<void*>(data));
+    }
+}
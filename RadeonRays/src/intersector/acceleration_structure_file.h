@@ -0,0 +1,142 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file acceleration_structure_file.h
+    \version 1.0
+    \brief Versioned on-disk storage for built acceleration structures.
+
+    File starts with a fixed size header followed by a section table and section
+    data. Each section is a raw array exactly as it is uploaded to the device
+    and starts at 16 bytes aligned offset, so the file can be memory mapped
+    and sections consumed in place.
+
+        Header      | magic, version, intersector type, scene hash, section count
+        Table       | (offset, size) per section
+        Section 0   | aligned raw data
+        ...
+
+    Scene hash covers all geometry, transforms and shape IDs of the world.
+    Build options are not part of the hash: structure built with different
+    options is still valid for the same geometry.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../except/except.h"
+
+namespace Calc
+{
+    class Buffer;
+    class Device;
+}
+
+namespace RadeonRays
+{
+    class World;
+
+    ///< Calculate hash identifying the geometry of the world.
+    ///<
+    std::uint64_t CalculateSceneHash(World const& world);
+
+    ///< Collects sections of acceleration structure and writes them into a file.
+    ///<
+    class AccelerationStructureWriter
+    {
+    public:
+        // type identifies intersector which is able to load the file
+        AccelerationStructureWriter(char const* type, std::uint64_t scene_hash);
+
+        // Add section with raw data
+        void AddSection(void const* data, std::size_t size);
+
+        // Add section with array of trivially copyable elements
+        template <typename T>
+        void AddSection(std::vector<T> const& data)
+        {
+            AddSection(data.data(), data.size() * sizeof(T));
+        }
+
+        // Add section with the whole contents of device buffer
+        void AddSection(Calc::Device* device, Calc::Buffer const* buffer);
+
+        // Write the file, throws on IO errors
+        void Write(char const* filename) const;
+
+    private:
+        std::string m_type;
+        std::uint64_t m_scene_hash;
+        std::vector<std::vector<char>> m_sections;
+    };
+
+    ///< Reads acceleration structure file written by AccelerationStructureWriter.
+    ///<
+    class AccelerationStructureReader
+    {
+    public:
+        // Read the file, throws if it is missing, truncated or has unsupported version
+        AccelerationStructureReader(char const* filename);
+
+        // Intersector type stored in the file
+        std::string const& GetType() const { return m_type; }
+        // Hash of the world the structure was built for
+        std::uint64_t GetSceneHash() const { return m_scene_hash; }
+        // Number of sections
+        std::size_t GetNumSections() const { return m_sections.size(); }
+
+        // Get raw section data
+        void GetSection(std::size_t idx, void const** data, std::size_t* size) const;
+
+        // Create read only device buffer holding section data
+        Calc::Buffer* CreateBuffer(Calc::Device* device, std::size_t idx) const;
+
+        // Get section as array of trivially copyable elements
+        template <typename T>
+        void GetSection(std::size_t idx, std::vector<T>& data) const
+        {
+            void const* ptr = nullptr;
+            std::size_t size = 0;
+            GetSection(idx, &ptr, &size);
+
+            ThrowIf(size % sizeof(T) != 0, "Acceleration structure file is corrupted");
+
+            data.resize(size / sizeof(T));
+            if (size > 0)
+            {
+                std::copy(static_cast<char const*>(ptr), static_cast<char const*>(ptr) + size, reinterpret_cast<char*>(data.data()));
+            }
+        }
+
+    private:
+        std::string m_type;
+        std::uint64_t m_scene_hash;
+        // File contents
+        std::vector<char> m_data;
+        // Offset and size of each section in m_data
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> m_sections;
+    };
+}
@@ -0,0 +1,75 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file geometry_upload.h
+    \version 1.0
+    \brief Parallel traversal of concatenated shape geometry.
+
+    Intersectors lay out vertices and faces of all shapes back to back using
+    prefix sums of per shape counts. Work over such arrays is split into equal
+    chunks of elements rather than shapes, so scenes made of many small meshes
+    balance as well as a few big ones. A chunk crossing shape boundaries is
+    handed to the callback as one range per shape, which lets the callback
+    fetch per shape state (transform, mesh pointers) once per range.
+ */
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "../async/task_scheduler.h"
+
+namespace RadeonRays
+{
+    // Number of vertices or faces processed by a single task
+    static int const kUploadGrainSize = 16384;
+
+    // Call f(shapeidx, begin, end) in parallel for all elements of [0, count),
+    // start_idx holds the first element of each shape, [begin, end) are shape local
+    template <typename F>
+    inline void ForEachShapeRange(std::vector<int> const& start_idx, int count, F const& f)
+    {
+        if (start_idx.empty())
+        {
+            return;
+        }
+
+        task_scheduler::instance().parallel_for(0, count, kUploadGrainSize, [&](int begin, int end)
+        {
+            // Last shape starting at or before the chunk
+            int shapeidx = static_cast<int>(std::upper_bound(start_idx.cbegin(), start_idx.cend(), begin) - start_idx.cbegin()) - 1;
+            int const numshapes = static_cast<int>(start_idx.size());
+
+            for (int first = begin; first < end; ++shapeidx)
+            {
+                int const shapeend = shapeidx + 1 < numshapes ? start_idx[shapeidx + 1] : count;
+                int const last = std::min(end, shapeend);
+
+                if (last > first)
+                {
+                    f(shapeidx, first - start_idx[shapeidx], last - start_idx[shapeidx]);
+                    first = last;
+                }
+            }
+        });
+    }
+}
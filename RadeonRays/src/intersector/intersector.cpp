@@ -1,25 +1,170 @@
 #include "intersector.h"
+#include "acceleration_structure_file.h"
 #include "device.h"
+#include "../except/except.h"
+#include "../world/world.h"
+
+#include <algorithm>
+#include <limits>
 
 namespace RadeonRays
 {
+    // Work group size of 2D kernels
+    static std::uint64_t const kTileGranularity = 64;
+
     Intersector::Intersector(Calc::Device *device)
-        : m_device(device),
-        m_counter(device->CreateBuffer(sizeof(int), Calc::BufferType::kRead),
-                  [device](Calc::Buffer* buffer) { device->DeleteBuffer(buffer); }),
-        m_counter2(device->CreateBuffer(sizeof(int), Calc::BufferType::kRead),
-              [device](Calc::Buffer* buffer) { device->DeleteBuffer(buffer); }),
-        m_counter3(device->CreateBuffer(sizeof(int), Calc::BufferType::kRead),
-               [device](Calc::Buffer* buffer) { device->DeleteBuffer(buffer); })
+        : m_device(device)
+        , m_rays_per_dispatch(0)
+    {
+    }
+
+    Intersector::~Intersector()
+    {
+        // Host values must not go away while uploads are still pending
+        for (auto& ring : m_counters)
+        {
+            for (auto& slot : ring.second.slots)
+            {
+                if (slot.upload_event)
+                {
+                    m_device->WaitForEvent(slot.upload_event);
+                    m_device->DeleteEvent(slot.upload_event);
+                }
+            }
+        }
+    }
+
+    Intersector::CounterSlot& Intersector::UploadCounters(std::uint32_t queue_idx, std::uint32_t const* values, std::size_t num_values) const
+    {
+        auto& ring = m_counters[queue_idx];
 
+        if (ring.slots.empty())
+        {
+            auto device = m_device;
+            ring.slots.resize(kNumCounterSlots);
+
+            for (auto& slot : ring.slots)
+            {
+                for (auto& buffer : slot.buffers)
+                {
+                    buffer = BufferPtr(device->CreateBuffer(sizeof(std::uint32_t), Calc::BufferType::kRead),
+                        [device](Calc::Buffer* buffer) { device->DeleteBuffer(buffer); });
+                }
+            }
+        }
+
+        auto& slot = ring.slots[ring.next];
+        ring.next = (ring.next + 1) % ring.slots.size();
+
+        // The upload has been issued kNumCounterSlots submissions ago,
+        // so this wait almost never blocks
+        if (slot.upload_event)
+        {
+            m_device->WaitForEvent(slot.upload_event);
+            m_device->DeleteEvent(slot.upload_event);
+            slot.upload_event = nullptr;
+        }
+
+        for (auto i = 0U; i < num_values; ++i)
+        {
+            slot.values[i] = values[i];
+        }
+
+        // Upload on the query queue, so the kernel sees the values without
+        // host synchronization. Only the last upload needs tracking.
+        for (auto i = 0U; i < num_values; ++i)
+        {
+            auto last = (i + 1 == num_values);
+            m_device->WriteBuffer(slot.buffers[i].get(), queue_idx, 0, sizeof(std::uint32_t), &slot.values[i],
+                last ? &slot.upload_event : nullptr);
+        }
+
+        return slot;
+    }
+
+    void Intersector::WaitForDependency(Calc::Event const* wait_event) const
     {
+        // Calc executions can't take wait lists, so pending
+        // dependency has to be resolved on the host
+        if (wait_event && !wait_event->IsComplete())
+        {
+            m_device->WaitForEvent(const_cast<Calc::Event*>(wait_event));
+        }
+    }
+
+    void Intersector::UpdateDispatchOptions(World const& world)
+    {
+        auto rays_per_dispatch = world.options_.GetOption("bvh.2d.rays_per_dispatch");
+        m_rays_per_dispatch = rays_per_dispatch ? static_cast<std::uint32_t>(std::max(rays_per_dispatch->AsFloat(), 0.f)) : 0;
+    }
+
+    std::uint32_t Intersector::GetRaysPerDispatch() const
+    {
+        // Requested tile size is still capped by the limits of the intersector
+        std::uint64_t const max_rays = GetMaxRaysPerDispatch();
+        std::uint64_t const rays = m_rays_per_dispatch ? std::min<std::uint64_t>(m_rays_per_dispatch, max_rays) : max_rays;
+
+        // Kernels round dispatches up to work group size, so tiles are kept
+        // multiple of it for padding work items not to overlap the next tile
+        return static_cast<std::uint32_t>(std::max<std::uint64_t>(rays / kTileGranularity, 1) * kTileGranularity);
+    }
+
+    std::uint64_t Intersector::GetMaxRaysPerDispatch() const
+    {
+        // Keep global sizes well within 32-bit range and per ray scratch
+        // (two floats for deterministic sums) within a single allocation
+        Calc::DeviceSpec spec;
+        m_device->GetSpec(spec);
+        return std::min<std::uint64_t>(1u << 24, spec.max_alloc_size / (2 * sizeof(float)));
+    }
+
+    std::uint32_t Intersector::GetNumSumLinearOutputs(std::uint32_t num_origins, std::uint32_t num_directions, std::uint32_t directions_stride)
+    {
+        // Kernels address two floats per output with 32-bit signed indices
+        std::uint64_t const num_outputs = static_cast<std::uint64_t>(num_origins) * std::min(directions_stride, num_directions);
+        ThrowIf(num_outputs > static_cast<std::uint64_t>(std::numeric_limits<std::int32_t>::max() / 2),
+            "Number of sum-linear outputs exceeds 32-bit buffer indexing");
+        return static_cast<std::uint32_t>(num_outputs);
+    }
+
+    std::uint32_t Intersector::GetNumCellStringBatches(std::uint32_t num_cell_strings, std::uint32_t num_directions)
+    {
+        // Kernels map (cell string, direction) batches from 32-bit signed group and work item ids
+        std::uint64_t const num_ray_batches = static_cast<std::uint64_t>(num_cell_strings) * num_directions;
+        ThrowIf(num_ray_batches > static_cast<std::uint64_t>(std::numeric_limits<std::int32_t>::max()),
+            "Number of cell-string batches exceeds 32-bit kernel indexing");
+        return static_cast<std::uint32_t>(num_ray_batches);
     }
 
     void Intersector::SetWorld(World const &world)
     {
+        UpdateDispatchOptions(world);
         Process(world);
     }
 
+    void Intersector::SaveAccelerationStructure(World const& world, char const* filename) const
+    {
+        auto type = GetAccelerationStructureType();
+        ThrowIf(type == nullptr, "Intersector does not support acceleration structure serialization");
+
+        AccelerationStructureWriter writer(type, CalculateSceneHash(world));
+        Save(world, writer);
+        writer.Write(filename);
+    }
+
+    void Intersector::LoadAccelerationStructure(World const& world, char const* filename)
+    {
+        auto type = GetAccelerationStructureType();
+        ThrowIf(type == nullptr, "Intersector does not support acceleration structure serialization");
+
+        AccelerationStructureReader reader(filename);
+        ThrowIf(reader.GetType() != type, "Acceleration structure has been built by a different intersector");
+        ThrowIf(reader.GetSceneHash() != CalculateSceneHash(world), "Acceleration structure has been built for a different scene");
+
+        UpdateDispatchOptions(world);
+        Load(world, reader);
+    }
+
     bool Intersector::IsCompatible(World const& world) const
     {
         return IsCompatibleImpl(world);
@@ -33,30 +178,45 @@ namespace RadeonRays
     void Intersector::QueryIntersection(std::uint32_t queue_idx, Calc::Buffer const *rays, std::uint32_t num_rays,
         Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
     {
-        m_device->WriteBuffer(m_counter.get(), 0, 0, sizeof(num_rays), &num_rays, nullptr);
-        m_device->Finish(0);
-        Intersect(queue_idx, rays, m_counter.get(), num_rays, hits, wait_event, event);
+        WaitForDependency(wait_event);
+        auto& counters = UploadCounters(queue_idx, &num_rays, 1);
+        Intersect(queue_idx, rays, counters.buffers[0].get(), num_rays, hits, nullptr, event);
     }
 
     void Intersector::QueryOcclusion(std::uint32_t queue_idx, Calc::Buffer const *rays, std::uint32_t num_rays,
         Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
     {
-        m_device->WriteBuffer(m_counter.get(), 0, 0, sizeof(num_rays), &num_rays, nullptr);
-        m_device->Finish(0);
-        Occluded(queue_idx, rays, m_counter.get(), num_rays, hits, wait_event, event);
+        WaitForDependency(wait_event);
+        auto& counters = UploadCounters(queue_idx, &num_rays, 1);
+        Occluded(queue_idx, rays, counters.buffers[0].get(), num_rays, hits, nullptr, event);
     }
 
     void Intersector::QueryOccluded2dSumLinear2(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs, Calc::Buffer const *offset_directions,
                                                 Calc::Buffer const *offset_koefs, std::uint32_t num_origins, std::uint32_t num_directions, std::uint32_t directions_stride,
                                                 Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
     {
-        m_device->WriteBuffer(m_counter.get(), 0, 0, sizeof(num_origins), &num_origins, nullptr);
-        m_device->WriteBuffer(m_counter2.get(), 0, 0, sizeof(num_directions), &num_directions, nullptr);
-        m_device->WriteBuffer(m_counter3.get(), 0, 0, sizeof(directions_stride), &directions_stride, nullptr);
-        m_device->Finish(0);
+        WaitForDependency(wait_event);
+        std::uint32_t const values[] = { num_origins, num_directions, directions_stride };
+        auto& counters = UploadCounters(queue_idx, values, 3);
+
+        // Ray space might not fit 32 bits, dispatch it in tiles,
+        // in-order queue serializes them and only the last one signals the event
+        std::uint64_t const num_rays = static_cast<std::uint64_t>(num_origins) * num_directions;
+        std::uint32_t const num_outputs = GetNumSumLinearOutputs(num_origins, num_directions, directions_stride);
+        std::uint64_t const tile_size = GetRaysPerDispatch();
+
+        std::uint64_t ray_offset = 0;
+        do
+        {
+            auto const tile_rays = static_cast<std::uint32_t>(std::min(tile_size, num_rays - ray_offset));
+            auto const last = ray_offset + tile_rays >= num_rays;
 
-        int num_rays = num_origins * num_directions;
-        Occluded2dSumLinear2(queue_idx, origins, directions, koefs, offset_directions, offset_koefs, m_counter.get(), m_counter2.get(), m_counter3.get(), num_rays, hits, wait_event, event);
+            Occluded2dSumLinear2(queue_idx, origins, directions, koefs, offset_directions, offset_koefs,
+                counters.buffers[0].get(), counters.buffers[1].get(), counters.buffers[2].get(),
+                ray_offset, tile_rays, num_outputs, hits, nullptr, last ? event : nullptr);
+
+            ray_offset += tile_rays;
+        } while (ray_offset < num_rays);
     }
 
     void Intersector::QueryOccluded2dCellString(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
@@ -64,24 +224,113 @@ namespace RadeonRays
                                                 std::uint32_t num_cell_strings, Calc::Buffer *hits,
                                                 Calc::Event const *wait_event, Calc::Event **event) const
     {
-        m_device->WriteBuffer(m_counter.get(), 0, 0, sizeof(num_origins), &num_origins, nullptr);
-        m_device->WriteBuffer(m_counter2.get(), 0, 0, sizeof(num_directions), &num_directions, nullptr);
-        m_device->WriteBuffer(m_counter3.get(), 0, 0, sizeof(num_cell_strings), &num_cell_strings, nullptr);
-        m_device->Finish(0);
+        WaitForDependency(wait_event);
+        std::uint32_t const values[] = { num_origins, num_directions, num_cell_strings };
+        auto& counters = UploadCounters(queue_idx, values, 3);
+
+        std::uint32_t const num_ray_batches = GetNumCellStringBatches(num_cell_strings, num_directions);
+        Occluded2dCellString(queue_idx, origins, directions, counters.buffers[0].get(), counters.buffers[1].get(),
+            cell_string_inds, counters.buffers[2].get(), num_ray_batches, num_origins, num_directions, num_cell_strings,
+            hits, nullptr, event);
+    }
+
+    void Intersector::QueryOccluded2dCellStringCount(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+                                                     std::uint32_t num_origins, std::uint32_t num_directions, Calc::Buffer const *cell_string_inds,
+                                                     std::uint32_t num_cell_strings, Calc::Buffer *counts, Calc::Buffer *point_masks,
+                                                     Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        WaitForDependency(wait_event);
+        std::uint32_t const values[] = { num_origins, num_directions, num_cell_strings };
+        auto& counters = UploadCounters(queue_idx, values, 3);
 
-        int num_ray_batches = num_cell_strings * num_directions;
-        Occluded2dCellString(queue_idx, origins, directions, m_counter.get(), m_counter2.get(), cell_string_inds, m_counter3.get(), num_ray_batches, hits, wait_event, event);
+        // Point bits are addressed as direction * num_origins + point, one bit per pair
+        std::uint64_t const num_mask_words = (static_cast<std::uint64_t>(num_origins) * num_directions + 31) / 32;
+        ThrowIf(point_masks && point_masks->GetSize() / sizeof(std::uint32_t) < num_mask_words,
+            "Point mask buffer is too small for the number of origins and directions");
+
+        std::uint32_t const num_ray_batches = GetNumCellStringBatches(num_cell_strings, num_directions);
+        Occluded2dCellStringCount(queue_idx, origins, directions, counters.buffers[0].get(), counters.buffers[1].get(),
+            cell_string_inds, counters.buffers[2].get(), num_ray_batches, counts, point_masks, nullptr, event);
+    }
+
+    void Intersector::QueryOccluded2dSumLinearSky(std::uint32_t queue_idx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                                  Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs, std::uint32_t num_origins,
+                                                  std::uint32_t directions_stride, Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        WaitForDependency(wait_event);
+        std::uint32_t const num_directions = sky.GetNumPatches();
+        std::uint32_t const values[] = { num_origins, num_directions, directions_stride };
+        auto& counters = UploadCounters(queue_idx, values, 3);
+
+        // Same tiling as for explicit directions
+        std::uint64_t const num_rays = static_cast<std::uint64_t>(num_origins) * num_directions;
+        std::uint32_t const num_outputs = GetNumSumLinearOutputs(num_origins, num_directions, directions_stride);
+        std::uint64_t const tile_size = GetRaysPerDispatch();
+
+        std::uint64_t ray_offset = 0;
+        do
+        {
+            auto const tile_rays = static_cast<std::uint32_t>(std::min(tile_size, num_rays - ray_offset));
+            auto const last = ray_offset + tile_rays >= num_rays;
+
+            Occluded2dSumLinearSky(queue_idx, origins, sky, frames, koefs, offset_koefs,
+                counters.buffers[0].get(), counters.buffers[1].get(), counters.buffers[2].get(),
+                ray_offset, tile_rays, num_outputs, hits, nullptr, last ? event : nullptr);
+
+            ray_offset += tile_rays;
+        } while (ray_offset < num_rays);
+    }
+
+    void Intersector::Occluded2dSumLinear2(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
+                                           Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
+                                           Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                           Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                           std::uint32_t num_outputs, Calc::Buffer *hits,
+                                           Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        Throw("QueryOccluded2dSumLinear2 is not supported by the intersector");
+    }
+
+    void Intersector::Occluded2dSumLinearSky(std::uint32_t queueidx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                             Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+                                             Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                             Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                             std::uint32_t num_outputs, Calc::Buffer *hits,
+                                             Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        Throw("QueryOccluded2dSumLinearSky is not supported by the intersector");
+    }
+
+    void Intersector::Occluded2dCellString(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+                                           Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                           Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+                                           std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+                                           std::uint32_t cell_strings_count, Calc::Buffer *hits,
+                                           Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        Throw("QueryOccluded2dCellString is not supported by the intersector");
+    }
+
+    void Intersector::Occluded2dCellStringCount(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+                                                Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                                Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+                                                std::uint32_t max_ray_batches, Calc::Buffer *counts, Calc::Buffer *point_masks,
+                                                Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        Throw("QueryOccluded2dCellStringCount is not supported by the intersector");
     }
 
     void Intersector::QueryIntersection(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays,
         std::uint32_t max_rays, Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
     {
-        Intersect(queue_idx, rays, num_rays, max_rays, hits, wait_event, event);
+        WaitForDependency(wait_event);
+        Intersect(queue_idx, rays, num_rays, max_rays, hits, nullptr, event);
     }
 
     void Intersector::QueryOcclusion(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays,
         std::uint32_t max_rays, Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const
     {
-        Occluded(queue_idx, rays, num_rays, max_rays, hits, wait_event, event);
+        WaitForDependency(wait_event);
+        Occluded(queue_idx, rays, num_rays, max_rays, hits, nullptr, event);
     }
 }
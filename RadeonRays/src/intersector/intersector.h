@@ -32,12 +32,18 @@ THE SOFTWARE.
 #include "buffer.h"
 #include "event.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
+#include <vector>
 
 namespace RadeonRays
 {
     class World;
+    class AccelerationStructureWriter;
+    class AccelerationStructureReader;
 
     /** 
     \brief Intersector interface
@@ -55,7 +61,7 @@ namespace RadeonRays
         // which is going to be used by an intersector.
         Intersector(Calc::Device* device);
         // Destructor.
-        virtual ~Intersector() = default;
+        virtual ~Intersector();
 
         /** 
         \brief Check if the intersector is compatible with a given world.
@@ -112,6 +118,18 @@ namespace RadeonRays
                                        std::uint32_t num_cell_strings, Calc::Buffer *hits,
                                        Calc::Event const *wait_event, Calc::Event **event) const;
 
+        // Same as QueryOccluded2dCellString counting occluded points, point_masks might be nullptr
+        void QueryOccluded2dCellStringCount(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+                                            std::uint32_t num_origins, std::uint32_t num_directions, Calc::Buffer const *cell_string_inds,
+                                            std::uint32_t num_cell_strings, Calc::Buffer *counts, Calc::Buffer *point_masks,
+                                            Calc::Event const *wait_event, Calc::Event **event) const;
+
+        // Same as QueryOccluded2dSumLinear2 with sky.GetNumPatches() directions generated in the kernel,
+        // frames might be nullptr
+        void QueryOccluded2dSumLinearSky(std::uint32_t queue_idx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                         Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs, std::uint32_t num_origins,
+                                         std::uint32_t directions_stride, Calc::Buffer *hits, Calc::Event const *wait_event, Calc::Event **event) const;
+
         /** 
         \brief Query intersection for a batch of rays
 
@@ -144,6 +162,21 @@ namespace RadeonRays
         void QueryOcclusion(std::uint32_t queue_idx, Calc::Buffer const* rays, Calc::Buffer const* num_rays,
             std::uint32_t max_rays, Calc::Buffer* hits, Calc::Event const* wait_event, Calc::Event** event) const;
 
+        /**
+        \brief Store acceleration structure built by the last SetWorld call.
+
+        The world should be the same as passed to SetWorld. Throws if serialization is not supported.
+        */
+        void SaveAccelerationStructure(World const& world, char const* filename) const;
+
+        /**
+        \brief Use previously stored acceleration structure instead of building it.
+
+        Replaces SetWorld for the world the structure has been built for. Throws if the data
+        has been written by different intersector or for different world.
+        */
+        void LoadAccelerationStructure(World const& world, char const* filename);
+
         // Disallow intersector copies
         Intersector(Intersector const&) = delete;
         Intersector& operator = (Intersector const&) = delete;
@@ -153,6 +186,11 @@ namespace RadeonRays
         virtual void Process(World const& world) = 0;
         // Compatibility check implemetation
         virtual bool IsCompatibleImpl(World const& world) const;
+        // Acceleration structure type name stored in files, nullptr if serialization is not supported
+        virtual char const* GetAccelerationStructureType() const { return nullptr; }
+        // Acceleration structure serialization implementation
+        virtual void Save(World const& /* world */, AccelerationStructureWriter& /* writer */) const {}
+        virtual void Load(World const& /* world */, AccelerationStructureReader const& /* reader */) {}
         // Intersection implementation
         virtual void Intersect(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays, 
             std::uint32_t max_rays, Calc::Buffer *hits, 
@@ -161,12 +199,22 @@ namespace RadeonRays
         virtual void Occluded(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays, 
             std::uint32_t max_rays, Calc::Buffer *hits, 
             Calc::Event const *wait_event, Calc::Event **event) const = 0;
-        
+        // 2D occlusion implementations, throw unless overridden
+        // Sum-linear queries are dispatched in tiles of origins x directions ray space, a tile covers
+        // max_rays rays starting from ray_offset (64-bit) and num_outputs is origins x stride
         virtual void Occluded2dSumLinear2(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
                                           Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
                                           Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
-                                          Calc::Buffer const *directions_stride, std::uint32_t maxrays, Calc::Buffer *hits,
-                                          Calc::Event const *wait_event, Calc::Event **event) const {}
+                                          Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                          std::uint32_t num_outputs, Calc::Buffer *hits,
+                                          Calc::Event const *wait_event, Calc::Event **event) const;
+
+        virtual void Occluded2dSumLinearSky(std::uint32_t queueidx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                            Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+                                            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                            Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                            std::uint32_t num_outputs, Calc::Buffer *hits,
+                                            Calc::Event const *wait_event, Calc::Event **event) const;
       
 //        virtual void QueryOccluded2dCellString(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
 //                                               std::uint32_t num_origins, std::uint32_t num_directions, Calc::Buffer const *cell_string_inds,
@@ -181,17 +229,76 @@ namespace RadeonRays
                                           Calc::Buffer const *cell_string_inds,
                                           Calc::Buffer const *num_cell_strings,
                                           std::uint32_t max_ray_batches,
+                                          std::uint32_t origins_count,
+                                          std::uint32_t directions_count,
+                                          std::uint32_t cell_strings_count,
                                           Calc::Buffer *hits,
                                           Calc::Event const *wait_event,
-                                          Calc::Event **event) const {}
+                                          Calc::Event **event) const;
+
+        virtual void Occluded2dCellStringCount(std::uint32_t queueidx,
+                                               Calc::Buffer const *origins,
+                                               Calc::Buffer const *directions,
+                                               Calc::Buffer const *num_origins,
+                                               Calc::Buffer const *num_directions,
+                                               Calc::Buffer const *cell_string_inds,
+                                               Calc::Buffer const *num_cell_strings,
+                                               std::uint32_t max_ray_batches,
+                                               Calc::Buffer *counts,
+                                               Calc::Buffer *point_masks,
+                                               Calc::Event const *wait_event,
+                                               Calc::Event **event) const;
 
     protected: 
+        // Largest sum-linear tile the intersector can run, overrides cap it
+        // by their batch or per work item scratch limits
+        virtual std::uint64_t GetMaxRaysPerDispatch() const;
+        // Number of rays in a single tile of a tiled query
+        std::uint32_t GetRaysPerDispatch() const;
+
         // Device to use
         Calc::Device* m_device;
-        // Buffer holding ray count
-        std::unique_ptr<Calc::Buffer, std::function<void(Calc::Buffer*)>> m_counter;
-        std::unique_ptr<Calc::Buffer, std::function<void(Calc::Buffer*)>> m_counter2;
-        std::unique_ptr<Calc::Buffer, std::function<void(Calc::Buffer*)>> m_counter3;
+
+    private:
+        // Number of query sizes a submission might need
+        static std::size_t const kNumCounters = 3;
+        // Number of submissions in flight per queue before a slot gets reused
+        static std::size_t const kNumCounterSlots = 8;
+
+        using BufferPtr = std::unique_ptr<Calc::Buffer, std::function<void(Calc::Buffer*)>>;
+
+        // Query sizes of a single submission. Uploads are not blocking,
+        // so host values have to stay alive until the upload event fires.
+        struct CounterSlot
+        {
+            std::uint32_t values[kNumCounters] = {};
+            BufferPtr buffers[kNumCounters];
+            Calc::Event* upload_event = nullptr;
+        };
+
+        // Slots are used round-robin, in-order queue guarantees the upload
+        // into a reused slot happens after the kernel which has read it.
+        struct CounterRing
+        {
+            std::vector<CounterSlot> slots;
+            std::size_t next = 0;
+        };
+
+        // Upload query sizes into the next slot of the queue ring
+        CounterSlot& UploadCounters(std::uint32_t queue_idx, std::uint32_t const* values, std::size_t num_values) const;
+        // Resolve dependency on user event
+        void WaitForDependency(Calc::Event const* wait_event) const;
+        // Read dispatch options of the world
+        void UpdateDispatchOptions(World const& world);
+        // Number of sum-linear outputs (origins x stride), throws if kernels can't index them
+        static std::uint32_t GetNumSumLinearOutputs(std::uint32_t num_origins, std::uint32_t num_directions, std::uint32_t directions_stride);
+        // Number of (cell string, direction) batches, throws if kernels can't index them
+        static std::uint32_t GetNumCellStringBatches(std::uint32_t num_cell_strings, std::uint32_t num_directions);
+
+        // Counter rings by queue index
+        mutable std::map<std::uint32_t, CounterRing> m_counters;
+        // Rays per sum-linear tile requested by "bvh.2d.rays_per_dispatch", 0 for device default
+        std::uint32_t m_rays_per_dispatch;
     };
 }
 
@@ -26,10 +26,18 @@ THE SOFTWARE.
 #include "../primitive/mesh.h"
 #include "../primitive/instance.h"
 #include "../except/except.h"
+#include "../device/kernel_cache.h"
+#include "acceleration_structure_file.h"
+#include "geometry_upload.h"
+
+#if USE_HOST
+#include "../kernels/CPU/kernels_host.h"
+#endif
 
 #include "device.h"
 #include "executable.h"
 
+#include <algorithm>
 #include <memory>
 #include <set>
 
@@ -82,6 +90,10 @@ namespace RadeonRays
         Calc::Executable* executable;
         Calc::Function* isect_func;
         Calc::Function* occlude_func;
+        // 2D queries, OpenCL and host only
+        Calc::Function* occlude_func2d_sum_linear;
+        Calc::Function* occlude_func2d_cell_string;
+        Calc::Function* occlude_func2d_sum_linear_sky;
 
         GpuData(Calc::Device* d)
             : device(d)
@@ -93,6 +105,9 @@ namespace RadeonRays
             , executable(nullptr)
             , isect_func(nullptr)
             , occlude_func(nullptr)
+            , occlude_func2d_sum_linear(nullptr)
+            , occlude_func2d_cell_string(nullptr)
+            , occlude_func2d_sum_linear_sky(nullptr)
         {
         }
 
@@ -106,6 +121,9 @@ namespace RadeonRays
             {
                 executable->DeleteFunction(isect_func);
                 executable->DeleteFunction(occlude_func);
+                executable->DeleteFunction(occlude_func2d_sum_linear);
+                executable->DeleteFunction(occlude_func2d_cell_string);
+                executable->DeleteFunction(occlude_func2d_sum_linear_sky);
                 device->DeleteExecutable(executable);
             }
         }
@@ -116,9 +134,15 @@ namespace RadeonRays
     {
         std::vector<int> mesh_vertices_start_idx;
         std::vector<int> mesh_faces_start_idx;
+        // Serial numbers of meshes in the order of bottom level data
+        std::vector<std::uint64_t> mesh_serials;
         std::vector<Bvh const*> bvhptrs;
         std::vector<ShapeData> shapedata;
-        std::vector<bbox> bounds;
+
+        // Settings cached BVHs have been built with
+        bool use_sah = false;
+        float traversal_cost = 10.f;
+        int num_bins = 64;
 
         PlainBvhTranslator translator;
     };
@@ -141,16 +165,24 @@ namespace RadeonRays
         buildopts.append("-D USE_SAFE_MATH ");
 #endif
 
+#if USE_HOST
+        // Host kernels are always compiled in
+        if (device->GetPlatform() == Calc::Platform::kHost)
+        {
+            m_gpudata->executable = static_cast<Calc::DeviceHost*>(m_device)->CreateExecutable(g_intersect_bvh2level_skiplinks_host, g_intersect_bvh2level_skiplinks_host_size);
+        }
+#endif
+
 #ifndef RR_EMBED_KERNELS
-        if ( device->GetPlatform() == Calc::Platform::kOpenCL )
+        if ( m_gpudata->executable == nullptr && device->GetPlatform() == Calc::Platform::kOpenCL )
         {
             char const* headers[] = { "../RadeonRays/src/kernels/CL/common.cl" };
 
             int numheaders = sizeof(headers) / sizeof(char const*);
 
-            m_gpudata->executable = m_device->CompileExecutable("../RadeonRays/src/kernels/CL/intersect_bvh2level_skiplinks.cl", headers, numheaders, buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_bvh2level_skiplinks.cl", headers, numheaders, buildopts.c_str());
         }
-        else
+        else if ( m_gpudata->executable == nullptr )
         {
             assert( device->GetPlatform() == Calc::Platform::kVulkan );
             m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/GLSL/bvh2l.comp", nullptr, 0, buildopts.c_str());
@@ -158,9 +190,9 @@ namespace RadeonRays
 
 #else
 #if USE_OPENCL
-        if (device->GetPlatform() == Calc::Platform::kOpenCL)
+        if (m_gpudata->executable == nullptr && device->GetPlatform() == Calc::Platform::kOpenCL)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_intersect_bvh2level_skiplinks_opencl, std::strlen(g_intersect_bvh2level_skiplinks_opencl), buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, g_intersect_bvh2level_skiplinks_opencl, std::strlen(g_intersect_bvh2level_skiplinks_opencl), buildopts.c_str());
         }
 #endif
 
@@ -174,492 +206,444 @@ namespace RadeonRays
 
         m_gpudata->isect_func = m_gpudata->executable->CreateFunction("intersect_main");
         m_gpudata->occlude_func = m_gpudata->executable->CreateFunction("occluded_main");
+
+        if (device->GetPlatform() != Calc::Platform::kVulkan)
+        {
+            m_gpudata->occlude_func2d_sum_linear = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear");
+            m_gpudata->occlude_func2d_cell_string = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string");
+            m_gpudata->occlude_func2d_sum_linear_sky = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear_sky");
+        }
     }
 
-    void IntersectorTwoLevel::Process(World const& world)
+    // Collect the shapes with meshes going first, returns the number of meshes.
+    // #22: we need to be able to handle instances whos base shapes are not present 
+    // in the scene, so we have to add them manually here and mark them disabled.
+    static int CollectShapes(World const& world, std::vector<Shape const*>& shapes, std::set<Shape const*>& shapes_disabled)
     {
-        // If something has been changed we need to rebuild BVH
-        int statechange = world.GetStateChange();
-
-        // Full rebuild in case number of objects changes
-        if (m_bvhs.empty() || world.has_changed())
+        for (auto s : world.shapes_)
         {
-            if (!m_bvhs.empty())
+            auto shapeimpl = static_cast<ShapeImpl const*>(s);
+
+            if (shapeimpl->is_instance())
             {
-                m_device->DeleteBuffer(m_gpudata->bvh);
-                m_device->DeleteBuffer(m_gpudata->vertices);
-                m_device->DeleteBuffer(m_gpudata->faces);
-                m_device->DeleteBuffer(m_gpudata->shapes);
-            }
+                // Here we know this is an instance, need to check if its base shape has been added as well
+                auto instance = static_cast<Instance const*>(shapeimpl);
+                auto base_shape = instance->GetBaseShape();
 
+                if (std::find(world.shapes_.cbegin(), world.shapes_.cend(), base_shape) == world.shapes_.cend() &&
+                    shapes_disabled.insert(base_shape).second)
+                {
+                    // Need to add the shape to the list
+                    shapes.push_back(base_shape);
+                }
+            }
 
-            auto builder = world.options_.GetOption("bvh.builder");
-            auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
-            auto nbins = world.options_.GetOption("bvh.sah.num_bins");
+            shapes.push_back(s);
+        }
 
-            bool use_sah = false;
-            float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
-            int num_bins = nbins ? (int)nbins->AsFloat() : 64;
+        // Now partition the range into meshes and instances, keep the order
+        // of meshes so the layout of bottom level data does not depend on instances
+        auto firstinst = std::stable_partition(shapes.begin(), shapes.end(), [&](Shape const* shape)
+        {
+            return !static_cast<ShapeImpl const*>(shape)->is_instance();
+        });
 
+        return (int)std::distance(shapes.begin(), firstinst);
+    }
 
-            if (builder && builder->AsString() == "sah")
-            {
-                use_sah = true;
-            }
+    // Find index of the instance base mesh
+    static int FindBaseMesh(std::vector<Shape const*> const& shapes, int nummeshes, Instance const* instance)
+    {
+        Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
 
-            // Copy the shapes here to be able to partition them and handle more efficiently
-            // #22: we need to be able to handle instances whos base shapes are not present 
-            // in the scene, so we have to add them manually here.
-            std::vector<Shape const*> shapes;
-            std::set<Shape const*> shapes_disabled;
+        // It should be there
+        auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
 
-            for (auto s : world.shapes_)
-            {
-                auto shapeimpl = static_cast<ShapeImpl const*>(s);
+        // TODO: should be assert
+        ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
 
-                if (shapeimpl->is_instance())
-                {
-                    // Here we know this is an instance, need to check if its base shape has been added as well
-                    auto instance = static_cast<Instance const*>(shapeimpl);
-                    auto base_shape = instance->GetBaseShape();
-
-                    if (std::find(world.shapes_.cbegin(), world.shapes_.cend(), base_shape) == world.shapes_.cend())
-                    {
-                        // Need to add the shape to the list
-                        shapes.push_back(base_shape);
-                        // And mark it disabled
-                        shapes_disabled.insert(base_shape);
-                    }
-                }
+        return (int)std::distance(shapes.cbegin(), iter);
+    }
 
-                shapes.push_back(s);
-            }
+    // Write the data into the buffer, buffer is recreated if its size does not match
+    static void UploadBuffer(Calc::Device* device, Calc::Buffer*& buffer, std::size_t size, std::size_t offset, void* data)
+    {
+        if (buffer && buffer->GetSize() == size)
+        {
+            Calc::Event* e = nullptr;
+            device->WriteBuffer(buffer, 0, offset, size - offset, (char*)data + offset, &e);
 
-            // Now partition the range into meshes and instances
-            auto firstinst = std::partition(shapes.begin(), shapes.end(), [&](Shape const* shape)
-            {
-                return !static_cast<ShapeImpl const*>(shape)->is_instance();
-            });
+            e->Wait();
+            device->DeleteEvent(e);
+        }
+        else
+        {
+            device->DeleteBuffer(buffer);
+            buffer = device->CreateBuffer(size, Calc::kRead, data);
+        }
+    }
 
-            // Count the number of meshes
-            int nummeshes = (int)std::distance(shapes.begin(), firstinst);
-            // Count the number of instances
-            int numinstances = (int)std::distance(firstinst, shapes.end());
-
-            int numvertices = 0;
-            int numfaces = 0;
-
-            // This buffer tracks mesh start index for next stage as mesh face indices are relative to 0
-            m_cpudata->mesh_vertices_start_idx.resize(nummeshes);
-            m_cpudata->mesh_faces_start_idx.resize(nummeshes);
-            m_cpudata->bvhptrs.resize(nummeshes + 1);
-            m_cpudata->shapedata.resize(nummeshes + numinstances);
-
-            // [0...numshapes-1] contain bottom level BVHs
-            // [numshapes] is the top level one
-            m_bvhs.resize(nummeshes + 1);
-            // Create actual BVH objects
-            for (int i = 0; i < nummeshes + 1; ++i)
-            {
-                m_bvhs[i] = std::make_unique<Bvh>(traversal_cost, num_bins, use_sah);
-                m_cpudata->bvhptrs[i] = m_bvhs[i].get();
-            }
+    void IntersectorTwoLevel::Process(World const& world)
+    {
+        // If something has been changed we need to rebuild BVH
+        int statechange = world.GetStateChange();
 
-            // Prepare necessary offsets in the arrays
-            // in order to be able to parallelize
-            for (int i = 0; i < nummeshes; ++i)
-            {
-                Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
+        if (m_gpudata->bvh && !world.has_changed() && statechange == ShapeImpl::kStateChangeNone)
+        {
+            return;
+        }
 
-                m_cpudata->mesh_faces_start_idx[i] = numfaces;
-                m_cpudata->mesh_vertices_start_idx[i] = numvertices;
+        auto builder = world.options_.GetOption("bvh.builder");
+        auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
+        auto nbins = world.options_.GetOption("bvh.sah.num_bins");
 
-                numfaces += mesh->num_faces();
-                numvertices += mesh->num_vertices();
-            }
+        bool use_sah = false;
+        float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
+        int num_bins = nbins ? (int)nbins->AsFloat() : 64;
 
-            // We can't avoild allocating it here, since bounds aren't stored anywhere
-            m_cpudata->bounds.resize(numfaces);
 
-            // We are storing individual object bounds here to build top level BVH
-            std::vector<bbox> object_bounds(nummeshes + numinstances);
+        if (builder && builder->AsString() == "sah")
+        {
+            use_sah = true;
+        }
 
-            matrix m, minv;
+        // Cached BVHs are only valid for the settings they have been built with
+        if (use_sah != m_cpudata->use_sah || traversal_cost != m_cpudata->traversal_cost || num_bins != m_cpudata->num_bins)
+        {
+            m_bvhs.clear();
+            m_top_bvh.reset();
+            m_cpudata->use_sah = use_sah;
+            m_cpudata->traversal_cost = traversal_cost;
+            m_cpudata->num_bins = num_bins;
+        }
 
-            // Handle simple shapes
-#pragma omp parallel for
-            for (int i = 0; i < nummeshes; ++i)
-            {
+        // Copy the shapes here to be able to partition them and handle more efficiently
+        std::vector<Shape const*> shapes;
+        std::set<Shape const*> shapes_disabled;
+        int nummeshes = CollectShapes(world, shapes, shapes_disabled);
+        int numinstances = (int)shapes.size() - nummeshes;
 
-                Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
-                // Get transform to apply to object bounds
-                mesh->GetTransform(m, minv);
+        // Bottom level data only depends on the set of meshes. Loaded structure
+        // has no BVHs to refit, so any change needs full rebuild.
+        bool rebuild_geometry = !m_top_bvh || (int)m_cpudata->mesh_serials.size() != nummeshes;
 
-                for (int j = 0; j < mesh->num_faces(); ++j)
-                {
-                    // Request bounds in object space since we build BVHs for objects locally
-                    mesh->GetFaceBounds(j, true, m_cpudata->bounds[m_cpudata->mesh_faces_start_idx[i] + j]);
-                }
+        for (int i = 0; i < nummeshes && !rebuild_geometry; ++i)
+        {
+            rebuild_geometry = static_cast<Mesh const*>(shapes[i])->serial() != m_cpudata->mesh_serials[i];
+        }
 
-                // Build BVH for current mesh
-                m_bvhs[i]->Build(&m_cpudata->bounds[m_cpudata->mesh_faces_start_idx[i]], mesh->num_faces());
+        if (rebuild_geometry)
+        {
+            BuildBottomLevel(shapes, nummeshes);
+        }
 
-                // Extract and store bounds. Note they are in object space and we need to translate them to world space
-                object_bounds[i] = transform_bbox(m_bvhs[i]->Bounds(), m);
+        // IDs are only stored in shape data, so the top level stays intact if nothing else has changed
+        bool const rebuild_top_level = rebuild_geometry || world.has_changed() ||
+            (statechange & ~ShapeImpl::kStateChangeId) != ShapeImpl::kStateChangeNone;
 
-                // Collect BVH pointers for toip level build
-                m_cpudata->bvhptrs[i] = m_bvhs[i].get();
-            }
+        auto& translator = m_cpudata->translator;
+        if (rebuild_top_level)
+        {
+            // We are storing individual object bounds here to build top level BVH
+            std::vector<bbox> object_bounds(nummeshes + numinstances);
 
-            // Handle instances
 #pragma omp parallel for
-            for (int i = nummeshes; i < nummeshes + numinstances; ++i)
+            for (int i = 0; i < nummeshes + numinstances; ++i)
             {
-
-                Instance const* instance = static_cast<Instance const*>(shapes[i]);
+                ShapeImpl const* shapeimpl = static_cast<ShapeImpl const*>(shapes[i]);
                 // Get transform to apply to object bounds
-                instance->GetTransform(m, minv);
-
-                // Find BVH for the instance
-                Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
-
-                // It should be there
-                auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
-
-                // TODO: should be assert
-                ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
+                matrix m, minv;
+                shapeimpl->GetTransform(m, minv);
 
-                int bvhidx = (int)std::distance(shapes.cbegin(), iter);
+                // Find BVH for the shape
+                int bvhidx = shapeimpl->is_instance() ? FindBaseMesh(shapes, nummeshes, static_cast<Instance const*>(shapeimpl)) : i;
 
                 // Extract and store bounds. Note they are in object space and we need to translate them to world space
-                object_bounds[i] = transform_bbox(m_bvhs[bvhidx]->Bounds(), m);
+                object_bounds[i] = transform_bbox(m_cpudata->bvhptrs[bvhidx]->Bounds(), m);
             }
 
             // Calculate top level BVH
-            m_bvhs[nummeshes]->Build(&object_bounds[0], nummeshes + numinstances);
-            m_cpudata->bvhptrs[nummeshes] = m_bvhs[nummeshes].get();
-
-            m_cpudata->translator.Flush();
-            // TODO: parallelize this
-            m_cpudata->translator.Process(&m_cpudata->bvhptrs[0], &m_cpudata->mesh_faces_start_idx[0], nummeshes);
+            m_top_bvh = std::make_unique<Bvh>(traversal_cost, num_bins, use_sah);
+            m_top_bvh->Build(&object_bounds[0], nummeshes + numinstances);
+            m_cpudata->bvhptrs[nummeshes] = m_top_bvh.get();
 
             // Update GPU data
-            // Copy translated nodes first
-            m_gpudata->bvh = m_device->CreateBuffer(m_cpudata->translator.nodes_.size() * sizeof(PlainBvhTranslator::Node), Calc::kRead, &m_cpudata->translator.nodes_[0]);
-            m_gpudata->bvhrootidx = m_cpudata->translator.root_;
-
-            // Create vertex buffer
+            if (rebuild_geometry)
             {
-                // Vertices
-                m_gpudata->vertices = m_device->CreateBuffer(numvertices * sizeof(float3), Calc::kRead);
-
-                // Get the pointer to mapped data
-                float3* vertexdata = nullptr;
-                Calc::Event* e = nullptr;
-
-                m_device->MapBuffer(m_gpudata->vertices, 0, 0, numvertices * sizeof(float3), Calc::MapType::kMapWrite, (void**)&vertexdata, &e);
-
-                e->Wait();
-                m_device->DeleteEvent(e);
-
-                // Here we need to put data in world space rather than object space
-                // So we need to get the transform from the mesh and multiply each vertex
-                matrix m, minv;
-
-#pragma omp parallel for
-                for (int i = 0; i < nummeshes; ++i)
-                {
-                    // Get the mesh
-                    Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
-                    // Get vertex buffer of the current mesh
-                    float3 const* myvertexdata = mesh->GetVertexData();
-
-                    // Iterate thru vertices multiply and append them to GPU buffer
-                    for (int j = 0; j < mesh->num_vertices(); ++j)
-                    {
-                        vertexdata[m_cpudata->mesh_vertices_start_idx[i] + j] = myvertexdata[j];
-                    }
-                }
-
-                m_device->UnmapBuffer(m_gpudata->vertices, 0, vertexdata, &e);
-
-                e->Wait();
-                m_device->DeleteEvent(e);
+                translator.Flush();
+                // TODO: parallelize this
+                translator.Process(&m_cpudata->bvhptrs[0], &m_cpudata->mesh_faces_start_idx[0], nummeshes);
             }
-
-            // Create face buffer
+            else
             {
-                // Create face buffer
-                m_gpudata->faces = m_device->CreateBuffer(numfaces * sizeof(Face), Calc::kRead);
-
-                // Get the pointer to mapped data
-                Face* facedata = nullptr;
-                Calc::Event* e = nullptr;
-
-                m_device->MapBuffer(m_gpudata->faces, 0, 0, numfaces * sizeof(Face), Calc::MapType::kMapWrite, (void**)&facedata, &e);
+                // Bottom level nodes stay intact, so copy only top BVH data
+                translator.UpdateTopLevel(*m_top_bvh);
+            }
 
-                e->Wait();
-                m_device->DeleteEvent(e);
+            UploadBuffer(m_device, m_gpudata->bvh, translator.nodes_.size() * sizeof(PlainBvhTranslator::Node),
+                rebuild_geometry ? 0 : translator.root_ * sizeof(PlainBvhTranslator::Node), &translator.nodes_[0]);
+            m_gpudata->bvhrootidx = translator.root_;
+        }
 
-                // Here the point is to add mesh starting index to actual index contained within the mesh,
-                // getting absolute index in the buffer.
-                // Besides that we need to permute the faces accorningly to BVH reordering, whihc
-                // is contained within bvh.primids_
+        // Now we need to collect shapdata
+        int const* topindices = m_top_bvh->GetIndices();
+        m_cpudata->shapedata.resize(nummeshes + numinstances);
 
 #pragma omp parallel for
-                for (int i = 0; i < nummeshes; ++i)
-                {
-                    // Reordering indices for a given mesh
-                    int const* reordering = m_bvhs[i]->GetIndices();
-
-                    // Get the mesh
-                    Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
-
-                    Mesh::Face const* myfaces = mesh->GetFaceData();
-
-                    int startidx = m_cpudata->mesh_vertices_start_idx[i];
-
-                    for (int j = 0; j < mesh->num_faces(); ++j)
-                    {
-                        // Copy face data to GPU buffer
-                        int myidx = m_cpudata->mesh_faces_start_idx[i] + j;
-                        int faceidx = reordering[j];
-
-                        facedata[myidx].idx[0] = myfaces[faceidx].idx[0] + startidx;
-                        facedata[myidx].idx[1] = myfaces[faceidx].idx[1] + startidx;
-                        facedata[myidx].idx[2] = myfaces[faceidx].idx[2] + startidx;
-
-                        facedata[myidx].shape_id = mesh->GetId();
-                        facedata[myidx].prim_id = faceidx;
-                    }
-                }
+        for (int i = 0; i < nummeshes + numinstances; ++i)
+        {
+            // Get the mesh
+            ShapeImpl const* shapeimpl = static_cast<ShapeImpl const*>(shapes[topindices[i]]);
 
-                m_device->UnmapBuffer(m_gpudata->faces, 0, facedata, &e);
+            m_cpudata->shapedata[i].id = shapeimpl->GetId();
 
-                e->Wait();
-                m_device->DeleteEvent(e);
+            // For disabled shapes force mask to zero since these shapes 
+            // present only virtually (they have not been added to the scene)
+            // and we need to skip them while doing traversal.
+            if (shapes_disabled.find(shapeimpl) == shapes_disabled.cend())
+            {
+                m_cpudata->shapedata[i].shapeDisabled = 0;
             }
-
-
-            // Now we need to collect shapdata
-            int const* topindices = m_bvhs[nummeshes]->GetIndices();
-
-#pragma omp parallel for
-            for (int i = 0; i < nummeshes + numinstances; ++i)
+            else
             {
-                // Get the mesh
-                ShapeImpl const* shapeimpl = static_cast<ShapeImpl const*>(shapes[topindices[i]]);
-
-                m_cpudata->shapedata[i].id = shapeimpl->GetId();
-
-                // For disabled shapes force mask to zero since these shapes 
-                // present only virtually (they have not been added to the scene)
-                // and we need to skip them while doing traversal.
-                if (shapes_disabled.find(shapeimpl) == shapes_disabled.cend())
-                {
-                    m_cpudata->shapedata[i].shapeDisabled = 0;
-                }
-                else
-                {
-                    m_cpudata->shapedata[i].shapeDisabled = 1;
-                }
-
-                shapeimpl->GetTransform(m, m_cpudata->shapedata[i].minv);
-
-                if (!shapeimpl->is_instance())
-                {
-                    m_cpudata->shapedata[i].bvhidx = m_cpudata->translator.roots_[topindices[i]];
-                }
-                else
-                {
-                    Instance const* instance = static_cast<Instance const*>(shapes[topindices[i]]);
-
-                    // Find corresponding mesh
-                    Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
-
-                    // It should be there
-                    auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
-
-                    // TODO: should be assert
-                    ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
-
-                    int bvhidx = (int)std::distance(shapes.cbegin(), iter);
-
-                    m_cpudata->shapedata[i].bvhidx = m_cpudata->translator.roots_[bvhidx];
-                }
+                m_cpudata->shapedata[i].shapeDisabled = 1;
             }
 
-            // Create face ID buffer
-            m_gpudata->shapes = m_device->CreateBuffer((nummeshes + numinstances) * sizeof(ShapeData), Calc::kRead, &m_cpudata->shapedata[0]);
-        }
-        // Refit
-        else if (statechange != ShapeImpl::kStateChangeNone)
-        {
-            //std::cout << "Refit\n";
-
-            // Copy the shapes here to be able to partition them and handle more efficiently
-            // #22: we need to be able to handle instances whos base shapes are not present 
-            // in the scene, so we have to add them manually here.
-            std::vector<Shape const*> shapes;
-            std::set<Shape const*> shapes_disabled;
+            matrix m;
+            shapeimpl->GetTransform(m, m_cpudata->shapedata[i].minv);
 
-            for (auto s : world.shapes_)
+            if (!shapeimpl->is_instance())
+            {
+                m_cpudata->shapedata[i].bvhidx = translator.roots_[topindices[i]];
+            }
+            else
             {
-                auto shapeimpl = static_cast<ShapeImpl const*>(s);
+                Instance const* instance = static_cast<Instance const*>(shapeimpl);
 
-                if (shapeimpl->is_instance())
-                {
-                    // Here we know this is an instance, need to check if its base shape has been added as well
-                    auto instance = static_cast<Instance const*>(shapeimpl);
-                    auto base_shape = instance->GetBaseShape();
-
-                    if (std::find(world.shapes_.cbegin(), world.shapes_.cend(), base_shape) == world.shapes_.cend())
-                    {
-                        // Need to add the shape to the list
-                        shapes.push_back(base_shape);
-                        // And mark it disabled
-                        shapes_disabled.insert(base_shape);
-                    }
-                }
+                // Find corresponding mesh
+                int bvhidx = FindBaseMesh(shapes, nummeshes, instance);
 
-                shapes.push_back(s);
+                m_cpudata->shapedata[i].bvhidx = translator.roots_[bvhidx];
             }
+        }
 
-            // Now partition the range into meshes and instances
-            auto firstinst = std::partition(shapes.begin(), shapes.end(), [&](Shape const* shape)
-            {
-                return !static_cast<ShapeImpl const*>(shape)->is_instance();
-            });
+        // Shape data is small, so it is always rewritten completely
+        UploadBuffer(m_device, m_gpudata->shapes, (nummeshes + numinstances) * sizeof(ShapeData), 0, &m_cpudata->shapedata[0]);
 
-            // Count the number of meshes
-            int nummeshes = (int)std::distance(shapes.begin(), firstinst);
-            // Count the number of instances
-            int numinstances = (int)std::distance(firstinst, shapes.end());
+        m_device->Finish(0);
+    }
 
-            std::vector<bbox> object_bounds(nummeshes + numinstances);
+    void IntersectorTwoLevel::BuildBottomLevel(std::vector<Shape const*> const& shapes, int nummeshes)
+    {
+        int numvertices = 0;
+        int numfaces = 0;
+
+        // This buffer tracks mesh start index for next stage as mesh face indices are relative to 0
+        m_cpudata->mesh_vertices_start_idx.resize(nummeshes);
+        m_cpudata->mesh_faces_start_idx.resize(nummeshes);
+        m_cpudata->mesh_serials.resize(nummeshes);
+        // [0...numshapes-1] contain bottom level BVHs
+        // [numshapes] is the top level one
+        m_cpudata->bvhptrs.resize(nummeshes + 1);
+
+        // Prepare necessary offsets in the arrays
+        // in order to be able to parallelize
+        for (int i = 0; i < nummeshes; ++i)
+        {
+            Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
 
-            matrix m, minv;
+            m_cpudata->mesh_faces_start_idx[i] = numfaces;
+            m_cpudata->mesh_vertices_start_idx[i] = numvertices;
+            m_cpudata->mesh_serials[i] = mesh->serial();
 
-            // Go over meshes and rebuild BVH bounds
-#pragma omp parallel for
-            for (int i = 0; i < nummeshes; ++i)
+            numfaces += mesh->num_faces();
+            numvertices += mesh->num_vertices();
+        }
+
+        // Reuse BVHs of the meshes we have already seen, the rest of the cache
+        // belongs to meshes which are not in the world anymore
+        std::vector<std::unique_ptr<Bvh> > bvhs(nummeshes);
+        for (int i = 0; i < nummeshes; ++i)
+        {
+            auto iter = m_bvhs.find(m_cpudata->mesh_serials[i]);
+            if (iter != m_bvhs.end())
             {
-                Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
-                // Get transform to apply to object bounds
-                mesh->GetTransform(m, minv);
-                // Extract and store bounds. Note they are in object space and we need to translate them to world space
-                object_bounds[i] = transform_bbox(m_bvhs[i]->Bounds(), m);
+                bvhs[i] = std::move(iter->second);
             }
+        }
 
+        // Build BVHs for new meshes
 #pragma omp parallel for
-            for (int i = nummeshes; i < nummeshes + numinstances; ++i)
+        for (int i = 0; i < nummeshes; ++i)
+        {
+            if (bvhs[i])
             {
+                continue;
+            }
 
-                Instance const* instance = static_cast<Instance const*>(shapes[i]);
-                // Get transform to apply to object bounds
-                instance->GetTransform(m, minv);
+            Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
 
-                // Find BVH for the instance
-                Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
+            std::vector<bbox> bounds(mesh->num_faces());
+            for (int j = 0; j < mesh->num_faces(); ++j)
+            {
+                // Request bounds in object space since we build BVHs for objects locally
+                mesh->GetFaceBounds(j, true, bounds[j]);
+            }
 
-                // It should be there
-                auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
+            bvhs[i] = std::make_unique<Bvh>(m_cpudata->traversal_cost, m_cpudata->num_bins, m_cpudata->use_sah);
+            bvhs[i]->Build(&bounds[0], mesh->num_faces());
+        }
 
-                // TODO: should be assert
-                ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
+        m_bvhs.clear();
+        for (int i = 0; i < nummeshes; ++i)
+        {
+            // Collect BVH pointers for top level build
+            m_cpudata->bvhptrs[i] = bvhs[i].get();
+            m_bvhs[m_cpudata->mesh_serials[i]] = std::move(bvhs[i]);
+        }
 
-                int bvhidx = (int)std::distance(shapes.cbegin(), iter);
+        m_device->DeleteBuffer(m_gpudata->vertices);
+        m_device->DeleteBuffer(m_gpudata->faces);
 
-                // Extract and store bounds. Note they are in object space and we need to translate them to world space
-                object_bounds[i] = transform_bbox(m_bvhs[bvhidx]->Bounds(), m);
-            }
+        // Create vertex buffer
+        {
+            // Vertices
+            m_gpudata->vertices = m_device->CreateBuffer(numvertices * sizeof(float3), Calc::kRead);
 
-            // Calculate top level BVH
-            auto builder = world.options_.GetOption("bvh.builder");
-            auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
-            auto nbins = world.options_.GetOption("bvh.sah.num_bins");
+            // Get the pointer to mapped data
+            float3* vertexdata = nullptr;
+            Calc::Event* e = nullptr;
 
-            bool use_sah = false;
-            float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
-            int num_bins = nbins ? (int)nbins->AsFloat() : 64;
+            m_device->MapBuffer(m_gpudata->vertices, 0, 0, numvertices * sizeof(float3), Calc::MapType::kMapWrite, (void**)&vertexdata, &e);
 
+            e->Wait();
+            m_device->DeleteEvent(e);
 
-            if (builder && builder->AsString() == "sah")
+            // Bottom level BVHs are built in object space, so vertices are copied as is
+            ForEachShapeRange(m_cpudata->mesh_vertices_start_idx, numvertices, [&](int shapeidx, int begin, int end)
             {
-                use_sah = true;
-            }
+                Mesh const* mesh = static_cast<Mesh const*>(shapes[shapeidx]);
+                float3 const* myvertexdata = mesh->GetVertexData();
 
-            m_bvhs[nummeshes] = std::make_unique<Bvh>(traversal_cost, num_bins, use_sah);
-            m_bvhs[nummeshes]->Build(&object_bounds[0], nummeshes + numinstances);
-            m_cpudata->bvhptrs[nummeshes] = m_bvhs[nummeshes].get();
+                std::copy(myvertexdata + begin, myvertexdata + end, vertexdata + m_cpudata->mesh_vertices_start_idx[shapeidx] + begin);
+            });
+
+            m_device->UnmapBuffer(m_gpudata->vertices, 0, vertexdata, &e);
 
+            e->Wait();
+            m_device->DeleteEvent(e);
+        }
 
-            // TODO: parallelize this
-            m_cpudata->translator.UpdateTopLevel(*m_bvhs[nummeshes]);
+        // Create face buffer
+        {
+            // Create face buffer
+            m_gpudata->faces = m_device->CreateBuffer(numfaces * sizeof(Face), Calc::kRead);
 
-            // Update GPU data
-            // Copy only top BVH data
+            // Get the pointer to mapped data
+            Face* facedata = nullptr;
             Calc::Event* e = nullptr;
-            m_device->WriteBuffer(m_gpudata->bvh, 0, m_cpudata->translator.root_ * sizeof(PlainBvhTranslator::Node), (2 * (nummeshes + numinstances) - 1) * sizeof(PlainBvhTranslator::Node), (char*)&m_cpudata->translator.nodes_[m_cpudata->translator.root_], &e);
+
+            m_device->MapBuffer(m_gpudata->faces, 0, 0, numfaces * sizeof(Face), Calc::MapType::kMapWrite, (void**)&facedata, &e);
 
             e->Wait();
             m_device->DeleteEvent(e);
 
-            // Now we need to collect shapdata
-            int const* topindices = m_bvhs[nummeshes]->GetIndices();
+            // Here the point is to add mesh starting index to actual index contained within the mesh,
+            // getting absolute index in the buffer.
+            // Besides that we need to permute the faces accorningly to BVH reordering, whihc
+            // is contained within bvh.primids_
 
-#pragma omp parallel for
-            for (int i = 0; i < nummeshes + numinstances; ++i)
+            ForEachShapeRange(m_cpudata->mesh_faces_start_idx, numfaces, [&](int shapeidx, int begin, int end)
             {
+                // Reordering indices for a given mesh
+                int const* reordering = m_cpudata->bvhptrs[shapeidx]->GetIndices();
+
                 // Get the mesh
-                ShapeImpl const* shapeimpl = static_cast<ShapeImpl const*>(shapes[topindices[i]]);
+                Mesh const* mesh = static_cast<Mesh const*>(shapes[shapeidx]);
 
-                m_cpudata->shapedata[i].id = shapeimpl->GetId();
-                // For disabled shapes force mask to zero since these shapes 
-                // present only virtually (they have not been added to the scene)
-                // and we need to skip them while doing traversal.
-                if (shapes_disabled.find(shapeimpl) == shapes_disabled.cend())
-                {
-                    m_cpudata->shapedata[i].shapeDisabled = 0;
-                }
-                else
-                {
-                    m_cpudata->shapedata[i].shapeDisabled = 1;
-                }
+                Mesh::Face const* myfaces = mesh->GetFaceData();
 
-                shapeimpl->GetTransform(m, m_cpudata->shapedata[i].minv);
+                int startidx = m_cpudata->mesh_vertices_start_idx[shapeidx];
 
-                if (!shapeimpl->is_instance())
+                for (int j = begin; j < end; ++j)
                 {
-                    m_cpudata->shapedata[i].bvhidx = m_cpudata->translator.roots_[topindices[i]];
+                    // Copy face data to GPU buffer
+                    int myidx = m_cpudata->mesh_faces_start_idx[shapeidx] + j;
+                    int faceidx = reordering[j];
+
+                    facedata[myidx].idx[0] = myfaces[faceidx].idx[0] + startidx;
+                    facedata[myidx].idx[1] = myfaces[faceidx].idx[1] + startidx;
+                    facedata[myidx].idx[2] = myfaces[faceidx].idx[2] + startidx;
+
+                    facedata[myidx].shape_id = mesh->GetId();
+                    facedata[myidx].prim_id = faceidx;
                 }
-                else
-                {
-                    Instance const* instance = static_cast<Instance const*>(shapes[topindices[i]]);
+            });
 
-                    // Find corresponding mesh
-                    Mesh const* basemesh = static_cast<Mesh const*>(instance->GetBaseShape());
+            m_device->UnmapBuffer(m_gpudata->faces, 0, facedata, &e);
 
-                    // It should be there
-                    auto iter = std::find(shapes.cbegin(), shapes.cbegin() + nummeshes, basemesh);
+            e->Wait();
+            m_device->DeleteEvent(e);
+        }
+    }
 
-                    // TODO: should be assert
-                    ThrowIf(iter == shapes.cbegin() + nummeshes, "Internal error");
+    char const* IntersectorTwoLevel::GetAccelerationStructureType() const
+    {
+        return "bvh2l";
+    }
 
-                    int bvhidx = (int)std::distance(shapes.cbegin(), iter);
+    // Sections of saved acceleration structure
+    enum TwoLevelSection
+    {
+        // Index of top level root node
+        kTwoLevelSectionRoot,
+        // Translated nodes of all levels
+        kTwoLevelSectionNodes,
+        // Object space vertices
+        kTwoLevelSectionVertices,
+        // Faces in bottom level BVH order
+        kTwoLevelSectionFaces,
+        // Shape data in top level BVH order
+        kTwoLevelSectionShapes
+    };
 
-                    m_cpudata->shapedata[i].bvhidx = m_cpudata->translator.roots_[bvhidx];
-                }
-            }
+    void IntersectorTwoLevel::Save(World const& world, AccelerationStructureWriter& writer) const
+    {
+        ThrowIf(!m_gpudata->bvh, "Acceleration structure has not been built");
 
-            // Create face ID buffer
-            m_device->WriteBuffer(m_gpudata->shapes, 0, 0, (nummeshes + numinstances) * sizeof(ShapeData), (char*)&m_cpudata->shapedata[0], &e);
+        writer.AddSection(std::vector<int>(1, m_gpudata->bvhrootidx));
+        writer.AddSection(m_device, m_gpudata->bvh);
+        writer.AddSection(m_device, m_gpudata->vertices);
+        writer.AddSection(m_device, m_gpudata->faces);
+        writer.AddSection(m_device, m_gpudata->shapes);
+    }
 
-            e->Wait();
-            m_device->DeleteEvent(e);
+    void IntersectorTwoLevel::Load(World const& world, AccelerationStructureReader const& reader)
+    {
+        std::vector<int> root;
+        reader.GetSection(kTwoLevelSectionRoot, root);
+        ThrowIf(root.size() != 1, "Acceleration structure file is corrupted");
 
-            m_device->Finish(0);
+        if (m_gpudata->bvh)
+        {
+            m_device->DeleteBuffer(m_gpudata->bvh);
+            m_device->DeleteBuffer(m_gpudata->vertices);
+            m_device->DeleteBuffer(m_gpudata->faces);
+            m_device->DeleteBuffer(m_gpudata->shapes);
         }
+
+        // BVHs are not needed for queries, next change rebuilds everything
+        m_bvhs.clear();
+        m_top_bvh.reset();
+        m_cpudata->mesh_serials.clear();
+
+        m_gpudata->bvh = reader.CreateBuffer(m_device, kTwoLevelSectionNodes);
+        m_gpudata->vertices = reader.CreateBuffer(m_device, kTwoLevelSectionVertices);
+        m_gpudata->faces = reader.CreateBuffer(m_device, kTwoLevelSectionFaces);
+        m_gpudata->shapes = reader.CreateBuffer(m_device, kTwoLevelSectionShapes);
+        m_gpudata->bvhrootidx = root[0];
+
+        m_device->Finish(0);
     }
 
     void IntersectorTwoLevel::Intersect(std::uint32_t queueidx, Calc::Buffer const* rays, Calc::Buffer const* numrays, std::uint32_t maxrays, Calc::Buffer* hits, Calc::Event const* waitevent, Calc::Event** event) const
@@ -705,4 +689,111 @@ namespace RadeonRays
 
         m_device->Execute(func, queueidx, globalsize, localsize, event);
     }
+
+    void IntersectorTwoLevel::Occluded2dSumLinear2(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
+        Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
+        Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+        Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+        std::uint32_t num_outputs, Calc::Buffer *hits,
+        Calc::Event const *waitevent, Calc::Event **event) const
+    {
+        auto& func = m_gpudata->occlude_func2d_sum_linear;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, m_gpudata->shapes);
+        func->SetArg(arg++, sizeof(int), &m_gpudata->bvhrootidx);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, koefs);
+        func->SetArg(arg++, offset_directions);
+        func->SetArg(arg++, offset_koefs);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((maxrays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queueidx, globalsize, localsize, event);
+    }
+
+    void IntersectorTwoLevel::Occluded2dSumLinearSky(std::uint32_t queueidx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+        Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+        Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+        Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+        std::uint32_t num_outputs, Calc::Buffer *hits,
+        Calc::Event const *waitevent, Calc::Event **event) const
+    {
+        auto& func = m_gpudata->occlude_func2d_sum_linear_sky;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Kernels can't take null buffers, pass origins instead and switch frames off
+        SkyPatches sky_arg = sky;
+        int use_frames = frames ? 1 : 0;
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, m_gpudata->shapes);
+        func->SetArg(arg++, sizeof(int), &m_gpudata->bvhrootidx);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, sizeof(SkyPatches), &sky_arg);
+        func->SetArg(arg++, frames ? frames : origins);
+        func->SetArg(arg++, sizeof(int), &use_frames);
+        func->SetArg(arg++, koefs);
+        func->SetArg(arg++, offset_koefs);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((maxrays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queueidx, globalsize, localsize, event);
+    }
+
+    void IntersectorTwoLevel::Occluded2dCellString(std::uint32_t queueidx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+        Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+        Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+        std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+        std::uint32_t cell_strings_count, Calc::Buffer *hits,
+        Calc::Event const *waitevent, Calc::Event **event) const
+    {
+        auto& func = m_gpudata->occlude_func2d_cell_string;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, m_gpudata->shapes);
+        func->SetArg(arg++, sizeof(int), &m_gpudata->bvhrootidx);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, cell_string_inds);
+        func->SetArg(arg++, num_cell_strings);
+        func->SetArg(arg++, hits);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((max_ray_batches + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queueidx, globalsize, localsize, event);
+    }
 }
@@ -35,6 +35,10 @@ THE SOFTWARE.
     and then top level BVH across all bottom level BVHs. Top level leafs keep object transforms and
     might reference other leafs making instancing possible.
 
+    Bottom level BVHs are cached per mesh. If the set of meshes stays the same
+    (transform changes, instances attached or detached) only top level BVH is
+    rebuilt and vertex and face buffers are left untouched.
+
 
     Pros:
         -Simple and efficient kernel with low VGPR pressure.
@@ -52,6 +56,8 @@ THE SOFTWARE.
 #include "calc.h"
 #include "device.h"
 #include "intersector.h"
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -72,6 +78,10 @@ namespace RadeonRays
     private:
         // World processing implementation
         void Process(World const& world) override;
+        // Serialization implementation
+        char const* GetAccelerationStructureType() const override;
+        void Save(World const& world, AccelerationStructureWriter& writer) const override;
+        void Load(World const& world, AccelerationStructureReader const& reader) override;
         // Intersection implementation
         void Intersect(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays, 
             std::uint32_t max_rays, Calc::Buffer *hits, 
@@ -80,6 +90,25 @@ namespace RadeonRays
         void Occluded(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays, 
             std::uint32_t max_rays, Calc::Buffer *hits, 
             Calc::Event const *wait_event, Calc::Event **event) const override;
+        // 2D occlusion implementation
+        void Occluded2dSumLinear2(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
+            Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
+            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+            Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+            std::uint32_t num_outputs, Calc::Buffer *hits,
+            Calc::Event const *wait_event, Calc::Event **event) const override;
+        void Occluded2dSumLinearSky(std::uint32_t queue_idx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+            Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+            Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+            std::uint32_t num_outputs, Calc::Buffer *hits,
+            Calc::Event const *wait_event, Calc::Event **event) const override;
+        void Occluded2dCellString(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+            Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+            std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+            std::uint32_t cell_strings_count, Calc::Buffer *hits,
+            Calc::Event const *wait_event, Calc::Event **event) const override;
 
     private:
         // Gpu data
@@ -88,9 +117,15 @@ namespace RadeonRays
         struct ShapeData;
         struct Face;
 
+        // Rebuild bottom level BVHs of new meshes and upload geometry
+        void BuildBottomLevel(std::vector<Shape const*> const& shapes, int nummeshes);
+
         std::unique_ptr<GpuData> m_gpudata;
         std::unique_ptr<CpuData> m_cpudata;
-        std::vector<std::unique_ptr<Bvh> > m_bvhs;
+        // Bottom level BVHs keyed by mesh serial number
+        std::map<std::uint64_t, std::unique_ptr<Bvh> > m_bvhs;
+        // Top level BVH
+        std::unique_ptr<Bvh> m_top_bvh;
     };
 }
 
@@ -31,6 +31,7 @@
 
 #include "../translator/fatnode_bvh_translator.h"
 #include "../except/except.h"
+#include "../device/kernel_cache.h"
 
 #include <algorithm>
 
@@ -107,7 +108,7 @@ namespace RadeonRays
             char const* headers[] = { "../RadeonRays/src/kernels/CL/common.cl" };
 
             int numheaders = sizeof(headers) / sizeof(char const*);
-            m_gpudata->executable = m_device->CompileExecutable("../RadeonRays/src/kernels/CL/intersect_bvh2_bittrail.cl", headers, numheaders, buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_bvh2_bittrail.cl", headers, numheaders, buildopts.c_str());
         }
         else
         {
@@ -118,7 +119,7 @@ namespace RadeonRays
 #if USE_OPENCL
         if (device->GetPlatform() == Calc::Platform::kOpenCL)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_intersect_bvh2_bittrail_opencl, std::strlen(g_intersect_bvh2_bittrail_opencl), buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, g_intersect_bvh2_bittrail_opencl, std::strlen(g_intersect_bvh2_bittrail_opencl), buildopts.c_str());
         }
 #endif
 
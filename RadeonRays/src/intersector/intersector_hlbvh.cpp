@@ -30,6 +30,7 @@ THE SOFTWARE.
 #include "device.h"
 #include "executable.h"
 #include "../except/except.h"
+#include "../device/kernel_cache.h"
 
 #include <algorithm>
 #include <memory>
@@ -55,11 +56,16 @@ namespace RadeonRays
         Calc::Executable* executable;
         Calc::Function* isect_func;
         Calc::Function* occlude_func;
+        // 2D queries, OpenCL only
+        Calc::Function* occlude_func2d_sum_linear;
+        Calc::Function* occlude_func2d_cell_string;
 
         GpuData(Calc::Device* d)
             : device(d)
             , vertices(nullptr)
             , faces(nullptr)
+            , occlude_func2d_sum_linear(nullptr)
+            , occlude_func2d_cell_string(nullptr)
         {
         }
 
@@ -70,6 +76,8 @@ namespace RadeonRays
             device->DeleteBuffer(stack);
             executable->DeleteFunction(isect_func);
             executable->DeleteFunction(occlude_func);
+            executable->DeleteFunction(occlude_func2d_sum_linear);
+            executable->DeleteFunction(occlude_func2d_cell_string);
             device->DeleteExecutable(executable);
         }
     };
@@ -99,7 +107,7 @@ namespace RadeonRays
 
             int numheaders = sizeof( headers ) / sizeof( char const* );
 
-            m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/CL/intersect_hlbvh_stack.cl", headers, numheaders, buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_hlbvh_stack.cl", headers, numheaders, buildopts.c_str());
         }
         else
         {
@@ -110,7 +118,7 @@ namespace RadeonRays
 #if USE_OPENCL
         if (device->GetPlatform() == Calc::Platform::kOpenCL)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_intersect_hlbvh_stack_opencl, std::strlen(g_intersect_hlbvh_stack_opencl), buildopts.c_str());
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, g_intersect_hlbvh_stack_opencl, std::strlen(g_intersect_hlbvh_stack_opencl), buildopts.c_str());
         }
 #endif
 
@@ -125,6 +133,12 @@ namespace RadeonRays
 
         m_gpudata->isect_func = m_gpudata->executable->CreateFunction("intersect_main");
         m_gpudata->occlude_func = m_gpudata->executable->CreateFunction("occluded_main");
+
+        if (device->GetPlatform() == Calc::Platform::kOpenCL)
+        {
+            m_gpudata->occlude_func2d_sum_linear = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear");
+            m_gpudata->occlude_func2d_cell_string = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string");
+        }
     }
 
     void IntersectorHlbvh::Process(World const& world)
@@ -429,4 +443,88 @@ namespace RadeonRays
         m_device->Execute(func, queue_idx, globalsize, localsize, event);
     }
 
+    void IntersectorHlbvh::Occluded2dSumLinear2(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
+        Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
+        Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+        Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+        std::uint32_t num_outputs, Calc::Buffer *hits,
+        Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        // Check if we can allocate enough stack memory
+        if (max_rays >= kMaxBatchSize)
+        {
+            throw ExceptionImpl("hlbvh accelerator max batch size exceeded");
+        }
+
+        auto& func = m_gpudata->occlude_func2d_sum_linear;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_bvh->GetGpuData().nodes);
+        func->SetArg(arg++, m_bvh->GetGpuData().sorted_bounds);
+        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, koefs);
+        func->SetArg(arg++, offset_directions);
+        func->SetArg(arg++, offset_koefs);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, m_gpudata->stack);
+        func->SetArg(arg++, hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((max_rays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queue_idx, globalsize, localsize, event);
+    }
+
+    std::uint64_t IntersectorHlbvh::GetMaxRaysPerDispatch() const
+    {
+        // Batches of kMaxBatchSize rays and more are rejected
+        return std::min<std::uint64_t>(Intersector::GetMaxRaysPerDispatch(), kMaxBatchSize - 1);
+    }
+
+    void IntersectorHlbvh::Occluded2dCellString(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+        Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+        Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+        std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+        std::uint32_t cell_strings_count, Calc::Buffer *hits,
+        Calc::Event const *wait_event, Calc::Event **event) const
+    {
+        // Each work item needs its own stack
+        if (max_ray_batches >= kMaxBatchSize)
+        {
+            throw ExceptionImpl("hlbvh accelerator max batch size exceeded");
+        }
+
+        auto& func = m_gpudata->occlude_func2d_cell_string;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_bvh->GetGpuData().nodes);
+        func->SetArg(arg++, m_bvh->GetGpuData().sorted_bounds);
+        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, cell_string_inds);
+        func->SetArg(arg++, num_cell_strings);
+        func->SetArg(arg++, m_gpudata->stack);
+        func->SetArg(arg++, hits);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((max_ray_batches + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queue_idx, globalsize, localsize, event);
+    }
 }
@@ -73,6 +73,24 @@ namespace RadeonRays
             std::uint32_t max_rays, Calc::Buffer *hits, 
             Calc::Event const *wait_event, Calc::Event **event) const override;
 
+        // 2D occlusion implemenation
+        void Occluded2dSumLinear2(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions, Calc::Buffer const *koefs,
+            Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
+            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+            Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+            std::uint32_t num_outputs, Calc::Buffer *hits,
+            Calc::Event const *wait_event, Calc::Event **event) const override;
+
+        void Occluded2dCellString(std::uint32_t queue_idx, Calc::Buffer const *origins, Calc::Buffer const *directions,
+            Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+            Calc::Buffer const *cell_string_inds, Calc::Buffer const *num_cell_strings,
+            std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+            std::uint32_t cell_strings_count, Calc::Buffer *hits,
+            Calc::Event const *wait_event, Calc::Event **event) const override;
+
+        // Sum-linear tiles share the preallocated traversal stack
+        std::uint64_t GetMaxRaysPerDispatch() const override;
+
     private:
         struct GpuData;
         struct ShapeData;
@@ -28,6 +28,10 @@ THE SOFTWARE.
 #include "../primitive/instance.h"
 #include "../translator/q_bvh_translator.h"
 #include "../world/world.h"
+#include "acceleration_structure_file.h"
+#include "../device/kernel_cache.h"
+
+#include <algorithm>
 
 namespace RadeonRays
 {
@@ -44,6 +48,8 @@ namespace RadeonRays
                 , executable(nullptr)
                 , isect_func(nullptr)
                 , occlude_func(nullptr)
+                , occlude_func2d_sum_linear(nullptr)
+                , occlude_func2d_cell_string(nullptr)
             {
             }
 
@@ -53,6 +59,8 @@ namespace RadeonRays
                 {
                     executable->DeleteFunction(isect_func);
                     executable->DeleteFunction(occlude_func);
+                    executable->DeleteFunction(occlude_func2d_sum_linear);
+                    executable->DeleteFunction(occlude_func2d_cell_string);
                     device->DeleteExecutable(executable);
                 }
             }
@@ -62,6 +70,9 @@ namespace RadeonRays
             Calc::Executable *executable;
             Calc::Function *isect_func;
             Calc::Function *occlude_func;
+            // 2D queries, OpenCL only
+            Calc::Function *occlude_func2d_sum_linear;
+            Calc::Function *occlude_func2d_cell_string;
         };
 
         // Device
@@ -119,9 +130,9 @@ namespace RadeonRays
 
             int numheaders = sizeof(headers) / sizeof(const char *);
 
-            m_gpudata->bvh_prog.executable = m_device->CompileExecutable("../RadeonRays/src/kernels/CL/intersect_bvh2_lds.cl", headers, numheaders, buildopts.c_str());
+            m_gpudata->bvh_prog.executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_bvh2_lds.cl", headers, numheaders, buildopts.c_str());
             if (spec.has_fp16)
-                m_gpudata->qbvh_prog.executable = m_device->CompileExecutable("../RadeonRays/src/kernels/CL/intersect_bvh2_lds_fp16.cl", headers, numheaders, buildopts.c_str());
+                m_gpudata->qbvh_prog.executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_bvh2_lds_fp16.cl", headers, numheaders, buildopts.c_str());
         }
         else
         {
@@ -134,9 +145,9 @@ namespace RadeonRays
 #if USE_OPENCL
         if (device->GetPlatform() == Calc::Platform::kOpenCL)
         {
-            m_gpudata->bvh_prog.executable = m_device->CompileExecutable(g_intersect_bvh2_lds_opencl, std::strlen(g_intersect_bvh2_lds_opencl), buildopts.c_str());
+            m_gpudata->bvh_prog.executable = KernelCache::CompileExecutable(m_device, g_intersect_bvh2_lds_opencl, std::strlen(g_intersect_bvh2_lds_opencl), buildopts.c_str());
             if (spec.has_fp16)
-                m_gpudata->qbvh_prog.executable = m_device->CompileExecutable(g_intersect_bvh2_lds_fp16_opencl, std::strlen(g_intersect_bvh2_lds_fp16_opencl), buildopts.c_str());
+                m_gpudata->qbvh_prog.executable = KernelCache::CompileExecutable(m_device, g_intersect_bvh2_lds_fp16_opencl, std::strlen(g_intersect_bvh2_lds_fp16_opencl), buildopts.c_str());
         }
 #endif
 #if USE_VULKAN
@@ -153,6 +164,12 @@ namespace RadeonRays
         m_gpudata->bvh_prog.isect_func = m_gpudata->bvh_prog.executable->CreateFunction("intersect_main");
         m_gpudata->bvh_prog.occlude_func = m_gpudata->bvh_prog.executable->CreateFunction("occluded_main");
 
+        if (device->GetPlatform() == Calc::Platform::kOpenCL)
+        {
+            m_gpudata->bvh_prog.occlude_func2d_sum_linear = m_gpudata->bvh_prog.executable->CreateFunction("occluded_main_2d_sum_linear");
+            m_gpudata->bvh_prog.occlude_func2d_cell_string = m_gpudata->bvh_prog.executable->CreateFunction("occluded_main_2d_cell_string");
+        }
+
         if (m_gpudata->qbvh_prog.executable)
         {
             m_gpudata->qbvh_prog.isect_func = m_gpudata->qbvh_prog.executable->CreateFunction("intersect_main");
@@ -263,19 +280,56 @@ namespace RadeonRays
         }
     }
 
-    void IntersectorLDS::Intersect(std::uint32_t queue_idx, const Calc::Buffer *rays, const Calc::Buffer *num_rays,
-        std::uint32_t max_rays, Calc::Buffer *hits,
-        const Calc::Event *wait_event, Calc::Event **event) const
+    char const* IntersectorLDS::GetAccelerationStructureType() const
     {
-        std::size_t stack_size = 4 * max_rays * kMaxStackSize;
+        return "fatbvh";
+    }
 
-        // Check if we need to reallocate memory
-        if (!m_gpudata->stack || stack_size > m_gpudata->stack->GetSize())
+    // Sections of saved acceleration structure
+    enum LDSSection
+    {
+        // Node format, 1 for QBVH
+        kLDSSectionFormat,
+        // Nodes with embedded triangles
+        kLDSSectionNodes
+    };
+
+    void IntersectorLDS::Save(const World &world, AccelerationStructureWriter &writer) const
+    {
+        ThrowIf(!m_gpudata->bvh, "Acceleration structure has not been built");
+
+        writer.AddSection(std::vector<int>(1, m_gpudata->prog == &m_gpudata->qbvh_prog ? 1 : 0));
+        writer.AddSection(m_device, m_gpudata->bvh);
+    }
+
+    void IntersectorLDS::Load(const World &world, AccelerationStructureReader const &reader)
+    {
+        std::vector<int> format;
+        reader.GetSection(kLDSSectionFormat, format);
+        ThrowIf(format.size() != 1, "Acceleration structure file is corrupted");
+
+        bool use_qbvh = format[0] == 1;
+        ThrowIf(use_qbvh && !m_gpudata->qbvh_prog.executable, "Device does not support QBVH");
+
+        // Free previous data
+        if (m_gpudata->bvh)
         {
-            m_device->DeleteBuffer(m_gpudata->stack);
-            m_gpudata->stack = m_device->CreateBuffer(stack_size, Calc::BufferType::kWrite);
+            m_device->DeleteBuffer(m_gpudata->bvh);
         }
 
+        m_gpudata->bvh = reader.CreateBuffer(m_device, kLDSSectionNodes);
+        m_gpudata->prog = use_qbvh ? &m_gpudata->qbvh_prog : &m_gpudata->bvh_prog;
+
+        // Make sure everything is committed
+        m_device->Finish(0);
+    }
+
+    void IntersectorLDS::Intersect(std::uint32_t queue_idx, const Calc::Buffer *rays, const Calc::Buffer *num_rays,
+        std::uint32_t max_rays, Calc::Buffer *hits,
+        const Calc::Event *wait_event, Calc::Event **event) const
+    {
+        ReserveStack(max_rays);
+
         assert(m_gpudata->prog);
         auto &func = m_gpudata->prog->isect_func;
 
@@ -298,14 +352,7 @@ namespace RadeonRays
         std::uint32_t max_rays, Calc::Buffer *hits,
         const Calc::Event *wait_event, Calc::Event **event) const
     {
-        std::size_t stack_size = 4 * max_rays * kMaxStackSize;
-
-        // Check if we need to reallocate memory
-        if (!m_gpudata->stack || stack_size > m_gpudata->stack->GetSize())
-        {
-            m_device->DeleteBuffer(m_gpudata->stack);
-            m_gpudata->stack = m_device->CreateBuffer(stack_size, Calc::BufferType::kWrite);
-        }
+        ReserveStack(max_rays);
 
         assert(m_gpudata->prog);
         auto &func = m_gpudata->prog->occlude_func;
@@ -324,4 +371,92 @@ namespace RadeonRays
 
         m_device->Execute(func, queue_idx, globalsize, localsize, event);
     }
+
+    void IntersectorLDS::Occluded2dSumLinear2(std::uint32_t queue_idx, const Calc::Buffer *origins, const Calc::Buffer *directions, const Calc::Buffer *koefs,
+        const Calc::Buffer *offset_directions, const Calc::Buffer *offset_koefs,
+        const Calc::Buffer *num_origins, const Calc::Buffer *num_directions,
+        const Calc::Buffer *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+        std::uint32_t num_outputs, Calc::Buffer *hits,
+        const Calc::Event *wait_event, Calc::Event **event) const
+    {
+        assert(m_gpudata->prog);
+        auto &func = m_gpudata->prog->occlude_func2d_sum_linear;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        ReserveStack(max_rays);
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, koefs);
+        func->SetArg(arg++, offset_directions);
+        func->SetArg(arg++, offset_koefs);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, m_gpudata->stack);
+        func->SetArg(arg++, hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+
+        std::size_t localsize = kWorkGroupSize;
+        std::size_t globalsize = ((max_rays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queue_idx, globalsize, localsize, event);
+    }
+
+    void IntersectorLDS::Occluded2dCellString(std::uint32_t queue_idx, const Calc::Buffer *origins, const Calc::Buffer *directions,
+        const Calc::Buffer *num_origins, const Calc::Buffer *num_directions,
+        const Calc::Buffer *cell_string_inds, const Calc::Buffer *num_cell_strings,
+        std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+        std::uint32_t cell_strings_count, Calc::Buffer *hits,
+        const Calc::Event *wait_event, Calc::Event **event) const
+    {
+        assert(m_gpudata->prog);
+        auto &func = m_gpudata->prog->occlude_func2d_cell_string;
+        ThrowIf(!func, "2D queries are not supported on this platform");
+
+        // Each work item traces all the rays of its cell-string with the same stack
+        ReserveStack(max_ray_batches);
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, cell_string_inds);
+        func->SetArg(arg++, num_cell_strings);
+        func->SetArg(arg++, m_gpudata->stack);
+        func->SetArg(arg++, hits);
+
+        std::size_t localsize = kWorkGroupSize;
+        std::size_t globalsize = ((max_ray_batches + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queue_idx, globalsize, localsize, event);
+    }
+
+    std::uint64_t IntersectorLDS::GetMaxRaysPerDispatch() const
+    {
+        // Every work item of the tile owns kMaxStackSize stack entries
+        Calc::DeviceSpec spec;
+        m_device->GetSpec(spec);
+        return std::min<std::uint64_t>(Intersector::GetMaxRaysPerDispatch(), spec.max_alloc_size / (sizeof(std::uint32_t) * kMaxStackSize));
+    }
+
+    void IntersectorLDS::ReserveStack(std::uint32_t num_items) const
+    {
+        std::size_t stack_size = sizeof(std::uint32_t) * static_cast<std::size_t>(num_items) * kMaxStackSize;
+
+        // Check if we need to reallocate memory
+        if (!m_gpudata->stack || stack_size > m_gpudata->stack->GetSize())
+        {
+            m_device->DeleteBuffer(m_gpudata->stack);
+            m_gpudata->stack = m_device->CreateBuffer(stack_size, Calc::BufferType::kWrite);
+        }
+    }
 }
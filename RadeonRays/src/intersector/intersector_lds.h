@@ -36,6 +36,10 @@ namespace RadeonRays
     private:
         // World preprocessing implementation
         void Process(const World &world) override;
+        // Serialization implementation
+        char const* GetAccelerationStructureType() const override;
+        void Save(const World &world, AccelerationStructureWriter &writer) const override;
+        void Load(const World &world, AccelerationStructureReader const &reader) override;
         // Intersection implementation
         void Intersect(std::uint32_t queue_idx, const Calc::Buffer *rays, const Calc::Buffer *num_rays,
             std::uint32_t max_rays, Calc::Buffer *hits,
@@ -44,6 +48,25 @@ namespace RadeonRays
         void Occluded(std::uint32_t queue_idx, const Calc::Buffer *rays, const Calc::Buffer *num_rays,
             std::uint32_t max_rays, Calc::Buffer *hits,
             const Calc::Event *wait_event, Calc::Event **event) const override;
+        // 2D occlusion implementation
+        void Occluded2dSumLinear2(std::uint32_t queue_idx, const Calc::Buffer *origins, const Calc::Buffer *directions, const Calc::Buffer *koefs,
+            const Calc::Buffer *offset_directions, const Calc::Buffer *offset_koefs,
+            const Calc::Buffer *num_origins, const Calc::Buffer *num_directions,
+            const Calc::Buffer *directions_stride, std::uint64_t ray_offset, std::uint32_t max_rays,
+            std::uint32_t num_outputs, Calc::Buffer *hits,
+            const Calc::Event *wait_event, Calc::Event **event) const override;
+        void Occluded2dCellString(std::uint32_t queue_idx, const Calc::Buffer *origins, const Calc::Buffer *directions,
+            const Calc::Buffer *num_origins, const Calc::Buffer *num_directions,
+            const Calc::Buffer *cell_string_inds, const Calc::Buffer *num_cell_strings,
+            std::uint32_t max_ray_batches, std::uint32_t origins_count, std::uint32_t directions_count,
+            std::uint32_t cell_strings_count, Calc::Buffer *hits,
+            const Calc::Event *wait_event, Calc::Event **event) const override;
+
+        // Sum-linear tiles are limited by the traversal stack allocation
+        std::uint64_t GetMaxRaysPerDispatch() const override;
+
+        // Make sure traversal stack fits given number of work items
+        void ReserveStack(std::uint32_t num_items) const;
 
     private:
         struct GpuData;
@@ -23,58 +23,503 @@ THE SOFTWARE.
 
 #include "../accelerator/bvh.h"
 #include "../accelerator/split_bvh.h"
+#include "../accelerator/hlbvh.h"
 #include "../primitive/mesh.h"
 #include "../primitive/instance.h"
 #include "../world/world.h"
 
 #include "../translator/plain_bvh_translator.h"
+#include "../translator/quantized_bvh_translator.h"
+#include "acceleration_structure_file.h"
+#include "geometry_upload.h"
+#include "../device/kernel_cache.h"
 
 #include "device.h"
 #include "executable.h"
+#include "primitives.h"
 #include <algorithm>
+#include <limits>
+#include <numeric>
+
+#if USE_HOST
+#include "../kernels/CPU/kernels_host.h"
+#endif
 
 // Preferred work group size for Radeon devices
 static int const kWorkGroupSize = 64;
 
+#define STARTIDX(x)     (((int)((x).pmin.w)) >> 4)
+#define NUMPRIMS(x)     (((int)((x).pmin.w)) & 0xF)
+#define LEAFNODE(x)     (((x).pmin.w) != -1.f)
+#define NEXT(x)     ((int)((x).pmax.w))
+
+// Number of triangles in a leaf block, must match TRIANGLE_BLOCK_SIZE in intersect_bvh2_skiplinks.cl
+static int const kTriangleBlockSize = 4;
+
 namespace RadeonRays
 {
+    namespace
+    {
+        struct Face
+        {
+            // Up to 3 indices
+            int idx[3];
+            // Shape ID
+            int shape_id;
+            // Primitive ID
+            int prim_id;
+        };
+
+        // Leaf triangles in SoA layout, i-th lane of each component belongs to i-th triangle.
+        // Padding triangles are left zeroed, so they are degenerate and never hit.
+        struct TriangleBlock
+        {
+            // First vertex x, y, z
+            float v0[3][kTriangleBlockSize];
+            // First edge (v2 - v1) x, y, z
+            float e1[3][kTriangleBlockSize];
+            // Second edge (v3 - v1) x, y, z
+            float e2[3][kTriangleBlockSize];
+        };
+    }
+
+    // Host copies of the data needed to refit the tree without rebuilding it
+    struct IntersectorSkipLinks::RefitData
+    {
+        // Shapes in the order their geometry is laid out in vertex buffer
+        std::vector<Shape const*> shapes;
+        // Start of each shape in vertex buffer
+        std::vector<int> vertices_start_idx;
+        // World space vertices
+        std::vector<float3> vertices;
+        // Vertex indices of the faces in leaf slot order, -1 for padding slots
+        std::vector<int> indices;
+        // Translated nodes
+        std::vector<bbox> nodes;
+        // SAH cost of the tree right after the build
+        float build_cost;
+        // Traversal cost used for SAH estimates
+        float traversal_cost;
+        // Face slots turned into padding by detached shapes since the build
+        int num_dead_faces = 0;
+    };
+
+    // SAH cost of the translated tree, not normalized by root area
+    // so the trees which grow after the refit are penalized
+    static float CalculateSahCost(std::vector<bbox> const& nodes, float traversal_cost)
+    {
+        float cost = 0.f;
+        for (auto const& node : nodes)
+        {
+            cost += node.surface_area() * (LEAFNODE(node) ? (float)NUMPRIMS(node) : traversal_cost);
+        }
+
+        return cost;
+    }
+
+    // Pack faces into leaf triangle blocks, one face slot per block lane
+    static void BuildTriangleBlocks(std::vector<float3> const& vertices, std::vector<int> const& indices, std::vector<TriangleBlock>& blocks)
+    {
+        int numslots = (int)indices.size() / 3;
+        int numblocks = numslots / kTriangleBlockSize;
+        blocks.assign(numblocks, TriangleBlock());
+
+        // Split by blocks, so lanes of a block are filled by the same task
+        task_scheduler::instance().parallel_for(0, numblocks, kUploadGrainSize / kTriangleBlockSize, [&](int begin, int end)
+        {
+            for (int i = begin * kTriangleBlockSize; i < end * kTriangleBlockSize; ++i)
+            {
+                if (indices[i * 3] == -1)
+                {
+                    continue;
+                }
+
+                float3 const& v1 = vertices[indices[i * 3]];
+                float3 const e1 = vertices[indices[i * 3 + 1]] - v1;
+                float3 const e2 = vertices[indices[i * 3 + 2]] - v1;
+
+                TriangleBlock& block = blocks[i / kTriangleBlockSize];
+                int const lane = i % kTriangleBlockSize;
+                block.v0[0][lane] = v1.x; block.v0[1][lane] = v1.y; block.v0[2][lane] = v1.z;
+                block.e1[0][lane] = e1.x; block.e1[1][lane] = e1.y; block.e1[2][lane] = e1.z;
+                block.e2[0][lane] = e2.x; block.e2[1][lane] = e2.y; block.e2[2][lane] = e2.z;
+            }
+        });
+    }
+
+    namespace
+    {
+        // Layout of shape geometry in vertex and face arrays
+        struct ShapeLayout
+        {
+            // Shapes in world order, so attached shapes are appended to the end
+            std::vector<Shape const*> shapes;
+            // Start of each shape in vertex array
+            std::vector<int> vertices_start_idx;
+            // Start of each shape in face array
+            std::vector<int> faces_start_idx;
+            int numvertices;
+            int numfaces;
+        };
+    }
+
+    // Get mesh geometry of a shape (base mesh for instances)
+    static Mesh const* GetShapeMesh(Shape const* shape)
+    {
+        ShapeImpl const* shapeimpl = static_cast<ShapeImpl const*>(shape);
+        return shapeimpl->is_instance() ?
+            static_cast<Mesh const*>(static_cast<Instance const*>(shapeimpl)->GetBaseShape()) :
+            static_cast<Mesh const*>(shapeimpl);
+    }
+
+    static void CalculateShapeLayout(std::vector<Shape const*> const& shapes, ShapeLayout& layout)
+    {
+        layout.shapes = shapes;
+
+        int numshapes = (int)layout.shapes.size();
+        layout.numvertices = 0;
+        layout.numfaces = 0;
+        layout.vertices_start_idx.resize(numshapes);
+        layout.faces_start_idx.resize(numshapes);
+
+        for (int i = 0; i < numshapes; ++i)
+        {
+            Mesh const* mesh = GetShapeMesh(layout.shapes[i]);
+
+            layout.faces_start_idx[i] = layout.numfaces;
+            layout.vertices_start_idx[i] = layout.numvertices;
+
+            layout.numfaces += mesh->num_faces();
+            layout.numvertices += mesh->num_vertices();
+        }
+    }
+
+    static void CalculateShapeLayout(World const& world, ShapeLayout& layout)
+    {
+        CalculateShapeLayout(world.shapes_, layout);
+    }
+
+    // Transform vertices of all shapes into world space
+    static void CollectVertices(ShapeLayout const& layout, std::vector<float3>& vertices)
+    {
+        vertices.resize(layout.numvertices);
+
+        ForEachShapeRange(layout.vertices_start_idx, layout.numvertices, [&](int shapeidx, int begin, int end)
+        {
+            Mesh const* mesh = GetShapeMesh(layout.shapes[shapeidx]);
+
+            // Instances use their own transform for base shape geometry
+            matrix m, minv;
+            layout.shapes[shapeidx]->GetTransform(m, minv);
+
+            float3 const* myvertexdata = mesh->GetVertexData();
+            float3* dst = &vertices[layout.vertices_start_idx[shapeidx]];
+            for (int j = begin; j < end; ++j)
+            {
+                dst[j] = transform_point(myvertexdata[j], m);
+            }
+        });
+    }
+
+    // Collect world space bounds of all faces
+    static void CollectFaceBounds(ShapeLayout const& layout, std::vector<bbox>& bounds)
+    {
+        bounds.resize(layout.numfaces);
+
+        ForEachShapeRange(layout.faces_start_idx, layout.numfaces, [&](int shapeidx, int begin, int end)
+        {
+            ShapeImpl const* shape = static_cast<ShapeImpl const*>(layout.shapes[shapeidx]);
+            Mesh const* mesh = GetShapeMesh(shape);
+            bbox* dst = &bounds[layout.faces_start_idx[shapeidx]];
+
+            if (!shape->is_instance())
+            {
+                // Meshes give world space bounds directly
+                for (int j = begin; j < end; ++j)
+                {
+                    mesh->GetFaceBounds(j, false, dst[j]);
+                }
+            }
+            else
+            {
+                // Instance is using its own transform for base shape geometry
+                // so we need to get object space bounds and transform them manually
+                matrix m, minv;
+                shape->GetTransform(m, minv);
+
+                for (int j = begin; j < end; ++j)
+                {
+                    bbox tmp;
+                    mesh->GetFaceBounds(j, true, tmp);
+                    dst[j] = transform_bbox(tmp, m);
+                }
+            }
+        });
+    }
+
+    // Give each leaf its own range of face slots starting at block boundary,
+    // so leaf triangles are packed into whole blocks. STARTIDX of a leaf
+    // becomes block index (face index if blocks are not used), slots of the
+    // tree start at firstslot.
+    static void AssignFaceSlots(PlainBvhTranslator& translator, int block_size, int firstslot, std::vector<int>& slots)
+    {
+        slots.clear();
+
+        for (auto& node : translator.nodes_)
+        {
+            if (LEAFNODE(node.bounds))
+            {
+                int const startidx = STARTIDX(node.bounds);
+                int const numprims = NUMPRIMS(node.bounds);
+                int const leafslot = (int)slots.size();
+
+                for (int i = 0; i < std::max(numprims, 1); ++i)
+                {
+                    slots.push_back(startidx + i);
+                }
+
+                // Pad the last block with empty slots
+                slots.resize((slots.size() + block_size - 1) / block_size * block_size, -1);
+                node.bounds.pmin.w = (float)((((firstslot + leafslot) / block_size) << 4) | numprims);
+            }
+        }
+    }
+
+    // Fill faces in slot order. Here the point is to add shape starting index to actual index
+    // contained within the mesh, getting absolute index in the buffer. Besides that we need to
+    // permute the faces accordingly to BVH reordering. Vertex indices are shifted by firstvertex.
+    static void FillFaces(ShapeLayout const& layout, int firstvertex, std::vector<int> const& slots, int const* reordering, std::vector<Face>& faces)
+    {
+        int const numslots = (int)slots.size();
+        faces.resize(numslots);
+
+        task_scheduler::instance().parallel_for(0, numslots, kUploadGrainSize, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                // Padding slot
+                if (slots[i] == -1)
+                {
+                    faces[i].idx[0] = faces[i].idx[1] = faces[i].idx[2] = -1;
+                    faces[i].shape_id = -1;
+                    faces[i].prim_id = -1;
+                    continue;
+                }
+
+                int indextolook4 = reordering[slots[i]];
+
+                // We need to find a shape corresponding to current face
+                auto iter = std::upper_bound(layout.faces_start_idx.cbegin(), layout.faces_start_idx.cend(), indextolook4);
+                int shapeidx = static_cast<int>(std::distance(layout.faces_start_idx.cbegin(), iter) - 1);
+
+                Mesh::Face const* myfacedata = GetShapeMesh(layout.shapes[shapeidx])->GetFaceData();
+                int faceidx = indextolook4 - layout.faces_start_idx[shapeidx];
+                int mystartidx = layout.vertices_start_idx[shapeidx] + firstvertex;
+
+                faces[i].idx[0] = myfacedata[faceidx].idx[0] + mystartidx;
+                faces[i].idx[1] = myfacedata[faceidx].idx[1] + mystartidx;
+                faces[i].idx[2] = myfacedata[faceidx].idx[2] + mystartidx;
+
+                // Optimization: we are putting faceid here
+                faces[i].shape_id = layout.shapes[shapeidx]->GetId();
+                faces[i].prim_id = faceidx;
+            }
+        });
+    }
+
+    // Vertex indices of the faces, -1 for padding slots
+    static void CollectFaceIndices(std::vector<Face> const& faces, std::vector<int>& indices)
+    {
+        indices.resize(faces.size() * 3);
+        for (std::size_t i = 0; i < faces.size(); ++i)
+        {
+            std::copy(faces[i].idx, faces[i].idx + 3, &indices[i * 3]);
+        }
+    }
+
+    // Update node bounds keeping translator data stored in w components
+    static void SetNodeBounds(bbox& node, bbox const& bounds)
+    {
+        node.pmin.x = bounds.pmin.x;
+        node.pmin.y = bounds.pmin.y;
+        node.pmin.z = bounds.pmin.z;
+        node.pmax.x = bounds.pmax.x;
+        node.pmax.y = bounds.pmax.y;
+        node.pmax.z = bounds.pmax.z;
+    }
+
+    // Recompute node bounds bottom-up keeping topology: children are always stored after their parent,
+    // left child right next to it and right child at the skip link of the left one. Leaves left with
+    // padding only shrink to the center of their old bounds, so they cost nothing and are never hit.
+    static void RefitNodes(std::vector<float3> const& vertices, std::vector<int> const& indices, int block_size, std::vector<bbox>& nodes)
+    {
+        for (int addr = (int)nodes.size() - 1; addr >= 0; --addr)
+        {
+            bbox& node = nodes[addr];
+            bbox bounds;
+
+            if (LEAFNODE(node))
+            {
+                int const start = STARTIDX(node) * block_size;
+                int const numprims = std::max(NUMPRIMS(node), 1);
+                for (int f = start; f < start + numprims; ++f)
+                {
+                    if (indices[f * 3] == -1)
+                    {
+                        continue;
+                    }
+
+                    bounds.grow(vertices[indices[f * 3]]);
+                    bounds.grow(vertices[indices[f * 3 + 1]]);
+                    bounds.grow(vertices[indices[f * 3 + 2]]);
+                }
+
+                if (bounds.pmin.x > bounds.pmax.x)
+                {
+                    bounds = bbox(node.center());
+                }
+            }
+            else
+            {
+                bbox const& left = nodes[addr + 1];
+                bbox const& right = nodes[NEXT(left)];
+                bounds = bboxunion(left, right);
+            }
+
+            SetNodeBounds(node, bounds);
+        }
+    }
+
+    // Create node buffer or update its contents, quantizing nodes if requested
+    static void WriteNodes(Calc::Device* device, std::vector<bbox> const& nodes, bool quantized, Calc::Buffer*& buffer)
+    {
+        QuantizedBvhTranslator translator;
+        void const* data = nodes.data();
+        std::size_t size = nodes.size() * sizeof(bbox);
+
+        if (quantized)
+        {
+            translator.Process(nodes);
+            data = translator.nodes_.data();
+            size = translator.nodes_.size() * sizeof(QuantizedBvhTranslator::Node);
+        }
+
+        if (buffer)
+        {
+            device->WriteBuffer(buffer, 0, 0, size, const_cast<void*>(data), nullptr);
+        }
+        else
+        {
+            buffer = device->CreateBuffer(size, Calc::BufferType::kRead, const_cast<void*>(data));
+        }
+
+        // Host data goes away on return
+        device->Finish(0);
+    }
+
     struct IntersectorSkipLinks::GpuData
     {
         // Device
         Calc::Device* device;
         // BVH nodes
         Calc::Buffer* bvh;
-        // Vertex positions
-        Calc::Buffer* vertices;
+        // Leaf triangle blocks (vertex positions for Vulkan)
+        Calc::Buffer* geometry;
         // Indices
         Calc::Buffer* faces;
+        // Number of face slots per block, leaves start at block boundary
+        int triangle_block_size;
+        // Node format kernels have been compiled for
+        NodeFormat node_format;
 
         Calc::Executable* executable;
         Calc::Function* isect_func;
         Calc::Function* occlude_func;
         Calc::Function* occlude_func2d_sum_linear;
         Calc::Function* occlude_func2d_cell_string;
+        Calc::Function* occlude_func2d_sum_linear_contrib;
+        Calc::Function* occlude_func2d_sum_linear_reduce;
+        Calc::Function* occlude_func2d_cell_string_frustum;
+        Calc::Function* occlude_func2d_cell_string_init;
+        Calc::Function* occlude_func2d_cell_string_flat;
+        // Sky patch ray generation, OpenCL and host only
+        Calc::Function* occlude_func2d_sum_linear_sky;
+        Calc::Function* occlude_func2d_sum_linear_sky_contrib;
+        Calc::Function* occlude_func2d_cell_string_count;
+        // Leaf faces and triangle blocks for trees built on the device, OpenCL and host only
+        Calc::Function* emit_leaf_geometry_func;
+
+        // Parallel primitives (nullptr if not supported by the device)
+        Calc::Primitives* primitives;
+        // Cell-string lengths and their exclusive scan for flattened traversal
+        Calc::Buffer* cell_string_lengths;
+        Calc::Buffer* cell_string_offsets;
+        // Number of elements allocated in the buffers above
+        std::uint32_t cell_string_capacity;
+        // Per ray koef contributions for deterministic sum
+        Calc::Buffer* sum_linear_contribs;
+        // Number of rays allocated in the buffer above
+        std::uint32_t sum_linear_capacity;
 
         GpuData(Calc::Device* d)
             : device(d)
             , bvh(nullptr)
-            , vertices(nullptr)
+            , geometry(nullptr)
             , faces(nullptr)
+            , triangle_block_size(1)
+            , node_format(kNodeFormatFull)
             , executable(nullptr)
+            , occlude_func2d_sum_linear_sky(nullptr)
+            , occlude_func2d_sum_linear_sky_contrib(nullptr)
+            , occlude_func2d_cell_string_count(nullptr)
+            , emit_leaf_geometry_func(nullptr)
+            , primitives(nullptr)
+            , cell_string_lengths(nullptr)
+            , cell_string_offsets(nullptr)
+            , cell_string_capacity(0)
+            , sum_linear_contribs(nullptr)
+            , sum_linear_capacity(0)
         {
         }
 
         ~GpuData()
         {
             device->DeleteBuffer(bvh);
-            device->DeleteBuffer(vertices);
+            device->DeleteBuffer(geometry);
             device->DeleteBuffer(faces);
+            device->DeleteBuffer(cell_string_lengths);
+            device->DeleteBuffer(cell_string_offsets);
+            device->DeleteBuffer(sum_linear_contribs);
+            if (primitives)
+            {
+                device->DeletePrimitives(primitives);
+            }
+            DeleteKernels();
+        }
+
+        void DeleteKernels()
+        {
             if (executable)
             {
                 executable->DeleteFunction(isect_func);
                 executable->DeleteFunction(occlude_func);
                 executable->DeleteFunction(occlude_func2d_sum_linear);
+                executable->DeleteFunction(occlude_func2d_cell_string);
+                executable->DeleteFunction(occlude_func2d_sum_linear_contrib);
+                executable->DeleteFunction(occlude_func2d_sum_linear_reduce);
+                executable->DeleteFunction(occlude_func2d_cell_string_frustum);
+                executable->DeleteFunction(occlude_func2d_cell_string_init);
+                executable->DeleteFunction(occlude_func2d_cell_string_flat);
+                executable->DeleteFunction(occlude_func2d_sum_linear_sky);
+                executable->DeleteFunction(occlude_func2d_sum_linear_sky_contrib);
+                executable->DeleteFunction(occlude_func2d_cell_string_count);
+                executable->DeleteFunction(emit_leaf_geometry_func);
                 device->DeleteExecutable(executable);
+                executable = nullptr;
+                occlude_func2d_sum_linear_sky = nullptr;
+                occlude_func2d_sum_linear_sky_contrib = nullptr;
+                occlude_func2d_cell_string_count = nullptr;
+                emit_leaf_geometry_func = nullptr;
             }
         }
     };
@@ -83,7 +528,28 @@ namespace RadeonRays
         : Intersector(device)
         , m_gpudata(new GpuData(device))
         , m_bvh(nullptr)
+        , m_refit_threshold(1.5f)
+        , m_cell_string_traversal(kCellStringSerial)
+        , m_sum_linear_accumulation(kSumLinearAtomic)
+        , m_node_format(kNodeFormatFull)
+        , m_build_on_device(false)
     {
+        // GLSL kernels fetch vertices directly and intersect a single face per leaf
+        m_gpudata->triangle_block_size = device->GetPlatform() == Calc::Platform::kVulkan ? 1 : kTriangleBlockSize;
+
+        CompileKernels();
+
+        // Flattened cell-string traversal needs scan
+        if (m_device->HasBuiltinPrimitives())
+        {
+            m_gpudata->primitives = m_device->CreatePrimitives();
+        }
+    }
+
+    void IntersectorSkipLinks::CompileKernels()
+    {
+        m_gpudata->DeleteKernels();
+
         std::string buildopts;
 #ifdef RR_RAY_MASK
         buildopts.append("-D RR_RAY_MASK ");
@@ -96,320 +562,878 @@ namespace RadeonRays
 #ifdef USE_SAFE_MATH
         buildopts.append("-D USE_SAFE_MATH ");
 #endif
+
+        bool const quantized = m_node_format == kNodeFormatQuantized;
+        if (quantized)
+        {
+            buildopts.append("-D RR_QUANTIZED_NODES ");
+        }
         
+#if USE_HOST
+        // Host kernels are always compiled in
+        if (m_device->GetPlatform() == Calc::Platform::kHost)
+        {
+            m_gpudata->executable = quantized ?
+                static_cast<Calc::DeviceHost*>(m_device)->CreateExecutable(g_intersect_bvh2_skiplinks_quantized_host, g_intersect_bvh2_skiplinks_quantized_host_size) :
+                static_cast<Calc::DeviceHost*>(m_device)->CreateExecutable(g_intersect_bvh2_skiplinks_host, g_intersect_bvh2_skiplinks_host_size);
+        }
+#endif
+
 #ifndef RR_EMBED_KERNELS
-        if ( device->GetPlatform() == Calc::Platform::kOpenCL )
+        if ( m_gpudata->executable == nullptr && m_device->GetPlatform() == Calc::Platform::kOpenCL )
         {
             char const* headers[] = { "../RadeonRays/src/kernels/CL/common.cl" };
 
-            int numheaders = sizeof( headers ) / sizeof( char const* );
+            int numheaders = sizeof( headers ) / sizeof( char const* );
+
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, "../RadeonRays/src/kernels/CL/intersect_bvh2_skiplinks.cl", headers, numheaders, buildopts.c_str());
+        }
+        else if ( m_gpudata->executable == nullptr )
+        {
+            assert( m_device->GetPlatform() == Calc::Platform::kVulkan );
+            m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/GLSL/bvh.comp", nullptr, 0, buildopts.c_str());
+        }
+#else
+#if USE_OPENCL
+        if (m_gpudata->executable == nullptr && m_device->GetPlatform() == Calc::Platform::kOpenCL)
+        {
+            m_gpudata->executable = KernelCache::CompileExecutable(m_device, g_intersect_bvh2_skiplinks_opencl, std::strlen(g_intersect_bvh2_skiplinks_opencl), buildopts.c_str());
+        }
+#endif
+
+#if USE_VULKAN
+        if (m_gpudata->executable == nullptr && m_device->GetPlatform() == Calc::Platform::kVulkan)
+        {
+            m_gpudata->executable = m_device->CompileExecutable(g_bvh_vulkan, std::strlen(g_bvh_vulkan), buildopts.c_str());
+        }
+#endif
+#endif
+
+        assert(m_gpudata->executable);
+
+        m_gpudata->node_format = m_node_format;
+
+        m_gpudata->isect_func = m_gpudata->executable->CreateFunction("intersect_main");
+        m_gpudata->occlude_func = m_gpudata->executable->CreateFunction("occluded_main");
+        m_gpudata->occlude_func2d_sum_linear = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear");
+        m_gpudata->occlude_func2d_cell_string = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string");
+        m_gpudata->occlude_func2d_sum_linear_contrib = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear_contrib");
+        m_gpudata->occlude_func2d_sum_linear_reduce = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear_reduce");
+        m_gpudata->occlude_func2d_cell_string_frustum = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string_frustum");
+        m_gpudata->occlude_func2d_cell_string_init = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string_init");
+        m_gpudata->occlude_func2d_cell_string_flat = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string_flat");
+
+        if (m_device->GetPlatform() != Calc::Platform::kVulkan)
+        {
+            m_gpudata->occlude_func2d_sum_linear_sky = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear_sky");
+            m_gpudata->occlude_func2d_sum_linear_sky_contrib = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear_sky_contrib");
+            m_gpudata->occlude_func2d_cell_string_count = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string_count");
+            m_gpudata->emit_leaf_geometry_func = m_gpudata->executable->CreateFunction("emit_leaf_geometry_main");
+        }
+
+    }
+
+    void IntersectorSkipLinks::UpdateOptions(World const& world)
+    {
+        // Traversal mode does not affect the tree, so check it on every call
+        auto traversal = world.options_.GetOption("bvh.cellstring.traversal");
+        m_cell_string_traversal = kCellStringSerial;
+        if (traversal && traversal->AsString() == "frustum")
+        {
+            m_cell_string_traversal = kCellStringFrustum;
+        }
+        else if (traversal && traversal->AsString() == "flat" && m_gpudata->primitives)
+        {
+            m_cell_string_traversal = kCellStringFlat;
+        }
+
+        auto accumulation = world.options_.GetOption("bvh.sumlinear.accumulation");
+        m_sum_linear_accumulation = accumulation && accumulation->AsString() == "deterministic" ?
+            kSumLinearDeterministic : kSumLinearAtomic;
+
+        auto refit = world.options_.GetOption("bvh.refit.sah_threshold");
+        m_refit_threshold = refit ? refit->AsFloat() : 1.5f;
+
+        // GLSL kernels only support full precision nodes
+        auto format = world.options_.GetOption("bvh.node_format");
+        m_node_format = format && format->AsString() == "quantized" && m_device->GetPlatform() != Calc::Platform::kVulkan ?
+            kNodeFormatQuantized : kNodeFormatFull;
+
+        // Device builder needs parallel primitives, GLSL has no skip links emission.
+        // Nodes are emitted on the device, so they are never quantized.
+        auto builder = world.options_.GetOption("bvh.builder");
+        m_build_on_device = builder && builder->AsString() == "hlbvh" &&
+            m_device->GetPlatform() != Calc::Platform::kVulkan && m_device->HasBuiltinPrimitives();
+        if (m_build_on_device)
+        {
+            m_node_format = kNodeFormatFull;
+        }
+    }
+
+    Bvh* IntersectorSkipLinks::CreateBvh(World const& world) const
+    {
+        // Check options
+        auto builder = world.options_.GetOption("bvh.builder");
+        auto splits = world.options_.GetOption("bvh.sah.use_splits");
+        auto maxdepth = world.options_.GetOption("bvh.sah.max_split_depth");
+        auto overlap = world.options_.GetOption("bvh.sah.min_overlap");
+        auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
+        auto node_budget = world.options_.GetOption("bvh.sah.extra_node_budget");
+        auto nbins = world.options_.GetOption("bvh.sah.num_bins");
+        auto leafprims = world.options_.GetOption("bvh.max_leaf_prims");
+
+        bool use_sah = false;
+        bool use_splits = false;
+        int max_split_depth = maxdepth ? (int)maxdepth->AsFloat() : 10;
+        int num_bins = nbins ? (int)nbins->AsFloat() : 64;
+        float min_overlap = overlap ? overlap->AsFloat() : 0.05f;
+        float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
+        float extra_node_budget = node_budget ? node_budget->AsFloat() : 0.5f;
+        // Leaf size is limited by 4 bits of NUMPRIMS, single face leaves if blocks are not used
+        int max_leaf_prims = leafprims ? (int)leafprims->AsFloat() : kTriangleBlockSize;
+        max_leaf_prims = m_gpudata->triangle_block_size > 1 ? std::min(std::max(max_leaf_prims, 1), 15) : 1;
+
+        if (builder && builder->AsString() == "sah")
+        {
+            use_sah = true;
+        }
+
+        if (splits && splits->AsFloat() > 0.f)
+        {
+            use_splits = true;
+        }
+
+        return use_splits ?
+            new SplitBvh(traversal_cost, num_bins, max_split_depth, min_overlap, extra_node_budget, max_leaf_prims) :
+            new Bvh(traversal_cost, num_bins, use_sah, max_leaf_prims);
+    }
+
+    void IntersectorSkipLinks::Process(World const& world)
+    {
+        UpdateOptions(world);
+
+        int statechange = world.GetStateChange();
+        bool const format_changed = m_node_format != m_gpudata->node_format;
+
+        // If something has been changed we need to rebuild BVH
+        if (!m_gpudata->bvh || world.has_changed() || statechange != ShapeImpl::kStateChangeNone || format_changed)
+        {
+            if (m_gpudata->bvh && !format_changed)
+            {
+                bool const can_refit = m_refitdata && m_refit_threshold > 0.f;
+
+                // IDs are only stored in faces
+                if (!world.has_changed() && statechange == ShapeImpl::kStateChangeId)
+                {
+                    UpdateShapeIds(world);
+                    return;
+                }
+
+                // Moving shapes around does not change topology, so try to refit first
+                if (can_refit && !world.has_changed() &&
+                    (statechange & ~ShapeImpl::kStateChangeId) == ShapeImpl::kStateChangeTransform && Refit(world))
+                {
+                    if (statechange & ShapeImpl::kStateChangeId)
+                    {
+                        UpdateShapeIds(world);
+                    }
+
+                    return;
+                }
+
+                // Attached shapes go to a separate subtree if the rest of the scene is intact
+                if (can_refit && !world.shapes_added_.empty() && world.shapes_removed_.empty() && Append(world))
+                {
+                    return;
+                }
+
+                // Detached shapes turn into padding slots, the tree only shrinks around the rest
+                if (can_refit && world.shapes_added_.empty() && !world.shapes_removed_.empty() && Detach(world))
+                {
+                    return;
+                }
+            }
+
+            if (format_changed)
+            {
+                CompileKernels();
+            }
+
+            if (m_gpudata->bvh)
+            {
+                m_device->DeleteBuffer(m_gpudata->bvh);
+                m_device->DeleteBuffer(m_gpudata->geometry);
+                m_device->DeleteBuffer(m_gpudata->faces);
+                m_gpudata->bvh = nullptr;
+            }
+
+            if (m_build_on_device)
+            {
+                BuildOnDevice(world);
+                return;
+            }
+
+            // This tracks shape start indices for next stage as mesh face indices are relative to 0
+            ShapeLayout layout;
+            CalculateShapeLayout(world, layout);
+
+            int const numvertices = layout.numvertices;
+            int const numfaces = layout.numfaces;
+            int const block_size = m_gpudata->triangle_block_size;
+
+            auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
+            float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
+
+            m_bvh.reset(CreateBvh(world));
+
+            // We can't avoild allocating it here, since bounds aren't stored anywhere
+            std::vector<bbox> bounds;
+            CollectFaceBounds(layout, bounds);
+
+            // World space vertices don't depend on the BVH, so without triangle blocks
+            // they are uploaded while the BVH is being built
+            std::vector<float3> vertices;
+            CollectVertices(layout, vertices);
+
+            if (block_size == 1)
+            {
+                m_gpudata->geometry = m_device->CreateBuffer(numvertices * sizeof(float3), Calc::BufferType::kRead);
+                m_device->WriteBuffer(m_gpudata->geometry, 0, 0, numvertices * sizeof(float3), vertices.data(), nullptr);
+            }
+
+            m_bvh->Build(&bounds[0], numfaces);
+
+            // Keep host copies for refits unless those are disabled
+            if (m_refit_threshold > 0.f)
+            {
+                m_refitdata.reset(new RefitData);
+                m_refitdata->shapes = layout.shapes;
+                m_refitdata->vertices_start_idx = layout.vertices_start_idx;
+                m_refitdata->traversal_cost = traversal_cost;
+            }
+            else
+            {
+                m_refitdata.reset();
+            }
+
+#ifdef RR_PROFILE
+            m_bvh->PrintStatistics(std::cout);
+#endif
+            PlainBvhTranslator translator;
+            translator.Process(*m_bvh);
+
+            std::vector<int> slots;
+            AssignFaceSlots(translator, block_size, 0, slots);
+
+            std::vector<bbox> nodes(translator.nodes_.size());
+            std::transform(translator.nodes_.cbegin(), translator.nodes_.cend(), nodes.begin(),
+                [](PlainBvhTranslator::Node const& node) { return node.bounds; });
+
+            // Update GPU data
+            // Copy translated nodes first
+            WriteNodes(m_device, nodes, m_gpudata->node_format == kNodeFormatQuantized, m_gpudata->bvh);
+
+            if (m_refitdata)
+            {
+                m_refitdata->build_cost = CalculateSahCost(nodes, traversal_cost);
+                m_refitdata->nodes = std::move(nodes);
+            }
+
+            // Create face buffer
+            std::vector<Face> faces;
+            FillFaces(layout, 0, slots, m_bvh->GetIndices(), faces);
+            m_gpudata->faces = m_device->CreateBuffer(faces.size() * sizeof(Face), Calc::BufferType::kRead, &faces[0]);
+
+            std::vector<int> indices;
+            CollectFaceIndices(faces, indices);
+
+            // Create geometry buffer
+            if (block_size > 1)
+            {
+                std::vector<TriangleBlock> blocks;
+                BuildTriangleBlocks(vertices, indices, blocks);
+                m_gpudata->geometry = m_device->CreateBuffer(blocks.size() * sizeof(TriangleBlock), Calc::BufferType::kRead, &blocks[0]);
+            }
+
+            // Moving keeps the storage the geometry upload reads from alive until Finish
+            if (m_refitdata)
+            {
+                m_refitdata->vertices = std::move(vertices);
+                m_refitdata->indices = std::move(indices);
+            }
+
+            // Make sure everything is commited
+            m_device->Finish(0);
+        }
+    }
+
+    void IntersectorSkipLinks::BuildOnDevice(World const& world)
+    {
+        ShapeLayout layout;
+        CalculateShapeLayout(world, layout);
+
+        int const numvertices = layout.numvertices;
+        int const numfaces = layout.numfaces;
+
+        ThrowIf(numfaces == 0, "Device BVH builder requires at least one face");
+
+        if (!m_hlbvh)
+        {
+            m_hlbvh.reset(new Hlbvh(m_device));
+        }
+
+        std::vector<bbox> bounds;
+        CollectFaceBounds(layout, bounds);
+
+        m_hlbvh->Build(&bounds[0], numfaces);
+
+        // Trade build time for SAH quality
+        auto iterations = world.options_.GetOption("bvh.hlbvh.restructure_iterations");
+        if (iterations && iterations->AsFloat() > 0.f)
+        {
+            m_hlbvh->RestructureTreelets((int)iterations->AsFloat());
+        }
+
+        // Faces stay in world order, leaves refer to them through sorted primitive indices
+        std::vector<float3> vertices;
+        CollectVertices(layout, vertices);
+
+        std::vector<int> identity(numfaces);
+        std::iota(identity.begin(), identity.end(), 0);
+
+        std::vector<Face> faces;
+        FillFaces(layout, 0, identity, &identity[0], faces);
+
+        auto vertex_buffer = m_device->CreateBuffer(numvertices * sizeof(float3), Calc::BufferType::kRead, &vertices[0]);
+        auto face_buffer = m_device->CreateBuffer(numfaces * sizeof(Face), Calc::BufferType::kRead, &faces[0]);
+
+        // Subtrees of up to a block of faces are collapsed into a leaf, which
+        // takes a single block, so leaf count is needed before allocation
+        int const block_size = m_gpudata->triangle_block_size;
+        int numleaves = m_hlbvh->CountSkipLinksLeaves(block_size);
+        auto leaf_prims = m_device->CreateBuffer(numleaves * block_size * sizeof(int), Calc::BufferType::kWrite);
+        m_gpudata->bvh = m_device->CreateBuffer((2 * numleaves - 1) * sizeof(bbox), Calc::BufferType::kRead);
+        m_gpudata->faces = m_device->CreateBuffer(numleaves * block_size * sizeof(Face), Calc::BufferType::kRead);
+        m_gpudata->geometry = m_device->CreateBuffer(numleaves * sizeof(TriangleBlock), Calc::BufferType::kRead);
+
+        m_hlbvh->EmitSkipLinks(m_gpudata->bvh, leaf_prims, block_size);
+
+        auto& func = m_gpudata->emit_leaf_geometry_func;
+        int arg = 0;
+        func->SetArg(arg++, face_buffer);
+        func->SetArg(arg++, leaf_prims);
+        func->SetArg(arg++, sizeof(numleaves), &numleaves);
+        func->SetArg(arg++, vertex_buffer);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, m_gpudata->geometry);
+
+        std::size_t globalsize = ((numleaves + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+        m_device->Execute(func, 0, globalsize, kWorkGroupSize, nullptr);
+
+        // Make sure everything is commited
+        m_device->Finish(0);
+
+        m_device->DeleteBuffer(leaf_prims);
+        m_device->DeleteBuffer(vertex_buffer);
+        m_device->DeleteBuffer(face_buffer);
+
+        // Host tree and copies are not available for refits
+        m_bvh.reset();
+        m_refitdata.reset();
+    }
+
+    void IntersectorSkipLinks::UpdateShapeIds(World const& world)
+    {
+        // Shapes have not been attached or detached, so layout is the one faces have been built for
+        ShapeLayout layout;
+        CalculateShapeLayout(world, layout);
+
+        int const numshapes = (int)layout.shapes.size();
+        std::vector<char> dirty(numshapes);
+        for (int i = 0; i < numshapes; ++i)
+        {
+            dirty[i] = (static_cast<ShapeImpl const*>(layout.shapes[i])->GetStateChange() & ShapeImpl::kStateChangeId) != 0;
+        }
+
+        int const numslots = (int)(m_gpudata->faces->GetSize() / sizeof(Face));
+        std::vector<Face> faces(numslots);
+        m_device->ReadBuffer(m_gpudata->faces, 0, 0, numslots * sizeof(Face), &faces[0], nullptr);
+        m_device->Finish(0);
+
+        // Faces are in leaf order, find owning shape by the first vertex
+        task_scheduler::instance().parallel_for(0, numslots, kUploadGrainSize, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                if (faces[i].idx[0] == -1)
+                {
+                    continue;
+                }
+
+                auto iter = std::upper_bound(layout.vertices_start_idx.cbegin(), layout.vertices_start_idx.cend(), faces[i].idx[0]);
+                int shapeidx = static_cast<int>(std::distance(layout.vertices_start_idx.cbegin(), iter) - 1);
+
+                if (dirty[shapeidx])
+                {
+                    faces[i].shape_id = layout.shapes[shapeidx]->GetId();
+                }
+            }
+        });
+
+        m_device->WriteBuffer(m_gpudata->faces, 0, 0, numslots * sizeof(Face), &faces[0], nullptr);
+
+        // Make sure everything is commited
+        m_device->Finish(0);
+    }
+
+    bool IntersectorSkipLinks::Append(World const& world)
+    {
+        auto& data = *m_refitdata;
+        int const numoldshapes = (int)data.shapes.size();
+
+        // Attached shapes are at the end of the world, the rest must be intact
+        if (world.shapes_.size() <= data.shapes.size() ||
+            !std::equal(data.shapes.cbegin(), data.shapes.cend(), world.shapes_.cbegin()))
+        {
+            return false;
+        }
+
+        for (auto shape : data.shapes)
+        {
+            if (static_cast<ShapeImpl const*>(shape)->GetStateChange() != ShapeImpl::kStateChangeNone)
+            {
+                return false;
+            }
+        }
+
+        ShapeLayout layout;
+        CalculateShapeLayout(std::vector<Shape const*>(world.shapes_.cbegin() + numoldshapes, world.shapes_.cend()), layout);
+
+        if (layout.numfaces == 0)
+        {
+            return false;
+        }
+
+        int const block_size = m_gpudata->triangle_block_size;
+        int const firstvertex = (int)data.vertices.size();
+        int const firstslot = (int)data.indices.size() / 3;
+        int const numoldnodes = (int)data.nodes.size();
+
+        // Build the subtree for attached shapes only
+        std::vector<bbox> bounds;
+        CollectFaceBounds(layout, bounds);
+
+        std::unique_ptr<Bvh> bvh(CreateBvh(world));
+        bvh->Build(&bounds[0], layout.numfaces);
+
+        PlainBvhTranslator translator;
+        translator.Process(*bvh);
+
+        std::vector<int> slots;
+        AssignFaceSlots(translator, block_size, firstslot, slots);
+
+        std::vector<bbox> subtree(translator.nodes_.size());
+        std::transform(translator.nodes_.cbegin(), translator.nodes_.cend(), subtree.begin(),
+            [](PlainBvhTranslator::Node const& node) { return node.bounds; });
+
+        // New root has the old tree as its left child and the subtree as the right one.
+        // Old tree is shifted by one node and its traversal continues in the subtree.
+        int const rightidx = numoldnodes + 1;
+        std::vector<bbox> nodes(rightidx + subtree.size());
+
+        bbox root;
+        SetNodeBounds(root, bboxunion(data.nodes[0], subtree[0]));
+        root.pmin.w = -1.f;
+        root.pmax.w = -1.f;
+        nodes[0] = root;
+
+        for (int i = 0; i < numoldnodes; ++i)
+        {
+            nodes[i + 1] = data.nodes[i];
+            nodes[i + 1].pmax.w = (float)(NEXT(data.nodes[i]) == -1 ? rightidx : NEXT(data.nodes[i]) + 1);
+        }
+
+        for (int i = 0; i < (int)subtree.size(); ++i)
+        {
+            nodes[rightidx + i] = subtree[i];
+            nodes[rightidx + i].pmax.w = (float)(NEXT(subtree[i]) == -1 ? -1 : NEXT(subtree[i]) + rightidx);
+        }
 
-            m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/CL/intersect_bvh2_skiplinks.cl", headers, numheaders, buildopts.c_str());
+        // Joined cost is the sum of both trees and the new root, so it can't see overlap on its own.
+        // Rays entering the overlap of the two roots traverse both trees, while a rebuild would
+        // partition that region. Estimate the saving of a rebuild from the overlap area and the
+        // cheaper per area cost of the two trees and rebuild everything if appending loses too much.
+        float const old_cost = CalculateSahCost(data.nodes, data.traversal_cost);
+        float const subtree_cost = CalculateSahCost(subtree, data.traversal_cost);
+        float const overlap_area = intersects(data.nodes[0], subtree[0]) ?
+            intersection(data.nodes[0], subtree[0]).surface_area() : 0.f;
+        float const old_area = data.nodes[0].surface_area();
+        float const subtree_area = subtree[0].surface_area();
+        float const rebuild_saving = overlap_area *
+            std::min(old_area > 0.f ? old_cost / old_area : 0.f, subtree_area > 0.f ? subtree_cost / subtree_area : 0.f);
+
+        if (CalculateSahCost(nodes, data.traversal_cost) > (data.build_cost + subtree_cost - rebuild_saving) * m_refit_threshold)
+        {
+            return false;
         }
-        else
+
+        // Faces of the old tree are not kept on host
+        std::vector<Face> faces(firstslot);
+        if (firstslot > 0)
         {
-            assert( device->GetPlatform() == Calc::Platform::kVulkan );
-            m_gpudata->executable = m_device->CompileExecutable( "../RadeonRays/src/kernels/GLSL/bvh.comp", nullptr, 0, buildopts.c_str());
+            m_device->ReadBuffer(m_gpudata->faces, 0, 0, firstslot * sizeof(Face), &faces[0], nullptr);
+            m_device->Finish(0);
         }
-#else
-#if USE_OPENCL
-        if (device->GetPlatform() == Calc::Platform::kOpenCL)
+
+        std::vector<Face> newfaces;
+        FillFaces(layout, firstvertex, slots, bvh->GetIndices(), newfaces);
+        faces.insert(faces.end(), newfaces.cbegin(), newfaces.cend());
+
+        std::vector<int> newindices;
+        CollectFaceIndices(newfaces, newindices);
+
+        std::vector<float3> newvertices;
+        CollectVertices(layout, newvertices);
+
+        // Update host copies
+        for (int i = 0; i < (int)layout.shapes.size(); ++i)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_intersect_bvh2_skiplinks_opencl, std::strlen(g_intersect_bvh2_skiplinks_opencl), buildopts.c_str());
+            data.shapes.push_back(layout.shapes[i]);
+            data.vertices_start_idx.push_back(layout.vertices_start_idx[i] + firstvertex);
         }
-#endif
 
-#if USE_VULKAN
-        if (m_gpudata->executable == nullptr && device->GetPlatform() == Calc::Platform::kVulkan)
+        data.vertices.insert(data.vertices.end(), newvertices.cbegin(), newvertices.cend());
+        data.indices.insert(data.indices.end(), newindices.cbegin(), newindices.cend());
+        data.nodes = std::move(nodes);
+        data.build_cost += subtree_cost;
+
+        // Buffers grow, so recreate them
+        m_device->DeleteBuffer(m_gpudata->bvh);
+        m_device->DeleteBuffer(m_gpudata->geometry);
+        m_device->DeleteBuffer(m_gpudata->faces);
+        m_gpudata->bvh = nullptr;
+
+        WriteNodes(m_device, data.nodes, m_gpudata->node_format == kNodeFormatQuantized, m_gpudata->bvh);
+        m_gpudata->faces = m_device->CreateBuffer(faces.size() * sizeof(Face), Calc::BufferType::kRead, &faces[0]);
+
+        if (block_size > 1)
         {
-            m_gpudata->executable = m_device->CompileExecutable(g_bvh_vulkan, std::strlen(g_bvh_vulkan), buildopts.c_str());
+            std::vector<TriangleBlock> blocks;
+            BuildTriangleBlocks(data.vertices, data.indices, blocks);
+            m_gpudata->geometry = m_device->CreateBuffer(blocks.size() * sizeof(TriangleBlock), Calc::BufferType::kRead, &blocks[0]);
+        }
+        else
+        {
+            m_gpudata->geometry = m_device->CreateBuffer(data.vertices.size() * sizeof(float3), Calc::BufferType::kRead, &data.vertices[0]);
         }
-#endif
-#endif
 
-        assert(m_gpudata->executable);
+        // Make sure everything is commited
+        m_device->Finish(0);
 
-        m_gpudata->isect_func = m_gpudata->executable->CreateFunction("intersect_main");
-        m_gpudata->occlude_func = m_gpudata->executable->CreateFunction("occluded_main");
-        m_gpudata->occlude_func2d_sum_linear = m_gpudata->executable->CreateFunction("occluded_main_2d_sum_linear");
-        m_gpudata->occlude_func2d_cell_string = m_gpudata->executable->CreateFunction("occluded_main_2d_cell_string");
+        return true;
     }
 
-    void IntersectorSkipLinks::Process(World const& world)
+    bool IntersectorSkipLinks::Detach(World const& world)
     {
-        // If something has been changed we need to rebuild BVH
-        if (!m_bvh || world.has_changed() || world.GetStateChange() != ShapeImpl::kStateChangeNone)
+        auto& data = *m_refitdata;
+        int const block_size = m_gpudata->triangle_block_size;
+        int const numoldshapes = (int)data.shapes.size();
+
+        // Without triangle blocks there are no padding slots to put detached faces into
+        if (block_size == 1)
+        {
+            return false;
+        }
+
+        // Remaining shapes must keep their order and be intact
+        std::vector<int> remap(numoldshapes, -1);
+        int numshapes = 0;
+        for (int i = 0; i < numoldshapes && numshapes < (int)world.shapes_.size(); ++i)
         {
-            if (m_bvh)
+            if (data.shapes[i] == world.shapes_[numshapes])
             {
-                m_device->DeleteBuffer(m_gpudata->bvh);
-                m_device->DeleteBuffer(m_gpudata->vertices);
-                m_device->DeleteBuffer(m_gpudata->faces);
+                remap[i] = numshapes++;
             }
+        }
 
-            int numshapes = (int)world.shapes_.size();
-            int numvertices = 0;
-            int numfaces = 0;
-
-            // This buffer tracks mesh start index for next stage as mesh face indices are relative to 0
-            std::vector<int> mesh_vertices_start_idx(numshapes);
-            std::vector<int> mesh_faces_start_idx(numshapes);
-
-            // Check options
-            auto builder = world.options_.GetOption("bvh.builder");
-            auto splits = world.options_.GetOption("bvh.sah.use_splits");
-            auto maxdepth = world.options_.GetOption("bvh.sah.max_split_depth");
-            auto overlap = world.options_.GetOption("bvh.sah.min_overlap");
-            auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
-            auto node_budget = world.options_.GetOption("bvh.sah.extra_node_budget");
-            auto nbins = world.options_.GetOption("bvh.sah.num_bins");
-
-            bool use_sah = false;
-            bool use_splits = false;
-            int max_split_depth = maxdepth ? (int)maxdepth->AsFloat() : 10;
-            int num_bins = nbins ? (int)nbins->AsFloat() : 64;
-            float min_overlap = overlap ? overlap->AsFloat() : 0.05f;
-            float traversal_cost = tcost ? tcost->AsFloat() : 10.f;
-            float extra_node_budget = node_budget ? node_budget->AsFloat() : 0.5f;
+        if (numshapes != (int)world.shapes_.size())
+        {
+            return false;
+        }
 
-            if (builder && builder->AsString() == "sah")
+        for (auto shape : world.shapes_)
+        {
+            if (static_cast<ShapeImpl const*>(shape)->GetStateChange() != ShapeImpl::kStateChangeNone)
             {
-                use_sah = true;
+                return false;
             }
+        }
 
-            if (splits && splits->AsFloat() > 0.f)
+        // Compact vertices of remaining shapes
+        std::vector<int> vertices_start_idx(numshapes);
+        std::vector<float3> vertices;
+        for (int i = 0; i < numoldshapes; ++i)
+        {
+            if (remap[i] == -1)
             {
-                use_splits = true;
+                continue;
             }
 
-            m_bvh.reset( use_splits ?
-                new SplitBvh(traversal_cost, num_bins, max_split_depth, min_overlap, extra_node_budget) :
-                new Bvh(traversal_cost, num_bins, use_sah)
-            );
+            int const start = data.vertices_start_idx[i];
+            int const end = i + 1 < numoldshapes ? data.vertices_start_idx[i + 1] : (int)data.vertices.size();
+            vertices_start_idx[remap[i]] = (int)vertices.size();
+            vertices.insert(vertices.end(), data.vertices.cbegin() + start, data.vertices.cbegin() + end);
+        }
 
-            // Partition the array into meshes and instances
-            std::vector<Shape const*> shapes(world.shapes_);
+        // Faces are not kept on host
+        int const numslots = (int)data.indices.size() / 3;
+        std::vector<Face> faces(numslots);
+        m_device->ReadBuffer(m_gpudata->faces, 0, 0, numslots * sizeof(Face), &faces[0], nullptr);
+        m_device->Finish(0);
 
-            auto firstinst = std::partition(shapes.begin(), shapes.end(),
-                [&](Shape const* shape)
+        // Turn faces of detached shapes into padding and move the rest to compacted vertices
+        int numdead = 0;
+        int numlive = 0;
+        for (auto& face : faces)
+        {
+            if (face.idx[0] == -1)
             {
-                return !static_cast<ShapeImpl const*>(shape)->is_instance();
-            });
+                continue;
+            }
 
-            // Count the number of meshes
-            int nummeshes = (int)std::distance(shapes.begin(), firstinst);
-            // Count the number of instances
-            int numinstances = (int)std::distance(firstinst, shapes.end());
+            int const shapeidx = (int)(std::upper_bound(data.vertices_start_idx.cbegin(), data.vertices_start_idx.cend(), face.idx[0]) -
+                data.vertices_start_idx.cbegin()) - 1;
 
-            for (int i = 0; i < nummeshes; ++i)
+            if (remap[shapeidx] == -1)
             {
-                Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
+                face.idx[0] = face.idx[1] = face.idx[2] = -1;
+                face.shape_id = -1;
+                face.prim_id = -1;
+                ++numdead;
+            }
+            else
+            {
+                int const offset = vertices_start_idx[remap[shapeidx]] - data.vertices_start_idx[shapeidx];
+                face.idx[0] += offset;
+                face.idx[1] += offset;
+                face.idx[2] += offset;
+                ++numlive;
+            }
+        }
 
-                mesh_faces_start_idx[i] = numfaces;
-                mesh_vertices_start_idx[i] = numvertices;
+        // Dead slots are still visited by rays going through their leaves, rebuild once there are too many
+        numdead += data.num_dead_faces;
+        if (numlive == 0 || numdead > numlive * (m_refit_threshold - 1.f))
+        {
+            return false;
+        }
 
-                numfaces += mesh->num_faces();
-                numvertices += mesh->num_vertices();
-            }
+        // Update host copies
+        data.shapes = world.shapes_;
+        data.vertices_start_idx = std::move(vertices_start_idx);
+        data.vertices = std::move(vertices);
+        data.num_dead_faces = numdead;
+        CollectFaceIndices(faces, data.indices);
+        RefitNodes(data.vertices, data.indices, block_size, data.nodes);
+
+        // Slot count doesn't change, so buffers are reused
+        std::vector<TriangleBlock> blocks;
+        BuildTriangleBlocks(data.vertices, data.indices, blocks);
+        m_device->WriteBuffer(m_gpudata->geometry, 0, 0, blocks.size() * sizeof(TriangleBlock), &blocks[0], nullptr);
+        m_device->WriteBuffer(m_gpudata->faces, 0, 0, numslots * sizeof(Face), &faces[0], nullptr);
+        WriteNodes(m_device, data.nodes, m_gpudata->node_format == kNodeFormatQuantized, m_gpudata->bvh);
+
+        // Make sure everything is commited
+        m_device->Finish(0);
+
+        return true;
+    }
 
-            for (int i = nummeshes; i < nummeshes + numinstances; ++i)
-            {
-                Instance const* instance = static_cast<Instance const*>(shapes[i]);
-                Mesh const* mesh = static_cast<Mesh const*>(instance->GetBaseShape());
+    char const* IntersectorSkipLinks::GetAccelerationStructureType() const
+    {
+        return "bvh";
+    }
 
-                mesh_faces_start_idx[i] = numfaces;
-                mesh_vertices_start_idx[i] = numvertices;
+    // Sections of saved acceleration structure
+    enum SkipLinksSection
+    {
+        // Number of face slots per triangle block and node format
+        kSectionLayout,
+        // Translated nodes
+        kSectionNodes,
+        // Faces in leaf slot order
+        kSectionFaces,
+        // Geometry buffer as uploaded to the device
+        kSectionGeometry,
+        // World space vertices for refits
+        kSectionVertices
+    };
 
-                numfaces += mesh->num_faces();
-                numvertices += mesh->num_vertices();
-            }
+    void IntersectorSkipLinks::Save(World const& world, AccelerationStructureWriter& writer) const
+    {
+        ThrowIf(!m_gpudata->bvh, "Acceleration structure has not been built");
 
-            // We can't avoild allocating it here, since bounds aren't stored anywhere
-            std::vector<bbox> bounds(numfaces);
+        // Blocks keep vertices in a form not suitable for refits, so store them as well
+        ShapeLayout layout;
+        CalculateShapeLayout(world, layout);
 
-            // We handle meshes first collecting their world space bounds
-#pragma omp parallel for
-            for (int i = 0; i < nummeshes; ++i)
-            {
-                Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
+        std::vector<float3> vertices;
+        CollectVertices(layout, vertices);
 
-                for (int j = 0; j < mesh->num_faces(); ++j)
-                {
-                    // Here we directly get world space bounds
-                    mesh->GetFaceBounds(j, false, bounds[mesh_faces_start_idx[i] + j]);
-                }
-            }
+        writer.AddSection(std::vector<int>{ m_gpudata->triangle_block_size, (int)m_gpudata->node_format });
+        writer.AddSection(m_device, m_gpudata->bvh);
+        writer.AddSection(m_device, m_gpudata->faces);
+        writer.AddSection(m_device, m_gpudata->geometry);
+        writer.AddSection(vertices);
+    }
 
-            // Then we handle instances. Need to flatten them into actual geometry.
-#pragma omp parallel for
-            for (int i = nummeshes; i < nummeshes + numinstances; ++i)
-            {
-                Instance const* instance = static_cast<Instance const*>(shapes[i]);
-                Mesh const* mesh = static_cast<Mesh const*>(instance->GetBaseShape());
+    void IntersectorSkipLinks::Load(World const& world, AccelerationStructureReader const& reader)
+    {
+        UpdateOptions(world);
 
-                // Instance is using its own transform for base shape geometry
-                // so we need to get object space bounds and transform them manually
-                matrix m, minv;
-                instance->GetTransform(m, minv);
+        std::vector<int> layout_info;
+        reader.GetSection(kSectionLayout, layout_info);
+        ThrowIf(layout_info.size() != 2 || layout_info[0] != m_gpudata->triangle_block_size,
+            "Acceleration structure has been saved on a device of different type");
+        ThrowIf(layout_info[1] != m_node_format, "Acceleration structure has been saved with different node format");
 
-                for (int j = 0; j < mesh->num_faces(); ++j)
-                {
-                    bbox tmp;
-                    mesh->GetFaceBounds(j, true, tmp);
-                    bounds[mesh_faces_start_idx[i] + j] = transform_bbox(tmp, m);
-                }
-            }
+        ShapeLayout layout;
+        CalculateShapeLayout(world, layout);
 
-            m_bvh->Build(&bounds[0], numfaces);
+        std::vector<float3> vertices;
+        reader.GetSection(kSectionVertices, vertices);
+        ThrowIf((int)vertices.size() != layout.numvertices, "Acceleration structure file is corrupted");
 
-#ifdef RR_PROFILE
-            m_bvh->PrintStatistics(std::cout);
-#endif
-            PlainBvhTranslator translator;
-            translator.Process(*m_bvh);
+        if (m_gpudata->bvh)
+        {
+            m_device->DeleteBuffer(m_gpudata->bvh);
+            m_device->DeleteBuffer(m_gpudata->geometry);
+            m_device->DeleteBuffer(m_gpudata->faces);
+        }
 
-            // Update GPU data
-            // Copy translated nodes first
-            m_gpudata->bvh = m_device->CreateBuffer(translator.nodes_.size() * sizeof(PlainBvhTranslator::Node), Calc::BufferType::kRead, &translator.nodes_[0]);
+        // Tree is not needed for queries
+        m_bvh.reset();
 
-            // Create vertex buffer
-            {
-                // Vertices
-                m_gpudata->vertices = m_device->CreateBuffer(numvertices * sizeof(float3), Calc::BufferType::kRead);
+        if (m_node_format != m_gpudata->node_format)
+        {
+            CompileKernels();
+        }
 
-                // Get the pointer to mapped data
-                float3* vertexdata = nullptr;
-                Calc::Event* e = nullptr;
-                m_device->MapBuffer(m_gpudata->vertices, 0, 0, numvertices * sizeof(float3), Calc::MapType::kMapWrite, (void**)&vertexdata, &e);
+        m_gpudata->bvh = reader.CreateBuffer(m_device, kSectionNodes);
+        m_gpudata->faces = reader.CreateBuffer(m_device, kSectionFaces);
+        m_gpudata->geometry = reader.CreateBuffer(m_device, kSectionGeometry);
 
-                e->Wait();
-                m_device->DeleteEvent(e);
+        // Restore host copies for refits unless those are disabled
+        if (m_refit_threshold > 0.f)
+        {
+            auto tcost = world.options_.GetOption("bvh.sah.traversal_cost");
 
-                // Here we need to put data in world space rather than object space
-                // So we need to get the transform from the mesh and multiply each vertex
-                matrix m, minv;
+            m_refitdata.reset(new RefitData);
+            m_refitdata->shapes = layout.shapes;
+            m_refitdata->vertices_start_idx = layout.vertices_start_idx;
+            m_refitdata->vertices = std::move(vertices);
+            m_refitdata->traversal_cost = tcost ? tcost->AsFloat() : 10.f;
 
-#pragma omp parallel for
-                for (int i = 0; i < nummeshes; ++i)
-                {
-                    // Get the mesh
-                    Mesh const* mesh = static_cast<Mesh const*>(shapes[i]);
-                    // Get vertex buffer of the current mesh
-                    float3 const* myvertexdata = mesh->GetVertexData();
-                    // Get mesh transform
-                    mesh->GetTransform(m, minv);
-
-                    //#pragma omp parallel for
-                    // Iterate thru vertices multiply and append them to GPU buffer
-                    for (int j = 0; j < mesh->num_vertices(); ++j)
-                    {
-                        vertexdata[mesh_vertices_start_idx[i] + j] = transform_point(myvertexdata[j], m);
-                    }
-                }
+            std::vector<Face> faces;
+            reader.GetSection(kSectionFaces, faces);
+            m_refitdata->indices.resize(faces.size() * 3);
+            for (std::size_t i = 0; i < faces.size(); ++i)
+            {
+                std::copy(faces[i].idx, faces[i].idx + 3, &m_refitdata->indices[i * 3]);
+            }
 
-#pragma omp parallel for
-                for (int i = nummeshes; i < nummeshes + numinstances; ++i)
-                {
-                    Instance const* instance = static_cast<Instance const*>(shapes[i]);
-                    // Get the mesh
-                    Mesh const* mesh = static_cast<Mesh const*>(instance->GetBaseShape());
-                    // Get vertex buffer of the current mesh
-                    float3 const* myvertexdata = mesh->GetVertexData();
-                    // Get mesh transform
-                    instance->GetTransform(m, minv);
-
-                    //#pragma omp parallel for
-                    // Iterate thru vertices multiply and append them to GPU buffer
-                    for (int j = 0; j < mesh->num_vertices(); ++j)
-                    {
-                        vertexdata[mesh_vertices_start_idx[i] + j] = transform_point(myvertexdata[j], m);
-                    }
-                }
+            if (m_node_format == kNodeFormatQuantized)
+            {
+                // Decoded bounds are conservative, refit recomputes them anyway
+                std::vector<QuantizedBvhTranslator::Node> nodes;
+                reader.GetSection(kSectionNodes, nodes);
+                QuantizedBvhTranslator::Decode(nodes, m_refitdata->nodes);
+            }
+            else
+            {
+                reader.GetSection(kSectionNodes, m_refitdata->nodes);
+            }
+            m_refitdata->build_cost = CalculateSahCost(m_refitdata->nodes, m_refitdata->traversal_cost);
+        }
+        else
+        {
+            m_refitdata.reset();
+        }
 
-                m_device->UnmapBuffer(m_gpudata->vertices, 0, vertexdata, &e);
+        // Make sure everything is commited
+        m_device->Finish(0);
+    }
 
-                e->Wait();
-                m_device->DeleteEvent(e);
+    bool IntersectorSkipLinks::Refit(World const& world)
+    {
+        auto& data = *m_refitdata;
+        int numshapes = (int)data.shapes.size();
+
+        // Re-transform vertices of moved shapes only, dirty_start_idx lays
+        // their vertices back to back for balanced chunks
+        std::vector<int> dirty;
+        std::vector<int> dirty_start_idx;
+        int numdirtyvertices = 0;
+        for (int i = 0; i < numshapes; ++i)
+        {
+            if (static_cast<ShapeImpl const*>(data.shapes[i])->GetStateChange() & ShapeImpl::kStateChangeTransform)
+            {
+                dirty.push_back(i);
+                dirty_start_idx.push_back(numdirtyvertices);
+                numdirtyvertices += GetShapeMesh(data.shapes[i])->num_vertices();
             }
+        }
 
-            // Create face buffer
+        ForEachShapeRange(dirty_start_idx, numdirtyvertices, [&](int k, int begin, int end)
+        {
+            int const i = dirty[k];
+            ShapeImpl const* shape = static_cast<ShapeImpl const*>(data.shapes[i]);
+
+            // Instances use their own transform for base shape geometry
+            matrix m, minv;
+            shape->GetTransform(m, minv);
+
+            float3 const* myvertexdata = GetShapeMesh(shape)->GetVertexData();
+            for (int j = begin; j < end; ++j)
             {
-                struct Face
-                {
-                    // Up to 3 indices
-                    int idx[3];
-                    // Shape ID
-                    int shape_id;
-                    // Primitive ID
-                    int prim_id;
-                };
-
-                // This number is different from the number of faces for some BVHs
-                auto numindices = m_bvh->GetNumIndices();
-                // Create face buffer
-                m_gpudata->faces = m_device->CreateBuffer(numindices * sizeof(Face), Calc::BufferType::kRead);
-
-                // Get the pointer to mapped data
-                Face* facedata = nullptr;
-                Calc::Event* e = nullptr;
-
-                m_device->MapBuffer(m_gpudata->faces, 0, 0, numindices * sizeof(Face), Calc::BufferType::kWrite, (void**)&facedata, &e);
-
-                e->Wait();
-                m_device->DeleteEvent(e);
-
-                // Here the point is to add mesh starting index to actual index contained within the mesh,
-                // getting absolute index in the buffer.
-                // Besides that we need to permute the faces accorningly to BVH reordering, whihc
-                // is contained within bvh.primids_
-                int const* reordering = m_bvh->GetIndices();
-                for (size_t i = 0; i < numindices; ++i)
-                {
-                    int indextolook4 = reordering[i];
+                data.vertices[data.vertices_start_idx[i] + j] = transform_point(myvertexdata[j], m);
+            }
+        });
 
-                    // We need to find a shape corresponding to current face
-                    auto iter = std::upper_bound(mesh_faces_start_idx.cbegin(), mesh_faces_start_idx.cend(), indextolook4);
+        RefitNodes(data.vertices, data.indices, m_gpudata->triangle_block_size, data.nodes);
 
-                    // Find the index of the shape
-                    int shapeidx = static_cast<int>(std::distance(mesh_faces_start_idx.cbegin(), iter) - 1);
+        // Moved geometry might make the tree too loose, rebuild it then
+        if (CalculateSahCost(data.nodes, data.traversal_cost) > data.build_cost * m_refit_threshold)
+        {
+            return false;
+        }
 
-                    // Get the mesh directly or out of instance
-                    Mesh const* mesh = nullptr;
-                    if (shapeidx < nummeshes)
-                    {
-                        mesh = static_cast<Mesh const*>(shapes[shapeidx]);
-                    }
-                    else
-                    {
-                        mesh = static_cast<Mesh const*>(static_cast<Instance const*>(shapes[shapeidx])->GetBaseShape());
-                    }
+        if (m_gpudata->triangle_block_size > 1)
+        {
+            std::vector<TriangleBlock> blocks;
+            BuildTriangleBlocks(data.vertices, data.indices, blocks);
+            m_device->WriteBuffer(m_gpudata->geometry, 0, 0, blocks.size() * sizeof(TriangleBlock), &blocks[0], nullptr);
+        }
+        else
+        {
+            for (auto i : dirty)
+            {
+                int const start = data.vertices_start_idx[i];
+                int const end = i + 1 < numshapes ? data.vertices_start_idx[i + 1] : (int)data.vertices.size();
 
-                    // Get vertex buffer of the current mesh
-                    Mesh::Face const* myfacedata = mesh->GetFaceData();
-                    // Find face idx
-                    int faceidx = indextolook4 - mesh_faces_start_idx[shapeidx];
-                    // Find mesh start idx
-                    int mystartidx = mesh_vertices_start_idx[shapeidx];
-
-                    // Copy face data to GPU buffer
-                    facedata[i].idx[0] = myfacedata[faceidx].idx[0] + mystartidx;
-                    facedata[i].idx[1] = myfacedata[faceidx].idx[1] + mystartidx;
-                    facedata[i].idx[2] = myfacedata[faceidx].idx[2] + mystartidx;
-
-                    // Optimization: we are putting faceid here
-                    facedata[i].shape_id = shapes[shapeidx]->GetId();
-                    facedata[i].prim_id = faceidx;
+                if (end > start)
+                {
+                    m_device->WriteBuffer(m_gpudata->geometry, 0, start * sizeof(float3), (end - start) * sizeof(float3), &data.vertices[start], nullptr);
                 }
+            }
+        }
 
-                m_device->UnmapBuffer(m_gpudata->faces, 0, facedata, &e);
+        WriteNodes(m_device, data.nodes, m_gpudata->node_format == kNodeFormatQuantized, m_gpudata->bvh);
 
-                e->Wait();
-                m_device->DeleteEvent(e);
-            }
+        // Make sure everything is commited
+        m_device->Finish(0);
 
-            // Make sure everything is commited
-            m_device->Finish(0);
-        }
+        return true;
     }
 
     void IntersectorSkipLinks::Intersect(std::uint32_t queueidx, Calc::Buffer const* rays, Calc::Buffer const* numrays, std::uint32_t maxrays, Calc::Buffer* hits, Calc::Event const* waitevent, Calc::Event** event) const
@@ -420,7 +1444,7 @@ namespace RadeonRays
         int arg = 0;
 
         func->SetArg(arg++, m_gpudata->bvh);
-        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->geometry);
         func->SetArg(arg++, m_gpudata->faces);
         func->SetArg(arg++, rays);
         func->SetArg(arg++, numrays);
@@ -440,7 +1464,7 @@ namespace RadeonRays
         int arg = 0;
 
         func->SetArg(arg++, m_gpudata->bvh);
-        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->geometry);
         func->SetArg(arg++, m_gpudata->faces);
         func->SetArg(arg++, rays);
         func->SetArg(arg++, numrays);
@@ -456,15 +1480,23 @@ namespace RadeonRays
                                           Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
                                           Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
                                           Calc::Buffer const *directions_stride,
-                                          std::uint32_t maxrays, Calc::Buffer *hits,
+                                          std::uint64_t ray_offset, std::uint32_t maxrays,
+                                          std::uint32_t num_outputs, Calc::Buffer *hits,
                                           Calc::Event const *wait_event, Calc::Event **event) const {
-        auto& func = m_gpudata->occlude_func2d_sum_linear;
+        bool const deterministic = m_sum_linear_accumulation == kSumLinearDeterministic;
+
+        if (deterministic)
+        {
+            ReserveSumLinearContribs(maxrays);
+        }
+
+        auto& func = deterministic ? m_gpudata->occlude_func2d_sum_linear_contrib : m_gpudata->occlude_func2d_sum_linear;
 
         // Set args
         int arg = 0;
 
         func->SetArg(arg++, m_gpudata->bvh);
-        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->geometry);
         func->SetArg(arg++, m_gpudata->faces);
         func->SetArg(arg++, origins);
         func->SetArg(arg++, directions);
@@ -474,14 +1506,114 @@ namespace RadeonRays
         func->SetArg(arg++, num_origins);
         func->SetArg(arg++, num_directions);
         func->SetArg(arg++, directions_stride);
-        func->SetArg(arg++, hits);
+        func->SetArg(arg++, deterministic ? m_gpudata->sum_linear_contribs : hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
 
         size_t localsize = kWorkGroupSize;
         size_t globalsize = ((maxrays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
 
+        if (!deterministic)
+        {
+            m_device->Execute(func, queueidx, globalsize, localsize, event);
+            return;
+        }
+
+        m_device->Execute(func, queueidx, globalsize, localsize, nullptr);
+
+        ReduceSumLinearContribs(queueidx, num_origins, num_directions, directions_stride, ray_offset, maxrays, num_outputs, hits, event);
+    }
+
+    void IntersectorSkipLinks::ReserveSumLinearContribs(std::uint32_t maxrays) const
+    {
+        std::uint32_t num_contribs = std::max(maxrays, 1u);
+        if (m_gpudata->sum_linear_capacity < num_contribs)
+        {
+            m_device->DeleteBuffer(m_gpudata->sum_linear_contribs);
+            m_gpudata->sum_linear_contribs = m_device->CreateBuffer(num_contribs * 2 * sizeof(float), Calc::BufferType::kWrite);
+            m_gpudata->sum_linear_capacity = num_contribs;
+        }
+    }
+
+    void IntersectorSkipLinks::ReduceSumLinearContribs(std::uint32_t queueidx, Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                                       Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                                       std::uint32_t num_outputs, Calc::Buffer *hits, Calc::Event **event) const
+    {
+        // Add contributions of the tile per (direction stride, origin) in direction order,
+        // tiles go in order as well, so the sums are reproducible
+        auto& func = m_gpudata->occlude_func2d_sum_linear_reduce;
+
+        int num_rays = static_cast<int>(maxrays);
+        int arg = 0;
+
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, m_gpudata->sum_linear_contribs);
+        func->SetArg(arg++, hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+        func->SetArg(arg++, sizeof(int), &num_rays);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((num_outputs + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
         m_device->Execute(func, queueidx, globalsize, localsize, event);
     }
 
+    void IntersectorSkipLinks::Occluded2dSumLinearSky(std::uint32_t queueidx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                                      Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+                                                      Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                                      Calc::Buffer const *directions_stride,
+                                                      std::uint64_t ray_offset, std::uint32_t maxrays,
+                                                      std::uint32_t num_outputs, Calc::Buffer *hits,
+                                                      Calc::Event const *wait_event, Calc::Event **event) const {
+        ThrowIf(!m_gpudata->occlude_func2d_sum_linear_sky, "Sky patch queries are not supported on this platform");
+
+        bool const deterministic = m_sum_linear_accumulation == kSumLinearDeterministic;
+
+        if (deterministic)
+        {
+            ReserveSumLinearContribs(maxrays);
+        }
+
+        auto& func = deterministic ? m_gpudata->occlude_func2d_sum_linear_sky_contrib : m_gpudata->occlude_func2d_sum_linear_sky;
+
+        // Kernels can't take null buffers, pass origins instead and switch frames off
+        SkyPatches sky_arg = sky;
+        int use_frames = frames ? 1 : 0;
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->geometry);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, sizeof(SkyPatches), &sky_arg);
+        func->SetArg(arg++, frames ? frames : origins);
+        func->SetArg(arg++, sizeof(int), &use_frames);
+        func->SetArg(arg++, koefs);
+        func->SetArg(arg++, offset_koefs);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, directions_stride);
+        func->SetArg(arg++, deterministic ? m_gpudata->sum_linear_contribs : hits);
+        func->SetArg(arg++, sizeof(std::uint64_t), &ray_offset);
+
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = ((maxrays + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        if (!deterministic)
+        {
+            m_device->Execute(func, queueidx, globalsize, localsize, event);
+            return;
+        }
+
+        m_device->Execute(func, queueidx, globalsize, localsize, nullptr);
+
+        // Same reduction as for explicit directions
+        ReduceSumLinearContribs(queueidx, num_origins, num_directions, directions_stride, ray_offset, maxrays, num_outputs, hits, event);
+    }
+
     void IntersectorSkipLinks::Occluded2dCellString(std::uint32_t queueidx,
                                                     Calc::Buffer const *origins,
                                                     Calc::Buffer const *directions,
@@ -490,16 +1622,26 @@ namespace RadeonRays
                                                     Calc::Buffer const *cell_string_inds,
                                                     Calc::Buffer const *num_cell_strings,
                                                     std::uint32_t max_ray_batches,
+                                                    std::uint32_t origins_count,
+                                                    std::uint32_t directions_count,
+                                                    std::uint32_t cell_strings_count,
                                                     Calc::Buffer *hits,
                                                     Calc::Event const *wait_event,
                                                     Calc::Event **event) const {
-        auto& func = m_gpudata->occlude_func2d_cell_string;
+        if (m_cell_string_traversal == kCellStringFlat)
+        {
+            Occluded2dCellStringFlat(queueidx, origins, directions, num_origins, num_directions, cell_string_inds, num_cell_strings,
+                origins_count, directions_count, cell_strings_count, hits, wait_event, event);
+            return;
+        }
+
+        auto& func = m_cell_string_traversal == kCellStringFrustum ? m_gpudata->occlude_func2d_cell_string_frustum : m_gpudata->occlude_func2d_cell_string;
 
         // Set args
         int arg = 0;
 
         func->SetArg(arg++, m_gpudata->bvh);
-        func->SetArg(arg++, m_gpudata->vertices);
+        func->SetArg(arg++, m_gpudata->geometry);
         func->SetArg(arg++, m_gpudata->faces);
         func->SetArg(arg++, origins);
         func->SetArg(arg++, directions);
@@ -510,8 +1652,140 @@ namespace RadeonRays
         func->SetArg(arg++, hits);
 
         size_t localsize = kWorkGroupSize;
-        size_t globalsize = ((max_ray_batches + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+        // Frustum traversal uses the whole work-group per ray batch
+        size_t globalsize = m_cell_string_traversal == kCellStringFrustum ?
+            static_cast<std::size_t>(max_ray_batches) * kWorkGroupSize :
+            ((max_ray_batches + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+        m_device->Execute(func, queueidx, globalsize, localsize, event);
+    }
+
+    void IntersectorSkipLinks::Occluded2dCellStringCount(std::uint32_t queueidx,
+                                                         Calc::Buffer const *origins,
+                                                         Calc::Buffer const *directions,
+                                                         Calc::Buffer const *num_origins,
+                                                         Calc::Buffer const *num_directions,
+                                                         Calc::Buffer const *cell_string_inds,
+                                                         Calc::Buffer const *num_cell_strings,
+                                                         std::uint32_t max_ray_batches,
+                                                         Calc::Buffer *counts,
+                                                         Calc::Buffer *point_masks,
+                                                         Calc::Event const *wait_event,
+                                                         Calc::Event **event) const {
+        auto& func = m_gpudata->occlude_func2d_cell_string_count;
+        ThrowIf(!func, "Cell-string counts are not supported on this platform");
+
+        // Kernels can't take null buffers, pass counts instead and switch masks off
+        int use_masks = point_masks ? 1 : 0;
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->geometry);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, cell_string_inds);
+        func->SetArg(arg++, num_cell_strings);
+        func->SetArg(arg++, counts);
+        func->SetArg(arg++, point_masks ? point_masks : counts);
+        func->SetArg(arg++, sizeof(int), &use_masks);
+
+        // Whole work-group per ray batch
+        size_t localsize = kWorkGroupSize;
+        size_t globalsize = static_cast<std::size_t>(max_ray_batches) * kWorkGroupSize;
 
         m_device->Execute(func, queueidx, globalsize, localsize, event);
     }
+
+    void IntersectorSkipLinks::Occluded2dCellStringFlat(std::uint32_t queueidx,
+                                                        Calc::Buffer const *origins,
+                                                        Calc::Buffer const *directions,
+                                                        Calc::Buffer const *num_origins,
+                                                        Calc::Buffer const *num_directions,
+                                                        Calc::Buffer const *cell_string_inds,
+                                                        Calc::Buffer const *num_cell_strings,
+                                                        std::uint32_t origins_count,
+                                                        std::uint32_t directions_count,
+                                                        std::uint32_t cell_strings_count,
+                                                        Calc::Buffer *hits,
+                                                        Calc::Event const *wait_event,
+                                                        Calc::Event **event) const {
+        // One extra element holds the total number of points after the scan
+        std::uint32_t num_elements = cell_strings_count + 1;
+        if (m_gpudata->cell_string_capacity < num_elements)
+        {
+            m_device->DeleteBuffer(m_gpudata->cell_string_lengths);
+            m_device->DeleteBuffer(m_gpudata->cell_string_offsets);
+            m_gpudata->cell_string_lengths = m_device->CreateBuffer(num_elements * sizeof(int), Calc::BufferType::kWrite);
+            m_gpudata->cell_string_offsets = m_device->CreateBuffer(num_elements * sizeof(int), Calc::BufferType::kWrite);
+            m_gpudata->cell_string_capacity = num_elements;
+        }
+
+        // Compute lengths and clear hits
+        {
+            auto& func = m_gpudata->occlude_func2d_cell_string_init;
+
+            int arg = 0;
+
+            func->SetArg(arg++, num_directions);
+            func->SetArg(arg++, cell_string_inds);
+            func->SetArg(arg++, num_cell_strings);
+            func->SetArg(arg++, m_gpudata->cell_string_lengths);
+            func->SetArg(arg++, hits);
+
+            size_t localsize = kWorkGroupSize;
+            size_t globalsize = ((num_elements + kWorkGroupSize - 1) / kWorkGroupSize) * kWorkGroupSize;
+
+            m_device->Execute(func, queueidx, globalsize, localsize, nullptr);
+        }
+
+        m_gpudata->primitives->ScanExclusiveAddInt32(queueidx, m_gpudata->cell_string_lengths, m_gpudata->cell_string_offsets, num_elements);
+
+        auto& func = m_gpudata->occlude_func2d_cell_string_flat;
+
+        // Set args
+        int arg = 0;
+
+        func->SetArg(arg++, m_gpudata->bvh);
+        func->SetArg(arg++, m_gpudata->geometry);
+        func->SetArg(arg++, m_gpudata->faces);
+        func->SetArg(arg++, origins);
+        func->SetArg(arg++, directions);
+        func->SetArg(arg++, num_origins);
+        func->SetArg(arg++, num_directions);
+        func->SetArg(arg++, cell_string_inds);
+        func->SetArg(arg++, num_cell_strings);
+        func->SetArg(arg++, m_gpudata->cell_string_offsets);
+        func->SetArg(arg++, hits);
+
+        // Total number of points is only known on the device, so tiles cover the usual
+        // case of strings partitioning the origins, and the last one strides over the grid
+        // up to the device side total in case strings overlap. In-order queue serializes
+        // the tiles and only the last one signals the event.
+        std::uint64_t const num_rays = static_cast<std::uint64_t>(origins_count) * directions_count;
+        std::uint64_t const tile_size = GetRaysPerDispatch();
+        size_t localsize = kWorkGroupSize;
+
+        std::uint64_t ray_offset = 0;
+        do
+        {
+            std::uint64_t const tile_rays = std::min(tile_size, num_rays - ray_offset);
+            auto const last = ray_offset + tile_rays >= num_rays;
+
+            // Nothing to trace still takes a work group, hits are already cleared
+            std::uint64_t ray_stride = std::max<std::uint64_t>((tile_rays + kWorkGroupSize - 1) / kWorkGroupSize, 1) * kWorkGroupSize;
+            std::uint64_t ray_end = last ? std::numeric_limits<std::uint64_t>::max() : ray_offset + tile_rays;
+
+            func->SetArg(arg, sizeof(std::uint64_t), &ray_offset);
+            func->SetArg(arg + 1, sizeof(std::uint64_t), &ray_end);
+            func->SetArg(arg + 2, sizeof(std::uint64_t), &ray_stride);
+            m_device->Execute(func, queueidx, static_cast<size_t>(ray_stride), localsize, last ? event : nullptr);
+
+            ray_offset += tile_rays;
+        } while (ray_offset < num_rays);
+    }
 }
@@ -67,6 +67,7 @@ THE SOFTWARE.
 namespace RadeonRays
 {
     class Bvh;
+    class Hlbvh;
 
     /** 
     \brief Intersector implementation using skip links BVH
@@ -80,6 +81,29 @@ namespace RadeonRays
     private:
         // Preprocess implementation
         void Process(World const& world) override;
+        // Update settings which do not affect acceleration structure
+        void UpdateOptions(World const& world);
+        // (Re)create kernels for requested node format
+        void CompileKernels();
+        // Serialization implementation
+        char const* GetAccelerationStructureType() const override;
+        void Save(World const& world, AccelerationStructureWriter& writer) const override;
+        void Load(World const& world, AccelerationStructureReader const& reader) override;
+        // Create builder configured by world options
+        Bvh* CreateBvh(World const& world) const;
+        // Update node bounds for moved shapes keeping topology,
+        // returns false if the tree has to be rebuilt instead
+        bool Refit(World const& world);
+        // Patch shape IDs in face data for shapes having their ID changed
+        void UpdateShapeIds(World const& world);
+        // Put attached shapes into a separate subtree next to the existing tree,
+        // returns false if the tree has to be rebuilt instead
+        bool Append(World const& world);
+        // Patch faces of detached shapes out of the tree keeping its topology,
+        // returns false if the tree has to be rebuilt instead
+        bool Detach(World const& world);
+        // Build the tree, its skip links and leaf geometry on the device
+        void BuildOnDevice(World const& world);
         // Intersection implementation
         void Intersect(std::uint32_t queue_idx, Calc::Buffer const *rays, Calc::Buffer const *num_rays, 
             std::uint32_t max_rays, Calc::Buffer *hits, 
@@ -94,9 +118,19 @@ namespace RadeonRays
                                   Calc::Buffer const *offset_directions, Calc::Buffer const *offset_koefs,
                                   Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
                                   Calc::Buffer const *directions_stride,
-                                  std::uint32_t maxrays, Calc::Buffer *hits,
+                                  std::uint64_t ray_offset, std::uint32_t maxrays,
+                                  std::uint32_t num_outputs, Calc::Buffer *hits,
                                   Calc::Event const *wait_event, Calc::Event **event) const override;
 
+        // Occulusion2d implementation for sky patch directions
+        void Occluded2dSumLinearSky(std::uint32_t queueidx, Calc::Buffer const *origins, SkyPatches const& sky, Calc::Buffer const *frames,
+                                    Calc::Buffer const *koefs, Calc::Buffer const *offset_koefs,
+                                    Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                    Calc::Buffer const *directions_stride,
+                                    std::uint64_t ray_offset, std::uint32_t maxrays,
+                                    std::uint32_t num_outputs, Calc::Buffer *hits,
+                                    Calc::Event const *wait_event, Calc::Event **event) const override;
+
         // Occulusion2d implementation for cell-strings
         void Occluded2dCellString(std::uint32_t queueidx,
                                   Calc::Buffer const *origins,
@@ -106,16 +140,99 @@ namespace RadeonRays
                                   Calc::Buffer const *cell_string_inds,
                                   Calc::Buffer const *num_cell_strings,
                                   std::uint32_t max_ray_batches,
+                                  std::uint32_t origins_count,
+                                  std::uint32_t directions_count,
+                                  std::uint32_t cell_strings_count,
                                   Calc::Buffer *hits,
                                   Calc::Event const *wait_event,
                                   Calc::Event **event) const override;
 
+        // Occulusion2d implementation counting occluded points of cell-strings
+        void Occluded2dCellStringCount(std::uint32_t queueidx,
+                                       Calc::Buffer const *origins,
+                                       Calc::Buffer const *directions,
+                                       Calc::Buffer const *num_origins,
+                                       Calc::Buffer const *num_directions,
+                                       Calc::Buffer const *cell_string_inds,
+                                       Calc::Buffer const *num_cell_strings,
+                                       std::uint32_t max_ray_batches,
+                                       Calc::Buffer *counts,
+                                       Calc::Buffer *point_masks,
+                                       Calc::Event const *wait_event,
+                                       Calc::Event **event) const override;
+
+        // Grow per ray scratch of deterministic sum-linear queries
+        void ReserveSumLinearContribs(std::uint32_t maxrays) const;
+        // Add per ray contributions of a sum-linear tile into hits in fixed order
+        void ReduceSumLinearContribs(std::uint32_t queueidx, Calc::Buffer const *num_origins, Calc::Buffer const *num_directions,
+                                     Calc::Buffer const *directions_stride, std::uint64_t ray_offset, std::uint32_t maxrays,
+                                     std::uint32_t num_outputs, Calc::Buffer *hits, Calc::Event **event) const;
+
+        // Flattened (point, direction) traversal for cell-strings
+        void Occluded2dCellStringFlat(std::uint32_t queueidx,
+                                      Calc::Buffer const *origins,
+                                      Calc::Buffer const *directions,
+                                      Calc::Buffer const *num_origins,
+                                      Calc::Buffer const *num_directions,
+                                      Calc::Buffer const *cell_string_inds,
+                                      Calc::Buffer const *num_cell_strings,
+                                      std::uint32_t origins_count,
+                                      std::uint32_t directions_count,
+                                      std::uint32_t cell_strings_count,
+                                      Calc::Buffer *hits,
+                                      Calc::Event const *wait_event,
+                                      Calc::Event **event) const;
+
     private:
         struct GpuData;
+        struct RefitData;
+
+        // Traversal mode for cell-string queries
+        enum CellStringTraversal
+        {
+            // Work item per (string, direction) looping over points
+            kCellStringSerial,
+            // Work-group per (string, direction) sharing bounding frustum
+            kCellStringFrustum,
+            // Work item per (point, direction) using scan over string lengths
+            kCellStringFlat
+        };
+
+        // Layout of BVH nodes in device memory
+        enum NodeFormat
+        {
+            // Full precision bounds, 32 bytes per node
+            kNodeFormatFull,
+            // Bounds quantized to 16 bits, 16 bytes per node
+            kNodeFormatQuantized
+        };
+
+        // Koef accumulation mode for sum-linear queries
+        enum SumLinearAccumulation
+        {
+            // Atomic adds into output
+            kSumLinearAtomic,
+            // Per ray contributions reduced in fixed order
+            kSumLinearDeterministic
+        };
 
         // Implementation data
         std::unique_ptr<GpuData> m_gpudata;
         // Bvh data structure
         std::unique_ptr<Bvh> m_bvh;
+        // Device builder (created on first use)
+        std::unique_ptr<Hlbvh> m_hlbvh;
+        // Data for transform only updates (nullptr if refit is disabled)
+        std::unique_ptr<RefitData> m_refitdata;
+        // Max allowed SAH cost growth after refit compared to full build
+        float m_refit_threshold;
+        // Cell-string traversal mode
+        CellStringTraversal m_cell_string_traversal;
+        // Sum-linear accumulation mode
+        SumLinearAccumulation m_sum_linear_accumulation;
+        // Requested node format, kernels are switched on the next build
+        NodeFormat m_node_format;
+        // Build the tree on the device instead of the host
+        bool m_build_on_device;
     };
 }
@@ -47,6 +47,9 @@ DEFINES
 #define NODEIDX(i) (i)
 // Shortcut for delta evaluation
 #define DELTA(i,j) delta(morton_codes,num_prims,i,j)
+// Number of leaves of a restructured treelet
+#define TREELET_SIZE 7
+#define TREELET_SUBSETS (1 << TREELET_SIZE)
 
 /*************************************************************************
 TYPE DEFINITIONS
@@ -97,6 +100,13 @@ INLINE bbox bbox_union(bbox b1, bbox b2)
     return res;
 }
 
+// Surface area of a bbox
+INLINE float bbox_surface_area(bbox b)
+{
+    float3 ext = b.pmax.xyz - b.pmin.xyz;
+    return 2.f * (ext.x * ext.y + ext.x * ext.z + ext.y * ext.z);
+}
+
 // Assign Morton codes to each of positions
 KERNEL void calculate_morton_code_main(
     // Centers of primitive bounding boxes
@@ -118,7 +128,8 @@ KERNEL void calculate_morton_code_main(
         // Calculate center and scene extents
         float3 const center = (bound.pmax + bound.pmin).xyz * 0.5f;
         float3 const scene_min = scene_bound->pmin.xyz;
-        float3 const scene_extents = scene_bound->pmax.xyz - scene_bound->pmin.xyz;
+        // Flat scenes get zero code along the flat axis
+        float3 const scene_extents = max(scene_bound->pmax.xyz - scene_bound->pmin.xyz, (float3)(FLT_MIN));
         // Calculate morton code
         morton_codes[global_id] = calculate_morton_code((center - scene_min) / scene_extents);
     }
@@ -274,8 +285,8 @@ KERNEL void refit_bounds_main(
 {
     int global_id = get_global_id(0);
 
-    // Start from leaf nodes
-    if (global_id < num_prims)
+    // Start from leaf nodes, single leaf is the root itself
+    if (global_id < num_prims && num_prims > 1)
     {
         // Get my leaf index
         int idx = LEAFIDX(global_id);
@@ -311,4 +322,299 @@ KERNEL void refit_bounds_main(
         }
         while (idx != 0);
     }
-}
\ No newline at end of file
+}
+
+// Union of the bounds of treelet leaves in the subset
+INLINE bbox treelet_bounds(GLOBAL bbox const* bounds, int const* leaves, int subset)
+{
+    bbox b = bounds[leaves[31 - clz(subset & -subset)]];
+    for (int i = 0; i < TREELET_SIZE; ++i)
+    {
+        if (subset & (1 << i))
+        {
+            b = bbox_union(b, bounds[leaves[i]]);
+        }
+    }
+    return b;
+}
+
+// Rearrange the treelet of up to TREELET_SIZE leaves under root into the topology
+// of minimum SAH cost. Treelet leaves are formed by expanding the largest one
+// starting from root children, the cost is found by dynamic programming over
+// all subsets of the leaves ("Fast Parallel Construction of High-Quality Bounding
+// Volume Hierarchies", Karras, Aila). Leaves hold single primitives, so only
+// the areas of internal nodes depend on the topology.
+INLINE void restructure_treelet(
+    int num_prims,
+    GLOBAL HlbvhNode* nodes,
+    GLOBAL bbox* bounds,
+    GLOBAL int* leaf_counts,
+    int root)
+{
+    int leaves[TREELET_SIZE];
+    int internals[TREELET_SIZE - 1];
+    int num_leaves = 2;
+    int num_internals = 1;
+    float old_cost = bbox_surface_area(bounds[root]);
+
+    internals[0] = root;
+    leaves[0] = nodes[root].left;
+    leaves[1] = nodes[root].right;
+
+    while (num_leaves < TREELET_SIZE)
+    {
+        int largest = -1;
+        float largest_area = -1.f;
+        for (int i = 0; i < num_leaves; ++i)
+        {
+            float area = bbox_surface_area(bounds[leaves[i]]);
+            if (leaves[i] < num_prims - 1 && area > largest_area)
+            {
+                largest = i;
+                largest_area = area;
+            }
+        }
+
+        if (largest == -1)
+        {
+            break;
+        }
+
+        int expanded = leaves[largest];
+        internals[num_internals++] = expanded;
+        old_cost += largest_area;
+        leaves[largest] = nodes[expanded].left;
+        leaves[num_leaves++] = nodes[expanded].right;
+    }
+
+    // Subsets are visited in increasing order, so their parts are always done
+    float cost[TREELET_SUBSETS];
+    int split[TREELET_SUBSETS];
+    int full = (1 << num_leaves) - 1;
+
+    for (int subset = 1; subset <= full; ++subset)
+    {
+        cost[subset] = 0.f;
+
+        if (popcount(subset) > 1)
+        {
+            float best = FLT_MAX;
+            for (int part = (subset - 1) & subset; part > 0; part = (part - 1) & subset)
+            {
+                float c = cost[part] + cost[subset ^ part];
+                if (c < best)
+                {
+                    best = c;
+                    split[subset] = part;
+                }
+            }
+
+            cost[subset] = best + bbox_surface_area(treelet_bounds(bounds, leaves, subset));
+        }
+    }
+
+    if (cost[full] >= old_cost)
+    {
+        return;
+    }
+
+    // Emit new topology top down reusing treelet internal nodes
+    int stack_subsets[TREELET_SIZE];
+    int stack_nodes[TREELET_SIZE];
+    int sp = 0;
+    num_internals = 1;
+    stack_subsets[sp] = full;
+    stack_nodes[sp++] = root;
+
+    while (sp > 0)
+    {
+        int subset = stack_subsets[--sp];
+        int idx = stack_nodes[sp];
+        int parts[2] = { split[subset], subset ^ split[subset] };
+        int kids[2];
+        int count = 0;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (popcount(parts[i]) == 1)
+            {
+                kids[i] = leaves[31 - clz(parts[i])];
+            }
+            else
+            {
+                kids[i] = internals[num_internals++];
+                stack_subsets[sp] = parts[i];
+                stack_nodes[sp++] = kids[i];
+            }
+
+            nodes[kids[i]].parent = idx;
+        }
+
+        for (int i = 0; i < num_leaves; ++i)
+        {
+            count += (subset & (1 << i)) ? leaf_counts[leaves[i]] : 0;
+        }
+
+        nodes[idx].left = kids[0];
+        nodes[idx].right = kids[1];
+        bounds[idx] = treelet_bounds(bounds, leaves, subset);
+        leaf_counts[idx] = count;
+    }
+}
+
+// Propagate bounds and leaf counts up to the root optionally restructuring
+// treelets on the way. Subtrees are complete once the second child arrives,
+// so the treelet of a node is only touched by a single work item. Subtrees of
+// up to max_leaf_prims leaves are counted as a single skip-links leaf, those
+// counts are only valid after a refit only pass.
+KERNEL void restructure_treelets_main(
+    // Number of primitives
+    int num_prims,
+    // Nodes
+    GLOBAL HlbvhNode* nodes,
+    // Node bounds
+    GLOBAL bbox* bounds,
+    // Number of leaves in the subtree of each node
+    GLOBAL int* leaf_counts,
+    // Number of skip-links leaves in the subtree of each node
+    GLOBAL int* cluster_counts,
+    // Maximum number of primitives in a skip-links leaf
+    int max_leaf_prims,
+    // Atomic flags
+    GLOBAL int* flags,
+    // Restructure treelets (refit only if 0)
+    int optimize
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_prims)
+    {
+        int idx = LEAFIDX(global_id);
+        leaf_counts[idx] = 1;
+        cluster_counts[idx] = 1;
+
+        while (idx != 0)
+        {
+            idx = nodes[idx].parent;
+
+            // Make subtree of the node visible to the work item handling it
+            mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+            if (atomic_cmpxchg(flags + idx, 0, 1) == 0)
+            {
+                break;
+            }
+
+            int lc = nodes[idx].left;
+            int rc = nodes[idx].right;
+
+            bounds[idx] = bbox_union(bounds[lc], bounds[rc]);
+            leaf_counts[idx] = leaf_counts[lc] + leaf_counts[rc];
+            cluster_counts[idx] = leaf_counts[idx] <= max_leaf_prims ? 1 : cluster_counts[lc] + cluster_counts[rc];
+
+            if (optimize && leaf_counts[idx] >= TREELET_SIZE)
+            {
+                restructure_treelet(num_prims, nodes, bounds, leaf_counts, idx);
+            }
+        }
+    }
+}
+
+// Write the tree in skip-links layout (see intersect_bvh2_skiplinks.cl): nodes
+// in depth first order with left child right after its parent and pmax.w holding
+// the address to continue with once the subtree is done. Subtrees of up to
+// max_leaf_prims primitives are collapsed into a single leaf, nodes below it are
+// not written. Left child follows its parent and right child follows the whole
+// left subtree of 2n - 1 nodes for n leaves, so the address and the index of the
+// leaf are accumulated on the way to the root. Leaf i references i-th group of
+// max_leaf_prims entries of leaf_prims, unused entries are set to -1. Leaf and
+// cluster counts come from restructure_treelets_main.
+KERNEL void emit_skiplinks_main(
+    // Number of leaves in the subtree of each node
+    GLOBAL int const* restrict leaf_counts,
+    // Number of skip-links leaves in the subtree of each node
+    GLOBAL int const* restrict cluster_counts,
+    // Number of primitives
+    int num_prims,
+    // Maximum number of primitives in a skip-links leaf
+    int max_leaf_prims,
+    // Nodes
+    GLOBAL HlbvhNode const* restrict nodes,
+    // Node bounds
+    GLOBAL bbox const* restrict bounds,
+    // Nodes in skip-links layout
+    GLOBAL bbox* skiplinks,
+    // Primitives of each skip-links leaf
+    GLOBAL int* leaf_prims
+)
+{
+    int global_id = get_global_id(0);
+    int num_nodes = 2 * num_prims - 1;
+
+    if (global_id < num_nodes)
+    {
+        // Node is a part of a collapsed subtree
+        if (global_id != 0 && leaf_counts[nodes[global_id].parent] <= max_leaf_prims)
+        {
+            return;
+        }
+
+        bool leaf = leaf_counts[global_id] <= max_leaf_prims;
+
+        int addr = 0;
+        int leaf_idx = 0;
+        for (int idx = global_id; idx != 0;)
+        {
+            int parent = nodes[idx].parent;
+            int left = nodes[parent].left;
+            addr += left == idx ? 1 : 2 * cluster_counts[left];
+            leaf_idx += left == idx ? 0 : cluster_counts[left];
+            idx = parent;
+        }
+
+        int next = addr + 2 * cluster_counts[global_id] - 1;
+        int num_emitted = 2 * cluster_counts[0] - 1;
+
+        bbox node = bounds[global_id];
+        node.pmin.w = leaf ? (float)((leaf_idx << 4) | leaf_counts[global_id]) : -1.f;
+        node.pmax.w = next < num_emitted ? (float)next : -1.f;
+        skiplinks[addr] = node;
+
+        if (leaf)
+        {
+            // Walk the subtree in depth first order, without restructuring
+            // its leaves are consecutive primitives in Morton order
+            GLOBAL int* prims = leaf_prims + leaf_idx * max_leaf_prims;
+            int count = 0;
+            int idx = global_id;
+            for (;;)
+            {
+                while (idx < num_prims - 1)
+                {
+                    idx = nodes[idx].left;
+                }
+
+                // Leaves keep primitive index in both children
+                prims[count++] = nodes[idx].left;
+
+                while (idx != global_id && nodes[nodes[idx].parent].right == idx)
+                {
+                    idx = nodes[idx].parent;
+                }
+
+                if (idx == global_id)
+                {
+                    break;
+                }
+
+                idx = nodes[nodes[idx].parent].right;
+            }
+
+            for (; count < max_leaf_prims; ++count)
+            {
+                prims[count] = -1;
+            }
+        }
+    }
+}
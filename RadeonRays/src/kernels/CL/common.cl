@@ -275,3 +275,129 @@ float2 triangle_calculate_barycentrics(float3 p, float3 v1, float3 v2, float3 v3
     float const b2 = (d00 * d21 - d01 * d20) * invdenom;
     return make_float2(b1, b2);
 }
+
+/*************************************************************************
+2D QUERY HELPERS
+**************************************************************************/
+
+// Atomically add the value to the float in global memory
+INLINE
+float atomicadd(volatile __global float* address, const float value)
+{
+    float old = value;
+    while ((old = atomic_xchg(address, atomic_xchg(address, 0.0f)+old)) != 0.0f);
+    return old;
+}
+
+// Create active unmasked ray for 2D queries
+INLINE
+ray make_ray_2d(float4 origin, float4 direction)
+{
+    ray r;
+    r.o = origin;
+    r.d = direction;
+    r.extra.x = -1;
+    r.extra.y = 1;
+    r.doBackfaceCulling = 0;
+    r.padding = 1;
+    return r;
+}
+
+// Accumulate koefs of a sum-linear ray into the output pair,
+// x and z are added if the ray is occluded, y and w otherwise
+INLINE
+void sum_linear_accumulate(GLOBAL float* hits, int output_idx, float4 koef, bool hit)
+{
+    float const k0 = hit ? koef.x : koef.y;
+    float const k1 = hit ? koef.z : koef.w;
+
+    // Different directions might share the same output slot
+    if (fabs(k0) > 1e-4f)
+    {
+        atomicadd(&hits[output_idx * 2], k0);
+    }
+    if (fabs(k1) > 1e-4f)
+    {
+        atomicadd(&hits[output_idx * 2 + 1], k1);
+    }
+}
+
+// Sky patch set, must match SkyPatches in radeon_rays.h
+typedef struct
+{
+    int type;
+    int subdivision;
+    int num_azimuths;
+    int padding;
+    // Unit zenith and zero azimuth directions of the sky frame
+    float4 zenith;
+    float4 azimuth;
+} SkyPatches;
+
+#define SKY_PATCHES_REINHART 0
+#define SKY_PATCHES_EQUAL_AREA 1
+
+// Number of patches in Tregenza rings from the horizon up, zenith cap excluded
+__constant int TREGENZA_RING_PATCHES[7] = { 30, 30, 24, 24, 18, 12, 6 };
+
+// Direction to the center of sky patch in the frame given by zenith
+// and zero azimuth directions, see SkyPatches for patch enumeration
+INLINE
+float4 sky_patch_direction(SkyPatches const* sky, float4 zenith, float4 azimuth, int patch_id)
+{
+    float const pi = 3.14159265358979323846f;
+    float z;
+    float phi;
+
+    if (sky->type == SKY_PATCHES_REINHART)
+    {
+        // Each Tregenza ring is split into subdivision rings having subdivision times more patches
+        int const num_rings = 7 * sky->subdivision;
+        float const ring_span = 0.5f * pi / (num_rings + 0.5f);
+        int ring_patches = 0;
+        int ring = 0;
+
+        for (; ring < num_rings; ++ring)
+        {
+            ring_patches = TREGENZA_RING_PATCHES[ring / sky->subdivision] * sky->subdivision;
+
+            if (patch_id < ring_patches)
+            {
+                break;
+            }
+
+            patch_id -= ring_patches;
+        }
+
+        // Zenith cap is the last patch
+        if (ring == num_rings)
+        {
+            return make_float4(zenith.x, zenith.y, zenith.z, 0.f);
+        }
+
+        z = sin((ring + 0.5f) * ring_span);
+        phi = 2.f * pi * (patch_id + 0.5f) / ring_patches;
+    }
+    else
+    {
+        // Rings of equal height cut equal areas of the hemisphere
+        int const ring = patch_id / sky->num_azimuths;
+        z = (ring + 0.5f) / sky->subdivision;
+        phi = 2.f * pi * (patch_id - ring * sky->num_azimuths + 0.5f) / sky->num_azimuths;
+    }
+
+    float const r = sqrt(max(1.f - z * z, 0.f));
+    float3 const bitangent = cross(zenith.xyz, azimuth.xyz);
+    float3 const d = azimuth.xyz * (r * cos(phi)) + bitangent * (r * sin(phi)) + zenith.xyz * z;
+    return make_float4(d.x, d.y, d.z, 0.f);
+}
+
+// Create a ray towards the center of sky patch, frames keep per origin
+// zenith and zero azimuth directions unless use_frames is 0
+INLINE
+ray make_sky_ray_2d(float4 origin, SkyPatches const* sky, GLOBAL float4 const* restrict frames, int use_frames, int origin_id, int patch_id)
+{
+    float4 const zenith = use_frames ? frames[origin_id * 2] : sky->zenith;
+    float4 const azimuth = use_frames ? frames[origin_id * 2 + 1] : sky->azimuth;
+    return make_ray_2d(origin, sky_patch_direction(sky, zenith, azimuth, patch_id));
+}
@@ -361,3 +361,212 @@ KERNEL void occluded_main(
         }
     }
 }
+
+// Any hit traversal shared by 2D queries, stack layout is the same as in occluded_main
+INLINE bool trace_occluded(
+    // Bvh nodes
+    GLOBAL const bvh_node *restrict nodes,
+    // Ray
+    ray const* my_ray,
+    // Stack memory
+    GLOBAL uint *stack,
+    uint stack_bottom,
+    // Local stack memory
+    __local uint *lds_stack,
+    uint lds_stack_bottom)
+{
+    const float3 invDir = safe_invdir(*my_ray);
+    const float3 oxInvDir = -my_ray->o.xyz * invDir;
+
+    // Current node address
+    uint addr = 0;
+    // Intersection parametric distance
+    const float closest_t = my_ray->o.w;
+
+    uint sptr = stack_bottom;
+    uint lds_sptr = lds_stack_bottom;
+
+    lds_stack[lds_sptr++] = INVALID_ADDR;
+
+    while (addr != INVALID_ADDR)
+    {
+        const bvh_node node = nodes[addr];
+
+        if (INTERNAL_NODE(node))
+        {
+            float2 s0 = fast_intersect_bbox2(
+                node.aabb_left_min_or_v0_and_addr_left.xyz,
+                node.aabb_left_max_or_v1_and_mesh_id.xyz,
+                invDir, oxInvDir, closest_t);
+            float2 s1 = fast_intersect_bbox2(
+                node.aabb_right_min_or_v2_and_addr_right.xyz,
+                node.aabb_right_max_and_prim_id.xyz,
+                invDir, oxInvDir, closest_t);
+
+            bool traverse_c0 = (s0.x <= s0.y);
+            bool traverse_c1 = (s1.x <= s1.y);
+            bool c1first = traverse_c1 && (s0.x > s1.x);
+
+            if (traverse_c0 || traverse_c1)
+            {
+                uint deferred = INVALID_ADDR;
+
+                if (c1first || !traverse_c0)
+                {
+                    addr = GetAddrRight(node);
+                    deferred = GetAddrLeft(node);
+                }
+                else
+                {
+                    addr = GetAddrLeft(node);
+                    deferred = GetAddrRight(node);
+                }
+
+                if (traverse_c0 && traverse_c1)
+                {
+                    if (lds_sptr - lds_stack_bottom >= LDS_STACK_SIZE)
+                    {
+                        for (int i = 1; i < LDS_STACK_SIZE; ++i)
+                        {
+                            stack[sptr + i] = lds_stack[lds_stack_bottom + i];
+                        }
+
+                        sptr += LDS_STACK_SIZE;
+                        lds_sptr = lds_stack_bottom + 1;
+                    }
+
+                    lds_stack[lds_sptr++] = deferred;
+                }
+
+                continue;
+            }
+        }
+        else
+        {
+#ifdef RR_RAY_MASK
+            if (ray_get_mask(my_ray) != convert_int(GetMeshId(node)))
+            {
+#endif // RR_RAY_MASK
+                float t = fast_intersect_triangle(
+                    *my_ray,
+                    node.aabb_left_min_or_v0_and_addr_left.xyz,
+                    node.aabb_left_max_or_v1_and_mesh_id.xyz,
+                    node.aabb_right_min_or_v2_and_addr_right.xyz,
+                    closest_t);
+
+                if (t < closest_t)
+                {
+                    return true;
+                }
+#ifdef RR_RAY_MASK
+            }
+#endif // RR_RAY_MASK
+        }
+
+        addr = lds_stack[--lds_sptr];
+
+        if (addr == INVALID_ADDR && sptr > stack_bottom)
+        {
+            sptr -= LDS_STACK_SIZE;
+            for (int i = 1; i < LDS_STACK_SIZE; ++i)
+            {
+                lds_stack[lds_stack_bottom + i] = stack[sptr + i];
+            }
+
+            lds_sptr = lds_stack_bottom + LDS_STACK_SIZE - 1;
+            addr = lds_stack[lds_sptr];
+        }
+    }
+
+    return false;
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void occluded_main_2d_sum_linear(
+    // Bvh nodes
+    GLOBAL const bvh_node *restrict nodes,
+    // Rays
+    GLOBAL const float4 *restrict origins,
+    GLOBAL const float4 *restrict directions,
+    GLOBAL const float4 *restrict koefs,
+    GLOBAL const int *restrict offset_directions,
+    GLOBAL const int *restrict offset_koefs,
+    // Number of origins and directions
+    GLOBAL const int *restrict num_origins,
+    GLOBAL const int *restrict num_directions,
+    GLOBAL const int *restrict stride_directions,
+    // Stack memory
+    GLOBAL uint *stack,
+    // Koef sums per origin and direction stride
+    GLOBAL float *hits,
+    // Index of the first ray of the dispatch
+    ulong ray_offset)
+{
+    __local uint lds_stack[GROUP_SIZE * LDS_STACK_SIZE];
+
+    uint index = get_global_id(0);
+    uint local_index = get_local_id(0);
+    const long ray_id = (long)ray_offset + index;
+
+    // Handle only working subset
+    if (ray_id < (long)(*num_origins) * (*num_directions))
+    {
+        const int origin_id = (int)(ray_id % (*num_origins));
+        const int direction_id = (int)(ray_id / (*num_origins));
+        const int output_offset = (direction_id % (*stride_directions)) * (*num_origins);
+
+        const float4 koef = koefs[direction_id + offset_koefs[origin_id]];
+        const ray my_ray = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+        const bool hit = trace_occluded(nodes, &my_ray, stack, STACK_SIZE * index, lds_stack, local_index * LDS_STACK_SIZE);
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+    }
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void occluded_main_2d_cell_string(
+    // Bvh nodes
+    GLOBAL const bvh_node *restrict nodes,
+    // Rays
+    GLOBAL const float4 *restrict origins,
+    GLOBAL const float4 *restrict directions,
+    // Number of origins and directions
+    GLOBAL const int *restrict num_origins,
+    GLOBAL const int *restrict num_directions,
+    // Cell-string to point mappings
+    GLOBAL const int *restrict cell_string_inds,
+    GLOBAL const int *restrict num_cell_strings,
+    // Stack memory
+    GLOBAL uint *stack,
+    // Hit results: 1 if any ray of the cell-string is occluded, 0 otherwise
+    GLOBAL float *hits)
+{
+    __local uint lds_stack[GROUP_SIZE * LDS_STACK_SIZE];
+
+    uint index = get_global_id(0);
+    uint local_index = get_local_id(0);
+
+    // Handle only working subset
+    if (index < (uint)((*num_cell_strings) * (*num_directions)))
+    {
+        const int cell_string_id = index % (*num_cell_strings);
+        const int direction_id = index / (*num_cell_strings);
+
+        float result = 0.f;
+
+        // Iterate over all points in cell-string
+        for (int i = cell_string_inds[cell_string_id * 2]; i < cell_string_inds[cell_string_id * 2 + 1]; ++i)
+        {
+            const ray my_ray = make_ray_2d(origins[i], directions[direction_id]);
+
+            if (trace_occluded(nodes, &my_ray, stack, STACK_SIZE * index, lds_stack, local_index * LDS_STACK_SIZE))
+            {
+                result = 1.f;
+                break;
+            }
+        }
+
+        hits[cell_string_id + direction_id * (*num_cell_strings)] = result;
+    }
+}
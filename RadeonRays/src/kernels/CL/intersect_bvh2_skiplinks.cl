@@ -50,6 +50,9 @@ THE SOFTWARE.
             addr <- skiplink at node (follow next)
         }
 
+    If RR_QUANTIZED_NODES is defined nodes are fetched in 16-byte quantized form
+    and decoded into plain ones, see QuantizedBvhTranslator.
+
     Pros:
         -Simple and efficient kernel with low VGPR pressure.
         -Can traverse trees of arbitrary depth.
@@ -82,6 +85,55 @@ DEFINES
  **************************************************************************/
 typedef bbox bvh_node;
 
+#ifdef RR_QUANTIZED_NODES
+// Quantized node, see QuantizedBvhTranslator. 16-bit bounds lo.xyz, hi.xyz are
+// packed into x, y, z and w holds the skip link or leaf data. Quantization grid
+// origin and step are stored in front of the nodes.
+typedef uint4 bvh_node_data;
+
+#define QUANTIZED_HEADER_SIZE 2
+#define QUANTIZED_LEAF_BIT 0x80000000u
+#define QUANTIZED_LAST_BIT 0x40000000u
+#define QUANTIZED_INVALID_LINK 0x7fffffffu
+
+// Decode quantized node into plain one, grid points are exact floats
+// so the bounds match the ones produced on the host
+INLINE
+bvh_node fetch_node(GLOBAL bvh_node_data const* restrict nodes, int addr)
+{
+    float4 const origin = as_float4(nodes[0]);
+    float4 const step = as_float4(nodes[1]);
+    uint4 const data = nodes[QUANTIZED_HEADER_SIZE + addr];
+    float3 const lo = convert_float3((uint3)(data.x & 0xffff, data.x >> 16, data.y & 0xffff));
+    float3 const hi = convert_float3((uint3)(data.y >> 16, data.z & 0xffff, data.z >> 16));
+
+    bvh_node node;
+    node.pmin = (float4)(lo * step.xyz + origin.xyz, -1.f);
+    node.pmax = (float4)(hi * step.xyz + origin.xyz, -1.f);
+
+    if (data.w & QUANTIZED_LEAF_BIT)
+    {
+        // Skip link of a leaf is the next node unless it is the last one
+        node.pmin.w = (float)(data.w & ~(QUANTIZED_LEAF_BIT | QUANTIZED_LAST_BIT));
+        node.pmax.w = (data.w & QUANTIZED_LAST_BIT) ? -1.f : (float)(addr + 1);
+    }
+    else if (data.w != QUANTIZED_INVALID_LINK)
+    {
+        node.pmax.w = (float)data.w;
+    }
+
+    return node;
+}
+#else
+typedef bbox bvh_node_data;
+
+INLINE
+bvh_node fetch_node(GLOBAL bvh_node_data const* restrict nodes, int addr)
+{
+    return nodes[addr];
+}
+#endif // RR_QUANTIZED_NODES
+
 typedef struct
 {
     // Vertex indices
@@ -92,13 +144,136 @@ typedef struct
     int prim_id;
 } Face;
 
+// Number of triangles in a leaf block
+#define TRIANGLE_BLOCK_SIZE 4
+
+// Leaf triangles in SoA layout, i-th component of each vector belongs to
+// i-th triangle of the block. Padding triangles are degenerate and never hit.
+typedef struct
+{
+    // First vertex x, y, z
+    float4 v0[3];
+    // First edge (v2 - v1) x, y, z
+    float4 e1[3];
+    // Second edge (v3 - v1) x, y, z
+    float4 e2[3];
+} TriangleBlock;
+
+// Fetch vertices of a triangle stored in the block
+INLINE
+void triangle_block_get_vertices(GLOBAL TriangleBlock const* restrict block, int lane, float3* v1, float3* v2, float3* v3)
+{
+    GLOBAL float const* data = (GLOBAL float const*)block;
+    float3 const v0 = make_float3(data[lane], data[4 + lane], data[8 + lane]);
+    float3 const e1 = make_float3(data[12 + lane], data[16 + lane], data[20 + lane]);
+    float3 const e2 = make_float3(data[24 + lane], data[28 + lane], data[32 + lane]);
+    *v1 = v0;
+    *v2 = v0 + e1;
+    *v3 = v0 + e2;
+}
+
+// Intersect ray against all the triangles of a leaf, four at a time.
+// Returns face index of the closest (or any if any_hit is set) hit
+// updating t_max accordingly, INVALID_IDX otherwise.
+INLINE
+int intersect_leaf(
+    ray const* r,
+    GLOBAL TriangleBlock const* restrict triangles,
+    GLOBAL Face const* restrict faces,
+    bvh_node const* node,
+    float* t_max,
+    bool any_hit)
+{
+    int const start = STARTIDX((*node));
+    int const end = start + (max(NUMPRIMS((*node)), 1) + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE;
+    int isect_idx = INVALID_IDX;
+
+    float4 const dx = (float4)(r->d.x);
+    float4 const dy = (float4)(r->d.y);
+    float4 const dz = (float4)(r->d.z);
+
+    for (int block_idx = start; block_idx < end; ++block_idx)
+    {
+        GLOBAL TriangleBlock const* block = triangles + block_idx;
+        float4 const e1x = block->e1[0];
+        float4 const e1y = block->e1[1];
+        float4 const e1z = block->e1[2];
+        float4 const e2x = block->e2[0];
+        float4 const e2y = block->e2[1];
+        float4 const e2z = block->e2[2];
+
+        // s1 = cross(d, e2)
+        float4 const s1x = dy * e2z - dz * e2y;
+        float4 const s1y = dz * e2x - dx * e2z;
+        float4 const s1z = dx * e2y - dy * e2x;
+        float4 const denom = s1x * e1x + s1y * e1y + s1z * e1z;
+
+#ifdef USE_SAFE_MATH
+        float4 const invd = 1.f / denom;
+#else
+        float4 const invd = native_recip(denom);
+#endif
+
+        // s2 = cross(o - v1, e1)
+        float4 const ox = (float4)(r->o.x) - block->v0[0];
+        float4 const oy = (float4)(r->o.y) - block->v0[1];
+        float4 const oz = (float4)(r->o.z) - block->v0[2];
+        float4 const b1 = (ox * s1x + oy * s1y + oz * s1z) * invd;
+        float4 const s2x = oy * e1z - oz * e1y;
+        float4 const s2y = oz * e1x - ox * e1z;
+        float4 const s2z = ox * e1y - oy * e1x;
+        float4 const b2 = (dx * s2x + dy * s2y + dz * s2z) * invd;
+        float4 const t = (e2x * s2x + e2y * s2y + e2z * s2z) * invd;
+
+        int4 hit = denom != 0.f && b1 >= 0.f && b1 <= 1.f && b2 >= 0.f && b1 + b2 <= 1.f && t >= 0.f;
+
+#ifdef RR_BACKFACE_CULL
+        if (ray_get_doBackfaceCull(r))
+        {
+            float4 const nx = e1y * e2z - e1z * e2y;
+            float4 const ny = e1z * e2x - e1x * e2z;
+            float4 const nz = e1x * e2y - e1y * e2x;
+            hit = hit && !(nx * dx + ny * dy + nz * dz > 0.f);
+        }
+#endif // RR_BACKFACE_CULL
+
+        float const lane_t[TRIANGLE_BLOCK_SIZE] = { t.x, t.y, t.z, t.w };
+        int const lane_hit[TRIANGLE_BLOCK_SIZE] = { hit.x, hit.y, hit.z, hit.w };
+
+        // Lanes are checked in order, so the closest hit is found
+        // in the same way as with one triangle per leaf
+        for (int lane = 0; lane < TRIANGLE_BLOCK_SIZE; ++lane)
+        {
+            int const face_idx = block_idx * TRIANGLE_BLOCK_SIZE + lane;
+#ifdef RR_RAY_MASK
+            if (ray_get_mask(r) == faces[face_idx].shape_id)
+            {
+                continue;
+            }
+#endif // RR_RAY_MASK
+            if (lane_hit[lane] && lane_t[lane] < *t_max)
+            {
+                *t_max = lane_t[lane];
+                isect_idx = face_idx;
+
+                if (any_hit)
+                {
+                    return isect_idx;
+                }
+            }
+        }
+    }
+
+    return isect_idx;
+}
+
 __attribute__((reqd_work_group_size(64, 1, 1)))
 KERNEL 
 void intersect_main(
     // BVH nodes
-    GLOBAL bvh_node const* restrict nodes,
-    // Triangle vertices
-    GLOBAL float3 const* restrict vertices,
+    GLOBAL bvh_node_data const* restrict nodes,
+    // Leaf triangle blocks
+    GLOBAL TriangleBlock const* restrict triangles,
     // Triangle indices
     GLOBAL Face const* restrict faces,
     // Rays 
@@ -132,7 +307,7 @@ void intersect_main(
             while (addr != INVALID_IDX)
             {
                 // Fetch next node
-                bvh_node node = nodes[addr];
+                bvh_node node = fetch_node(nodes, addr);
                 // Intersect against bbox
                 float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
 
@@ -141,27 +316,12 @@ void intersect_main(
                     // Check if the node is a leaf
                     if (LEAFNODE(node))
                     {
-                        int const face_idx = STARTIDX(node);
-                        Face const face = faces[face_idx];
-#ifdef RR_RAY_MASK
-                        if (ray_get_mask(&r) != face.shape_id)
+                        // Intersect leaf triangles updating closest hit distance and index
+                        int const face_idx = intersect_leaf(&r, triangles, faces, &node, &t_max, false);
+                        if (face_idx != INVALID_IDX)
                         {
-#endif // RR_RAY_MASK
-                            float3 const v1 = vertices[face.idx[0]];
-                            float3 const v2 = vertices[face.idx[1]];
-                            float3 const v3 = vertices[face.idx[2]];
-
-                            // Intersect triangle
-                            float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
-                            // If hit update closest hit distance and index
-                            if (f < t_max)
-                            {
-                                t_max = f;
-                                isect_idx = face_idx;
-                            }
-#ifdef RR_RAY_MASK
+                            isect_idx = face_idx;
                         }
-#endif // RR_RAY_MASK
                     }
                     else
                     {
@@ -178,11 +338,10 @@ void intersect_main(
             // Check if we have found an intersection
             if (isect_idx != INVALID_IDX)
             {
-                // Fetch the node & vertices
+                // Fetch the face & vertices
                 Face const face = faces[isect_idx];
-                float3 const v1 = vertices[face.idx[0]];
-                float3 const v2 = vertices[face.idx[1]];
-                float3 const v3 = vertices[face.idx[2]];
+                float3 v1, v2, v3;
+                triangle_block_get_vertices(triangles + isect_idx / TRIANGLE_BLOCK_SIZE, isect_idx % TRIANGLE_BLOCK_SIZE, &v1, &v2, &v3);
                 // Calculate hit position
                 float3 const p = r.o.xyz + r.d.xyz * t_max;
                 // Calculte barycentric coordinates
@@ -206,9 +365,9 @@ __attribute__((reqd_work_group_size(64, 1, 1)))
 KERNEL 
 void occluded_main(
     // BVH nodes
-    GLOBAL bvh_node const* restrict nodes,
-    // Triangle vertices
-    GLOBAL float3 const* restrict vertices,
+    GLOBAL bvh_node_data const* restrict nodes,
+    // Leaf triangle blocks
+    GLOBAL TriangleBlock const* restrict triangles,
     // Triangle indices
     GLOBAL Face const* restrict faces,
     // Rays 
@@ -241,7 +400,7 @@ void occluded_main(
             while (addr != INVALID_IDX)
             {
                 // Fetch next node
-                bvh_node node = nodes[addr];
+                bvh_node node = fetch_node(nodes, addr);
                 // Intersect against bbox
                 float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
 
@@ -250,27 +409,12 @@ void occluded_main(
                     // Check if the node is a leaf
                     if (LEAFNODE(node))
                     {
-                        int const face_idx = STARTIDX(node);
-                        Face const face = faces[face_idx];
-#ifdef RR_RAY_MASK
-                        if (ray_get_mask(&r) != face.shape_id)
+                        // Intersect leaf triangles, if hit store the result and bail out
+                        if (intersect_leaf(&r, triangles, faces, &node, &t_max, true) != INVALID_IDX)
                         {
-#endif // RR_RAY_MASK
-                            float3 const v1 = vertices[face.idx[0]];
-                            float3 const v2 = vertices[face.idx[1]];
-                            float3 const v3 = vertices[face.idx[2]];
-
-                            // Intersect triangle
-                            float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
-                            // If hit store the result and bail out
-                            if (f < t_max)
-                            {
-                                hits[global_id] = HIT_MARKER;
-                                return;
-                            }
-#ifdef RR_RAY_MASK
+                            hits[global_id] = HIT_MARKER;
+                            return;
                         }
-#endif // RR_RAY_MASK
                     }
                     else
                     {
@@ -290,23 +434,77 @@ void occluded_main(
     }
 }
 
-#define USE_ATOMIC
+// Any hit traversal for a single ray, returns address of the leaf
+// containing occluder or INVALID_IDX if the ray is not occluded
+INLINE
+int find_occluding_leaf(GLOBAL bvh_node_data const* restrict nodes, GLOBAL TriangleBlock const* restrict triangles, GLOBAL Face const* restrict faces, ray* r)
+{
+    // Precompute inverse direction and origin / dir for bbox testing
+    float3 const invdir = safe_invdir(*r);
+    float3 const oxinvdir = -r->o.xyz * invdir;
+    // Intersection parametric distance
+    float t_max = r->o.w;
+
+    // Current node address
+    int addr = 0;
+
+    while (addr != INVALID_IDX)
+    {
+        // Fetch next node
+        bvh_node node = fetch_node(nodes, addr);
+        // Intersect against bbox
+        float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+
+        if (s.x <= s.y)
+        {
+            // Check if the node is a leaf
+            if (LEAFNODE(node))
+            {
+                if (intersect_leaf(r, triangles, faces, &node, &t_max, true) != INVALID_IDX)
+                {
+                    return addr;
+                }
+            }
+            else
+            {
+                // Move to next node otherwise.
+                // Left child is always at addr + 1
+                ++addr;
+                continue;
+            }
+        }
+
+        addr = NEXT(node);
+    }
+
+    return INVALID_IDX;
+}
+
+INLINE
+bool occluded_any(GLOBAL bvh_node_data const* restrict nodes, GLOBAL TriangleBlock const* restrict triangles, GLOBAL Face const* restrict faces, ray* r)
+{
+    return find_occluding_leaf(nodes, triangles, faces, r) != INVALID_IDX;
+}
+
+// Test the ray against a single leaf only, INVALID_IDX leaf never occludes
+INLINE
+bool occluded_by_leaf(GLOBAL bvh_node_data const* restrict nodes, GLOBAL TriangleBlock const* restrict triangles, GLOBAL Face const* restrict faces, ray* r, int addr)
+{
+    if (addr == INVALID_IDX)
+        return false;
 
-#ifdef USE_ATOMIC
-inline float atomicadd(volatile __global float* address, const float value) {
-    float old = value;
-    while ((old = atomic_xchg(address, atomic_xchg(address, 0.0f)+old)) != 0.0f);
-    return old;
+    bvh_node node = fetch_node(nodes, addr);
+    float t_max = r->o.w;
+    return intersect_leaf(r, triangles, faces, &node, &t_max, true) != INVALID_IDX;
 }
-#endif
 
 __attribute__((reqd_work_group_size(64, 1, 1)))
 KERNEL
 void occluded_main_2d_sum_linear(
 // BVH nodes
-GLOBAL bvh_node const* restrict nodes,
-// Triangle vertices
-GLOBAL float3 const* restrict vertices,
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
 // Triangle indices
 GLOBAL Face const* restrict faces,
 
@@ -323,20 +521,23 @@ GLOBAL int const* restrict num_origins,
 GLOBAL int const* restrict num_directions,
 GLOBAL int const* restrict stride_directions,
 // Hit data
-GLOBAL float* hits
+GLOBAL float* hits,
+// Index of the first ray of the dispatch
+ulong ray_offset
 )
 {
-    int num_rays = (*num_origins) * (*num_directions);
-    
+    long num_rays = (long)(*num_origins) * (*num_directions);
+
     int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
 
-    int origin_id = global_id % (*num_origins);
-    int direction_id = (int)(global_id / (*num_origins));
+    int origin_id = (int)(ray_id % (*num_origins));
+    int direction_id = (int)(ray_id / (*num_origins));
     int direction_stride = (int)(direction_id % (*stride_directions));
     int output_offset = direction_stride * (*num_origins);
     
     // Handle only working subset
-    if (global_id < num_rays)
+    if (ray_id < num_rays)
     {
         const int direction_offset = offset_directions[origin_id];
         const int koefs_offset = offset_koefs[origin_id];
@@ -351,87 +552,8 @@ GLOBAL float* hits
         r.extra.y = 1;
         r.doBackfaceCulling = 0;
         r.padding = 1;
-        
-        {
-            // Precompute inverse direction and origin / dir for bbox testing
-            float3 const invdir = safe_invdir(r);
-            float3 const oxinvdir = -r.o.xyz * invdir;
-            // Intersection parametric distance
-            float t_max = r.o.w;
-            
-            // Current node address
-            int addr = 0;
-            
-            while (addr != INVALID_IDX)
-            {
-                // Fetch next node
-                bvh_node node = nodes[addr];
-                // Intersect against bbox
-                float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
-                
-                if (s.x <= s.y)
-                {
-                    // Check if the node is a leaf
-                    if (LEAFNODE(node))
-                    {
-                        int const face_idx = STARTIDX(node);
-                        Face const face = faces[face_idx];
-                        #ifdef RR_RAY_MASK
-                        if (ray_get_mask(&r) != face.shape_id)
-                        {
-                            #endif // RR_RAY_MASK
-                            float3 const v1 = vertices[face.idx[0]];
-                            float3 const v2 = vertices[face.idx[1]];
-                            float3 const v3 = vertices[face.idx[2]];
-                            
-                            // Intersect triangle
-                            float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
-                            // If hit store the result and bail out
-                            if (f < t_max)
-                            {
-                                #ifdef USE_ATOMIC
-                                if (fabs(koef.x)>1e-4) {
-                                    atomicadd(&hits[(output_offset + origin_id)*2], koef.x);
-                                }
-                                if (fabs(koef.z)>1e-4) {
-                                    atomicadd(&hits[(output_offset + origin_id)*2+1], koef.z);
-                                }
-                                #else
-                                    hits[(output_offset + origin_id)*2] += koef.x;
-                                    hits[(output_offset + origin_id)*2+1] += koef.z;
-                                #endif
-
-                                return;
-                            }
-                            #ifdef RR_RAY_MASK
-                        }
-                        #endif // RR_RAY_MASK
-                    }
-                    else
-                    {
-                        // Move to next node otherwise.
-                        // Left child is always at addr + 1
-                        ++addr;
-                        continue;
-                    }
-                }
-                
-                addr = NEXT(node);
-            }
-            
-            // Finished traversal, but no intersection found
-            #ifdef USE_ATOMIC
-            if (fabs(koef.y)>1e-4) {
-                atomicadd(&hits[(output_offset + origin_id)*2], koef.y);
-            }
-            if (fabs(koef.w)>1e-4) {
-                atomicadd(&hits[(output_offset + origin_id)*2+1], koef.w);
-            }
-            #else
-                hits[(output_offset + origin_id)*2] += koef.y;
-                hits[(output_offset + origin_id)*2+1] += koef.w;
-            #endif
-        }
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, occluded_any(nodes, triangles, faces, &r));
     }
 }
 
@@ -439,9 +561,9 @@ __attribute__((reqd_work_group_size(64, 1, 1)))
 KERNEL
 void occluded_main_2d_cell_string(
 // BVH nodes
-GLOBAL bvh_node const* restrict nodes,
-// Triangle vertices
-GLOBAL float3 const* restrict vertices,
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
 // Triangle indices
 GLOBAL Face const* restrict faces,
 
@@ -461,8 +583,17 @@ GLOBAL int const* restrict num_cell_strings,
 GLOBAL float* hits
 )
 {
-    int global_id = get_global_id(0);
+    // Shadow cache: leaf which has recently occluded a string of the group. Neighbouring
+    // work items handle neighbouring strings in the same direction, so the same occluder
+    // often shades them too and is tested before traversing from the root.
+    __local volatile int lds_shadow_leaf;
+
+    if (get_local_id(0) == 0)
+        lds_shadow_leaf = INVALID_IDX;
 
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int global_id = get_global_id(0);
 
     // Handle only working subset
     int num_ray_batches = (*num_cell_strings) * (*num_directions);
@@ -478,77 +609,833 @@ GLOBAL float* hits
         int cs_pt_start = cell_string_inds[cell_string_id*2];
         int cs_pt_end = cell_string_inds[cell_string_id*2+1];
 
-        // Iterate over all points in cell-string
+        float result = 0.f;
+
+        // Iterate over all points in cell-string, any occluded point shades the string
         for (int i = cs_pt_start; i < cs_pt_end; i++) {
 
-            // Create ray
-            ray r;
-            r.o = origins[i];
-            r.d = directions[direction_id];
-            r.extra.x = -1;
-            r.extra.y = 1;
-            r.doBackfaceCulling = 0;
-            r.padding = 1;
+            ray r = make_ray_2d(origins[i], directions[direction_id]);
+
+            if (occluded_by_leaf(nodes, triangles, faces, &r, lds_shadow_leaf))
+            {
+                result = 1.f;
+                break;
+            }
 
+            int const leaf = find_occluding_leaf(nodes, triangles, faces, &r);
+            if (leaf != INVALID_IDX)
             {
-                // Precompute inverse direction and origin / dir for bbox testing
-                float3 const invdir = safe_invdir(r);
-                float3 const oxinvdir = -r.o.xyz * invdir;
+                // Racing writers store valid leaves, any of them will do
+                lds_shadow_leaf = leaf;
+                result = 1.f;
+                break;
+            }
+        }
+
+        hits[cell_string_id + direction_id * (*num_cell_strings)] = result;
+    }
+}
+
+#define CELL_STRING_GROUP_SIZE 64
+
+// Cooperative traversal for cell-strings: one work-group per (cell-string, direction).
+// All rays of the string share the direction, so the group walks the tree once
+// with the bounding frustum of the string (the ray from the center of the origins box
+// tested against node boxes inflated by the box half extent) and only the leaves
+// surviving this test are intersected per point.
+__attribute__((reqd_work_group_size(CELL_STRING_GROUP_SIZE, 1, 1)))
+KERNEL
+void occluded_main_2d_cell_string_frustum(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+GLOBAL float4 const* restrict directions,
 
-                // Intersection parametric distance
-                float t_max = r.o.w;
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
 
-                // Current node address
-                int addr = 0;
+// Cell-string to point mappings
+GLOBAL int const* restrict cell_string_inds,
+GLOBAL int const* restrict num_cell_strings,
 
-                while (addr != INVALID_IDX)
+// Hit data
+GLOBAL float* hits
+)
+{
+    __local float4 lds_pmin[CELL_STRING_GROUP_SIZE];
+    __local float4 lds_pmax[CELL_STRING_GROUP_SIZE];
+    __local int lds_occluded;
+
+    int const batch_id = get_group_id(0);
+    int const local_id = get_local_id(0);
+
+    // Handle only working subset (uniform across the group)
+    int num_ray_batches = (*num_cell_strings) * (*num_directions);
+    if (batch_id >= num_ray_batches)
+        return;
+
+    // Map batch_id to cell_string_id and direction_id
+    const int cell_string_id = batch_id % (*num_cell_strings);
+    const int direction_id = (int)(batch_id / (*num_cell_strings));
+
+    int cs_pt_start = cell_string_inds[cell_string_id*2];
+    int cs_pt_end = cell_string_inds[cell_string_id*2+1];
+
+    float4 const d = directions[direction_id];
+
+    // Bounds of the string origins, w keeps max t
+    float4 pmin = make_float4(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX);
+    float4 pmax = make_float4(-FLT_MAX, -FLT_MAX, -FLT_MAX, 0.f);
+    for (int i = cs_pt_start + local_id; i < cs_pt_end; i += CELL_STRING_GROUP_SIZE)
+    {
+        float4 const o = origins[i];
+        pmin = min(pmin, o);
+        pmax = max(pmax, o);
+    }
+
+    lds_pmin[local_id] = pmin;
+    lds_pmax[local_id] = pmax;
+
+    if (local_id == 0)
+        lds_occluded = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int s = CELL_STRING_GROUP_SIZE >> 1; s > 0; s >>= 1)
+    {
+        if (local_id < s)
+        {
+            lds_pmin[local_id] = min(lds_pmin[local_id], lds_pmin[local_id + s]);
+            lds_pmax[local_id] = max(lds_pmax[local_id], lds_pmax[local_id + s]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    float3 const extent = 0.5f * (lds_pmax[0].xyz - lds_pmin[0].xyz);
+
+    // Frustum ray starts from the origins box center
+    ray f;
+    f.o.xyz = 0.5f * (lds_pmax[0].xyz + lds_pmin[0].xyz);
+    f.o.w = lds_pmax[0].w;
+    f.d = d;
+
+    float3 const invdir = safe_invdir(f);
+    float3 const oxinvdir = -f.o.xyz * invdir;
+    float const t_frustum = f.o.w;
+
+    // Current node address
+    int addr = (cs_pt_start < cs_pt_end) ? 0 : INVALID_IDX;
+
+    while (addr != INVALID_IDX)
+    {
+        // Fetch next node
+        bvh_node node = fetch_node(nodes, addr);
+
+        // Intersect the frustum against inflated bbox
+        bbox inflated = node;
+        inflated.pmin.xyz -= extent;
+        inflated.pmax.xyz += extent;
+        float2 s = fast_intersect_bbox1(inflated, invdir, oxinvdir, t_frustum);
+
+        if (s.x <= s.y)
+        {
+            // Check if the node is a leaf
+            if (LEAFNODE(node))
+            {
+                // Each work item tests its own points against surviving leaf
+                for (int i = cs_pt_start + local_id; i < cs_pt_end; i += CELL_STRING_GROUP_SIZE)
                 {
-                    // Fetch next node
-                    bvh_node node = nodes[addr];
-                    // Intersect against bbox
-                    float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+                    ray r;
+                    r.o = origins[i];
+                    r.d = d;
+                    r.extra.x = -1;
+                    r.extra.y = 1;
+                    r.doBackfaceCulling = 0;
+                    r.padding = 1;
 
-                    if (s.x <= s.y)
+                    float t_max = r.o.w;
+                    if (intersect_leaf(&r, triangles, faces, &node, &t_max, true) != INVALID_IDX)
                     {
-                        // Check if the node is a leaf
-                        if (LEAFNODE(node))
-                        {
-                            int const face_idx = STARTIDX(node);
-                            Face const face = faces[face_idx];
-                            #ifdef RR_RAY_MASK
-                            if (ray_get_mask(&r) != face.shape_id)
-                            {
-                                #endif // RR_RAY_MASK
-                                float3 const v1 = vertices[face.idx[0]];
-                                float3 const v2 = vertices[face.idx[1]];
-                                float3 const v3 = vertices[face.idx[2]];
-
-                                // Intersect triangle
-                                float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
-                                // If hit store the result and bail out
-                                if (f < t_max)
-                                {
-                                    hits[cell_string_id + direction_id * (*num_cell_strings)] = 1.;
-                                    return;
-
-                                }
-                                #ifdef RR_RAY_MASK
-                            }
-                            #endif // RR_RAY_MASK
-                        }
-                        else
-                        {
-                            // Move to next node otherwise.
-                            // Left child is always at addr + 1
-                            ++addr;
-                            continue;
-                        }
+                        lds_occluded = 1;
+                        break;
                     }
-                    addr = NEXT(node);
                 }
+
+                barrier(CLK_LOCAL_MEM_FENCE);
+                int const occluded = lds_occluded;
+                // Make sure everyone has read the flag before it can be set again
+                barrier(CLK_LOCAL_MEM_FENCE);
+
+                // Any occluded point shades the whole string
+                if (occluded)
+                    break;
+            }
+            else
+            {
+                // Move to next node otherwise.
+                // Left child is always at addr + 1
+                ++addr;
+                continue;
             }
         }
-        // Finished traversal for all points in cell-string, but no intersection found
-        hits[cell_string_id + direction_id * (*num_cell_strings)] = 0.;
+
+        addr = NEXT(node);
+    }
+
+    if (local_id == 0)
+    {
+        hits[cell_string_id + direction_id * (*num_cell_strings)] = lds_occluded ? 1. : 0.;
+    }
+}
+
+// Counting cell-string traversal: one work-group per (cell-string, direction).
+// Every point is traced, work items take contiguous runs of points and test the
+// leaf which has occluded their previous point first. Counts are reduced in local
+// memory and optional per point bits are set or cleared atomically.
+__attribute__((reqd_work_group_size(CELL_STRING_GROUP_SIZE, 1, 1)))
+KERNEL
+void occluded_main_2d_cell_string_count(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+GLOBAL float4 const* restrict directions,
+
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+
+// Cell-string to point mappings
+GLOBAL int const* restrict cell_string_inds,
+GLOBAL int const* restrict num_cell_strings,
+
+// Number of occluded points per cell-string and direction
+GLOBAL float* counts,
+// Per point occlusion bits, unused if use_masks is 0
+GLOBAL uint* point_masks,
+int use_masks
+)
+{
+    __local int lds_count;
+
+    int const batch_id = get_group_id(0);
+    int const local_id = get_local_id(0);
+
+    // Handle only working subset (uniform across the group)
+    int num_ray_batches = (*num_cell_strings) * (*num_directions);
+    if (batch_id >= num_ray_batches)
+        return;
+
+    if (local_id == 0)
+        lds_count = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Map batch_id to cell_string_id and direction_id
+    const int cell_string_id = batch_id % (*num_cell_strings);
+    const int direction_id = (int)(batch_id / (*num_cell_strings));
+
+    int const cs_pt_start = cell_string_inds[cell_string_id*2];
+    int const cs_pt_end = cell_string_inds[cell_string_id*2+1];
+    int const run = (cs_pt_end - cs_pt_start + CELL_STRING_GROUP_SIZE - 1) / CELL_STRING_GROUP_SIZE;
+    int const run_start = cs_pt_start + local_id * run;
+    int const run_end = min(run_start + run, cs_pt_end);
+
+    float4 const d = directions[direction_id];
+
+    int count = 0;
+    int shadow_leaf = INVALID_IDX;
+
+    for (int i = run_start; i < run_end; ++i)
+    {
+        ray r = make_ray_2d(origins[i], d);
+
+        bool occluded = occluded_by_leaf(nodes, triangles, faces, &r, shadow_leaf);
+        if (!occluded)
+        {
+            int const leaf = find_occluding_leaf(nodes, triangles, faces, &r);
+            if (leaf != INVALID_IDX)
+            {
+                shadow_leaf = leaf;
+                occluded = true;
+            }
+        }
+
+        count += occluded ? 1 : 0;
+
+        if (use_masks)
+        {
+            // Neighbouring strings might share the word, bit index might not fit 32 bits
+            ulong const bit = (ulong)direction_id * (*num_origins) + i;
+            ulong const word = bit >> 5;
+            uint const mask = 1u << (uint)(bit & 31);
+            if (occluded)
+                atomic_or(&point_masks[word], mask);
+            else
+                atomic_and(&point_masks[word], ~mask);
+        }
+    }
+
+    if (count)
+        atomic_add(&lds_count, count);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (local_id == 0)
+    {
+        counts[cell_string_id + direction_id * (*num_cell_strings)] = (float)lds_count;
+    }
+}
+
+// Prepares flattened cell-string traversal: writes string lengths (with an extra zero
+// element, so exclusive scan yields total number of points in the last element)
+// and clears hit flags used for early exit.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_cell_string_init(
+// Number of directions
+GLOBAL int const* restrict num_directions,
+// Cell-string to point mappings
+GLOBAL int const* restrict cell_string_inds,
+GLOBAL int const* restrict num_cell_strings,
+// Cell-string lengths
+GLOBAL int* restrict lengths,
+// Hit data
+GLOBAL float* hits
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_cell_strings)
+    {
+        lengths[global_id] = cell_string_inds[global_id*2+1] - cell_string_inds[global_id*2];
+
+        for (int i = 0; i < *num_directions; ++i)
+        {
+            hits[global_id + i * (*num_cell_strings)] = 0.;
+        }
+    }
+    else if (global_id == *num_cell_strings)
+    {
+        lengths[global_id] = 0;
+    }
+}
+
+// Any hit traversal of a single point of a flattened cell-string. Hits are OR-reduced
+// into per string output, string_occluded mirrors the flag of the string in local memory,
+// so siblings stop traversal as soon as one point of the string is occluded.
+INLINE
+void occluded_cell_string_point(
+    GLOBAL bvh_node_data const* restrict nodes,
+    GLOBAL TriangleBlock const* restrict triangles,
+    GLOBAL Face const* restrict faces,
+    ray* r,
+    GLOBAL float* hits,
+    int hit_idx,
+    __local volatile int* string_occluded
+)
+{
+    // Precompute inverse direction and origin / dir for bbox testing
+    float3 const invdir = safe_invdir(*r);
+    float3 const oxinvdir = -r->o.xyz * invdir;
+
+    // Intersection parametric distance
+    float t_max = r->o.w;
+
+    // Current node address
+    int addr = 0;
+
+    while (addr != INVALID_IDX)
+    {
+        // Fetch next node
+        bvh_node node = fetch_node(nodes, addr);
+        // Intersect against bbox
+        float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+
+        if (s.x <= s.y)
+        {
+            // Check if the node is a leaf
+            if (LEAFNODE(node))
+            {
+                // Sibling has shaded the string meanwhile
+                if (*string_occluded)
+                    return;
+
+                // Intersect leaf triangles, if hit store the result and bail out,
+                // all writers store the same value
+                if (intersect_leaf(r, triangles, faces, &node, &t_max, true) != INVALID_IDX)
+                {
+                    *string_occluded = 1;
+                    hits[hit_idx] = 1.;
+                    return;
+                }
+            }
+            else
+            {
+                // Move to next node otherwise.
+                // Left child is always at addr + 1
+                ++addr;
+                continue;
+            }
+        }
+
+        addr = NEXT(node);
+    }
+}
+
+// Flattened cell-string traversal: one work item per (point, direction) pair.
+// Points of the same string map to adjacent work items, so uneven string lengths
+// do not cause divergence. Total number of points is read from the scan, so the
+// dispatch strides over the grid until it is past the end of the pair range.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_cell_string_flat(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+GLOBAL float4 const* restrict directions,
+
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+
+// Cell-string to point mappings
+GLOBAL int const* restrict cell_string_inds,
+GLOBAL int const* restrict num_cell_strings,
+
+// Exclusive scan of cell-string lengths
+GLOBAL int const* restrict offsets,
+
+// Hit data
+GLOBAL float* hits,
+// Index of the first (point, direction) pair of the dispatch
+ulong ray_offset,
+// Index past the last pair the dispatch may process
+ulong ray_end,
+// Number of pairs processed by the dispatch in a single pass
+ulong ray_stride
+)
+{
+    // Output indices grow with global_id, but skip empty strings and jump on direction
+    // wrap, so a string run is flagged by the local index of its first work item
+    __local int lds_hit_idx[64];
+    __local volatile int lds_string_occluded[64];
+
+    int local_id = get_local_id(0);
+
+    int const num_strings = *num_cell_strings;
+    int const num_points = offsets[num_strings];
+    ulong const num_rays = (ulong)num_points * (*num_directions);
+    ulong const end = min(ray_end, num_rays);
+
+    // Loop bound is uniform across the work-group, so all work items reach the barriers
+    for (ulong group_start = ray_offset + get_group_id(0) * get_local_size(0); group_start < end; group_start += ray_stride)
+    {
+        ulong const ray_id = group_start + local_id;
+
+        int cell_string_id = INVALID_IDX;
+        int direction_id = 0;
+        int point_id = 0;
+        int hit_idx = INVALID_IDX;
+
+        // Handle only working subset
+        if (ray_id < end)
+        {
+            point_id = (int)(ray_id % num_points);
+            direction_id = (int)(ray_id / num_points);
+
+            // Find the string containing the point: last one with offset <= point_id
+            int lo = 0;
+            int hi = num_strings;
+            while (hi - lo > 1)
+            {
+                int const mid = (lo + hi) >> 1;
+                if (offsets[mid] <= point_id)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+
+            cell_string_id = lo;
+            hit_idx = cell_string_id + direction_id * num_strings;
+        }
+
+        lds_string_occluded[local_id] = 0;
+        lds_hit_idx[local_id] = hit_idx;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Skip if some other point has already shaded the string
+        if (hit_idx != INVALID_IDX && ((GLOBAL volatile float*)hits)[hit_idx] == 0.f)
+        {
+            // First work item of the run: valid indices are sorted and precede invalid ones
+            int lo = 0;
+            int hi = local_id;
+            while (lo < hi)
+            {
+                int const mid = (lo + hi) >> 1;
+                if (lds_hit_idx[mid] < hit_idx)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            ray r = make_ray_2d(origins[cell_string_inds[cell_string_id*2] + point_id - offsets[cell_string_id]], directions[direction_id]);
+            occluded_cell_string_point(nodes, triangles, faces, &r, hits, hit_idx, &lds_string_occluded[lo]);
+        }
+
+        // Local memory is reused by the next pass
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+// Deterministic variant of occluded_main_2d_sum_linear, first pass: writes
+// koefs selected by ray visibility into per ray slots of contribs buffer.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_sum_linear_contrib(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+GLOBAL float4 const* restrict directions,
+GLOBAL float4 const* restrict koefs,
+
+GLOBAL int const* restrict offset_directions,
+GLOBAL int const* restrict offset_koefs,
+
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+GLOBAL int const* restrict stride_directions,
+// Per ray contributions
+GLOBAL float2* contribs,
+// Index of the first ray of the dispatch
+ulong ray_offset
+)
+{
+    long num_rays = (long)(*num_origins) * (*num_directions);
+
+    int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Handle only working subset
+    if (ray_id < num_rays)
+    {
+        int origin_id = (int)(ray_id % (*num_origins));
+        int direction_id = (int)(ray_id / (*num_origins));
+
+        const float4 koef = koefs[direction_id + offset_koefs[origin_id]];
+
+        // Create ray
+        ray r;
+        r.o = origins[origin_id];
+        r.d = directions[direction_id + offset_directions[origin_id]];
+        r.extra.x = -1;
+        r.extra.y = 1;
+        r.doBackfaceCulling = 0;
+        r.padding = 1;
+
+        // Precompute inverse direction and origin / dir for bbox testing
+        float3 const invdir = safe_invdir(r);
+        float3 const oxinvdir = -r.o.xyz * invdir;
+        // Intersection parametric distance
+        float t_max = r.o.w;
+
+        // Current node address
+        int addr = 0;
+        bool hit = false;
+
+        while (addr != INVALID_IDX && !hit)
+        {
+            // Fetch next node
+            bvh_node node = fetch_node(nodes, addr);
+            // Intersect against bbox
+            float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+
+            if (s.x <= s.y)
+            {
+                // Check if the node is a leaf
+                if (LEAFNODE(node))
+                {
+                    // Intersect leaf triangles
+                    hit = intersect_leaf(&r, triangles, faces, &node, &t_max, true) != INVALID_IDX;
+                }
+                else
+                {
+                    // Move to next node otherwise.
+                    // Left child is always at addr + 1
+                    ++addr;
+                    continue;
+                }
+            }
+
+            addr = NEXT(node);
+        }
+
+        float2 contrib = hit ? make_float2(koef.x, koef.z) : make_float2(koef.y, koef.w);
+
+        // Same threshold as accumulating version
+        contrib.x = fabs(contrib.x) > 1e-4f ? contrib.x : 0.f;
+        contrib.y = fabs(contrib.y) > 1e-4f ? contrib.y : 0.f;
+
+        contribs[global_id] = contrib;
+    }
+}
+
+// Deterministic variant of occluded_main_2d_sum_linear, second pass: one work item
+// per (direction stride, origin) output slot sums contributions of its directions
+// in fixed order, so results do not depend on scheduling.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_sum_linear_reduce(
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+GLOBAL int const* restrict stride_directions,
+// Per ray contributions
+GLOBAL float2 const* restrict contribs,
+// Hit data
+GLOBAL float* hits,
+// Index of the first ray and number of rays of the dispatch
+ulong ray_offset,
+int num_tile_rays
+)
+{
+    int const stride = min(*stride_directions, *num_directions);
+    int num_outputs = (*num_origins) * stride;
+
+    int global_id = get_global_id(0);
+
+    if (global_id < num_outputs)
+    {
+        int origin_id = global_id % (*num_origins);
+        int direction_stride = (int)(global_id / (*num_origins));
+
+        // First direction of the slot with a ray inside the dispatch
+        long const first_ray = (long)ray_offset;
+        long const last_ray = first_ray + num_tile_rays;
+        int direction_id = (int)max((first_ray - origin_id + *num_origins - 1) / (*num_origins), 0L);
+        direction_id += (direction_stride - direction_id % (*stride_directions) + *stride_directions) % (*stride_directions);
+
+        float2 sum = make_float2(0.f, 0.f);
+        for (; direction_id < *num_directions; direction_id += *stride_directions)
+        {
+            long const ray_id = (long)direction_id * (*num_origins) + origin_id;
+            if (ray_id >= last_ray)
+                break;
+
+            float2 const contrib = contribs[ray_id - first_ray];
+            sum.x += contrib.x;
+            sum.y += contrib.y;
+        }
+
+        hits[global_id * 2] += sum.x;
+        hits[global_id * 2 + 1] += sum.y;
+    }
+}
+
+// Same as occluded_main_2d_sum_linear, directions are generated from sky patches
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_sum_linear_sky(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+SkyPatches sky,
+GLOBAL float4 const* restrict frames,
+int use_frames,
+GLOBAL float4 const* restrict koefs,
+
+GLOBAL int const* restrict offset_koefs,
+
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+GLOBAL int const* restrict stride_directions,
+// Hit data
+GLOBAL float* hits,
+// Index of the first ray of the dispatch
+ulong ray_offset
+)
+{
+    long num_rays = (long)(*num_origins) * (*num_directions);
+
+    int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Handle only working subset
+    if (ray_id < num_rays)
+    {
+        int origin_id = (int)(ray_id % (*num_origins));
+        int direction_id = (int)(ray_id / (*num_origins));
+        int output_offset = (direction_id % (*stride_directions)) * (*num_origins);
+
+        const float4 koef = koefs[direction_id + offset_koefs[origin_id]];
+
+        // Generate the ray from sky patch
+        ray r = make_sky_ray_2d(origins[origin_id], &sky, frames, use_frames, origin_id, direction_id);
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, occluded_any(nodes, triangles, faces, &r));
+    }
+}
+
+// Deterministic variant of occluded_main_2d_sum_linear_sky, writes per ray
+// contributions to be summed by occluded_main_2d_sum_linear_reduce.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void occluded_main_2d_sum_linear_sky_contrib(
+// BVH nodes
+GLOBAL bvh_node_data const* restrict nodes,
+// Leaf triangle blocks
+GLOBAL TriangleBlock const* restrict triangles,
+// Triangle indices
+GLOBAL Face const* restrict faces,
+
+// Rays
+GLOBAL float4 const* restrict origins,
+SkyPatches sky,
+GLOBAL float4 const* restrict frames,
+int use_frames,
+GLOBAL float4 const* restrict koefs,
+
+GLOBAL int const* restrict offset_koefs,
+
+// Number of origins and directions
+GLOBAL int const* restrict num_origins,
+GLOBAL int const* restrict num_directions,
+GLOBAL int const* restrict stride_directions,
+// Per ray contributions
+GLOBAL float2* contribs,
+// Index of the first ray of the dispatch
+ulong ray_offset
+)
+{
+    long num_rays = (long)(*num_origins) * (*num_directions);
+
+    int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Handle only working subset
+    if (ray_id < num_rays)
+    {
+        int origin_id = (int)(ray_id % (*num_origins));
+        int direction_id = (int)(ray_id / (*num_origins));
+
+        const float4 koef = koefs[direction_id + offset_koefs[origin_id]];
+
+        // Generate the ray from sky patch
+        ray r = make_sky_ray_2d(origins[origin_id], &sky, frames, use_frames, origin_id, direction_id);
+
+        bool const hit = occluded_any(nodes, triangles, faces, &r);
+        float2 contrib = hit ? make_float2(koef.x, koef.z) : make_float2(koef.y, koef.w);
+
+        // Same threshold as accumulating version
+        contrib.x = fabs(contrib.x) > 1e-4f ? contrib.x : 0.f;
+        contrib.y = fabs(contrib.y) > 1e-4f ? contrib.y : 0.f;
+
+        contribs[global_id] = contrib;
+    }
+}
+
+// Leaf geometry of a tree built on the device (see emit_skiplinks_main in build_hlbvh.cl):
+// leaf i holds up to a block of primitives listed in i-th group of leaf_prims, packed
+// into the lanes of its own triangle block, the rest of the block is padding.
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL
+void emit_leaf_geometry_main(
+// Faces in primitive order
+GLOBAL Face const* restrict faces,
+// Primitives of each leaf, -1 for padding
+GLOBAL int const* restrict leaf_prims,
+// Number of leaves
+int num_leaves,
+// World space vertices
+GLOBAL float3 const* restrict vertices,
+// Faces in leaf slot order
+GLOBAL Face* leaf_faces,
+// Leaf triangle blocks
+GLOBAL TriangleBlock* triangles
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_leaves)
+    {
+        Face padding;
+        padding.idx[0] = padding.idx[1] = padding.idx[2] = INVALID_IDX;
+        padding.shape_id = INVALID_IDX;
+        padding.prim_id = INVALID_IDX;
+
+        // SoA components of the block, see triangle_block_get_vertices
+        float data[9 * TRIANGLE_BLOCK_SIZE];
+
+        for (int lane = 0; lane < TRIANGLE_BLOCK_SIZE; ++lane)
+        {
+            int const prim = leaf_prims[global_id * TRIANGLE_BLOCK_SIZE + lane];
+
+            float3 v1 = (float3)(0.f);
+            float3 e1 = (float3)(0.f);
+            float3 e2 = (float3)(0.f);
+
+            if (prim != INVALID_IDX)
+            {
+                Face const face = faces[prim];
+                leaf_faces[global_id * TRIANGLE_BLOCK_SIZE + lane] = face;
+
+                v1 = vertices[face.idx[0]];
+                e1 = vertices[face.idx[1]] - v1;
+                e2 = vertices[face.idx[2]] - v1;
+            }
+            else
+            {
+                leaf_faces[global_id * TRIANGLE_BLOCK_SIZE + lane] = padding;
+            }
+
+            data[lane] = v1.x;
+            data[TRIANGLE_BLOCK_SIZE + lane] = v1.y;
+            data[2 * TRIANGLE_BLOCK_SIZE + lane] = v1.z;
+            data[3 * TRIANGLE_BLOCK_SIZE + lane] = e1.x;
+            data[4 * TRIANGLE_BLOCK_SIZE + lane] = e1.y;
+            data[5 * TRIANGLE_BLOCK_SIZE + lane] = e1.z;
+            data[6 * TRIANGLE_BLOCK_SIZE + lane] = e2.x;
+            data[7 * TRIANGLE_BLOCK_SIZE + lane] = e2.y;
+            data[8 * TRIANGLE_BLOCK_SIZE + lane] = e2.z;
+        }
+
+        GLOBAL float* block = (GLOBAL float*)(triangles + global_id);
+        for (int i = 0; i < 9 * TRIANGLE_BLOCK_SIZE; ++i)
+        {
+            block[i] = data[i];
+        }
     }
 }
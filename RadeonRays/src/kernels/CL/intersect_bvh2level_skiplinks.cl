@@ -456,4 +456,279 @@ KERNEL void occluded_main(
             hits[global_id] = MISS_MARKER;
         }
     }
-}
\ No newline at end of file
+}
+// Any hit traversal shared by 2D queries. The ray is transformed into
+// object space at top level leaves, so instances do not need their own geometry.
+INLINE bool trace_occluded(
+    // BVH nodes
+    GLOBAL bvh_node const* restrict nodes,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Faces
+    GLOBAL Face const* restrict faces,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // BVH root index
+    int root_idx,
+    // Ray
+    ray r
+)
+{
+    // Precompute invdir for bbox testing
+    float3 invdir = safe_invdir(r);
+    float3 invdirtop = invdir;
+    float const t_max = r.o.w;
+
+    // We need to keep original ray around for returns from bottom hierarchy
+    ray top_ray = r;
+
+    // Fetch top level BVH index
+    int addr = root_idx;
+    // Set top index
+    int top_addr = INVALID_IDX;
+
+    while (addr != INVALID_IDX)
+    {
+        // Fetch next node
+        bvh_node node = nodes[addr];
+        // Intersect against bbox
+        float2 s = fast_intersect_bbox1(node, invdir, -r.o.xyz * invdir, t_max);
+
+        if (s.x <= s.y)
+        {
+            if (LEAFNODE(node))
+            {
+                // If this is the leaf it can be either a leaf containing primitives (bottom hierarchy)
+                // or containing another BVH (top level hierarhcy)
+                if (top_addr != INVALID_IDX)
+                {
+                    // Intersect leaf here
+                    int const face_idx = STARTIDX(node);
+                    Face const face = faces[face_idx];
+                    float3 const v1 = vertices[face.idx[0]];
+                    float3 const v2 = vertices[face.idx[1]];
+                    float3 const v3 = vertices[face.idx[2]];
+
+                    // Any hit is enough
+                    float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
+                    if (f < t_max)
+                    {
+                        return true;
+                    }
+
+                    // And goto next node
+                    addr = NEXT(node);
+                }
+                else
+                {
+                    // This is top level hierarchy leaf
+                    // Save top node index for return
+                    top_addr = addr;
+                    // Get shape descrition struct index
+                    int shape_idx = SHAPEIDX(node);
+                    // Get shape mask
+                    const unsigned int shapeDisabled = shapes[shape_idx].shapeDisabled;
+#ifdef RR_RAY_MASK
+                    const int shapeId = shapes[shape_idx].id;
+#endif // RR_RAY_MASK
+                    // Drill into 2nd level BVH only if the geometry is not masked vs current ray
+                    // otherwise skip the subtree
+                    if (!shapeDisabled
+#ifdef RR_RAY_MASK
+                        && ray_get_mask(&r) != shapeId
+#endif // RR_RAY_MASK
+                        )
+                    {
+                        // Fetch bottom level BVH index
+                        addr = shapes[shape_idx].bvh_idx;
+
+                        // Transform the ray into object space
+                        r = transform_ray(r, shapes[shape_idx].m0, shapes[shape_idx].m1, shapes[shape_idx].m2, shapes[shape_idx].m3);
+                        // Recalc invdir
+                        invdir = safe_invdir(r);
+                        // And continue traversal of the bottom level BVH
+                        continue;
+                    }
+                    else
+                    {
+                        addr = INVALID_IDX;
+                    }
+                }
+            }
+            // Traverse child nodes otherwise.
+            else
+            {
+                // This is an internal node, proceed to left child (it is at current + 1 index)
+                addr = addr + 1;
+            }
+        }
+        else
+        {
+            // We missed the node, goto next one
+            addr = NEXT(node);
+        }
+
+        // Here check if we ended up traversing bottom level BVH
+        // in this case idx = -1 and topidx has valid value
+        if (addr == INVALID_IDX && top_addr != INVALID_IDX)
+        {
+            //  Proceed to next top level node
+            addr = NEXT(nodes[top_addr]);
+            // Set topidx
+            top_addr = INVALID_IDX;
+            // Restore ray here
+            r = top_ray;
+            // Restore invdir
+            invdir = invdirtop;
+        }
+    }
+
+    return false;
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void occluded_main_2d_sum_linear(
+    // BVH nodes
+    GLOBAL bvh_node const* restrict nodes,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Faces
+    GLOBAL Face const* restrict faces,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // BVH root index
+    int root_idx,
+    // Rays
+    GLOBAL float4 const* restrict origins,
+    GLOBAL float4 const* restrict directions,
+    GLOBAL float4 const* restrict koefs,
+    GLOBAL int const* restrict offset_directions,
+    GLOBAL int const* restrict offset_koefs,
+    // Number of origins and directions
+    GLOBAL int const* restrict num_origins,
+    GLOBAL int const* restrict num_directions,
+    GLOBAL int const* restrict stride_directions,
+    // Koef sums per origin and direction stride
+    GLOBAL float* hits,
+    // Index of the first ray of the dispatch
+    ulong ray_offset
+)
+{
+    int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Handle only working subset
+    if (ray_id < (long)(*num_origins) * (*num_directions))
+    {
+        int const origin_id = (int)(ray_id % (*num_origins));
+        int const direction_id = (int)(ray_id / (*num_origins));
+        int const output_offset = (direction_id % (*stride_directions)) * (*num_origins);
+
+        float4 const koef = koefs[direction_id + offset_koefs[origin_id]];
+        ray const r = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+        bool const hit = trace_occluded(nodes, vertices, faces, shapes, root_idx, r);
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+    }
+}
+
+// Same as occluded_main_2d_sum_linear, directions are generated from sky patches
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void occluded_main_2d_sum_linear_sky(
+    // BVH nodes
+    GLOBAL bvh_node const* restrict nodes,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Faces
+    GLOBAL Face const* restrict faces,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // BVH root index
+    int root_idx,
+    // Rays
+    GLOBAL float4 const* restrict origins,
+    SkyPatches sky,
+    GLOBAL float4 const* restrict frames,
+    int use_frames,
+    GLOBAL float4 const* restrict koefs,
+    GLOBAL int const* restrict offset_koefs,
+    // Number of origins and directions
+    GLOBAL int const* restrict num_origins,
+    GLOBAL int const* restrict num_directions,
+    GLOBAL int const* restrict stride_directions,
+    // Koef sums per origin and direction stride
+    GLOBAL float* hits,
+    // Index of the first ray of the dispatch
+    ulong ray_offset
+)
+{
+    int global_id = get_global_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Handle only working subset
+    if (ray_id < (long)(*num_origins) * (*num_directions))
+    {
+        int const origin_id = (int)(ray_id % (*num_origins));
+        int const direction_id = (int)(ray_id / (*num_origins));
+        int const output_offset = (direction_id % (*stride_directions)) * (*num_origins);
+
+        float4 const koef = koefs[direction_id + offset_koefs[origin_id]];
+        ray const r = make_sky_ray_2d(origins[origin_id], &sky, frames, use_frames, origin_id, direction_id);
+
+        bool const hit = trace_occluded(nodes, vertices, faces, shapes, root_idx, r);
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+    }
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void occluded_main_2d_cell_string(
+    // BVH nodes
+    GLOBAL bvh_node const* restrict nodes,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Faces
+    GLOBAL Face const* restrict faces,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // BVH root index
+    int root_idx,
+    // Rays
+    GLOBAL float4 const* restrict origins,
+    GLOBAL float4 const* restrict directions,
+    // Number of origins and directions
+    GLOBAL int const* restrict num_origins,
+    GLOBAL int const* restrict num_directions,
+    // Cell-string to point mappings
+    GLOBAL int const* restrict cell_string_inds,
+    GLOBAL int const* restrict num_cell_strings,
+    // Hit results: 1 if any ray of the cell-string is occluded, 0 otherwise
+    GLOBAL float* hits
+)
+{
+    int global_id = get_global_id(0);
+
+    // Handle only working subset
+    if (global_id < (*num_cell_strings) * (*num_directions))
+    {
+        int const cell_string_id = global_id % (*num_cell_strings);
+        int const direction_id = global_id / (*num_cell_strings);
+
+        float result = 0.f;
+
+        // Iterate over all points in cell-string
+        for (int i = cell_string_inds[cell_string_id * 2]; i < cell_string_inds[cell_string_id * 2 + 1]; ++i)
+        {
+            ray const r = make_ray_2d(origins[i], directions[direction_id]);
+
+            if (trace_occluded(nodes, vertices, faces, shapes, root_idx, r))
+            {
+                result = 1.f;
+                break;
+            }
+        }
+
+        hits[cell_string_id + direction_id * (*num_cell_strings)] = result;
+    }
+}
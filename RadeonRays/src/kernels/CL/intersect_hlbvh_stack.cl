@@ -425,3 +425,255 @@ KERNEL void intersect_main(
 
 
 
+
+// Any hit traversal shared by 2D queries, stack layout is the same as in occluded_main
+INLINE bool trace_occluded(
+    // Bvh nodes
+    GLOBAL bvh_node const * restrict nodes,
+    // Bounding boxes
+    GLOBAL bbox const* restrict bounds,
+    // Triangles vertices
+    GLOBAL float3 const * restrict vertices,
+    // Triangle indices
+    GLOBAL Face const* faces,
+    // Ray
+    ray const* r,
+    // Stack of the work item in global memory
+    __global int* gm_stack_base,
+    // Stack of the work item in LDS
+    __local int* lm_stack_base
+    )
+{
+    __global int* gm_stack = gm_stack_base;
+    __local int* lm_stack = lm_stack_base;
+
+    // Precompute inverse direction and origin / dir for bbox testing
+    float3 const invdir = safe_invdir(*r);
+    float3 const oxinvdir = -r->o.xyz * invdir;
+    // Intersection parametric distance
+    float const t_max = r->o.w;
+
+    // Current node address
+    int addr = 0;
+
+    //  Initalize local stack
+    *lm_stack = INVALID_IDX;
+    lm_stack += WAVEFRONT_SIZE;
+
+    // Start from 0 node (root)
+    while (addr != INVALID_IDX)
+    {
+        // Fetch next node
+        bvh_node const node = nodes[addr];
+
+        // Check if it is a leaf
+        if (LEAFNODE(node))
+        {
+            Face face = faces[STARTIDX(node)];
+#ifdef RR_RAY_MASK
+            if (ray_get_mask(r) != face.shape_id)
+            {
+#endif // RR_RAY_MASK
+                // Leafs directly store vertex indices
+                // so we load vertices directly
+                float3 const v1 = vertices[face.idx[0]];
+                float3 const v2 = vertices[face.idx[1]];
+                float3 const v3 = vertices[face.idx[2]];
+                // Intersect triangle
+                float const f = fast_intersect_triangle(*r, v1, v2, v3, t_max);
+                // Any hit is enough
+                if (f < t_max)
+                {
+                    return true;
+                }
+#ifdef RR_RAY_MASK
+            }
+#endif // RR_RAY_MASK
+        }
+        else
+        {
+            // It is internal node, so intersect vs both children bounds
+            float2 const s0 = fast_intersect_bbox1(bounds[node.child0], invdir, oxinvdir, t_max);
+            float2 const s1 = fast_intersect_bbox1(bounds[node.child1], invdir, oxinvdir, t_max);
+
+            // Determine which one to traverse
+            bool const traverse_c0 = (s0.x <= s0.y);
+            bool const traverse_c1 = (s1.x <= s1.y);
+            bool const c1first = traverse_c1 && (s0.x > s1.x);
+
+            if (traverse_c0 || traverse_c1)
+            {
+                int deferred = -1;
+
+                // Determine which one to traverse first
+                if (c1first || !traverse_c0)
+                {
+                    // Right one is closer or left one not travesed
+                    addr = node.child1;
+                    deferred = node.child0;
+                }
+                else
+                {
+                    // Traverse left node otherwise
+                    addr = node.child0;
+                    deferred = node.child1;
+                }
+
+                // If we traverse both children we need to postpone the node
+                if (traverse_c0 && traverse_c1)
+                {
+                    // If short stack is full, we offload it into global memory
+                    if (lm_stack - lm_stack_base >= SHORT_STACK_SIZE * WAVEFRONT_SIZE)
+                    {
+                        for (int i = 1; i < SHORT_STACK_SIZE; ++i)
+                        {
+                            gm_stack[i] = lm_stack_base[i * WAVEFRONT_SIZE];
+                        }
+
+                        gm_stack += SHORT_STACK_SIZE;
+                        lm_stack = lm_stack_base + WAVEFRONT_SIZE;
+                    }
+
+                    *lm_stack = deferred;
+                    lm_stack += WAVEFRONT_SIZE;
+                }
+
+                // Continue traversal
+                continue;
+            }
+        }
+
+        // Try popping from local stack
+        lm_stack -= WAVEFRONT_SIZE;
+        addr = *(lm_stack);
+
+        // If we popped INVALID_IDX then check global stack
+        if (addr == INVALID_IDX && gm_stack > gm_stack_base)
+        {
+            // Adjust stack pointer
+            gm_stack -= SHORT_STACK_SIZE;
+            // Copy data from global memory to LDS
+            for (int i = 1; i < SHORT_STACK_SIZE; ++i)
+            {
+                lm_stack_base[i * WAVEFRONT_SIZE] = gm_stack[i];
+            }
+            // Point local stack pointer to the end
+            lm_stack = lm_stack_base + (SHORT_STACK_SIZE - 1) * WAVEFRONT_SIZE;
+            addr = lm_stack_base[WAVEFRONT_SIZE * (SHORT_STACK_SIZE - 1)];
+        }
+    }
+
+    return false;
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void
+occluded_main_2d_sum_linear(
+    // Bvh nodes
+    GLOBAL bvh_node const * restrict nodes,
+    // Bounding boxes
+    GLOBAL bbox const* restrict bounds,
+    // Triangles vertices
+    GLOBAL float3 const * restrict vertices,
+    // Triangle indices
+    GLOBAL Face const* faces,
+    // Rays
+    GLOBAL float4 const* restrict origins,
+    GLOBAL float4 const* restrict directions,
+    GLOBAL float4 const* restrict koefs,
+    GLOBAL int const* restrict offset_directions,
+    GLOBAL int const* restrict offset_koefs,
+    // Number of origins and directions
+    GLOBAL int const* restrict num_origins,
+    GLOBAL int const* restrict num_directions,
+    GLOBAL int const* restrict stride_directions,
+    // Stack memory
+    GLOBAL int* stack,
+    // Koef sums per origin and direction stride
+    GLOBAL float* hits,
+    // Index of the first ray of the dispatch
+    ulong ray_offset
+    )
+{
+    int global_id = get_global_id(0);
+    int local_id = get_local_id(0);
+    int group_id = get_group_id(0);
+    long ray_id = (long)ray_offset + global_id;
+
+    // Allocate stack in LDS
+    __local int lds[SHORT_STACK_SIZE * WAVEFRONT_SIZE];
+
+    // Handle only working set
+    if (ray_id < (long)(*num_origins) * (*num_directions))
+    {
+        int const origin_id = (int)(ray_id % (*num_origins));
+        int const direction_id = (int)(ray_id / (*num_origins));
+        int const output_offset = (direction_id % (*stride_directions)) * (*num_origins);
+
+        float4 const koef = koefs[direction_id + offset_koefs[origin_id]];
+        ray const r = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+        bool const hit = trace_occluded(nodes, bounds, vertices, faces, &r,
+            stack + (group_id * WAVEFRONT_SIZE + local_id) * GLOBAL_STACK_SIZE, lds + local_id);
+
+        sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+    }
+}
+
+__attribute__((reqd_work_group_size(64, 1, 1)))
+KERNEL void
+occluded_main_2d_cell_string(
+    // Bvh nodes
+    GLOBAL bvh_node const * restrict nodes,
+    // Bounding boxes
+    GLOBAL bbox const* restrict bounds,
+    // Triangles vertices
+    GLOBAL float3 const * restrict vertices,
+    // Triangle indices
+    GLOBAL Face const* faces,
+    // Rays
+    GLOBAL float4 const* restrict origins,
+    GLOBAL float4 const* restrict directions,
+    // Number of origins and directions
+    GLOBAL int const* restrict num_origins,
+    GLOBAL int const* restrict num_directions,
+    // Cell-string to point mappings
+    GLOBAL int const* restrict cell_string_inds,
+    GLOBAL int const* restrict num_cell_strings,
+    // Stack memory
+    GLOBAL int* stack,
+    // Hit results: 1 if any ray of the cell-string is occluded, 0 otherwise
+    GLOBAL float* hits
+    )
+{
+    int global_id = get_global_id(0);
+    int local_id = get_local_id(0);
+    int group_id = get_group_id(0);
+
+    // Allocate stack in LDS
+    __local int lds[SHORT_STACK_SIZE * WAVEFRONT_SIZE];
+
+    // Handle only working set
+    if (global_id < (*num_cell_strings) * (*num_directions))
+    {
+        int const cell_string_id = global_id % (*num_cell_strings);
+        int const direction_id = global_id / (*num_cell_strings);
+
+        float result = 0.f;
+
+        // Iterate over all points in cell-string
+        for (int i = cell_string_inds[cell_string_id * 2]; i < cell_string_inds[cell_string_id * 2 + 1]; ++i)
+        {
+            ray const r = make_ray_2d(origins[i], directions[direction_id]);
+
+            if (trace_occluded(nodes, bounds, vertices, faces, &r,
+                stack + (group_id * WAVEFRONT_SIZE + local_id) * GLOBAL_STACK_SIZE, lds + local_id))
+            {
+                result = 1.f;
+                break;
+            }
+        }
+
+        hits[cell_string_id + direction_id * (*num_cell_strings)] = result;
+    }
+}
@@ -0,0 +1,546 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file build_hlbvh.cpp
+    \version 1.0
+    \brief Host-native port of build_hlbvh.cl.
+
+    Kernels receive arguments in the same order as their OpenCL counterparts
+    and process a range of global work items each. See build_hlbvh.cl for
+    the description of the tree layout.
+ */
+#if USE_HOST
+#include "kernels_host.h"
+#include "common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+
+#define LEAFIDX(i) ((num_prims-1) + i)
+#define NODEIDX(i) (i)
+// Shortcut for delta evaluation
+#define DELTA(i,j) delta(morton_codes,num_prims,i,j)
+// Number of leaves of a restructured treelet
+#define TREELET_SIZE 7
+#define TREELET_SUBSETS (1 << TREELET_SIZE)
+
+namespace RadeonRays
+{
+namespace HostKernels
+{
+    struct HlbvhNode
+    {
+        int parent;
+        int left;
+        int right;
+        int next;
+    };
+
+    // Counterpart of OpenCL clz, x is never zero here
+    inline int clz(std::uint32_t x)
+    {
+#ifdef __GNUC__
+        return __builtin_clz(x);
+#else
+        int n = 0;
+        while (!(x & 0x80000000u))
+        {
+            x <<= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    // Counterpart of OpenCL popcount
+    inline int popcount(std::uint32_t x)
+    {
+#ifdef __GNUC__
+        return __builtin_popcount(x);
+#else
+        int n = 0;
+        for (; x; x &= x - 1)
+        {
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    // Expands a 10-bit integer into 30 bits by inserting 2 zeros after each bit
+    inline std::uint32_t expand_bits(std::uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // Calculates a 30-bit Morton code for the given 3D point located within the unit cube [0,1]
+    inline std::uint32_t calculate_morton_code(float3 const& p)
+    {
+        float const x = std::min(std::max(p.x * 1024.0f, 0.0f), 1023.0f);
+        float const y = std::min(std::max(p.y * 1024.0f, 0.0f), 1023.0f);
+        float const z = std::min(std::max(p.z * 1024.0f, 0.0f), 1023.0f);
+        std::uint32_t const xx = expand_bits((std::uint32_t)x);
+        std::uint32_t const yy = expand_bits((std::uint32_t)y);
+        std::uint32_t const zz = expand_bits((std::uint32_t)z);
+        return xx * 4 + yy * 2 + zz;
+    }
+
+    // Calculates longest common prefix length of bit representations
+    // if representations are equal we consider sucessive indices
+    inline int delta(int const* morton_codes, int num_prims, int i1, int i2)
+    {
+        int const left = std::min(i1, i2);
+        int const right = std::max(i1, i2);
+
+        if (left < 0 || right >= num_prims)
+        {
+            return -1;
+        }
+
+        int const left_code = morton_codes[left];
+        int const right_code = morton_codes[right];
+
+        return left_code != right_code ? clz(left_code ^ right_code) : (32 + clz(left ^ right));
+    }
+
+    // Find span occupied by internal node with index idx
+    inline void find_span(int const* morton_codes, int num_prims, int idx, int& first, int& last)
+    {
+        int const delta_next = DELTA(idx, idx + 1);
+        int const delta_prev = DELTA(idx, idx - 1);
+        int const d = delta_next > delta_prev ? 1 : (delta_next < delta_prev ? -1 : 0);
+
+        int const delta_min = DELTA(idx, idx - d);
+
+        int lmax = 2;
+        while (DELTA(idx, idx + lmax * d) > delta_min)
+            lmax *= 2;
+
+        int l = 0;
+        int t = lmax;
+        do
+        {
+            t /= 2;
+            if (DELTA(idx, idx + (l + t) * d) > delta_min)
+            {
+                l = l + t;
+            }
+        }
+        while (t > 1);
+
+        first = std::min(idx, idx + l * d);
+        last = std::max(idx, idx + l * d);
+    }
+
+    // Find split idx within the span
+    inline int find_split(int const* morton_codes, int num_prims, int first, int last)
+    {
+        int left = first;
+        int right = last;
+        int const num_identical = DELTA(left, right);
+
+        do
+        {
+            int const new_split = (right + left) / 2;
+
+            if (DELTA(left, new_split) > num_identical)
+            {
+                left = new_split;
+            }
+            else
+            {
+                right = new_split;
+            }
+        }
+        while (right > left + 1);
+
+        return left;
+    }
+
+    static void calculate_morton_code_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto primitive_bounds = arg_ptr<bbox const>(args, 0);
+        int const num_primitive_bounds = *arg_ptr<int const>(args, 1);
+        auto scene_bound = arg_ptr<bbox const>(args, 2);
+        auto morton_codes = arg_ptr<int>(args, 3);
+
+        end = std::min(end, (std::size_t)num_primitive_bounds);
+
+        float3 const scene_min = scene_bound->pmin;
+        float3 const extents = scene_bound->pmax - scene_bound->pmin;
+        // Flat scenes get zero code along the flat axis
+        float3 const scene_extents(std::max(extents.x, FLT_MIN), std::max(extents.y, FLT_MIN), std::max(extents.z, FLT_MIN));
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            bbox const& bound = primitive_bounds[global_id];
+            float3 const center = (bound.pmax + bound.pmin) * 0.5f;
+            float3 const p = center - scene_min;
+            morton_codes[global_id] = (int)calculate_morton_code(float3(p.x / scene_extents.x, p.y / scene_extents.y, p.z / scene_extents.z));
+        }
+    }
+
+    static void emit_hierarchy_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto morton_codes = arg_ptr<int const>(args, 0);
+        auto bounds = arg_ptr<bbox const>(args, 1);
+        auto indices = arg_ptr<int const>(args, 2);
+        int const num_prims = *arg_ptr<int const>(args, 3);
+        auto nodes = arg_ptr<HlbvhNode>(args, 4);
+        auto bounds_sorted = arg_ptr<bbox>(args, 5);
+
+        end = std::min(end, (std::size_t)num_prims);
+
+        for (auto i = begin; i < end; ++i)
+        {
+            int const global_id = (int)i;
+
+            // Set child
+            nodes[LEAFIDX(global_id)].left = nodes[LEAFIDX(global_id)].right = indices[global_id];
+            bounds_sorted[LEAFIDX(global_id)] = bounds[indices[global_id]];
+
+            // Set internal nodes
+            if (global_id < num_prims - 1)
+            {
+                int first, last;
+                find_span(morton_codes, num_prims, global_id, first, last);
+
+                int const split = find_split(morton_codes, num_prims, first, last);
+
+                int const c1idx = (split == first) ? LEAFIDX(split) : NODEIDX(split);
+                int const c2idx = (split + 1 == last) ? LEAFIDX(split + 1) : NODEIDX(split + 1);
+
+                nodes[NODEIDX(global_id)].left = c1idx;
+                nodes[NODEIDX(global_id)].right = c2idx;
+                nodes[c1idx].parent = NODEIDX(global_id);
+                nodes[c2idx].parent = NODEIDX(global_id);
+            }
+        }
+    }
+
+    static void refit_bounds_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto bounds = arg_ptr<bbox>(args, 0);
+        int const num_prims = *arg_ptr<int const>(args, 1);
+        auto nodes = arg_ptr<HlbvhNode const>(args, 2);
+        auto flags = arg_ptr<int>(args, 3);
+
+        // Single leaf is the root itself
+        end = num_prims > 1 ? std::min(end, (std::size_t)num_prims) : begin;
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            int idx = LEAFIDX((int)global_id);
+
+            do
+            {
+                idx = nodes[idx].parent;
+
+                // The second thread to arrive handles the node, acquire makes
+                // the bounds of the first one visible
+                int expected = 0;
+                if (!reinterpret_cast<std::atomic<int>*>(flags + idx)->compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+                {
+                    bounds[idx] = bboxunion(bounds[nodes[idx].left], bounds[nodes[idx].right]);
+                }
+                else
+                {
+                    break;
+                }
+            }
+            while (idx != 0);
+        }
+    }
+
+    // Union of the bounds of treelet leaves in the subset
+    inline bbox treelet_bounds(bbox const* bounds, int const* leaves, int subset)
+    {
+        bbox b = bounds[leaves[31 - clz(subset & -subset)]];
+        for (int i = 0; i < TREELET_SIZE; ++i)
+        {
+            if (subset & (1 << i))
+            {
+                b = bboxunion(b, bounds[leaves[i]]);
+            }
+        }
+        return b;
+    }
+
+    // See restructure_treelet in build_hlbvh.cl
+    inline void restructure_treelet(int num_prims, HlbvhNode* nodes, bbox* bounds, int* leaf_counts, int root)
+    {
+        int leaves[TREELET_SIZE];
+        int internals[TREELET_SIZE - 1];
+        int num_leaves = 2;
+        int num_internals = 1;
+        float old_cost = bounds[root].surface_area();
+
+        internals[0] = root;
+        leaves[0] = nodes[root].left;
+        leaves[1] = nodes[root].right;
+
+        while (num_leaves < TREELET_SIZE)
+        {
+            int largest = -1;
+            float largest_area = -1.f;
+            for (int i = 0; i < num_leaves; ++i)
+            {
+                float const area = bounds[leaves[i]].surface_area();
+                if (leaves[i] < num_prims - 1 && area > largest_area)
+                {
+                    largest = i;
+                    largest_area = area;
+                }
+            }
+
+            if (largest == -1)
+            {
+                break;
+            }
+
+            int const expanded = leaves[largest];
+            internals[num_internals++] = expanded;
+            old_cost += largest_area;
+            leaves[largest] = nodes[expanded].left;
+            leaves[num_leaves++] = nodes[expanded].right;
+        }
+
+        float cost[TREELET_SUBSETS];
+        int split[TREELET_SUBSETS];
+        int const full = (1 << num_leaves) - 1;
+
+        for (int subset = 1; subset <= full; ++subset)
+        {
+            cost[subset] = 0.f;
+
+            if (popcount(subset) > 1)
+            {
+                float best = FLT_MAX;
+                for (int part = (subset - 1) & subset; part > 0; part = (part - 1) & subset)
+                {
+                    float const c = cost[part] + cost[subset ^ part];
+                    if (c < best)
+                    {
+                        best = c;
+                        split[subset] = part;
+                    }
+                }
+
+                cost[subset] = best + treelet_bounds(bounds, leaves, subset).surface_area();
+            }
+        }
+
+        if (cost[full] >= old_cost)
+        {
+            return;
+        }
+
+        int stack_subsets[TREELET_SIZE];
+        int stack_nodes[TREELET_SIZE];
+        int sp = 0;
+        num_internals = 1;
+        stack_subsets[sp] = full;
+        stack_nodes[sp++] = root;
+
+        while (sp > 0)
+        {
+            int const subset = stack_subsets[--sp];
+            int const idx = stack_nodes[sp];
+            int const parts[2] = { split[subset], subset ^ split[subset] };
+            int kids[2];
+            int count = 0;
+
+            for (int i = 0; i < 2; ++i)
+            {
+                if (popcount(parts[i]) == 1)
+                {
+                    kids[i] = leaves[31 - clz(parts[i])];
+                }
+                else
+                {
+                    kids[i] = internals[num_internals++];
+                    stack_subsets[sp] = parts[i];
+                    stack_nodes[sp++] = kids[i];
+                }
+
+                nodes[kids[i]].parent = idx;
+            }
+
+            for (int i = 0; i < num_leaves; ++i)
+            {
+                count += (subset & (1 << i)) ? leaf_counts[leaves[i]] : 0;
+            }
+
+            nodes[idx].left = kids[0];
+            nodes[idx].right = kids[1];
+            bounds[idx] = treelet_bounds(bounds, leaves, subset);
+            leaf_counts[idx] = count;
+        }
+    }
+
+    static void restructure_treelets_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        int const num_prims = *arg_ptr<int const>(args, 0);
+        auto nodes = arg_ptr<HlbvhNode>(args, 1);
+        auto bounds = arg_ptr<bbox>(args, 2);
+        auto leaf_counts = arg_ptr<int>(args, 3);
+        auto cluster_counts = arg_ptr<int>(args, 4);
+        int const max_leaf_prims = *arg_ptr<int const>(args, 5);
+        auto flags = arg_ptr<int>(args, 6);
+        int const optimize = *arg_ptr<int const>(args, 7);
+
+        end = std::min(end, (std::size_t)num_prims);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            int idx = LEAFIDX((int)global_id);
+            leaf_counts[idx] = 1;
+            cluster_counts[idx] = 1;
+
+            while (idx != 0)
+            {
+                idx = nodes[idx].parent;
+
+                // The second thread to arrive handles the node, acquire makes
+                // the subtree of the first one visible
+                int expected = 0;
+                if (reinterpret_cast<std::atomic<int>*>(flags + idx)->compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+                {
+                    break;
+                }
+
+                int const lc = nodes[idx].left;
+                int const rc = nodes[idx].right;
+
+                bounds[idx] = bboxunion(bounds[lc], bounds[rc]);
+                leaf_counts[idx] = leaf_counts[lc] + leaf_counts[rc];
+                cluster_counts[idx] = leaf_counts[idx] <= max_leaf_prims ? 1 : cluster_counts[lc] + cluster_counts[rc];
+
+                if (optimize && leaf_counts[idx] >= TREELET_SIZE)
+                {
+                    restructure_treelet(num_prims, nodes, bounds, leaf_counts, idx);
+                }
+            }
+        }
+    }
+
+    static void emit_skiplinks_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto leaf_counts = arg_ptr<int const>(args, 0);
+        auto cluster_counts = arg_ptr<int const>(args, 1);
+        int const num_prims = *arg_ptr<int const>(args, 2);
+        int const max_leaf_prims = *arg_ptr<int const>(args, 3);
+        auto nodes = arg_ptr<HlbvhNode const>(args, 4);
+        auto bounds = arg_ptr<bbox const>(args, 5);
+        auto skiplinks = arg_ptr<bbox>(args, 6);
+        auto leaf_prims = arg_ptr<int>(args, 7);
+
+        int const num_nodes = 2 * num_prims - 1;
+        int const num_emitted = 2 * cluster_counts[0] - 1;
+        end = std::min(end, (std::size_t)num_nodes);
+
+        for (auto i = begin; i < end; ++i)
+        {
+            int const global_id = (int)i;
+
+            // Node is a part of a collapsed subtree
+            if (global_id != 0 && leaf_counts[nodes[global_id].parent] <= max_leaf_prims)
+            {
+                continue;
+            }
+
+            bool const leaf = leaf_counts[global_id] <= max_leaf_prims;
+
+            // Left child follows its parent, right one follows the left subtree
+            int addr = 0;
+            int leaf_idx = 0;
+            for (int idx = global_id; idx != 0;)
+            {
+                int const parent = nodes[idx].parent;
+                int const left = nodes[parent].left;
+                addr += left == idx ? 1 : 2 * cluster_counts[left];
+                leaf_idx += left == idx ? 0 : cluster_counts[left];
+                idx = parent;
+            }
+
+            int const next = addr + 2 * cluster_counts[global_id] - 1;
+
+            bbox node = bounds[global_id];
+            node.pmin.w = leaf ? (float)((leaf_idx << 4) | leaf_counts[global_id]) : -1.f;
+            node.pmax.w = next < num_emitted ? (float)next : -1.f;
+            skiplinks[addr] = node;
+
+            if (!leaf)
+            {
+                continue;
+            }
+
+            // Leaves of the subtree in depth first order, consecutive
+            // in Morton order unless treelets have been restructured
+            int* prims = leaf_prims + leaf_idx * max_leaf_prims;
+            int count = 0;
+            int idx = global_id;
+            for (;;)
+            {
+                while (idx < num_prims - 1)
+                {
+                    idx = nodes[idx].left;
+                }
+
+                // Leaves keep primitive index in both children
+                prims[count++] = nodes[idx].left;
+
+                while (idx != global_id && nodes[nodes[idx].parent].right == idx)
+                {
+                    idx = nodes[idx].parent;
+                }
+
+                if (idx == global_id)
+                {
+                    break;
+                }
+
+                idx = nodes[nodes[idx].parent].right;
+            }
+
+            std::fill(prims + count, prims + max_leaf_prims, -1);
+        }
+    }
+}
+
+    Calc::HostKernelEntry const g_build_hlbvh_host[] =
+    {
+        { "calculate_morton_code_main", HostKernels::calculate_morton_code_main },
+        { "emit_hierarchy_main", HostKernels::emit_hierarchy_main },
+        { "refit_bounds_main", HostKernels::refit_bounds_main },
+        { "restructure_treelets_main", HostKernels::restructure_treelets_main },
+        { "emit_skiplinks_main", HostKernels::emit_skiplinks_main }
+    };
+
+    std::size_t const g_build_hlbvh_host_size = sizeof(g_build_hlbvh_host) / sizeof(Calc::HostKernelEntry);
+}
+#endif // USE_HOST
@@ -0,0 +1,285 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file common.h
+    \version 1.0
+    \brief Host counterparts of common.cl routines used by host-native kernels.
+
+    Functions here mirror their OpenCL versions one to one, so host and GPU
+    backends produce the same results for the same acceleration structures.
+ */
+#pragma once
+
+#include "math/float2.h"
+#include "math/float3.h"
+#include "math/bbox.h"
+#include "math/ray.h"
+#include "radeon_rays.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace RadeonRays
+{
+namespace HostKernels
+{
+    static int const kHitMarker = 1;
+    static int const kMissMarker = -1;
+    static int const kInvalidIdx = -1;
+
+    // Face layout shared with GPU kernels
+    struct Face
+    {
+        // Vertex indices
+        int idx[3];
+        // Shape ID
+        int shape_id;
+        // Primitive ID
+        int prim_id;
+    };
+
+    // Number of triangles in a leaf block
+    static int const kTriangleBlockSize = 4;
+
+    // Leaf triangles in SoA layout shared with GPU kernels, i-th lane of each
+    // component belongs to i-th triangle. Padding triangles are degenerate.
+    struct TriangleBlock
+    {
+        // First vertex x, y, z
+        float v0[3][kTriangleBlockSize];
+        // First edge (v2 - v1) x, y, z
+        float e1[3][kTriangleBlockSize];
+        // Second edge (v3 - v1) x, y, z
+        float e2[3][kTriangleBlockSize];
+    };
+
+    // Fetch vertices of a triangle stored in the block
+    inline void triangle_block_get_vertices(TriangleBlock const& block, int lane, float3& v1, float3& v2, float3& v3)
+    {
+        float3 const v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+        float3 const e1(block.e1[0][lane], block.e1[1][lane], block.e1[2][lane]);
+        float3 const e2(block.e2[0][lane], block.e2[1][lane], block.e2[2][lane]);
+        v1 = v0;
+        v2 = v0 + e1;
+        v3 = v0 + e2;
+    }
+
+    // Kernel argument accessors
+    template <typename T>
+    inline T* arg_ptr(void* const* args, int idx)
+    {
+        return static_cast<T*>(args[idx]);
+    }
+
+    inline float3 safe_invdir(ray const& r)
+    {
+        float const ooeps = 1e-8f;
+        float3 invdir;
+        invdir.x = 1.f / (std::fabs(r.d.x) > ooeps ? r.d.x : std::copysign(ooeps, r.d.x));
+        invdir.y = 1.f / (std::fabs(r.d.y) > ooeps ? r.d.y : std::copysign(ooeps, r.d.y));
+        invdir.z = 1.f / (std::fabs(r.d.z) > ooeps ? r.d.z : std::copysign(ooeps, r.d.z));
+        return invdir;
+    }
+
+    // Intersect rays vs bbox and return intersection span.
+    // Intersection criteria is ret.x <= ret.y
+    inline float2 fast_intersect_bbox1(bbox const& box, float3 const& invdir, float3 const& oxinvdir, float t_max)
+    {
+        float const fx = box.pmax.x * invdir.x + oxinvdir.x;
+        float const fy = box.pmax.y * invdir.y + oxinvdir.y;
+        float const fz = box.pmax.z * invdir.z + oxinvdir.z;
+        float const nx = box.pmin.x * invdir.x + oxinvdir.x;
+        float const ny = box.pmin.y * invdir.y + oxinvdir.y;
+        float const nz = box.pmin.z * invdir.z + oxinvdir.z;
+        float const t1 = std::min(std::min(std::min(std::max(fx, nx), std::max(fy, ny)), std::max(fz, nz)), t_max);
+        float const t0 = std::max(std::max(std::max(std::min(fx, nx), std::min(fy, ny)), std::min(fz, nz)), 0.f);
+        return float2(t0, t1);
+    }
+
+    inline float fast_intersect_triangle(ray const& r, float3 const& v1, float3 const& v2, float3 const& v3, float t_max)
+    {
+        float3 const e1 = v2 - v1;
+        float3 const e2 = v3 - v1;
+
+#ifdef RR_BACKFACE_CULL
+        if (r.doBackfaceCulling && dot(cross(e1, e2), r.d) > 0.f)
+        {
+            return t_max;
+        }
+#endif // RR_BACKFACE_CULL
+
+        float3 const s1 = cross(r.d, e2);
+
+        float const denom = dot(s1, e1);
+        if (denom == 0.f)
+        {
+            return t_max;
+        }
+
+        float const invd = 1.f / denom;
+        float3 const d = r.o - v1;
+        float const b1 = dot(d, s1) * invd;
+        float3 const s2 = cross(d, e1);
+        float const b2 = dot(r.d, s2) * invd;
+        float const temp = dot(e2, s2) * invd;
+
+        if (b1 < 0.f || b1 > 1.f || b2 < 0.f || b1 + b2 > 1.f || temp < 0.f || temp > t_max)
+        {
+            return t_max;
+        }
+        else
+        {
+            return temp;
+        }
+    }
+
+    // Given a point in triangle plane, calculate its barycentrics
+    inline float2 triangle_calculate_barycentrics(float3 const& p, float3 const& v1, float3 const& v2, float3 const& v3)
+    {
+        float3 const e1 = v2 - v1;
+        float3 const e2 = v3 - v1;
+        float3 const e = p - v1;
+        float const d00 = dot(e1, e1);
+        float const d01 = dot(e1, e2);
+        float const d11 = dot(e2, e2);
+        float const d20 = dot(e, e1);
+        float const d21 = dot(e, e2);
+
+        float const denom = (d00 * d11 - d01 * d01);
+
+        if (denom == 0.f)
+        {
+            return float2(0.f, 0.f);
+        }
+
+        float const invdenom = 1.f / denom;
+        float const b1 = (d11 * d20 - d01 * d21) * invdenom;
+        float const b2 = (d00 * d21 - d01 * d20) * invdenom;
+        return float2(b1, b2);
+    }
+
+    // Counterpart of atomicadd in OpenCL kernels
+    inline void atomic_add_float(float* address, float value)
+    {
+        static_assert(sizeof(std::atomic<float>) == sizeof(float), "Unexpected std::atomic<float> layout");
+        auto atomic_address = reinterpret_cast<std::atomic<float>*>(address);
+        float old = atomic_address->load(std::memory_order_relaxed);
+        while (!atomic_address->compare_exchange_weak(old, old + value, std::memory_order_relaxed));
+    }
+
+    // Create a ray for 2d queries
+    inline ray make_ray_2d(float4 const& origin, float4 const& direction)
+    {
+        ray r;
+        r.o = origin;
+        r.d = direction;
+        r.extra.x = -1;
+        r.extra.y = 1;
+        r.doBackfaceCulling = 0;
+        r.padding = 1;
+        return r;
+    }
+
+    // Number of patches in Tregenza rings from the horizon up, zenith cap excluded
+    static int const kTregenzaRingPatches[7] = { 30, 30, 24, 24, 18, 12, 6 };
+
+    // Direction to the center of sky patch in the frame given by zenith
+    // and zero azimuth directions, see SkyPatches for patch enumeration
+    inline float4 sky_patch_direction(SkyPatches const& sky, float4 const& zenith, float4 const& azimuth, int patch_id)
+    {
+        float const pi = 3.14159265358979323846f;
+        float z;
+        float phi;
+
+        if (sky.type == SkyPatches::kReinhart)
+        {
+            // Each Tregenza ring is split into subdivision rings having subdivision times more patches
+            int const num_rings = 7 * sky.subdivision;
+            float const ring_span = 0.5f * pi / (num_rings + 0.5f);
+            int ring_patches = 0;
+            int ring = 0;
+
+            for (; ring < num_rings; ++ring)
+            {
+                ring_patches = kTregenzaRingPatches[ring / sky.subdivision] * sky.subdivision;
+
+                if (patch_id < ring_patches)
+                {
+                    break;
+                }
+
+                patch_id -= ring_patches;
+            }
+
+            // Zenith cap is the last patch
+            if (ring == num_rings)
+            {
+                return float4(zenith.x, zenith.y, zenith.z, 0.f);
+            }
+
+            z = std::sin((ring + 0.5f) * ring_span);
+            phi = 2.f * pi * (patch_id + 0.5f) / ring_patches;
+        }
+        else
+        {
+            // Rings of equal height cut equal areas of the hemisphere
+            int const ring = patch_id / sky.num_azimuths;
+            z = (ring + 0.5f) / sky.subdivision;
+            phi = 2.f * pi * (patch_id - ring * sky.num_azimuths + 0.5f) / sky.num_azimuths;
+        }
+
+        float const r = std::sqrt(std::max(1.f - z * z, 0.f));
+        float3 const bitangent = cross(zenith, azimuth);
+        float3 const d = azimuth * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + zenith * z;
+        return float4(d.x, d.y, d.z, 0.f);
+    }
+
+    // Create a ray towards the center of sky patch, frames keep per origin
+    // zenith and zero azimuth directions unless those are nullptr
+    inline ray make_sky_ray_2d(float4 const& origin, SkyPatches const& sky, float4 const* frames, int origin_id, int patch_id)
+    {
+        float4 const& zenith = frames ? frames[origin_id * 2] : sky.zenith;
+        float4 const& azimuth = frames ? frames[origin_id * 2 + 1] : sky.azimuth;
+        return make_ray_2d(origin, sky_patch_direction(sky, zenith, azimuth, patch_id));
+    }
+
+    // Add hit (x, z) or miss (y, w) koefs to the output slot of sum linear query
+    inline void sum_linear_accumulate(float* hits, int output_idx, float4 const& koef, bool hit)
+    {
+        float const k0 = hit ? koef.x : koef.y;
+        float const k1 = hit ? koef.z : koef.w;
+
+        // Different directions might share the same output slot
+        if (std::fabs(k0) > 1e-4f)
+        {
+            atomic_add_float(&hits[output_idx * 2], k0);
+        }
+        if (std::fabs(k1) > 1e-4f)
+        {
+            atomic_add_float(&hits[output_idx * 2 + 1], k1);
+        }
+    }
+}
+}
@@ -0,0 +1,974 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file intersect_bvh2_skiplinks.cpp
+    \version 1.0
+    \brief Host-native port of intersect_bvh2_skiplinks.cl.
+
+    Kernels receive arguments in the same order as their OpenCL counterparts
+    and process a range of global work items each. See intersect_bvh2_skiplinks.cl
+    for the description of BVH layout and traversal. Kernels taking BVH nodes are
+    instantiated for both plain and quantized node layouts.
+ */
+#if USE_HOST
+#include "kernels_host.h"
+#include "common.h"
+
+#include "radeon_rays.h"
+
+#define STARTIDX(x)     (((int)(x.pmin.w)) >> 4)
+#define NUMPRIMS(x)     (((int)(x.pmin.w)) & 0xF)
+#define LEAFNODE(x)     (((x).pmin.w) != -1.f)
+#define NEXT(x)     ((int)((x).pmax.w))
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HOST_KERNELS_USE_SSE
+#endif
+
+namespace RadeonRays
+{
+namespace HostKernels
+{
+    typedef bbox bvh_node;
+
+    // Quantized node layout shared with GPU kernels, see QuantizedBvhTranslator
+    struct QuantizedNode
+    {
+        std::uint16_t lo[3];
+        std::uint16_t hi[3];
+        std::uint32_t link;
+    };
+
+    static int const kQuantizedHeaderSize = 2;
+    static std::uint32_t const kQuantizedLeafBit = 0x80000000u;
+    static std::uint32_t const kQuantizedLastBit = 0x40000000u;
+    static std::uint32_t const kQuantizedInvalidLink = 0x7fffffffu;
+
+    static inline bvh_node const& fetch_node(bvh_node const* nodes, int addr)
+    {
+        return nodes[addr];
+    }
+
+    // Decode quantized node into plain one, quantization grid is stored in front of the nodes
+    static inline bvh_node fetch_node(QuantizedNode const* nodes, int addr)
+    {
+        float const* grid = reinterpret_cast<float const*>(nodes);
+        QuantizedNode const& qnode = nodes[kQuantizedHeaderSize + addr];
+
+        bvh_node node;
+        node.pmin = float3(qnode.lo[0] * grid[4] + grid[0], qnode.lo[1] * grid[5] + grid[1], qnode.lo[2] * grid[6] + grid[2]);
+        node.pmax = float3(qnode.hi[0] * grid[4] + grid[0], qnode.hi[1] * grid[5] + grid[1], qnode.hi[2] * grid[6] + grid[2]);
+
+        if (qnode.link & kQuantizedLeafBit)
+        {
+            node.pmin.w = (float)(qnode.link & ~(kQuantizedLeafBit | kQuantizedLastBit));
+            node.pmax.w = (qnode.link & kQuantizedLastBit) ? -1.f : (float)(addr + 1);
+        }
+        else
+        {
+            node.pmin.w = -1.f;
+            node.pmax.w = qnode.link == kQuantizedInvalidLink ? -1.f : (float)qnode.link;
+        }
+
+        return node;
+    }
+
+#ifdef HOST_KERNELS_USE_SSE
+    static inline __m128 dot3_ps(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+    {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    }
+
+    static inline __m128 cross_ps(__m128 ax, __m128 ay, __m128 bx, __m128 by)
+    {
+        return _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+    }
+#endif // HOST_KERNELS_USE_SSE
+
+    // Intersect ray against all the triangles of a block at once. Writes hit distances
+    // into t and returns the mask of hit lanes, lane i is hit if bit i is set.
+    // Mirrors fast_intersect_triangle except t_max test is left to the caller.
+    static inline int intersect_triangle_block(ray const& r, TriangleBlock const& block, float* t)
+    {
+#ifdef HOST_KERNELS_USE_SSE
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const one = _mm_set1_ps(1.f);
+        __m128 const dx = _mm_set1_ps(r.d.x);
+        __m128 const dy = _mm_set1_ps(r.d.y);
+        __m128 const dz = _mm_set1_ps(r.d.z);
+        __m128 const e1x = _mm_loadu_ps(block.e1[0]);
+        __m128 const e1y = _mm_loadu_ps(block.e1[1]);
+        __m128 const e1z = _mm_loadu_ps(block.e1[2]);
+        __m128 const e2x = _mm_loadu_ps(block.e2[0]);
+        __m128 const e2y = _mm_loadu_ps(block.e2[1]);
+        __m128 const e2z = _mm_loadu_ps(block.e2[2]);
+
+        // s1 = cross(d, e2)
+        __m128 const s1x = cross_ps(dy, dz, e2y, e2z);
+        __m128 const s1y = cross_ps(dz, dx, e2z, e2x);
+        __m128 const s1z = cross_ps(dx, dy, e2x, e2y);
+        __m128 const denom = dot3_ps(s1x, s1y, s1z, e1x, e1y, e1z);
+        __m128 const invd = _mm_div_ps(one, denom);
+
+        // s2 = cross(o - v1, e1)
+        __m128 const ox = _mm_sub_ps(_mm_set1_ps(r.o.x), _mm_loadu_ps(block.v0[0]));
+        __m128 const oy = _mm_sub_ps(_mm_set1_ps(r.o.y), _mm_loadu_ps(block.v0[1]));
+        __m128 const oz = _mm_sub_ps(_mm_set1_ps(r.o.z), _mm_loadu_ps(block.v0[2]));
+        __m128 const b1 = _mm_mul_ps(dot3_ps(ox, oy, oz, s1x, s1y, s1z), invd);
+        __m128 const s2x = cross_ps(oy, oz, e1y, e1z);
+        __m128 const s2y = cross_ps(oz, ox, e1z, e1x);
+        __m128 const s2z = cross_ps(ox, oy, e1x, e1y);
+        __m128 const b2 = _mm_mul_ps(dot3_ps(dx, dy, dz, s2x, s2y, s2z), invd);
+        __m128 const temp = _mm_mul_ps(dot3_ps(e2x, e2y, e2z, s2x, s2y, s2z), invd);
+
+        __m128 hit = _mm_cmpneq_ps(denom, zero);
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(b1, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(b1, one));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(b2, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(b1, b2), one));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(temp, zero));
+
+#ifdef RR_BACKFACE_CULL
+        if (r.doBackfaceCulling)
+        {
+            __m128 const nx = cross_ps(e1y, e1z, e2y, e2z);
+            __m128 const ny = cross_ps(e1z, e1x, e2z, e2x);
+            __m128 const nz = cross_ps(e1x, e1y, e2x, e2y);
+            hit = _mm_and_ps(hit, _mm_cmpngt_ps(dot3_ps(nx, ny, nz, dx, dy, dz), zero));
+        }
+#endif // RR_BACKFACE_CULL
+
+        _mm_storeu_ps(t, temp);
+        return _mm_movemask_ps(hit);
+#else
+        int mask = 0;
+        for (int lane = 0; lane < kTriangleBlockSize; ++lane)
+        {
+            float3 const e1(block.e1[0][lane], block.e1[1][lane], block.e1[2][lane]);
+            float3 const e2(block.e2[0][lane], block.e2[1][lane], block.e2[2][lane]);
+
+#ifdef RR_BACKFACE_CULL
+            if (r.doBackfaceCulling && dot(cross(e1, e2), r.d) > 0.f)
+            {
+                continue;
+            }
+#endif // RR_BACKFACE_CULL
+
+            float3 const s1 = cross(r.d, e2);
+            float const denom = dot(s1, e1);
+            if (denom == 0.f)
+            {
+                continue;
+            }
+
+            float const invd = 1.f / denom;
+            float3 const d = r.o - float3(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+            float const b1 = dot(d, s1) * invd;
+            float3 const s2 = cross(d, e1);
+            float const b2 = dot(r.d, s2) * invd;
+            t[lane] = dot(e2, s2) * invd;
+
+            if (b1 >= 0.f && b1 <= 1.f && b2 >= 0.f && b1 + b2 <= 1.f && t[lane] >= 0.f)
+            {
+                mask |= 1 << lane;
+            }
+        }
+
+        return mask;
+#endif // HOST_KERNELS_USE_SSE
+    }
+
+    // Intersect ray against all the triangles of a leaf. Returns face index of the closest
+    // (or any if any_hit is set) hit and updates t_max accordingly.
+    template <bool any_hit>
+    static int intersect_leaf(bvh_node const& node, TriangleBlock const* triangles, Face const* faces, ray const& r, float& t_max)
+    {
+        int const start = STARTIDX(node);
+        int const end = start + (std::max(NUMPRIMS(node), 1) + kTriangleBlockSize - 1) / kTriangleBlockSize;
+        int isect_idx = kInvalidIdx;
+
+        for (int block_idx = start; block_idx < end; ++block_idx)
+        {
+            float t[kTriangleBlockSize];
+            int const mask = intersect_triangle_block(r, triangles[block_idx], t);
+
+            // Lanes are checked in order, so the closest hit is found
+            // in the same way as with one triangle per leaf
+            for (int lane = 0; lane < kTriangleBlockSize; ++lane)
+            {
+                int const face_idx = block_idx * kTriangleBlockSize + lane;
+                if (!(mask & (1 << lane)) || !(t[lane] < t_max))
+                {
+                    continue;
+                }
+#ifdef RR_RAY_MASK
+                if (r.GetMask() == faces[face_idx].shape_id)
+                {
+                    continue;
+                }
+#else
+                (void)faces;
+#endif // RR_RAY_MASK
+
+                t_max = t[lane];
+                isect_idx = face_idx;
+
+                if (any_hit)
+                {
+                    return isect_idx;
+                }
+            }
+        }
+
+        return isect_idx;
+    }
+
+    // Traverse the tree with skip links. Returns closest (or any if any_hit is set)
+    // face index and updates t_max accordingly, leaf_addr receives the address of
+    // the leaf containing the face if provided.
+    template <bool any_hit, typename NodeData>
+    static int traverse(NodeData const* nodes, TriangleBlock const* triangles, Face const* faces, ray const& r, float& t_max, int* leaf_addr = nullptr)
+    {
+        // Precompute inverse direction and origin / dir for bbox testing
+        float3 const invdir = safe_invdir(r);
+        float3 const oxinvdir = -r.o * invdir;
+
+        // Current node address
+        int addr = 0;
+        // Current closest face index
+        int isect_idx = kInvalidIdx;
+
+        while (addr != kInvalidIdx)
+        {
+            // Fetch next node
+            bvh_node const& node = fetch_node(nodes, addr);
+            // Intersect against bbox
+            float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+
+            if (s.x <= s.y)
+            {
+                // Check if the node is a leaf
+                if (LEAFNODE(node))
+                {
+                    // Intersect leaf triangles updating closest hit distance and index
+                    int const face_idx = intersect_leaf<any_hit>(node, triangles, faces, r, t_max);
+                    if (face_idx != kInvalidIdx)
+                    {
+                        isect_idx = face_idx;
+
+                        if (leaf_addr)
+                        {
+                            *leaf_addr = addr;
+                        }
+
+                        if (any_hit)
+                        {
+                            return isect_idx;
+                        }
+                    }
+                }
+                else
+                {
+                    // Move to next node otherwise.
+                    // Left child is always at addr + 1
+                    ++addr;
+                    continue;
+                }
+            }
+
+            addr = NEXT(node);
+        }
+
+        return isect_idx;
+    }
+
+    template <typename NodeData>
+    static void intersect_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto rays = arg_ptr<ray const>(args, 3);
+        auto num_rays = arg_ptr<int const>(args, 4);
+        auto hits = arg_ptr<Intersection>(args, 5);
+
+        end = std::min<std::size_t>(end, std::max(*num_rays, 0));
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Fetch ray
+            ray const& r = rays[global_id];
+
+            if (!r.IsActive())
+            {
+                continue;
+            }
+
+            // Intersection parametric distance
+            float t_max = r.o.w;
+            int const isect_idx = traverse<false>(nodes, triangles, faces, r, t_max);
+
+            // Check if we have found an intersection
+            if (isect_idx != kInvalidIdx)
+            {
+                // Fetch the face & vertices
+                Face const& face = faces[isect_idx];
+                float3 v1, v2, v3;
+                triangle_block_get_vertices(triangles[isect_idx / kTriangleBlockSize], isect_idx % kTriangleBlockSize, v1, v2, v3);
+                // Calculate hit position
+                float3 const p = r.o + r.d * t_max;
+                // Calculte barycentric coordinates
+                float2 const uv = triangle_calculate_barycentrics(p, v1, v2, v3);
+                // Update hit information
+                hits[global_id].shapeid = face.shape_id;
+                hits[global_id].primid = face.prim_id;
+                hits[global_id].uvwt = float4(uv.x, uv.y, 0.f, t_max);
+            }
+            else
+            {
+                // Miss here
+                hits[global_id].shapeid = kMissMarker;
+                hits[global_id].primid = kMissMarker;
+            }
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto rays = arg_ptr<ray const>(args, 3);
+        auto num_rays = arg_ptr<int const>(args, 4);
+        auto hits = arg_ptr<int>(args, 5);
+
+        end = std::min<std::size_t>(end, std::max(*num_rays, 0));
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Fetch ray
+            ray const& r = rays[global_id];
+
+            if (!r.IsActive())
+            {
+                continue;
+            }
+
+            float t_max = r.o.w;
+            int const isect_idx = traverse<true>(nodes, triangles, faces, r, t_max);
+            hits[global_id] = isect_idx != kInvalidIdx ? kHitMarker : kMissMarker;
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_sum_linear(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        auto koefs = arg_ptr<float4 const>(args, 5);
+        auto offset_directions = arg_ptr<int const>(args, 6);
+        auto offset_koefs = arg_ptr<int const>(args, 7);
+        int const num_origins = *arg_ptr<int const>(args, 8);
+        int const num_directions = *arg_ptr<int const>(args, 9);
+        int const stride_directions = *arg_ptr<int const>(args, 10);
+        auto hits = arg_ptr<float>(args, 11);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 12);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+            int const direction_stride = direction_id % stride_directions;
+            int const output_offset = direction_stride * num_origins;
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Create ray
+            ray const r = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, triangles, faces, r, t_max) != kInvalidIdx;
+
+            sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_sum_linear_contrib(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        auto koefs = arg_ptr<float4 const>(args, 5);
+        auto offset_directions = arg_ptr<int const>(args, 6);
+        auto offset_koefs = arg_ptr<int const>(args, 7);
+        int const num_origins = *arg_ptr<int const>(args, 8);
+        int const num_directions = *arg_ptr<int const>(args, 9);
+        auto contribs = arg_ptr<float2>(args, 11);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 12);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Create ray
+            ray const r = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, triangles, faces, r, t_max) != kInvalidIdx;
+
+            float const k0 = hit ? koef.x : koef.y;
+            float const k1 = hit ? koef.z : koef.w;
+
+            // Same threshold as accumulating version
+            contribs[global_id] = float2(std::fabs(k0) > 1e-4f ? k0 : 0.f, std::fabs(k1) > 1e-4f ? k1 : 0.f);
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_sum_linear_sky(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto const& sky = *arg_ptr<SkyPatches const>(args, 4);
+        auto frames = *arg_ptr<int const>(args, 6) ? arg_ptr<float4 const>(args, 5) : nullptr;
+        auto koefs = arg_ptr<float4 const>(args, 7);
+        auto offset_koefs = arg_ptr<int const>(args, 8);
+        int const num_origins = *arg_ptr<int const>(args, 9);
+        int const num_directions = *arg_ptr<int const>(args, 10);
+        int const stride_directions = *arg_ptr<int const>(args, 11);
+        auto hits = arg_ptr<float>(args, 12);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 13);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+            int const output_offset = (direction_id % stride_directions) * num_origins;
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Generate the ray from sky patch
+            ray const r = make_sky_ray_2d(origins[origin_id], sky, frames, origin_id, direction_id);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, triangles, faces, r, t_max) != kInvalidIdx;
+
+            sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_sum_linear_sky_contrib(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto const& sky = *arg_ptr<SkyPatches const>(args, 4);
+        auto frames = *arg_ptr<int const>(args, 6) ? arg_ptr<float4 const>(args, 5) : nullptr;
+        auto koefs = arg_ptr<float4 const>(args, 7);
+        auto offset_koefs = arg_ptr<int const>(args, 8);
+        int const num_origins = *arg_ptr<int const>(args, 9);
+        int const num_directions = *arg_ptr<int const>(args, 10);
+        auto contribs = arg_ptr<float2>(args, 12);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 13);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Generate the ray from sky patch
+            ray const r = make_sky_ray_2d(origins[origin_id], sky, frames, origin_id, direction_id);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, triangles, faces, r, t_max) != kInvalidIdx;
+
+            float const k0 = hit ? koef.x : koef.y;
+            float const k1 = hit ? koef.z : koef.w;
+
+            // Same threshold as accumulating version
+            contribs[global_id] = float2(std::fabs(k0) > 1e-4f ? k0 : 0.f, std::fabs(k1) > 1e-4f ? k1 : 0.f);
+        }
+    }
+
+    static void occluded_main_2d_sum_linear_reduce(void* const* args, std::size_t begin, std::size_t end)
+    {
+        int const num_origins = *arg_ptr<int const>(args, 0);
+        int const num_directions = *arg_ptr<int const>(args, 1);
+        int const stride_directions = *arg_ptr<int const>(args, 2);
+        auto contribs = arg_ptr<float2 const>(args, 3);
+        auto hits = arg_ptr<float>(args, 4);
+        std::uint64_t const first_ray = *arg_ptr<std::uint64_t const>(args, 5);
+        std::uint64_t const last_ray = first_ray + *arg_ptr<int const>(args, 6);
+
+        std::size_t const num_outputs = (std::size_t)num_origins * std::min(stride_directions, num_directions);
+        end = std::min(end, num_outputs);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            int const origin_id = (int)(global_id % num_origins);
+            int const direction_stride = (int)(global_id / num_origins);
+
+            // First direction of the slot with a ray inside the dispatch
+            int direction_id = (int)((first_ray + num_origins - 1 - std::min<std::uint64_t>(first_ray, origin_id)) / num_origins);
+            direction_id += (direction_stride - direction_id % stride_directions + stride_directions) % stride_directions;
+
+            // Fixed summation order makes results reproducible
+            float2 sum(0.f, 0.f);
+            for (; direction_id < num_directions; direction_id += stride_directions)
+            {
+                std::uint64_t const ray_id = (std::uint64_t)direction_id * num_origins + origin_id;
+                if (ray_id >= last_ray)
+                    break;
+
+                float2 const& contrib = contribs[ray_id - first_ray];
+                sum.x += contrib.x;
+                sum.y += contrib.y;
+            }
+
+            hits[global_id * 2] += sum.x;
+            hits[global_id * 2 + 1] += sum.y;
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_cell_string(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        auto cell_string_inds = arg_ptr<int const>(args, 7);
+        int const num_directions = *arg_ptr<int const>(args, 6);
+        int const num_cell_strings = *arg_ptr<int const>(args, 8);
+        auto hits = arg_ptr<float>(args, 9);
+
+        std::size_t const num_ray_batches = (std::size_t)num_cell_strings * num_directions;
+        end = std::min(end, num_ray_batches);
+
+        // Shadow cache: consecutive batches are neighbouring strings in the same
+        // direction, so the leaf which has occluded the last one is tested first
+        int shadow_leaf = kInvalidIdx;
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Map global_id to cell string and direction
+            int const cell_string_id = (int)(global_id % num_cell_strings);
+            int const direction_id = (int)(global_id / num_cell_strings);
+
+            int const cs_pt_start = cell_string_inds[cell_string_id * 2];
+            int const cs_pt_end = cell_string_inds[cell_string_id * 2 + 1];
+
+            float result = 0.f;
+
+            // Iterate over all points in cell-string, any occluded point shades the string
+            for (int i = cs_pt_start; i < cs_pt_end; ++i)
+            {
+                ray const r = make_ray_2d(origins[i], directions[direction_id]);
+
+                // Try the occluder of the previous string first
+                float t_max = r.o.w;
+                if (shadow_leaf != kInvalidIdx &&
+                    intersect_leaf<true>(fetch_node(nodes, shadow_leaf), triangles, faces, r, t_max) != kInvalidIdx)
+                {
+                    result = 1.f;
+                    break;
+                }
+
+                t_max = r.o.w;
+                if (traverse<true>(nodes, triangles, faces, r, t_max, &shadow_leaf) != kInvalidIdx)
+                {
+                    result = 1.f;
+                    break;
+                }
+            }
+
+            hits[cell_string_id + direction_id * num_cell_strings] = result;
+        }
+    }
+
+    // Must match CELL_STRING_GROUP_SIZE in intersect_bvh2_skiplinks.cl
+    static std::size_t const kCellStringGroupSize = 64;
+
+    template <typename NodeData>
+    static void occluded_main_2d_cell_string_frustum(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        auto cell_string_inds = arg_ptr<int const>(args, 7);
+        int const num_directions = *arg_ptr<int const>(args, 6);
+        int const num_cell_strings = *arg_ptr<int const>(args, 8);
+        auto hits = arg_ptr<float>(args, 9);
+
+        // One work-group per (cell string, direction), ranges are group aligned
+        std::size_t const num_ray_batches = (std::size_t)num_cell_strings * num_directions;
+        std::size_t const first_batch = (begin + kCellStringGroupSize - 1) / kCellStringGroupSize;
+        std::size_t const last_batch = std::min((end + kCellStringGroupSize - 1) / kCellStringGroupSize, num_ray_batches);
+
+        for (auto batch_id = first_batch; batch_id < last_batch; ++batch_id)
+        {
+            int const cell_string_id = (int)(batch_id % num_cell_strings);
+            int const direction_id = (int)(batch_id / num_cell_strings);
+
+            int const cs_pt_start = cell_string_inds[cell_string_id * 2];
+            int const cs_pt_end = cell_string_inds[cell_string_id * 2 + 1];
+
+            float4 const& d = directions[direction_id];
+
+            // Bounds of the string origins, w keeps max t
+            float3 pmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+            float3 pmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), 0.f);
+            for (int i = cs_pt_start; i < cs_pt_end; ++i)
+            {
+                float4 const& o = origins[i];
+                pmin.x = std::min(pmin.x, o.x); pmax.x = std::max(pmax.x, o.x);
+                pmin.y = std::min(pmin.y, o.y); pmax.y = std::max(pmax.y, o.y);
+                pmin.z = std::min(pmin.z, o.z); pmax.z = std::max(pmax.z, o.z);
+                pmax.w = std::max(pmax.w, o.w);
+            }
+
+            float3 const extent(0.5f * (pmax.x - pmin.x), 0.5f * (pmax.y - pmin.y), 0.5f * (pmax.z - pmin.z), 0.f);
+
+            // Frustum ray starts from the origins box center
+            ray const f = make_ray_2d(float4(0.5f * (pmax.x + pmin.x), 0.5f * (pmax.y + pmin.y), 0.5f * (pmax.z + pmin.z), pmax.w), d);
+
+            float3 const invdir = safe_invdir(f);
+            float3 const oxinvdir = -f.o * invdir;
+            float const t_frustum = f.o.w;
+
+            float result = 0.f;
+            int addr = cs_pt_start < cs_pt_end ? 0 : kInvalidIdx;
+
+            while (addr != kInvalidIdx && result == 0.f)
+            {
+                // Fetch next node
+                bvh_node const& node = fetch_node(nodes, addr);
+
+                // Intersect the frustum against inflated bbox
+                bbox inflated = node;
+                inflated.pmin.x -= extent.x; inflated.pmax.x += extent.x;
+                inflated.pmin.y -= extent.y; inflated.pmax.y += extent.y;
+                inflated.pmin.z -= extent.z; inflated.pmax.z += extent.z;
+                float2 s = fast_intersect_bbox1(inflated, invdir, oxinvdir, t_frustum);
+
+                if (s.x <= s.y)
+                {
+                    // Check if the node is a leaf
+                    if (LEAFNODE(node))
+                    {
+                        // Test every point of the string against surviving leaf
+                        for (int i = cs_pt_start; i < cs_pt_end; ++i)
+                        {
+                            ray const r = make_ray_2d(origins[i], d);
+                            float t_max = r.o.w;
+                            if (intersect_leaf<true>(node, triangles, faces, r, t_max) != kInvalidIdx)
+                            {
+                                result = 1.f;
+                                break;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        // Move to next node otherwise.
+                        // Left child is always at addr + 1
+                        ++addr;
+                        continue;
+                    }
+                }
+
+                addr = NEXT(node);
+            }
+
+            hits[cell_string_id + direction_id * num_cell_strings] = result;
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_cell_string_count(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        int const num_origins = *arg_ptr<int const>(args, 5);
+        int const num_directions = *arg_ptr<int const>(args, 6);
+        auto cell_string_inds = arg_ptr<int const>(args, 7);
+        int const num_cell_strings = *arg_ptr<int const>(args, 8);
+        auto counts = arg_ptr<float>(args, 9);
+        auto point_masks = *arg_ptr<int const>(args, 11) ? arg_ptr<std::uint32_t>(args, 10) : nullptr;
+
+        // One work-group per (cell string, direction), ranges are group aligned
+        std::size_t const num_ray_batches = (std::size_t)num_cell_strings * num_directions;
+        std::size_t const first_batch = (begin + kCellStringGroupSize - 1) / kCellStringGroupSize;
+        std::size_t const last_batch = std::min((end + kCellStringGroupSize - 1) / kCellStringGroupSize, num_ray_batches);
+
+        for (auto batch_id = first_batch; batch_id < last_batch; ++batch_id)
+        {
+            int const cell_string_id = (int)(batch_id % num_cell_strings);
+            int const direction_id = (int)(batch_id / num_cell_strings);
+
+            int const cs_pt_start = cell_string_inds[cell_string_id * 2];
+            int const cs_pt_end = cell_string_inds[cell_string_id * 2 + 1];
+
+            int count = 0;
+            int shadow_leaf = kInvalidIdx;
+
+            for (int i = cs_pt_start; i < cs_pt_end; ++i)
+            {
+                ray const r = make_ray_2d(origins[i], directions[direction_id]);
+
+                // Try the occluder of the previous point first
+                float t_max = r.o.w;
+                bool occluded = shadow_leaf != kInvalidIdx &&
+                    intersect_leaf<true>(fetch_node(nodes, shadow_leaf), triangles, faces, r, t_max) != kInvalidIdx;
+
+                if (!occluded)
+                {
+                    t_max = r.o.w;
+                    occluded = traverse<true>(nodes, triangles, faces, r, t_max, &shadow_leaf) != kInvalidIdx;
+                }
+
+                count += occluded ? 1 : 0;
+
+                if (point_masks)
+                {
+                    // Neighbouring strings might share the word
+                    std::size_t const bit = (std::size_t)direction_id * num_origins + i;
+                    std::uint32_t const mask = 1u << (bit & 31);
+                    auto& word = *reinterpret_cast<std::atomic<std::uint32_t>*>(&point_masks[bit >> 5]);
+                    if (occluded)
+                    {
+                        word.fetch_or(mask, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        word.fetch_and(~mask, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            counts[cell_string_id + direction_id * num_cell_strings] = (float)count;
+        }
+    }
+
+    static void occluded_main_2d_cell_string_init(void* const* args, std::size_t begin, std::size_t end)
+    {
+        int const num_directions = *arg_ptr<int const>(args, 0);
+        auto cell_string_inds = arg_ptr<int const>(args, 1);
+        int const num_cell_strings = *arg_ptr<int const>(args, 2);
+        auto lengths = arg_ptr<int>(args, 3);
+        auto hits = arg_ptr<float>(args, 4);
+
+        // Extra element makes exclusive scan yield the total number of points
+        end = std::min<std::size_t>(end, (std::size_t)num_cell_strings + 1);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            if (global_id == (std::size_t)num_cell_strings)
+            {
+                lengths[global_id] = 0;
+                continue;
+            }
+
+            lengths[global_id] = cell_string_inds[global_id * 2 + 1] - cell_string_inds[global_id * 2];
+
+            for (int i = 0; i < num_directions; ++i)
+            {
+                hits[global_id + i * num_cell_strings] = 0.f;
+            }
+        }
+    }
+
+    template <typename NodeData>
+    static void occluded_main_2d_cell_string_flat(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<NodeData const>(args, 0);
+        auto triangles = arg_ptr<TriangleBlock const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto origins = arg_ptr<float4 const>(args, 3);
+        auto directions = arg_ptr<float4 const>(args, 4);
+        int const num_directions = *arg_ptr<int const>(args, 6);
+        auto cell_string_inds = arg_ptr<int const>(args, 7);
+        int const num_cell_strings = *arg_ptr<int const>(args, 8);
+        auto offsets = arg_ptr<int const>(args, 9);
+        auto hits = arg_ptr<float>(args, 10);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 11);
+        std::uint64_t const ray_stride = *arg_ptr<std::uint64_t const>(args, 13);
+
+        // Total number of points is only known here, dispatch strides until past the end
+        int const num_points = offsets[num_cell_strings];
+        std::uint64_t const num_rays = (std::uint64_t)num_points * num_directions;
+        std::uint64_t const ray_end = std::min(*arg_ptr<std::uint64_t const>(args, 12), num_rays);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            for (std::uint64_t ray_id = ray_offset + global_id; ray_id < ray_end; ray_id += ray_stride)
+            {
+                int const point_id = (int)(ray_id % num_points);
+                int const direction_id = (int)(ray_id / num_points);
+
+                // Find the string containing the point: last one with offset <= point_id
+                int const cell_string_id = (int)(std::upper_bound(offsets, offsets + num_cell_strings, point_id) - offsets) - 1;
+                int const hit_idx = cell_string_id + direction_id * num_cell_strings;
+
+                // Some other point has already shaded the string
+                if (reinterpret_cast<std::atomic<float>*>(&hits[hit_idx])->load(std::memory_order_relaxed) != 0.f)
+                {
+                    continue;
+                }
+
+                ray const r = make_ray_2d(origins[cell_string_inds[cell_string_id * 2] + point_id - offsets[cell_string_id]], directions[direction_id]);
+
+                float t_max = r.o.w;
+                if (traverse<true>(nodes, triangles, faces, r, t_max) != kInvalidIdx)
+                {
+                    // All writers store the same value
+                    reinterpret_cast<std::atomic<float>*>(&hits[hit_idx])->store(1.f, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    static void emit_leaf_geometry_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto faces = arg_ptr<Face const>(args, 0);
+        auto leaf_prims = arg_ptr<int const>(args, 1);
+        int const num_leaves = *arg_ptr<int const>(args, 2);
+        auto vertices = arg_ptr<float3 const>(args, 3);
+        auto leaf_faces = arg_ptr<Face>(args, 4);
+        auto triangles = arg_ptr<TriangleBlock>(args, 5);
+
+        end = std::min(end, (std::size_t)num_leaves);
+
+        Face padding;
+        padding.idx[0] = padding.idx[1] = padding.idx[2] = kInvalidIdx;
+        padding.shape_id = kInvalidIdx;
+        padding.prim_id = kInvalidIdx;
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Padding lanes stay degenerate
+            TriangleBlock block = {};
+
+            for (int lane = 0; lane < kTriangleBlockSize; ++lane)
+            {
+                int const prim = leaf_prims[global_id * kTriangleBlockSize + lane];
+                if (prim == kInvalidIdx)
+                {
+                    leaf_faces[global_id * kTriangleBlockSize + lane] = padding;
+                    continue;
+                }
+
+                Face const& face = faces[prim];
+                leaf_faces[global_id * kTriangleBlockSize + lane] = face;
+
+                float3 const& v1 = vertices[face.idx[0]];
+                float3 const e1 = vertices[face.idx[1]] - v1;
+                float3 const e2 = vertices[face.idx[2]] - v1;
+
+                block.v0[0][lane] = v1.x; block.v0[1][lane] = v1.y; block.v0[2][lane] = v1.z;
+                block.e1[0][lane] = e1.x; block.e1[1][lane] = e1.y; block.e1[2][lane] = e1.z;
+                block.e2[0][lane] = e2.x; block.e2[1][lane] = e2.y; block.e2[2][lane] = e2.z;
+            }
+
+            triangles[global_id] = block;
+        }
+    }
+}
+
+    Calc::HostKernelEntry const g_intersect_bvh2_skiplinks_host[] =
+    {
+        { "intersect_main", HostKernels::intersect_main<HostKernels::bvh_node> },
+        { "occluded_main", HostKernels::occluded_main<HostKernels::bvh_node> },
+        { "occluded_main_2d_sum_linear", HostKernels::occluded_main_2d_sum_linear<HostKernels::bvh_node> },
+        { "occluded_main_2d_sum_linear_contrib", HostKernels::occluded_main_2d_sum_linear_contrib<HostKernels::bvh_node> },
+        { "occluded_main_2d_sum_linear_reduce", HostKernels::occluded_main_2d_sum_linear_reduce },
+        { "occluded_main_2d_sum_linear_sky", HostKernels::occluded_main_2d_sum_linear_sky<HostKernels::bvh_node> },
+        { "occluded_main_2d_sum_linear_sky_contrib", HostKernels::occluded_main_2d_sum_linear_sky_contrib<HostKernels::bvh_node> },
+        { "occluded_main_2d_cell_string", HostKernels::occluded_main_2d_cell_string<HostKernels::bvh_node> },
+        { "occluded_main_2d_cell_string_frustum", HostKernels::occluded_main_2d_cell_string_frustum<HostKernels::bvh_node> },
+        { "occluded_main_2d_cell_string_count", HostKernels::occluded_main_2d_cell_string_count<HostKernels::bvh_node> },
+        { "occluded_main_2d_cell_string_init", HostKernels::occluded_main_2d_cell_string_init },
+        { "occluded_main_2d_cell_string_flat", HostKernels::occluded_main_2d_cell_string_flat<HostKernels::bvh_node> },
+        { "emit_leaf_geometry_main", HostKernels::emit_leaf_geometry_main }
+    };
+
+    std::size_t const g_intersect_bvh2_skiplinks_host_size = sizeof(g_intersect_bvh2_skiplinks_host) / sizeof(Calc::HostKernelEntry);
+
+    Calc::HostKernelEntry const g_intersect_bvh2_skiplinks_quantized_host[] =
+    {
+        { "intersect_main", HostKernels::intersect_main<HostKernels::QuantizedNode> },
+        { "occluded_main", HostKernels::occluded_main<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_sum_linear", HostKernels::occluded_main_2d_sum_linear<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_sum_linear_contrib", HostKernels::occluded_main_2d_sum_linear_contrib<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_sum_linear_reduce", HostKernels::occluded_main_2d_sum_linear_reduce },
+        { "occluded_main_2d_sum_linear_sky", HostKernels::occluded_main_2d_sum_linear_sky<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_sum_linear_sky_contrib", HostKernels::occluded_main_2d_sum_linear_sky_contrib<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_cell_string", HostKernels::occluded_main_2d_cell_string<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_cell_string_frustum", HostKernels::occluded_main_2d_cell_string_frustum<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_cell_string_count", HostKernels::occluded_main_2d_cell_string_count<HostKernels::QuantizedNode> },
+        { "occluded_main_2d_cell_string_init", HostKernels::occluded_main_2d_cell_string_init },
+        { "occluded_main_2d_cell_string_flat", HostKernels::occluded_main_2d_cell_string_flat<HostKernels::QuantizedNode> },
+        { "emit_leaf_geometry_main", HostKernels::emit_leaf_geometry_main }
+    };
+
+    std::size_t const g_intersect_bvh2_skiplinks_quantized_host_size = sizeof(g_intersect_bvh2_skiplinks_quantized_host) / sizeof(Calc::HostKernelEntry);
+}
+#endif // USE_HOST
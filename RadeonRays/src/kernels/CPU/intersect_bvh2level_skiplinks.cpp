@@ -0,0 +1,418 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file intersect_bvh2level_skiplinks.cpp
+    \version 1.0
+    \brief Host-native port of intersect_bvh2level_skiplinks.cl.
+
+    Kernels receive arguments in the same order as their OpenCL counterparts
+    and process a range of global work items each. See intersect_bvh2level_skiplinks.cl
+    for the description of the two-level BVH layout. Rays are transformed into
+    object space at top level leaves, so instances share bottom level data.
+ */
+#if USE_HOST
+#include "kernels_host.h"
+#include "common.h"
+
+#include "radeon_rays.h"
+
+#define STARTIDX(x)     (((int)(x.pmin.w)) >> 4)
+#define SHAPEIDX(x)     (((int)(x.pmin.w)) >> 4)
+#define LEAFNODE(x)     (((x).pmin.w) != -1.f)
+#define NEXT(x)     ((int)((x).pmax.w))
+
+namespace RadeonRays
+{
+namespace HostKernels
+{
+    typedef bbox bvh_node;
+
+    // Shape layout shared with GPU kernels, see IntersectorTwoLevel::ShapeData
+    struct Shape
+    {
+        // Shape ID
+        int id;
+        // Shape BVH index (bottom level)
+        int bvh_idx;
+        // Is the shape disabled?
+        unsigned int shape_disabled;
+        int padding1;
+        // Inverse transform
+        float4 m0;
+        float4 m1;
+        float4 m2;
+        float4 m3;
+        // Motion blur params
+        float4 velocity_linear;
+        float4 velocity_angular;
+    };
+
+    // Transform the ray into object space of the shape
+    static inline ray transform_ray(ray const& r, Shape const& shape)
+    {
+        ray res = r;
+        res.o.x = shape.m0.x * r.o.x + shape.m0.y * r.o.y + shape.m0.z * r.o.z + shape.m0.w;
+        res.o.y = shape.m1.x * r.o.x + shape.m1.y * r.o.y + shape.m1.z * r.o.z + shape.m1.w;
+        res.o.z = shape.m2.x * r.o.x + shape.m2.y * r.o.y + shape.m2.z * r.o.z + shape.m2.w;
+        res.d.x = shape.m0.x * r.d.x + shape.m0.y * r.d.y + shape.m0.z * r.d.z;
+        res.d.y = shape.m1.x * r.d.x + shape.m1.y * r.d.y + shape.m1.z * r.d.z;
+        res.d.z = shape.m2.x * r.d.x + shape.m2.y * r.d.y + shape.m2.z * r.d.z;
+        return res;
+    }
+
+    // Closest hit found by the traversal
+    struct Hit
+    {
+        int shape_id;
+        int prim_id;
+        float2 uv;
+    };
+
+    // Traverse both levels of the tree. Returns true if the ray hits anything and
+    // updates t_max. Closest hit is written into hit unless any_hit is set.
+    template <bool any_hit>
+    static bool traverse(bvh_node const* nodes, float3 const* vertices, Face const* faces, Shape const* shapes,
+        int root_idx, ray const& top_ray, float& t_max, Hit* hit)
+    {
+        // Precompute invdir for bbox testing
+        ray r = top_ray;
+        float3 const invdirtop = safe_invdir(r);
+        float3 invdir = invdirtop;
+        float3 oxinvdir = -r.o * invdir;
+
+        // Fetch top level BVH index
+        int addr = root_idx;
+        // Set top index
+        int top_addr = kInvalidIdx;
+        // Current shape ID
+        int shape_id = kInvalidIdx;
+        bool found = false;
+
+        while (addr != kInvalidIdx)
+        {
+            // Fetch next node
+            bvh_node const& node = nodes[addr];
+            // Intersect against bbox
+            float2 s = fast_intersect_bbox1(node, invdir, oxinvdir, t_max);
+
+            if (s.x <= s.y)
+            {
+                if (LEAFNODE(node))
+                {
+                    // If this is the leaf it can be either a leaf containing primitives (bottom hierarchy)
+                    // or containing another BVH (top level hierarhcy)
+                    if (top_addr != kInvalidIdx)
+                    {
+                        Face const& face = faces[STARTIDX(node)];
+                        float3 const& v1 = vertices[face.idx[0]];
+                        float3 const& v2 = vertices[face.idx[1]];
+                        float3 const& v3 = vertices[face.idx[2]];
+
+                        // If hit update closest hit distance and index
+                        float const f = fast_intersect_triangle(r, v1, v2, v3, t_max);
+                        if (f < t_max)
+                        {
+                            if (any_hit)
+                            {
+                                return true;
+                            }
+
+                            t_max = f;
+                            found = true;
+                            hit->shape_id = shape_id;
+                            hit->prim_id = face.prim_id;
+                            // Barycentrics are calculated in object space
+                            hit->uv = triangle_calculate_barycentrics(r.o + r.d * t_max, v1, v2, v3);
+                        }
+
+                        // And goto next node
+                        addr = NEXT(node);
+                    }
+                    else
+                    {
+                        // This is top level hierarchy leaf
+                        // Save top node index for return
+                        top_addr = addr;
+                        Shape const& shape = shapes[SHAPEIDX(node)];
+                        // Drill into 2nd level BVH only if the geometry is not masked vs current ray
+                        // otherwise skip the subtree
+                        if (!shape.shape_disabled
+#ifdef RR_RAY_MASK
+                            && r.GetMask() != shape.id
+#endif // RR_RAY_MASK
+                            )
+                        {
+                            // Fetch bottom level BVH index
+                            addr = shape.bvh_idx;
+                            shape_id = shape.id;
+
+                            r = transform_ray(top_ray, shape);
+                            // Recalc invdir
+                            invdir = safe_invdir(r);
+                            oxinvdir = -r.o * invdir;
+                            // And continue traversal of the bottom level BVH
+                            continue;
+                        }
+                        else
+                        {
+                            addr = kInvalidIdx;
+                        }
+                    }
+                }
+                else
+                {
+                    // This is an internal node, proceed to left child (it is at current + 1 index)
+                    ++addr;
+                }
+            }
+            else
+            {
+                // We missed the node, goto next one
+                addr = NEXT(node);
+            }
+
+            // Here check if we ended up traversing bottom level BVH
+            // in this case idx = -1 and topidx has valid value
+            if (addr == kInvalidIdx && top_addr != kInvalidIdx)
+            {
+                //  Proceed to next top level node
+                addr = NEXT(nodes[top_addr]);
+                // Set topidx
+                top_addr = kInvalidIdx;
+                // Restore ray here
+                r = top_ray;
+                // Restore invdir
+                invdir = invdirtop;
+                oxinvdir = -r.o * invdir;
+            }
+        }
+
+        return found;
+    }
+
+    static void intersect_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<bvh_node const>(args, 0);
+        auto vertices = arg_ptr<float3 const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto shapes = arg_ptr<Shape const>(args, 3);
+        int const root_idx = *arg_ptr<int const>(args, 4);
+        auto rays = arg_ptr<ray const>(args, 5);
+        auto num_rays = arg_ptr<int const>(args, 6);
+        auto hits = arg_ptr<Intersection>(args, 7);
+
+        end = std::min<std::size_t>(end, std::max(*num_rays, 0));
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Fetch ray
+            ray const& r = rays[global_id];
+
+            if (!r.IsActive())
+            {
+                continue;
+            }
+
+            float t_max = r.o.w;
+            Hit hit{};
+
+            // Check if we have found an intersection
+            if (traverse<false>(nodes, vertices, faces, shapes, root_idx, r, t_max, &hit))
+            {
+                // Update hit information
+                hits[global_id].shapeid = hit.shape_id;
+                hits[global_id].primid = hit.prim_id;
+                hits[global_id].uvwt = float4(hit.uv.x, hit.uv.y, 0.f, t_max);
+            }
+            else
+            {
+                // Miss here
+                hits[global_id].shapeid = kMissMarker;
+                hits[global_id].primid = kMissMarker;
+            }
+        }
+    }
+
+    static void occluded_main(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<bvh_node const>(args, 0);
+        auto vertices = arg_ptr<float3 const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto shapes = arg_ptr<Shape const>(args, 3);
+        int const root_idx = *arg_ptr<int const>(args, 4);
+        auto rays = arg_ptr<ray const>(args, 5);
+        auto num_rays = arg_ptr<int const>(args, 6);
+        auto hits = arg_ptr<int>(args, 7);
+
+        end = std::min<std::size_t>(end, std::max(*num_rays, 0));
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Fetch ray
+            ray const& r = rays[global_id];
+
+            if (!r.IsActive())
+            {
+                continue;
+            }
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, vertices, faces, shapes, root_idx, r, t_max, nullptr);
+            hits[global_id] = hit ? kHitMarker : kMissMarker;
+        }
+    }
+
+    static void occluded_main_2d_sum_linear(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<bvh_node const>(args, 0);
+        auto vertices = arg_ptr<float3 const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto shapes = arg_ptr<Shape const>(args, 3);
+        int const root_idx = *arg_ptr<int const>(args, 4);
+        auto origins = arg_ptr<float4 const>(args, 5);
+        auto directions = arg_ptr<float4 const>(args, 6);
+        auto koefs = arg_ptr<float4 const>(args, 7);
+        auto offset_directions = arg_ptr<int const>(args, 8);
+        auto offset_koefs = arg_ptr<int const>(args, 9);
+        int const num_origins = *arg_ptr<int const>(args, 10);
+        int const num_directions = *arg_ptr<int const>(args, 11);
+        int const stride_directions = *arg_ptr<int const>(args, 12);
+        auto hits = arg_ptr<float>(args, 13);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 14);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+            int const output_offset = (direction_id % stride_directions) * num_origins;
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Create ray
+            ray const r = make_ray_2d(origins[origin_id], directions[direction_id + offset_directions[origin_id]]);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, vertices, faces, shapes, root_idx, r, t_max, nullptr);
+
+            sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+        }
+    }
+
+    static void occluded_main_2d_sum_linear_sky(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<bvh_node const>(args, 0);
+        auto vertices = arg_ptr<float3 const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto shapes = arg_ptr<Shape const>(args, 3);
+        int const root_idx = *arg_ptr<int const>(args, 4);
+        auto origins = arg_ptr<float4 const>(args, 5);
+        auto const& sky = *arg_ptr<SkyPatches const>(args, 6);
+        auto frames = *arg_ptr<int const>(args, 8) ? arg_ptr<float4 const>(args, 7) : nullptr;
+        auto koefs = arg_ptr<float4 const>(args, 9);
+        auto offset_koefs = arg_ptr<int const>(args, 10);
+        int const num_origins = *arg_ptr<int const>(args, 11);
+        int const num_directions = *arg_ptr<int const>(args, 12);
+        int const stride_directions = *arg_ptr<int const>(args, 13);
+        auto hits = arg_ptr<float>(args, 14);
+        std::uint64_t const ray_offset = *arg_ptr<std::uint64_t const>(args, 15);
+
+        std::uint64_t const num_rays = (std::uint64_t)num_origins * num_directions;
+        end = (std::size_t)std::min<std::uint64_t>(end, num_rays > ray_offset ? num_rays - ray_offset : 0);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            std::uint64_t const ray_id = ray_offset + global_id;
+            int const origin_id = (int)(ray_id % num_origins);
+            int const direction_id = (int)(ray_id / num_origins);
+            int const output_offset = (direction_id % stride_directions) * num_origins;
+
+            float4 const& koef = koefs[direction_id + offset_koefs[origin_id]];
+
+            // Generate the ray from sky patch
+            ray const r = make_sky_ray_2d(origins[origin_id], sky, frames, origin_id, direction_id);
+
+            float t_max = r.o.w;
+            bool const hit = traverse<true>(nodes, vertices, faces, shapes, root_idx, r, t_max, nullptr);
+
+            sum_linear_accumulate(hits, output_offset + origin_id, koef, hit);
+        }
+    }
+
+    static void occluded_main_2d_cell_string(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto nodes = arg_ptr<bvh_node const>(args, 0);
+        auto vertices = arg_ptr<float3 const>(args, 1);
+        auto faces = arg_ptr<Face const>(args, 2);
+        auto shapes = arg_ptr<Shape const>(args, 3);
+        int const root_idx = *arg_ptr<int const>(args, 4);
+        auto origins = arg_ptr<float4 const>(args, 5);
+        auto directions = arg_ptr<float4 const>(args, 6);
+        int const num_directions = *arg_ptr<int const>(args, 8);
+        auto cell_string_inds = arg_ptr<int const>(args, 9);
+        int const num_cell_strings = *arg_ptr<int const>(args, 10);
+        auto hits = arg_ptr<float>(args, 11);
+
+        std::size_t const num_ray_batches = (std::size_t)num_cell_strings * num_directions;
+        end = std::min(end, num_ray_batches);
+
+        for (auto global_id = begin; global_id < end; ++global_id)
+        {
+            // Map global_id to cell string and direction
+            int const cell_string_id = (int)(global_id % num_cell_strings);
+            int const direction_id = (int)(global_id / num_cell_strings);
+
+            float result = 0.f;
+
+            // Iterate over all points in cell-string, any occluded point shades the string
+            for (int i = cell_string_inds[cell_string_id * 2]; i < cell_string_inds[cell_string_id * 2 + 1]; ++i)
+            {
+                ray const r = make_ray_2d(origins[i], directions[direction_id]);
+
+                float t_max = r.o.w;
+                if (traverse<true>(nodes, vertices, faces, shapes, root_idx, r, t_max, nullptr))
+                {
+                    result = 1.f;
+                    break;
+                }
+            }
+
+            hits[cell_string_id + direction_id * num_cell_strings] = result;
+        }
+    }
+}
+
+    Calc::HostKernelEntry const g_intersect_bvh2level_skiplinks_host[] =
+    {
+        { "intersect_main", HostKernels::intersect_main },
+        { "occluded_main", HostKernels::occluded_main },
+        { "occluded_main_2d_sum_linear", HostKernels::occluded_main_2d_sum_linear },
+        { "occluded_main_2d_sum_linear_sky", HostKernels::occluded_main_2d_sum_linear_sky },
+        { "occluded_main_2d_cell_string", HostKernels::occluded_main_2d_cell_string }
+    };
+
+    std::size_t const g_intersect_bvh2level_skiplinks_host_size = sizeof(g_intersect_bvh2level_skiplinks_host) / sizeof(Calc::HostKernelEntry);
+}
+#endif // USE_HOST
@@ -0,0 +1,50 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+/**
+    \file kernels_host.h
+    \version 1.0
+    \brief Tables of host-native kernels.
+
+    Each table mirrors kernel names of the corresponding OpenCL program,
+    so intersectors bind host and GPU functions the same way.
+ */
+#pragma once
+
+#if USE_HOST
+#include "device_host.h"
+
+namespace RadeonRays
+{
+    // intersect_bvh2_skiplinks.cl
+    extern Calc::HostKernelEntry const g_intersect_bvh2_skiplinks_host[];
+    extern std::size_t const g_intersect_bvh2_skiplinks_host_size;
+    // intersect_bvh2_skiplinks.cl built with RR_QUANTIZED_NODES
+    extern Calc::HostKernelEntry const g_intersect_bvh2_skiplinks_quantized_host[];
+    extern std::size_t const g_intersect_bvh2_skiplinks_quantized_host_size;
+    // build_hlbvh.cl
+    extern Calc::HostKernelEntry const g_build_hlbvh_host[];
+    extern std::size_t const g_build_hlbvh_host_size;
+    // intersect_bvh2level_skiplinks.cl
+    extern Calc::HostKernelEntry const g_intersect_bvh2level_skiplinks_host[];
+    extern std::size_t const g_intersect_bvh2level_skiplinks_host_size;
+}
+#endif // USE_HOST
@@ -24,15 +24,19 @@ THE SOFTWARE.
 #include "../except/except.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 
 namespace RadeonRays
 {
+    static std::atomic<std::uint64_t> s_mesh_serial(0);
+
     Mesh::Mesh(float const* vertices, int vnum, int vstride,
         int const* vidx, int vistride,
         int const* nfaceverts,
         int nfaces)
         : puretriangle_(true)
+        , serial_(++s_mesh_serial)
     {
         // Handle vertices
         // Allocate space in advance
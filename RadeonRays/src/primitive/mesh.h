@@ -25,6 +25,7 @@ THE SOFTWARE.
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <cstdint>
 
 #include "shapeimpl.h"
 #include "math/bbox.h"
@@ -83,6 +84,8 @@ namespace RadeonRays
         Face const* GetFaceData() const { return &faces_[0]; }
         // True if the mesh consists of triangles only
         bool puretriangle() const { return puretriangle_;  }
+        // Unique mesh number, unlike the address it is never reused
+        std::uint64_t serial() const { return serial_; }
 
     private:
         /// Disallow to copy meshes, too heavy
@@ -98,6 +101,8 @@ namespace RadeonRays
         std::vector<Face> faces_;
         /// Pure triangle flag
         bool puretriangle_;
+        /// Serial number
+        std::uint64_t serial_;
     };
 
     //
@@ -78,6 +78,10 @@ namespace RadeonRays
     {
         nodecnt_ = root_;
 
+        // Number of top level nodes changes as instances come and go
+        nodes_.resize(root_ + bvh.m_nodecnt);
+        extra_.resize(root_ + bvh.m_nodecnt);
+
         // Process root
         ProcessNode(bvh.m_root);
 
@@ -0,0 +1,148 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "quantized_bvh_translator.h"
+
+#include "../except/except.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define LEAFNODE(x)     (((x).pmin.w) != -1.f)
+#define NEXT(x)     ((int)((x).pmax.w))
+
+namespace RadeonRays
+{
+    // Number of steps the grid spans along each axis
+    static double const kMaxSteps = 65535.0;
+    // Integers up to this value are exactly representable as floats
+    static double const kMaxExactFloatInt = 16777216.0;
+
+    // Find power of two step and origin being a multiple of it, so the grid
+    // covers [pmin, pmax] and all its points are exact floats
+    static void CalculateGrid(float pmin, float pmax, float& origin, float& step)
+    {
+        double const extent = std::max((double)pmax - (double)pmin, 0.0);
+
+        int exponent = 0;
+        std::frexp(std::max(extent / (kMaxSteps - 1.0), 1e-30), &exponent);
+        double s = std::ldexp(1.0, exponent);
+
+        for (;;)
+        {
+            double const first = std::floor(pmin / s);
+            double const last = std::ceil(pmax / s);
+
+            if (last - first <= kMaxSteps && std::max(std::fabs(first), std::fabs(last)) <= kMaxExactFloatInt)
+            {
+                origin = (float)(first * s);
+                step = (float)s;
+                return;
+            }
+
+            s *= 2.0;
+        }
+    }
+
+    static std::uint16_t Quantize(double steps)
+    {
+        return (std::uint16_t)std::min(std::max(steps, 0.0), kMaxSteps);
+    }
+
+    void QuantizedBvhTranslator::Process(std::vector<bbox> const& nodes)
+    {
+        ThrowIf(nodes.empty(), "Nothing to quantize");
+
+        // Root bounds contain the whole tree
+        Header header;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            CalculateGrid(nodes[0].pmin[axis], nodes[0].pmax[axis], header.origin[axis], header.step[axis]);
+        }
+        header.origin[3] = header.step[3] = 0.f;
+
+        nodes_.resize(kHeaderSize + nodes.size());
+        std::memcpy(&nodes_[0], &header, sizeof(Header));
+
+        for (int i = 0; i < (int)nodes.size(); ++i)
+        {
+            bbox const& node = nodes[i];
+            Node& qnode = nodes_[kHeaderSize + i];
+
+            // Round outwards
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double const origin = (double)header.origin[axis] / header.step[axis];
+                qnode.lo[axis] = Quantize(std::floor(node.pmin[axis] / (double)header.step[axis]) - origin);
+                qnode.hi[axis] = Quantize(std::ceil(node.pmax[axis] / (double)header.step[axis]) - origin);
+            }
+
+            int const next = NEXT(node);
+
+            if (LEAFNODE(node))
+            {
+                int const data = (int)node.pmin.w;
+                ThrowIf(data < 0 || (std::uint32_t)data >= kLastBit, "Too many primitives for quantized BVH nodes");
+                ThrowIf(next != -1 && next != i + 1, "Leaf skip link does not point to the next node");
+
+                qnode.link = kLeafBit | (std::uint32_t)data | (next == -1 ? kLastBit : 0u);
+            }
+            else
+            {
+                qnode.link = next == -1 ? kInvalidLink : (std::uint32_t)next;
+            }
+        }
+    }
+
+    void QuantizedBvhTranslator::Decode(std::vector<Node> const& nodes, std::vector<bbox>& decoded)
+    {
+        ThrowIf(nodes.size() < (std::size_t)kHeaderSize, "Quantized nodes are missing the header");
+
+        Header header;
+        std::memcpy(&header, &nodes[0], sizeof(Header));
+
+        decoded.resize(nodes.size() - kHeaderSize);
+
+        for (int i = 0; i < (int)decoded.size(); ++i)
+        {
+            Node const& qnode = nodes[kHeaderSize + i];
+            bbox& node = decoded[i];
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.pmin[axis] = qnode.lo[axis] * header.step[axis] + header.origin[axis];
+                node.pmax[axis] = qnode.hi[axis] * header.step[axis] + header.origin[axis];
+            }
+
+            if (qnode.link & kLeafBit)
+            {
+                node.pmin.w = (float)(qnode.link & ~(kLeafBit | kLastBit));
+                node.pmax.w = (qnode.link & kLastBit) ? -1.f : (float)(i + 1);
+            }
+            else
+            {
+                node.pmin.w = -1.f;
+                node.pmax.w = qnode.link == kInvalidLink ? -1.f : (float)qnode.link;
+            }
+        }
+    }
+}
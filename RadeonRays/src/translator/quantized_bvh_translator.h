@@ -0,0 +1,89 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef QUANTIZED_BVH_TRANSLATOR_H
+#define QUANTIZED_BVH_TRANSLATOR_H
+
+#include "math/bbox.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace RadeonRays
+{
+    ///< This class encodes translated skip-links nodes into 16 bytes each.
+    ///< Node bounds are quantized to 16 bits on a grid covering the root
+    ///< bounds. Grid step is a power of two and the origin is a multiple of it,
+    ///< so decoding is exact on any device and rounding outwards keeps
+    ///< decoded boxes conservative. The grid is stored in front of the nodes.
+    ///<
+    class QuantizedBvhTranslator
+    {
+    public:
+        // Leaf flag in node link
+        static std::uint32_t const kLeafBit = 0x80000000u;
+        // Leaf flag for the last node in traversal order
+        static std::uint32_t const kLastBit = 0x40000000u;
+        // Missing skip link of internal node
+        static std::uint32_t const kInvalidLink = 0x7fffffffu;
+        // Number of nodes occupied by the grid
+        static int const kHeaderSize = 2;
+
+        // Quantized node
+        struct Node
+        {
+            // Bounds in grid steps
+            std::uint16_t lo[3];
+            std::uint16_t hi[3];
+            // Skip link for internal nodes. For leaves: leaf and last flags,
+            // STARTIDX and NUMPRIMS packed the same way as in plain nodes.
+            // Skip link of a leaf is the next node unless it is the last one.
+            std::uint32_t link;
+        };
+
+        // Quantization grid
+        struct Header
+        {
+            float origin[4];
+            float step[4];
+        };
+
+        // Constructor
+        QuantizedBvhTranslator() = default;
+
+        // Encode nodes produced by PlainBvhTranslator
+        void Process(std::vector<bbox> const& nodes);
+        // Decode nodes back into PlainBvhTranslator form, bounds are conservative
+        static void Decode(std::vector<Node> const& nodes, std::vector<bbox>& decoded);
+
+        // Header followed by nodes
+        std::vector<Node> nodes_;
+
+    private:
+        QuantizedBvhTranslator(QuantizedBvhTranslator const&) = delete;
+        QuantizedBvhTranslator& operator =(QuantizedBvhTranslator const&) = delete;
+    };
+
+    static_assert(sizeof(QuantizedBvhTranslator::Node) == 16, "Unexpected quantized node size");
+    static_assert(sizeof(QuantizedBvhTranslator::Header) == QuantizedBvhTranslator::kHeaderSize * sizeof(QuantizedBvhTranslator::Node), "Unexpected quantized header size");
+}
+
+#endif // QUANTIZED_BVH_TRANSLATOR_H
@@ -0,0 +1,73 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace RadeonRays
+{
+    ///< Incremental 64-bit FNV-1a hash, cheap and stable across
+    ///< platforms, so it can be used as a key for on-disk data
+    ///<
+    class Hash
+    {
+    public:
+        // Append raw bytes
+        void Append(void const* data, std::size_t size)
+        {
+            auto bytes = static_cast<unsigned char const*>(data);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                value_ ^= bytes[i];
+                value_ *= 1099511628211ull;
+            }
+        }
+
+        // Append string including terminator, so concatenations do not collide
+        void Append(char const* str)
+        {
+            std::string const s = str ? str : "";
+            Append(s.c_str(), s.size() + 1);
+        }
+
+        // Append trivially copyable value
+        template <typename T>
+        void AppendValue(T const& value)
+        {
+            Append(&value, sizeof(T));
+        }
+
+        // Get hash value
+        std::uint64_t GetValue() const
+        {
+            return value_;
+        }
+
+    private:
+        std::uint64_t value_ = 14695981039346656037ull;
+    };
+}
+
+#endif // HASH_H
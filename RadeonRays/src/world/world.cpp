@@ -30,7 +30,7 @@ namespace RadeonRays
         if (std::find(shapes_.cbegin(), shapes_.cend(), shape) == shapes_.cend())
         {
             shapes_.push_back(shape);
-            has_changed_ = true;
+            shapes_added_.insert(shape);
         }
     }
 
@@ -40,14 +40,27 @@ namespace RadeonRays
         if (iter != shapes_.end())
         {
             shapes_.erase(iter);
-            has_changed_ = true;
+
+            // Shapes which have never been commited just vanish
+            if (shapes_added_.erase(shape) == 0)
+            {
+                shapes_removed_.insert(shape);
+            }
         }
     }
     
     void World::DetachAll()
     {
+        for (auto shape : shapes_)
+        {
+            if (shapes_added_.find(shape) == shapes_added_.cend())
+            {
+                shapes_removed_.insert(shape);
+            }
+        }
+
         shapes_.clear();
-        has_changed_ = true;
+        shapes_added_.clear();
     }
 
     int World::GetStateChange() const
@@ -73,6 +86,7 @@ namespace RadeonRays
             shapeimpl->OnCommit();
         }
 
-        has_changed_ = false;
+        shapes_added_.clear();
+        shapes_removed_.clear();
     }
 }
\ No newline at end of file
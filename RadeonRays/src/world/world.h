@@ -23,6 +23,7 @@ THE SOFTWARE.
 #define WORLD_H
 
 #include <memory>
+#include <set>
 #include <vector>
 
 #include "radeon_rays.h"
@@ -50,20 +51,20 @@ namespace RadeonRays
         void DetachAll();
         // Call this as scene has been commited
         void OnCommit();
-        // 
+        // Shapes have been attached or detached since last commit
         bool has_changed() const;
-        //
+        // Combined state changes of all the shapes
         int GetStateChange() const;
 
 
     public:
-        // Shapes in the scene
+        // Shapes in the scene, attached shapes are appended to the end
         std::vector<Shape const*> shapes_;
-        // Flags to indicate shapes have been changed
-        std::vector<int> shapes_dirty_;
-
-        // TODO: Do more preciese dirty flags tracking
-        bool has_changed_ = true;
+        // Shapes attached since last commit
+        std::set<Shape const*> shapes_added_;
+        // Shapes present at last commit and detached since then.
+        // Detached shapes might be deleted already, so never dereference these.
+        std::set<Shape const*> shapes_removed_;
         // Global flags
         int hint_;
         // Options
@@ -72,7 +73,7 @@ namespace RadeonRays
 
     inline bool World::has_changed() const
     {
-        return has_changed_;
+        return !shapes_added_.empty() || !shapes_removed_.empty();
     }
 }
 
@@ -28,8 +28,10 @@ THE SOFTWARE.
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include <cstdint>
 #include <cstdlib>
 #include <ctime>
+#include <iterator>
 #include <memory>
 
 #include "gtest/gtest.h"
@@ -39,6 +41,7 @@ THE SOFTWARE.
 #include "except.h"
 #include "event.h"
 #include "executable.h"
+#include "primitives.h"
 
 // Api creation fixture, prepares api_ for further tests
 class CalcTestkOpenCL : public ::testing::Test
@@ -563,4 +566,201 @@ TEST_F(CalcTestkOpenCL, ExecuteRawParams)
     ASSERT_NO_THROW(m_calc->DeleteDevice(device));
 }
 
+TEST_F(CalcTestkOpenCL, SortRadixUint64)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    if (!device->HasBuiltinPrimitives())
+    {
+        m_calc->DeleteDevice(device);
+        return;
+    }
+
+    // Few distinct high halves to exercise stability across both key halves
+    auto const kBufferSize = 100000;
+    std::vector<std::uint64_t> keys(kBufferSize);
+    std::generate(keys.begin(), keys.end(), []() { return (std::uint64_t(std::rand() % 4 + 0x7FFFFFFE) << 32) | std::uint64_t(std::rand() % 1000); });
+    std::vector<std::uint32_t> values(kBufferSize);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto buffer_keys = device->CreateBuffer(kBufferSize * sizeof(std::uint64_t), Calc::BufferType::kRead, &keys[0]);
+    auto buffer_values = device->CreateBuffer(kBufferSize * sizeof(std::uint32_t), Calc::BufferType::kRead, &values[0]);
+    auto buffer_sorted_keys = device->CreateBuffer(kBufferSize * sizeof(std::uint64_t), Calc::BufferType::kWrite);
+    auto buffer_sorted_values = device->CreateBuffer(kBufferSize * sizeof(std::uint32_t), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SortRadixUint64(0, buffer_keys, buffer_sorted_keys, buffer_values, buffer_sorted_values, kBufferSize));
+
+    std::vector<std::uint64_t> sorted_keys(kBufferSize);
+    std::vector<std::uint32_t> sorted_values(kBufferSize);
+    Calc::Event* e = nullptr;
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_keys, 0, 0, kBufferSize, &sorted_keys[0], nullptr));
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_values, 0, 0, kBufferSize, &sorted_values[0], &e));
+    e->Wait();
+    device->DeleteEvent(e);
+
+    std::vector<std::uint32_t> expected(values);
+    std::stable_sort(expected.begin(), expected.end(), [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] < keys[b]; });
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(sorted_values[i], expected[i]);
+        ASSERT_EQ(sorted_keys[i], keys[expected[i]]);
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_keys);
+    device->DeleteBuffer(buffer_values);
+    device->DeleteBuffer(buffer_sorted_keys);
+    device->DeleteBuffer(buffer_sorted_values);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkOpenCL, SegmentedScanExclusiveAddInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    if (!device->HasBuiltinPrimitives())
+    {
+        m_calc->DeleteDevice(device);
+        return;
+    }
+
+    // Size is not a multiple of the work group size
+    auto const kBufferSize = 100003;
+    std::vector<int> input(kBufferSize);
+    std::generate(input.begin(), input.end(), []() { return std::rand() % 100; });
+    std::vector<int> heads(kBufferSize);
+    std::generate(heads.begin(), heads.end(), []() { return std::rand() % 20000 == 0 ? 1 : 0; });
+
+    auto buffer_in = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &input[0]);
+    auto buffer_heads = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &heads[0]);
+    auto buffer_out = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SegmentedScanExclusiveAddInt32(0, buffer_in, buffer_heads, buffer_out, kBufferSize));
+
+    std::vector<int> output(kBufferSize);
+    Calc::Event* e = nullptr;
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, kBufferSize, &output[0], &e));
+    e->Wait();
+    device->DeleteEvent(e);
+
+    int sum = 0;
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        sum = heads[i] ? 0 : sum;
+        ASSERT_EQ(output[i], sum);
+        sum += input[i];
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_heads);
+    device->DeleteBuffer(buffer_out);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkOpenCL, SegmentedReduceAddFloat)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    if (!device->HasBuiltinPrimitives())
+    {
+        m_calc->DeleteDevice(device);
+        return;
+    }
+
+    auto const kNumSegments = 10000;
+    std::vector<int> offsets(kNumSegments + 1);
+    std::generate(offsets.begin() + 1, offsets.end(), []() { return std::rand() % 20; });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<float> input(offsets.back());
+    std::generate(input.begin(), input.end(), []() { return (float)std::rand() / RAND_MAX; });
+
+    auto buffer_in = device->CreateBuffer(input.size() * sizeof(float), Calc::BufferType::kRead, &input[0]);
+    auto buffer_offsets = device->CreateBuffer(offsets.size() * sizeof(int), Calc::BufferType::kRead, &offsets[0]);
+    auto buffer_out = device->CreateBuffer(kNumSegments * sizeof(float), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SegmentedReduceAddFloat(0, buffer_in, buffer_offsets, buffer_out, kNumSegments));
+
+    std::vector<float> output(kNumSegments);
+    Calc::Event* e = nullptr;
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, kNumSegments, &output[0], &e));
+    e->Wait();
+    device->DeleteEvent(e);
+
+    for (auto i = 0; i < kNumSegments; ++i)
+    {
+        ASSERT_NEAR(output[i], std::accumulate(input.begin() + offsets[i], input.begin() + offsets[i + 1], 0.f), 1e-4f);
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_offsets);
+    device->DeleteBuffer(buffer_out);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkOpenCL, CompactInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    if (!device->HasBuiltinPrimitives())
+    {
+        m_calc->DeleteDevice(device);
+        return;
+    }
+
+    auto const kBufferSize = 100000;
+    std::vector<int> input(kBufferSize);
+    std::iota(input.begin(), input.end(), 0);
+    std::vector<int> predicate(kBufferSize);
+    std::generate(predicate.begin(), predicate.end(), []() { return std::rand() % 3 == 0 ? 1 : 0; });
+
+    auto buffer_predicate = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &predicate[0]);
+    auto buffer_in = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &input[0]);
+    auto buffer_out = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+    auto buffer_size = device->CreateBuffer(sizeof(int), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->CompactInt32(0, buffer_predicate, buffer_in, buffer_out, buffer_size, kBufferSize));
+
+    std::vector<int> expected;
+    std::copy_if(input.begin(), input.end(), std::back_inserter(expected), [&predicate](int i) { return predicate[i] != 0; });
+
+    int size = 0;
+    Calc::Event* e = nullptr;
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_size, 0, 0, 1, &size, &e));
+    e->Wait();
+    device->DeleteEvent(e);
+    ASSERT_EQ(size, (int)expected.size());
+
+    std::vector<int> output(size);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, size, &output[0], &e));
+    e->Wait();
+    device->DeleteEvent(e);
+    ASSERT_EQ(output, expected);
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_predicate);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_out);
+    device->DeleteBuffer(buffer_size);
+    m_calc->DeleteDevice(device);
+}
+
 #endif //USE_OPENCL
\ No newline at end of file
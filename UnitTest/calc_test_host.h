@@ -0,0 +1,553 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#include "radeon_rays.h"
+
+#if USE_HOST
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "calc.h"
+#include "device.h"
+#include "device_host.h"
+#include "buffer.h"
+#include "except.h"
+#include "event.h"
+#include "executable.h"
+#include "primitives.h"
+
+// Api creation fixture, prepares api_ for further tests
+class CalcTestkHost : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        m_calc = CreateCalc(Calc::Platform::kHost, 0);
+    }
+
+    void TearDown() override
+    {
+        DeleteCalc(m_calc);
+    }
+
+    Calc::Calc* m_calc;
+
+    static void add(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto a = static_cast<int const*>(args[0]);
+        auto b = static_cast<int const*>(args[1]);
+        auto c = static_cast<int*>(args[2]);
+
+        for (auto idx = begin; idx < end; ++idx)
+        {
+            c[idx] = a[idx] + b[idx];
+        }
+    }
+
+    static void add_value(void* const* args, std::size_t begin, std::size_t end)
+    {
+        auto a = static_cast<int const*>(args[0]);
+        auto b = *static_cast<int const*>(args[1]);
+        auto c = static_cast<int*>(args[2]);
+
+        for (auto idx = begin; idx < end; ++idx)
+        {
+            c[idx] = a[idx] + b;
+        }
+    }
+
+    static Calc::HostKernelEntry const* kernels()
+    {
+        static Calc::HostKernelEntry const kernels[] = { { "add", add }, { "add_value", add_value } };
+        return kernels;
+    }
+};
+
+TEST_F(CalcTestkHost, Create)
+{
+    ASSERT_NE(m_calc, nullptr);
+    ASSERT_EQ(m_calc->GetPlatform(), Calc::Platform::kHost);
+}
+
+TEST_F(CalcTestkHost, EnumDevices)
+{
+    auto num_devices = m_calc->GetDeviceCount();
+
+    ASSERT_EQ(num_devices, 1U);
+
+    Calc::DeviceSpec spec;
+    ASSERT_NO_THROW(m_calc->GetDeviceSpec(0, spec));
+    ASSERT_EQ(spec.type, Calc::DeviceType::kCpu);
+    ASSERT_THROW(m_calc->GetDeviceSpec(num_devices, spec), Calc::Exception);
+}
+
+TEST_F(CalcTestkHost, CreateBufferZeroSize)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    Calc::Buffer* buffer = nullptr;
+
+    ASSERT_THROW(buffer = device->CreateBuffer(0, Calc::BufferType::kWrite), Calc::Exception);
+
+    ASSERT_NO_THROW(device->DeleteBuffer(buffer));
+    ASSERT_NO_THROW(m_calc->DeleteDevice(device));
+}
+
+TEST_F(CalcTestkHost, ReadWriteBuffer)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    Calc::Buffer* buffer = nullptr;
+
+    const auto kBufferSize = 1000;
+    std::vector<int> numbers(kBufferSize);
+
+    std::generate(numbers.begin(), numbers.end(), std::rand);
+    ASSERT_NO_THROW(buffer = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite));
+
+    Calc::Event* e = nullptr;
+
+    ASSERT_NO_THROW(device->WriteBuffer(buffer, 0, 0, kBufferSize * sizeof(int), &numbers[0], &e));
+
+    e->Wait();
+    device->DeleteEvent(e);
+
+    std::vector<int> numbers_calc(kBufferSize);
+
+    ASSERT_NO_THROW(device->ReadBuffer(buffer, 0, 0, kBufferSize * sizeof(int), &numbers_calc[0], &e));
+
+    e->Wait();
+    device->DeleteEvent(e);
+
+    ASSERT_EQ(numbers, numbers_calc);
+
+    // Out of bounds access has to be reported
+    ASSERT_THROW(device->ReadBuffer(buffer, 0, sizeof(int), kBufferSize * sizeof(int), &numbers_calc[0], nullptr), Calc::Exception);
+
+    ASSERT_NO_THROW(device->DeleteBuffer(buffer));
+    ASSERT_NO_THROW(m_calc->DeleteDevice(device));
+}
+
+TEST_F(CalcTestkHost, MapBuffer)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    Calc::Buffer* buffer = nullptr;
+
+    const auto kBufferSize = 1000;
+    std::vector<int> numbers(kBufferSize);
+
+    std::generate(numbers.begin(), numbers.end(), std::rand);
+    ASSERT_NO_THROW(buffer = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite, &numbers[0]));
+
+    Calc::Event* e = nullptr;
+    int* mapdata = nullptr;
+
+    ASSERT_NO_THROW(device->MapTypedBuffer(buffer, 0, 0, kBufferSize, Calc::MapType::kMapWrite, &mapdata, &e));
+
+    e->Wait();
+    device->DeleteEvent(e);
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(numbers[i], mapdata[i]);
+        mapdata[i] = i;
+    }
+
+    ASSERT_NO_THROW(device->UnmapBuffer(buffer, 0, mapdata, &e));
+
+    e->Wait();
+    device->DeleteEvent(e);
+
+    std::vector<int> numbers_calc(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer, 0, 0, kBufferSize, &numbers_calc[0], nullptr));
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(numbers_calc[i], i);
+    }
+
+    ASSERT_NO_THROW(device->DeleteBuffer(buffer));
+    ASSERT_NO_THROW(m_calc->DeleteDevice(device));
+}
+
+TEST_F(CalcTestkHost, CompileExecutable)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    // Host device can't compile sources
+    ASSERT_THROW(device->CompileExecutable("", 0, nullptr), Calc::Exception);
+
+    Calc::Executable* executable = nullptr;
+    ASSERT_NO_THROW(executable = static_cast<Calc::DeviceHost*>(device)->CreateExecutable(kernels(), 2));
+
+    Calc::Function* func = nullptr;
+    ASSERT_NO_THROW(func = executable->CreateFunction("add"));
+    ASSERT_THROW(executable->CreateFunction("sub"), Calc::Exception);
+
+    ASSERT_NO_THROW(executable->DeleteFunction(func));
+    ASSERT_NO_THROW(device->DeleteExecutable(executable));
+    ASSERT_NO_THROW(m_calc->DeleteDevice(device));
+}
+
+TEST_F(CalcTestkHost, Execute)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    // Large enough to be split across worker threads
+    auto const kBufferSize = 1000000;
+    std::vector<int> a(kBufferSize);
+    std::vector<int> b(kBufferSize);
+
+    std::iota(a.begin(), a.end(), 0);
+    std::iota(b.begin(), b.end(), kBufferSize);
+
+    Calc::Buffer* buffer_a = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &a[0]);
+    Calc::Buffer* buffer_b = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &b[0]);
+    Calc::Buffer* buffer_c = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+
+    auto executable = static_cast<Calc::DeviceHost*>(device)->CreateExecutable(kernels(), 2);
+    auto func = executable->CreateFunction("add");
+
+    func->SetArg(0, buffer_a);
+    func->SetArg(1, buffer_b);
+    func->SetArg(2, buffer_c);
+
+    Calc::Event* e = nullptr;
+    ASSERT_NO_THROW(device->Execute(func, 0, kBufferSize, 64, &e));
+
+    e->Wait();
+    device->DeleteEvent(e);
+
+    std::vector<int> c(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_c, 0, 0, kBufferSize, &c[0], nullptr));
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(c[i], a[i] + b[i]);
+    }
+
+    executable->DeleteFunction(func);
+    device->DeleteExecutable(executable);
+    device->DeleteBuffer(buffer_a);
+    device->DeleteBuffer(buffer_b);
+    device->DeleteBuffer(buffer_c);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, ExecuteRawParams)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    auto const kBufferSize = 100000;
+    std::vector<int> a(kBufferSize);
+    std::iota(a.begin(), a.end(), 0);
+
+    Calc::Buffer* buffer_a = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &a[0]);
+    Calc::Buffer* buffer_c = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+
+    auto executable = static_cast<Calc::DeviceHost*>(device)->CreateExecutable(kernels(), 2);
+    auto func = executable->CreateFunction("add_value");
+
+    int b = 5;
+    func->SetArg(0, buffer_a);
+    func->SetArg(1, sizeof(int), &b);
+    func->SetArg(2, buffer_c);
+
+    // Value is copied at SetArg time
+    b = 0;
+
+    ASSERT_NO_THROW(device->Execute(func, 0, kBufferSize, 64, nullptr));
+
+    std::vector<int> c(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_c, 0, 0, kBufferSize, &c[0], nullptr));
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(c[i], a[i] + 5);
+    }
+
+    executable->DeleteFunction(func);
+    device->DeleteExecutable(executable);
+    device->DeleteBuffer(buffer_a);
+    device->DeleteBuffer(buffer_c);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, ScanExclusiveAddInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+    ASSERT_TRUE(device->HasBuiltinPrimitives());
+
+    auto const kBufferSize = 1000;
+    std::vector<int> input(kBufferSize);
+    std::generate(input.begin(), input.end(), []() { return std::rand() % 100; });
+
+    auto buffer_in = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &input[0]);
+    auto buffer_out = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->ScanExclusiveAddInt32(0, buffer_in, buffer_out, kBufferSize));
+
+    std::vector<int> output(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, kBufferSize, &output[0], nullptr));
+
+    int sum = 0;
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(output[i], sum);
+        sum += input[i];
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_out);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, SortRadixInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    // Negative keys go after positive ones, as with device radix sorts
+    auto const kBufferSize = 100000;
+    std::vector<std::int32_t> keys(kBufferSize);
+    std::generate(keys.begin(), keys.end(), []() { return std::rand() % 2000 - 1000; });
+    std::vector<std::int32_t> values(kBufferSize);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto buffer_keys = device->CreateBuffer(kBufferSize * sizeof(std::int32_t), Calc::BufferType::kRead, &keys[0]);
+    auto buffer_values = device->CreateBuffer(kBufferSize * sizeof(std::int32_t), Calc::BufferType::kRead, &values[0]);
+    auto buffer_sorted_keys = device->CreateBuffer(kBufferSize * sizeof(std::int32_t), Calc::BufferType::kWrite);
+    auto buffer_sorted_values = device->CreateBuffer(kBufferSize * sizeof(std::int32_t), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SortRadixInt32(0, buffer_keys, buffer_sorted_keys, buffer_values, buffer_sorted_values, kBufferSize));
+
+    std::vector<std::int32_t> sorted_keys(kBufferSize);
+    std::vector<std::int32_t> sorted_values(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_keys, 0, 0, kBufferSize, &sorted_keys[0], nullptr));
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_values, 0, 0, kBufferSize, &sorted_values[0], nullptr));
+
+    std::vector<std::int32_t> expected(values);
+    std::stable_sort(expected.begin(), expected.end(), [&keys](std::int32_t a, std::int32_t b) { return (std::uint32_t)keys[a] < (std::uint32_t)keys[b]; });
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(sorted_values[i], expected[i]);
+        ASSERT_EQ(sorted_keys[i], keys[expected[i]]);
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_keys);
+    device->DeleteBuffer(buffer_values);
+    device->DeleteBuffer(buffer_sorted_keys);
+    device->DeleteBuffer(buffer_sorted_values);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, SortRadixUint64)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    // Few distinct high halves to exercise stability across both key halves
+    auto const kBufferSize = 100000;
+    std::vector<std::uint64_t> keys(kBufferSize);
+    std::generate(keys.begin(), keys.end(), []() { return (std::uint64_t(std::rand() % 4 + 0x7FFFFFFE) << 32) | std::uint64_t(std::rand() % 1000); });
+    std::vector<std::uint32_t> values(kBufferSize);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto buffer_keys = device->CreateBuffer(kBufferSize * sizeof(std::uint64_t), Calc::BufferType::kRead, &keys[0]);
+    auto buffer_values = device->CreateBuffer(kBufferSize * sizeof(std::uint32_t), Calc::BufferType::kRead, &values[0]);
+    auto buffer_sorted_keys = device->CreateBuffer(kBufferSize * sizeof(std::uint64_t), Calc::BufferType::kWrite);
+    auto buffer_sorted_values = device->CreateBuffer(kBufferSize * sizeof(std::uint32_t), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SortRadixUint64(0, buffer_keys, buffer_sorted_keys, buffer_values, buffer_sorted_values, kBufferSize));
+
+    std::vector<std::uint64_t> sorted_keys(kBufferSize);
+    std::vector<std::uint32_t> sorted_values(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_keys, 0, 0, kBufferSize, &sorted_keys[0], nullptr));
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_sorted_values, 0, 0, kBufferSize, &sorted_values[0], nullptr));
+
+    std::vector<std::uint32_t> expected(values);
+    std::stable_sort(expected.begin(), expected.end(), [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] < keys[b]; });
+
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        ASSERT_EQ(sorted_values[i], expected[i]);
+        ASSERT_EQ(sorted_keys[i], keys[expected[i]]);
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_keys);
+    device->DeleteBuffer(buffer_values);
+    device->DeleteBuffer(buffer_sorted_keys);
+    device->DeleteBuffer(buffer_sorted_values);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, SegmentedScanExclusiveAddInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    // Long segments cross the blocks of the implementation
+    auto const kBufferSize = 100000;
+    std::vector<int> input(kBufferSize);
+    std::generate(input.begin(), input.end(), []() { return std::rand() % 100; });
+    std::vector<int> heads(kBufferSize);
+    std::generate(heads.begin(), heads.end(), []() { return std::rand() % 20000 == 0 ? 1 : 0; });
+
+    auto buffer_in = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &input[0]);
+    auto buffer_heads = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &heads[0]);
+    auto buffer_out = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SegmentedScanExclusiveAddInt32(0, buffer_in, buffer_heads, buffer_out, kBufferSize));
+
+    std::vector<int> output(kBufferSize);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, kBufferSize, &output[0], nullptr));
+
+    int sum = 0;
+    for (auto i = 0; i < kBufferSize; ++i)
+    {
+        sum = heads[i] ? 0 : sum;
+        ASSERT_EQ(output[i], sum);
+        sum += input[i];
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_heads);
+    device->DeleteBuffer(buffer_out);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, SegmentedReduceAddFloat)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    auto const kNumSegments = 10000;
+    std::vector<int> offsets(kNumSegments + 1);
+    std::generate(offsets.begin() + 1, offsets.end(), []() { return std::rand() % 20; });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<float> input(offsets.back());
+    std::generate(input.begin(), input.end(), []() { return (float)std::rand() / RAND_MAX; });
+
+    auto buffer_in = device->CreateBuffer(input.size() * sizeof(float), Calc::BufferType::kRead, &input[0]);
+    auto buffer_offsets = device->CreateBuffer(offsets.size() * sizeof(int), Calc::BufferType::kRead, &offsets[0]);
+    auto buffer_out = device->CreateBuffer(kNumSegments * sizeof(float), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->SegmentedReduceAddFloat(0, buffer_in, buffer_offsets, buffer_out, kNumSegments));
+
+    std::vector<float> output(kNumSegments);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, kNumSegments, &output[0], nullptr));
+
+    // Summation order is fixed, so results match exactly
+    for (auto i = 0; i < kNumSegments; ++i)
+    {
+        ASSERT_EQ(output[i], std::accumulate(input.begin() + offsets[i], input.begin() + offsets[i + 1], 0.f));
+    }
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_offsets);
+    device->DeleteBuffer(buffer_out);
+    m_calc->DeleteDevice(device);
+}
+
+TEST_F(CalcTestkHost, CompactInt32)
+{
+    Calc::Device* device = nullptr;
+
+    ASSERT_NO_THROW(device = m_calc->CreateDevice(0));
+
+    auto const kBufferSize = 100000;
+    std::vector<int> input(kBufferSize);
+    std::iota(input.begin(), input.end(), 0);
+    std::vector<int> predicate(kBufferSize);
+    std::generate(predicate.begin(), predicate.end(), []() { return std::rand() % 3 == 0 ? 1 : 0; });
+
+    auto buffer_predicate = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &predicate[0]);
+    auto buffer_in = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kRead, &input[0]);
+    auto buffer_out = device->CreateBuffer(kBufferSize * sizeof(int), Calc::BufferType::kWrite);
+    auto buffer_size = device->CreateBuffer(sizeof(int), Calc::BufferType::kWrite);
+
+    Calc::Primitives* prims = nullptr;
+    ASSERT_NO_THROW(prims = device->CreatePrimitives());
+    ASSERT_NO_THROW(prims->CompactInt32(0, buffer_predicate, buffer_in, buffer_out, buffer_size, kBufferSize));
+
+    std::vector<int> expected;
+    std::copy_if(input.begin(), input.end(), std::back_inserter(expected), [&predicate](int i) { return predicate[i] != 0; });
+
+    int size = 0;
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_size, 0, 0, 1, &size, nullptr));
+    ASSERT_EQ(size, (int)expected.size());
+
+    std::vector<int> output(size);
+    ASSERT_NO_THROW(device->ReadTypedBuffer(buffer_out, 0, 0, size, &output[0], nullptr));
+    ASSERT_EQ(output, expected);
+
+    device->DeletePrimitives(prims);
+    device->DeleteBuffer(buffer_predicate);
+    device->DeleteBuffer(buffer_in);
+    device->DeleteBuffer(buffer_out);
+    device->DeleteBuffer(buffer_size);
+    m_calc->DeleteDevice(device);
+}
+
+#endif // USE_HOST
@@ -31,6 +31,11 @@ THE SOFTWARE.
 #include "tiny_obj_loader.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
 using namespace RadeonRays;
 
 
@@ -73,7 +78,91 @@ public:
         api_->DeleteEvent(e_);
     }
 
+    template <typename T>
+    void ReadBuffer(Buffer* buffer, T* data, int size)
+    {
+        T* tmp = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(buffer, kMapRead, 0, size * sizeof(T), (void**)&tmp, &e_));
+        Wait();
+        std::copy(tmp, tmp + size, data);
+        ASSERT_NO_THROW(api_->UnmapBuffer(buffer, tmp, &e_));
+        Wait();
+    }
+
+    // Loads Cornell box and creates meshes for it, attaching them unless asked otherwise
+    void LoadCornellBox(std::vector<tinyobj::shape_t>& shapes, std::vector<TestShape>& test_shapes, bool attach = true)
+    {
+        std::vector<tinyobj::material_t> materials;
+        std::string res = tinyobj::LoadObj(shapes, materials, "../Resources/CornellBox/orig.objm");
+        ASSERT_TRUE(res.empty());
+
+        test_shapes.clear();
+        for (auto& obj_shape : shapes)
+        {
+            Shape* shape = nullptr;
+
+            ASSERT_NO_THROW(shape = api_->CreateMesh(&obj_shape.mesh.positions[0], (int)obj_shape.mesh.positions.size() / 3, 3 * sizeof(float),
+                &obj_shape.mesh.indices[0], 0, nullptr, (int)obj_shape.mesh.indices.size() / 3));
+
+            if (attach)
+            {
+                ASSERT_NO_THROW(api_->AttachShape(shape));
+            }
+
+            test_shapes.emplace_back(&obj_shape.mesh.positions[0], (int)obj_shape.mesh.positions.size() / 3,
+                &obj_shape.mesh.indices[0], (int)obj_shape.mesh.indices.size(), nullptr, (int)obj_shape.mesh.indices.size() / 3);
+            test_shapes.back().shape = shape;
+        }
+    }
+
+    void DeleteShapes(std::vector<TestShape> const& test_shapes)
+    {
+        for (auto& test_shape : test_shapes)
+        {
+            ASSERT_NO_THROW(api_->DetachShape(test_shape.shape));
+            ASSERT_NO_THROW(api_->DeleteShape(test_shape.shape));
+        }
+    }
+
+    // Same random rays inside the Cornell box on every call
+    static void GenerateRandomRays(std::vector<ray>& rays)
+    {
+        std::srand(0xABCDEF12);
+        for (auto& r : rays)
+        {
+            r = ray(float3(rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f),
+                normalize(float3(rand_float(), rand_float(), rand_float())), 1000.f);
+        }
+    }
+
+    // Query closest hits for committed scene and compare them against brute force ones
+    void CheckClosestHits(std::vector<TestShape> const& test_shapes, std::vector<ray> const& rays, Buffer* ray_buffer, Buffer* isect_buffer)
+    {
+        int const numrays = (int)rays.size();
+        std::vector<Intersection> isect_brute(numrays);
+        std::vector<Intersection> isect(numrays);
+
+        TestIntersections(test_shapes.data(), (int)test_shapes.size(), rays.data(), numrays, isect_brute.data());
+
+        ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, numrays, isect_buffer, nullptr, &e_));
+        Wait();
+
+        ReadBuffer(isect_buffer, isect.data(), numrays);
+
+        for (auto i = 0; i < numrays; ++i)
+        {
+            ASSERT_EQ(isect_brute[i].shapeid, isect[i].shapeid);
+
+            if (isect[i].shapeid != kNullId)
+            {
+                ASSERT_EQ(isect_brute[i].primid, isect[i].primid);
+                ASSERT_NEAR(isect_brute[i].uvwt.w, isect[i].uvwt.w, 1e-3f);
+            }
+        }
+    }
+
     void Perform_1Ray_Masked_Test();
+    void Perform_2d_Queries_Test(bool instanced);
 
     IntersectionApi* api_;
     Event* e_;
@@ -326,6 +415,31 @@ TEST_F(ApiBackendOpenCL, DISABLED_Intersection_1Ray_Masked_hashbvh)
 
 }
 
+// The test runs 2D cell string and sum linear occlusion queries vs a single triangle
+TEST_F(ApiBackendOpenCL, Occluded2d_fatbvh)
+{
+    api_->SetOption("acc.type", "fatbvh");
+
+    Perform_2d_Queries_Test(false);
+}
+
+// The test runs 2D cell string and sum linear occlusion queries vs a single triangle
+TEST_F(ApiBackendOpenCL, Occluded2d_hlbvh)
+{
+    api_->SetOption("acc.type", "hlbvh");
+
+    Perform_2d_Queries_Test(false);
+}
+
+// The test runs 2D cell string and sum linear occlusion queries vs an instanced triangle
+TEST_F(ApiBackendOpenCL, Occluded2d_2level_Instanced)
+{
+    api_->SetOption("acc.type", "bvh");
+    api_->SetOption("bvh.force2level", 1.f);
+
+    Perform_2d_Queries_Test(true);
+}
+
 #ifdef RR_BACKFACE_CULL
 // The test creates a single triangle mesh and tests backface culling functionality
 TEST_F(ApiBackendOpenCL, Intersection_1Ray_Backface_Culling)
@@ -1141,6 +1255,160 @@ TEST_F(ApiBackendOpenCL, Intersection_1Ray_InstanceNoShape)
     ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
 }
 
+// The test checks that transform and instance changes in 2 level BVH are picked up
+TEST_F(ApiBackendOpenCL, Intersection_1Ray_TwoLevelRefit)
+{
+    api_->SetOption("bvh.force2level", 1.f);
+
+    Shape* mesh = nullptr;
+    Shape* instance = nullptr;
+
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+
+    matrix m = translation(float3(0, 0, 5));
+    ASSERT_NO_THROW(mesh->SetTransform(m, inverse(m)));
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    auto query = [&](Intersection& isect)
+    {
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+        Intersection* tmp = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+        Wait();
+        isect = *tmp;
+        ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+        Wait();
+    };
+
+    Intersection isect;
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 15.f), 0.01f);
+
+    // Attaching an instance keeps mesh BVH
+    m = translation(float3(0, 0, 2));
+    ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+    ASSERT_NO_THROW(api_->AttachShape(instance));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, instance->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 12.f), 0.01f);
+
+    // Transform changes rebuild top level only
+    m = translation(float3(0, 0, 8));
+    ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 15.f), 0.01f);
+
+    m = translation(float3(0, 0, 1));
+    ASSERT_NO_THROW(mesh->SetTransform(m, inverse(m)));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 11.f), 0.01f);
+
+    // Detaching the mesh leaves disabled base shape for the instance
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, instance->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 18.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+// The test attaches, detaches and changes shapes between commits so that the skip-links
+// intersector appends, patches and refits its tree on the device instead of rebuilding it
+TEST_F(ApiBackendOpenCL, CornellBox_IncrementalUpdate_ClosestHit_Bruteforce)
+{
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes, false);
+
+    ASSERT_GT(test_shapes.size(), 2u);
+
+    for (auto i = 0u; i < test_shapes.size(); ++i)
+    {
+        ASSERT_NO_THROW(test_shapes[i].shape->SetId(i));
+    }
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    // Compare against the shapes currently attached
+    auto check = [&](std::vector<TestShape> const& attached)
+    {
+        ASSERT_NO_THROW(api_->Commit());
+        CheckClosestHits(attached, rays, ray_buffer, isect_buffer);
+    };
+
+    // Full build for the first half, then attach the rest one by one
+    std::vector<TestShape> attached;
+    for (auto i = 0u; i < test_shapes.size(); ++i)
+    {
+        ASSERT_NO_THROW(api_->AttachShape(test_shapes[i].shape));
+        attached.push_back(test_shapes[i]);
+
+        if (i >= test_shapes.size() / 2)
+        {
+            check(attached);
+        }
+    }
+
+    // ID changes only patch faces
+    for (auto i = 0u; i < attached.size(); i += 2)
+    {
+        ASSERT_NO_THROW(attached[i].shape->SetId(100 + i));
+    }
+
+    check(attached);
+
+    // Detached faces are patched out of the tree
+    ASSERT_NO_THROW(api_->DetachShape(attached[1].shape));
+    attached.erase(attached.begin() + 1);
+
+    check(attached);
+
+    // Refit and append have to skip dead slots left by detached shapes
+    ASSERT_NO_THROW(attached[0].shape->SetTransform(translation(float3(0.05f, 0.f, 0.f)), inverse(translation(float3(0.05f, 0.f, 0.f)))));
+
+    check(attached);
+
+    ASSERT_NO_THROW(api_->AttachShape(test_shapes[1].shape));
+    attached.push_back(test_shapes[1]);
+
+    check(attached);
+
+    // Too many dead slots rebuild the tree
+    while (attached.size() > 1)
+    {
+        ASSERT_NO_THROW(api_->DetachShape(attached.back().shape));
+        attached.pop_back();
+
+        check(attached);
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
 void ApiBackendOpenCL::Perform_1Ray_Masked_Test()
 {
     Shape* mesh = nullptr;
@@ -1276,4 +1544,202 @@ void ApiBackendOpenCL::Perform_1Ray_Masked_Test()
     ASSERT_NO_THROW(api_->DeleteBuffer(isect_flag_buffer));
 }
 
+void ApiBackendOpenCL::Perform_2d_Queries_Test(bool instanced)
+{
+    Shape* mesh = nullptr;
+    Shape* instance = nullptr;
+
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh != nullptr);
+
+    if (instanced)
+    {
+        // Base mesh stays out of the scene, only the shifted instance is visible
+        ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+        matrix m = translation(float3(0.f, 0.f, 0.5f));
+        matrix minv = inverse(m);
+        ASSERT_NO_THROW(instance->SetTransform(m, minv));
+        ASSERT_NO_THROW(api_->AttachShape(instance));
+    }
+    else
+    {
+        ASSERT_NO_THROW(api_->AttachShape(mesh));
+    }
+
+    // First point lies right below the triangle, the rest are off to the side
+    float4 origins[] = {
+        float4(0.f, 0.f, -1.f, 1000.f),
+        float4(5.f, 5.f, -1.f, 1000.f),
+        float4(6.f, 5.f, -1.f, 1000.f)
+    };
+
+    float4 directions[] = {
+        float4(0.f, 0.f, 1.f),
+        float4(0.f, 0.f, -1.f)
+    };
+
+    // Cell string 0 covers points [0, 2), cell string 1 covers [2, 3)
+    int cell_string_inds[] = { 0, 2, 2, 3 };
+
+    // x, z are accumulated on hit, y, w on miss
+    float4 koefs[] = {
+        float4(1.f, 2.f, 3.f, 4.f),
+        float4(10.f, 20.f, 30.f, 40.f)
+    };
+
+    int offsets[] = { 0, 0 };
+    float zeros[4] = { 0.f, 0.f, 0.f, 0.f };
+
+    auto origin_buffer = api_->CreateBuffer(sizeof(origins), origins);
+    auto direction_buffer = api_->CreateBuffer(sizeof(directions), directions);
+    auto inds_buffer = api_->CreateBuffer(sizeof(cell_string_inds), cell_string_inds);
+    auto koef_buffer = api_->CreateBuffer(sizeof(koefs), koefs);
+    auto offset_buffer = api_->CreateBuffer(sizeof(offsets), offsets);
+    auto cs_hit_buffer = api_->CreateBuffer(4 * sizeof(float), nullptr);
+    auto sl_hit_buffer = api_->CreateBuffer(sizeof(zeros), zeros);
+
+    ASSERT_NO_THROW(api_->Commit());
+
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, 3, 2, inds_buffer, 2, cs_hit_buffer, nullptr, &e_));
+    Wait();
+
+    float* tmp = nullptr;
+    float hits[4];
+    ASSERT_NO_THROW(api_->MapBuffer(cs_hit_buffer, kMapRead, 0, sizeof(hits), (void**)&tmp, &e_));
+    Wait();
+    std::copy(tmp, tmp + 4, hits);
+    ASSERT_NO_THROW(api_->UnmapBuffer(cs_hit_buffer, tmp, &e_));
+    Wait();
+
+    // Results are laid out as cell_string + direction * num_cell_strings
+    ASSERT_EQ(hits[0], 1.f);
+    ASSERT_EQ(hits[1], 0.f);
+    ASSERT_EQ(hits[2], 0.f);
+    ASSERT_EQ(hits[3], 0.f);
+
+    // Stride of 1 sums all directions into a single slot per origin
+    ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, offset_buffer, offset_buffer, 2, 2, 1, sl_hit_buffer, nullptr, &e_));
+    Wait();
+
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(sl_hit_buffer, kMapRead, 0, sizeof(hits), (void**)&tmp, &e_));
+    Wait();
+    std::copy(tmp, tmp + 4, hits);
+    ASSERT_NO_THROW(api_->UnmapBuffer(sl_hit_buffer, tmp, &e_));
+    Wait();
+
+    ASSERT_EQ(hits[0], 1.f + 20.f);
+    ASSERT_EQ(hits[1], 3.f + 40.f);
+    ASSERT_EQ(hits[2], 2.f + 20.f);
+    ASSERT_EQ(hits[3], 4.f + 40.f);
+
+    // Bail out
+    if (instanced)
+    {
+        ASSERT_NO_THROW(api_->DetachShape(instance));
+        ASSERT_NO_THROW(api_->DeleteShape(instance));
+    }
+    else
+    {
+        ASSERT_NO_THROW(api_->DetachShape(mesh));
+    }
+
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(cs_hit_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(sl_hit_buffer));
+}
+
+// Kernel cache statistics collected by the test callback
+struct KernelCacheStats
+{
+    int hits = 0;
+    int misses = 0;
+    std::vector<std::string> keys;
+};
+
+static void KernelCacheTestCallback(char const* key, bool hit, void* user_data)
+{
+    auto stats = reinterpret_cast<KernelCacheStats*>(user_data);
+    hit ? ++stats->hits : ++stats->misses;
+    stats->keys.push_back(key);
+}
+
+// The test checks that kernels compiled once are loaded from the cache afterwards
+TEST_F(ApiBackendOpenCL, KernelCache)
+{
+    int nativeidx = -1;
+    for (auto idx = 0U; idx < IntersectionApi::GetDeviceCount(); ++idx)
+    {
+        DeviceInfo devinfo;
+        IntersectionApi::GetDeviceInfo(idx, devinfo);
+
+        if (devinfo.type == DeviceInfo::kGpu && nativeidx == -1)
+        {
+            nativeidx = idx;
+        }
+    }
+
+    // Populate the cache
+    KernelCacheStats first;
+    IntersectionApi::SetKernelCache(".", KernelCacheTestCallback, &first);
+    IntersectionApi* api = nullptr;
+    ASSERT_NO_THROW(api = IntersectionApi::Create(nativeidx));
+    IntersectionApi::Delete(api);
+
+    ASSERT_GT(first.misses, 0);
+    ASSERT_EQ(first.hits, 0);
+
+    // Same kernels should come from the cache now
+    KernelCacheStats second;
+    IntersectionApi::SetKernelCache(".", KernelCacheTestCallback, &second);
+    ASSERT_NO_THROW(api = IntersectionApi::Create(nativeidx));
+    IntersectionApi::SetKernelCache(nullptr);
+
+    ASSERT_EQ(second.misses, 0);
+    ASSERT_EQ(second.hits, first.misses);
+
+    // Make sure loaded binaries work
+    Shape* mesh = nullptr;
+    ASSERT_NO_THROW(mesh = api->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_NO_THROW(api->AttachShape(mesh));
+
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+    Intersection isect;
+
+    auto ray_buffer = api->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api->CreateBuffer(sizeof(Intersection), nullptr);
+
+    ASSERT_NO_THROW(api->Commit());
+    ASSERT_NO_THROW(api->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Event* e = nullptr;
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e));
+    e->Wait();
+    api->DeleteEvent(e);
+    isect = *tmp;
+    ASSERT_NO_THROW(api->UnmapBuffer(isect_buffer, tmp, &e));
+    e->Wait();
+    api->DeleteEvent(e);
+
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    // Bail out
+    ASSERT_NO_THROW(api->DetachShape(mesh));
+    ASSERT_NO_THROW(api->DeleteShape(mesh));
+    ASSERT_NO_THROW(api->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api->DeleteBuffer(isect_buffer));
+    IntersectionApi::Delete(api);
+
+    for (auto const& key : first.keys)
+    {
+        std::remove(("./" + key + ".bin").c_str());
+    }
+}
+
 #endif // USE_OPENCL
\ No newline at end of file
@@ -0,0 +1,2778 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#if USE_HOST
+/// This test suite is testing RadeonRays library functionality
+/// on native multithreaded host backend
+///
+
+#include "gtest/gtest.h"
+#include "radeon_rays.h"
+#include "math/mathutils.h"
+#include "tiny_obj_loader.h"
+#include "utils.h"
+
+using namespace RadeonRays;
+using namespace tinyobj;
+
+// Api creation fixture, prepares api_ for further tests
+class ApiBackendHost : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        api_ = nullptr;
+        int nativeidx = -1;
+
+        // Always use native host backend
+        IntersectionApi::SetPlatform(DeviceInfo::kHost);
+
+        for (auto idx = 0U; idx < IntersectionApi::GetDeviceCount(); ++idx)
+        {
+            DeviceInfo devinfo;
+            IntersectionApi::GetDeviceInfo(idx, devinfo);
+
+            if (devinfo.platform == DeviceInfo::kHost && nativeidx == -1)
+            {
+                nativeidx = idx;
+            }
+        }
+
+        ASSERT_NE(nativeidx, -1);
+
+        api_ = IntersectionApi::Create(nativeidx);
+    }
+
+    void TearDown() override
+    {
+        if (api_ != nullptr) IntersectionApi::Delete(api_);
+        IntersectionApi::SetPlatform(DeviceInfo::kAny);
+    }
+
+    void Wait()
+    {
+        e_->Wait();
+        api_->DeleteEvent(e_);
+    }
+
+    template <typename T>
+    void ReadBuffer(Buffer* buffer, T* data, int size)
+    {
+        T* tmp = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(buffer, kMapRead, 0, size * sizeof(T), (void**)&tmp, &e_));
+        Wait();
+        std::copy(tmp, tmp + size, data);
+        ASSERT_NO_THROW(api_->UnmapBuffer(buffer, tmp, &e_));
+        Wait();
+    }
+
+    // Creates a single triangle mesh in z = 0 plane
+    Shape* CreateTriangle()
+    {
+        Shape* mesh = nullptr;
+        EXPECT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+        EXPECT_NO_THROW(api_->AttachShape(mesh));
+        return mesh;
+    }
+
+    // Creates meshes for Cornell box shapes, attaching them unless asked otherwise
+    void CreateCornellBox(std::vector<shape_t>& shapes, std::vector<TestShape>& test_shapes, bool attach = true)
+    {
+        test_shapes.clear();
+        for (auto& obj_shape : shapes)
+        {
+            Shape* shape = nullptr;
+
+            ASSERT_NO_THROW(shape = api_->CreateMesh(&obj_shape.mesh.positions[0], (int)obj_shape.mesh.positions.size() / 3, 3 * sizeof(float),
+                &obj_shape.mesh.indices[0], 0, nullptr, (int)obj_shape.mesh.indices.size() / 3));
+
+            if (attach)
+            {
+                ASSERT_NO_THROW(api_->AttachShape(shape));
+            }
+
+            test_shapes.emplace_back(&obj_shape.mesh.positions[0], (int)obj_shape.mesh.positions.size() / 3,
+                &obj_shape.mesh.indices[0], (int)obj_shape.mesh.indices.size(), nullptr, (int)obj_shape.mesh.indices.size() / 3);
+            test_shapes.back().shape = shape;
+        }
+    }
+
+    // Loads Cornell box and creates meshes for it
+    void LoadCornellBox(std::vector<shape_t>& shapes, std::vector<TestShape>& test_shapes, bool attach = true)
+    {
+        std::vector<material_t> materials;
+        std::string res = LoadObj(shapes, materials, "../Resources/CornellBox/orig.objm");
+        ASSERT_TRUE(res.empty());
+
+        CreateCornellBox(shapes, test_shapes, attach);
+    }
+
+    void DeleteShapes(std::vector<TestShape> const& test_shapes)
+    {
+        for (auto& test_shape : test_shapes)
+        {
+            ASSERT_NO_THROW(api_->DetachShape(test_shape.shape));
+            ASSERT_NO_THROW(api_->DeleteShape(test_shape.shape));
+        }
+    }
+
+    // Same random rays inside the Cornell box on every call
+    static void GenerateRandomRays(std::vector<ray>& rays)
+    {
+        std::srand(0xABCDEF12);
+        for (auto& r : rays)
+        {
+            r = ray(float3(rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f),
+                normalize(float3(rand_float(), rand_float(), rand_float())), 1000.f);
+        }
+    }
+
+    // Brute force closest hits against current shape transforms
+    static void FindReferenceHits(std::vector<TestShape> const& test_shapes, std::vector<ray> const& rays, std::vector<Intersection>& isect)
+    {
+        isect.assign(rays.size(), Intersection());
+        TestIntersections(test_shapes.data(), (int)test_shapes.size(), rays.data(), (int)rays.size(), isect.data());
+    }
+
+    // Query closest hits for committed scene and compare them against reference ones
+    void CheckClosestHits(Buffer* ray_buffer, Buffer* isect_buffer, std::vector<Intersection> const& isect_brute)
+    {
+        int const numrays = (int)isect_brute.size();
+        std::vector<Intersection> isect(numrays);
+
+        ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, numrays, isect_buffer, nullptr, &e_));
+        Wait();
+
+        ReadBuffer(isect_buffer, isect.data(), numrays);
+
+        for (auto i = 0; i < numrays; ++i)
+        {
+            ASSERT_EQ(isect_brute[i].shapeid, isect[i].shapeid);
+
+            if (isect[i].shapeid != kNullId)
+            {
+                ASSERT_EQ(isect_brute[i].primid, isect[i].primid);
+                ASSERT_NEAR(isect_brute[i].uvwt.w, isect[i].uvwt.w, 1e-3f);
+                ASSERT_NEAR(isect_brute[i].uvwt.x, isect[i].uvwt.x, 1e-3f);
+                ASSERT_NEAR(isect_brute[i].uvwt.y, isect[i].uvwt.y, 1e-3f);
+            }
+        }
+    }
+
+    // Query occlusion for committed scene and compare it against reference closest hits
+    void CheckOcclusion(Buffer* ray_buffer, Buffer* occluded_buffer, std::vector<Intersection> const& isect_brute)
+    {
+        int const numrays = (int)isect_brute.size();
+        std::vector<int> occluded(numrays);
+
+        ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, numrays, occluded_buffer, nullptr, &e_));
+        Wait();
+
+        ReadBuffer(occluded_buffer, occluded.data(), numrays);
+
+        for (auto i = 0; i < numrays; ++i)
+        {
+            ASSERT_EQ(isect_brute[i].shapeid != kNullId ? 1 : -1, occluded[i]);
+        }
+    }
+
+    void Perform_1Ray_Masked_Test();
+    void Perform_2d_Queries_Test(bool instanced);
+
+    IntersectionApi* api_;
+    Event* e_;
+
+    static float const * vertices() {
+        static float const vertices[] = {
+            -1.f,-1.f,0.f,
+            0.f,1.f,0.f,
+            1.f,-1.f,0.f,
+
+        };
+        return vertices;
+    }
+    static int const * indices() {
+        static int const indices[] = { 0, 1, 2 };
+        return indices;
+    }
+
+    static int const * numfaceverts() {
+        static const int numfaceverts[] = { 3 };
+        return numfaceverts;
+    }
+};
+
+TEST_F(ApiBackendHost, DeviceEnum)
+{
+    ASSERT_GE(IntersectionApi::GetDeviceCount(), 1U);
+
+    DeviceInfo devinfo;
+    IntersectionApi::GetDeviceInfo(0, devinfo);
+
+    ASSERT_EQ(devinfo.type, DeviceInfo::kCpu);
+    ASSERT_EQ(devinfo.platform, DeviceInfo::kHost);
+}
+
+// The test creates an empty scene
+TEST_F(ApiBackendHost, EmptyScene)
+{
+    ASSERT_THROW(api_->Commit(), Exception);
+}
+
+TEST_F(ApiBackendHost, Intersection_1Ray)
+{
+    Shape* mesh = CreateTriangle();
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Prepare the ray
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection isect;
+    ReadBuffer(isect_buffer, &isect, 1);
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+    ASSERT_EQ(isect.primid, 0);
+    ASSERT_NEAR(isect.uvwt.w, 10.f, 1e-5f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+// The test checks whether the api has been successfully created
+TEST_F(ApiBackendHost, SingleDevice)
+{
+    ASSERT_TRUE(api_ != nullptr);
+}
+
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, Mesh)
+{
+    Shape* shape = nullptr;
+
+    ASSERT_NO_THROW(shape = api_->CreateMesh(vertices(), 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(shape != nullptr);
+
+    ASSERT_NO_THROW(api_->AttachShape(shape));
+    ASSERT_NO_THROW(api_->DetachShape(shape));
+    ASSERT_NO_THROW(api_->DeleteShape(shape));
+}
+
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, MeshStrided)
+{
+    struct Vertex
+    {
+        float position[3];
+        float normal[3];
+        float uv[2];
+    };
+
+    // Mesh vertices
+    Vertex vertices[] = {
+        { 0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f },
+        { 0.f, 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f },
+        { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f },
+        { 0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f },
+        { 0.f, 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f },
+        { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f }
+    };
+
+    // Indices
+    int mindices[] = { 0, 1, 2, 0, 0, 1, 2, 0};
+
+    Shape* shape = nullptr;
+
+    ASSERT_NO_THROW(shape = api_->CreateMesh((float*)vertices, 6, sizeof(Vertex), mindices, 4*sizeof(int), nullptr, 2));
+
+    ASSERT_TRUE(shape != nullptr);
+
+    ASSERT_NO_THROW(api_->AttachShape(shape));
+    ASSERT_NO_THROW(api_->DetachShape(shape));
+    ASSERT_NO_THROW(api_->DeleteShape(shape));
+}
+
+
+
+//The test creates a single triangle mesh and then tries to create an instance of the mesh
+TEST_F(ApiBackendHost, Instance)
+{    
+    Shape* shape = nullptr;
+    
+    ASSERT_NO_THROW(shape = api_->CreateMesh(vertices(), 3, 3*sizeof(float), indices(),0, numfaceverts(), 1));
+    
+    ASSERT_TRUE(shape != nullptr);
+    
+    ASSERT_NO_THROW(api_->AttachShape(shape));
+    ASSERT_NO_THROW(api_->DetachShape(shape));
+    
+    Shape* instance = nullptr;
+    
+    ASSERT_NO_THROW(instance = api_->CreateInstance(shape));
+    
+    ASSERT_TRUE(instance != nullptr);
+    
+    ASSERT_NO_THROW(api_->DeleteShape(shape));
+}
+
+#ifdef RR_RAY_MASK
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, Intersection_1Ray_Masked_2level)
+#else
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, DISABLED_Intersection_1Ray_Masked_2level)
+#endif
+{
+
+    api_->SetOption("acc.type", "bvh");
+    api_->SetOption("bvh.force2level", 1.f);
+
+    Perform_1Ray_Masked_Test();
+
+}
+
+
+#ifdef RR_RAY_MASK
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, Intersection_1Ray_Masked_bvh)
+#else
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, DISABLED_Intersection_1Ray_Masked_bvh)
+#endif
+{
+
+    api_->SetOption("acc.type", "bvh");
+
+    Perform_1Ray_Masked_Test();
+
+}
+
+
+// Host device has no fatbvh intersector, the test checks that 2D queries
+// fall back to skip-links instead of failing
+TEST_F(ApiBackendHost, Occluded2d_fatbvh_FallbackToSkipLinks)
+{
+    api_->SetOption("acc.type", "fatbvh");
+
+    Perform_2d_Queries_Test(false);
+}
+
+// Host device has no hlbvh intersector, the test checks that 2D queries
+// fall back to skip-links instead of failing
+TEST_F(ApiBackendHost, Occluded2d_hlbvh_FallbackToSkipLinks)
+{
+    api_->SetOption("acc.type", "hlbvh");
+
+    Perform_2d_Queries_Test(false);
+}
+
+// The test runs 2D cell string and sum linear occlusion queries vs an instanced triangle
+TEST_F(ApiBackendHost, Occluded2d_2level_Instanced)
+{
+    api_->SetOption("acc.type", "bvh");
+    api_->SetOption("bvh.force2level", 1.f);
+
+    Perform_2d_Queries_Test(true);
+}
+
+#ifdef RR_BACKFACE_CULL
+// The test creates a single triangle mesh and tests backface culling functionality
+TEST_F(ApiBackendHost, Intersection_1Ray_Backface_Culling)
+#else
+// The test creates a single triangle mesh and tests backface culling functionality
+TEST_F(ApiBackendHost, DISABLED_Intersection_1Ray_Backface_Culling)
+#endif
+{
+
+    Shape* mesh = nullptr;
+
+    api_->SetOption("acc.type", "bvh");
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Prepare the ray
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+    r.SetDoBackfaceCulling(true);
+
+    // Intersection and hit data
+    Intersection isect;
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+    auto isect_flag_buffer = api_->CreateBuffer(sizeof(int), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    r = ray(float3(0.f, 0.f, 10.f), float3(0.f, 0.f, -1.f), 10000.f);
+    r.SetDoBackfaceCulling(true);
+
+    // Update ray buffer
+    ray* rr = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(ray_buffer, kMapWrite, 0, sizeof(ray), (void**)&rr, &e_));
+    Wait();
+    *rr = r;
+    ASSERT_NO_THROW(api_->UnmapBuffer(ray_buffer, rr, &e_));
+    Wait();
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, kNullId);
+
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_flag_buffer));
+
+}
+
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, Intersection_1Ray_Active)
+{
+    Shape* mesh = nullptr;
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Prepare the ray
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    // Intersection and hit data
+    Intersection isect;
+    
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    isect.primid = kNullId;
+    isect.shapeid = kNullId;
+
+    r.SetActive(false);
+    
+    ray* rr = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(ray_buffer, kMapWrite, 0, sizeof(ray), (void**)&rr, &e_));
+    Wait();
+    *rr = r;
+    ASSERT_NO_THROW(api_->UnmapBuffer(ray_buffer, rr, &e_));
+    Wait();
+    
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapWrite, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    *tmp = isect;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, kNullId);
+
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+// The test creates a single triangle mesh and tests attach/detach functionality
+TEST_F(ApiBackendHost, Intersection_3Rays)
+{
+
+    Shape* mesh = nullptr;
+
+    // 
+    ASSERT_NO_THROW(api_->SetOption("acc.type", "grid"));
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Rays
+    ray rays[3];
+
+    // Prepare the ray
+    rays[0].o = float4(0.f,0.f,-10.f, 1000.f);
+    rays[0].d = float3(0.f,0.f,1.f);
+
+    rays[1].o = float4(0.f,0.5f,-10.f, 1000.f);
+    rays[1].d = float3(0.f,0.f,1.f);
+
+    rays[2].o = float4(0.5f,0.f,-10.f, 1000.f);
+    rays[2].d = float3(0.f,0.f,1.f);
+
+    // Intersection and hit data
+    Intersection isect[3];
+    
+    auto ray_buffer = api_->CreateBuffer(3*sizeof(ray), rays);
+    auto isect_buffer = api_->CreateBuffer(3*sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 3, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, 3*sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect[0] = tmp[0];
+    isect[1] = tmp[1];
+    isect[2] = tmp[2];
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    for (int i=0; i<3; ++i)
+    {
+        ASSERT_EQ(isect[i].shapeid, mesh->GetId());
+    }
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+
+// Test is checking if mesh transform is working as expected
+TEST_F(ApiBackendHost, Intersection_1Ray_Transformed)
+{
+
+    Shape* mesh = nullptr;
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Prepare the ray
+    ray r;
+    r.o = float4(0.f,0.f,-10.f, 1000.f);
+    r.d = float3(0.f,0.f,1.f);
+
+    // Intersection and hit data
+    Intersection isect;
+    
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    matrix m = translation(float3(0,2,0));
+    matrix minv = inverse(m);
+    // Move the mesh
+    ASSERT_NO_THROW(mesh->SetTransform(m, minv));
+    // Reset ray
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, -1);
+
+    // Set transform to identity
+    m = matrix();
+    ASSERT_NO_THROW(mesh->SetTransform(m, m));
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+// The test checks intersection after geometry addition
+TEST_F(ApiBackendHost, Intersection_1Ray_DynamicGeo)
+{
+    // Mesh vertices
+    float vertices[] = {
+        -1.f,-1.f,0.f,
+        0.f,1.f,0.f,
+        1.f,-1.f,0.f,
+        
+    };
+    
+    float vertices1[] = {
+        -1.f,-1.f,-1.f,
+        0.f,1.f,-1.f,
+        1.f,-1.f,-1.f,
+        
+    };
+
+    Shape* closemesh = nullptr;
+    Shape* farmesh = nullptr;
+
+    // Create two meshes
+    ASSERT_NO_THROW(farmesh = api_->CreateMesh(vertices, 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_NO_THROW(closemesh = api_->CreateMesh(vertices1, 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(farmesh != nullptr);
+    ASSERT_TRUE(closemesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(farmesh));
+
+    // Prepare the ray
+    ray r;
+    r.o = float4(0.f,0.f,-10.f, 1000.f);
+    r.d = float3(0.f,0.f,1.f);
+
+
+    // Intersection and hit data
+    Intersection isect;
+    
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, farmesh->GetId());
+
+    // Attach closer mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(closemesh));
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, closemesh->GetId());
+
+    // Attach closer mesh to the scene
+    ASSERT_NO_THROW(api_->DetachShape(closemesh));
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, farmesh->GetId());
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(farmesh));
+    ASSERT_NO_THROW(api_->DeleteShape(farmesh));
+    ASSERT_NO_THROW(api_->DeleteShape(closemesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBoxLoad)
+{
+    using namespace tinyobj;
+    std::vector<shape_t> shapes;
+    std::vector<material_t> materials;
+    std::vector<Shape*> apishapes;
+
+    // Load obj file 
+    std::string res = LoadObj(shapes, materials, "../Resources/CornellBox/orig.objm");
+
+    ASSERT_NO_THROW(api_->SetOption("acc.type", "grid"));
+
+    // Create meshes within IntersectionApi
+    for  (auto & tObjShape : shapes)
+    {
+        Shape* shape = nullptr;
+        ASSERT_NO_THROW(shape = api_->CreateMesh(&tObjShape.mesh.positions[0], (int)tObjShape.mesh.positions.size() / 3, 3*sizeof(float),
+            &tObjShape.mesh.indices[0], 0, nullptr, (int)tObjShape.mesh.indices.size() / 3));
+
+        ASSERT_NO_THROW(api_->AttachShape(shape));
+        apishapes.push_back(shape);
+    }
+
+    // Commit update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Delete meshes
+    for (auto & apishape : apishapes)
+    {
+        ASSERT_NO_THROW(api_->DeleteShape(apishape));
+    }
+}
+
+TEST_F(ApiBackendHost, CornellBox_1Ray)
+{
+    using namespace tinyobj;
+    std::vector<shape_t> shapes;
+    std::vector<material_t> materials;
+    std::vector<Shape*> apishapes;
+
+    // Load obj file 
+    std::string res = LoadObj(shapes, materials, "../Resources/CornellBox/orig.objm");
+
+    //ASSERT_NO_THROW(api_->SetOption("acc.type", "grid"));
+
+    // Create meshes within IntersectionApi
+    for (auto & tObjShape : shapes)
+    {
+        Shape* shape = nullptr;
+        ASSERT_NO_THROW(shape = api_->CreateMesh(&tObjShape.mesh.positions[0], (int)tObjShape.mesh.positions.size() / 3, 3 * sizeof(float),
+            &tObjShape.mesh.indices[0], 0, nullptr, (int)tObjShape.mesh.indices.size() / 3));
+
+        ASSERT_NO_THROW(api_->AttachShape(shape));
+        apishapes.push_back(shape);
+    }
+
+    // Prepare the ray
+    ray r;
+    r.o = float4(0.f, 0.5f, -10.f, 1000.f);
+    r.d = float3(0.f, 0.f, 1.f);
+
+
+    // Intersection and hit data
+    Intersection isect;
+    
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+
+    // Delete meshes
+    for (auto & apishape : apishapes)
+    {
+        ASSERT_NO_THROW(api_->DeleteShape(apishape));
+    }
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+
+// Test is checking if mesh transform is working as expected
+TEST_F(ApiBackendHost, Intersection_1Ray_TransformedInstance1)
+{
+    // this test uses a single mesh, it added into the world as itself
+    // at <0,-1,1000> AND as an instance at <0,0,2>
+    // ray from <0,0,-10> along the pos z should hit the uninstanced mesh
+
+    std::vector<TestShape> shapes = { TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1),
+                            TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1), 
+                            TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1)};
+    TestShape& mesh0 = shapes[0];
+    TestShape& mesh1 = shapes[1];
+    TestShape& instance = shapes[2];
+
+    // Create meshes
+    // NOTE mesh in world and as a instance upsets the simple TestIntersection API call 
+    ASSERT_NO_THROW(mesh0.shape = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh0.shape != nullptr);
+    ASSERT_NO_THROW(mesh1.shape = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh1.shape != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh0.shape));
+    // Create instance of a triangle
+    ASSERT_NO_THROW(instance.shape = api_->CreateInstance(mesh1.shape));
+
+    matrix m = translation(float3(0, 0, 2));
+    const matrix minv = inverse(m);
+    ASSERT_NO_THROW(instance.shape->SetTransform(m, minv));
+
+    ASSERT_NO_THROW(api_->AttachShape(instance.shape));
+
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    // Intersection and hit data
+    Intersection isect;
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results for 1st ray
+    Intersection isect_brute;
+    TestIntersections(shapes.data(), (int)shapes.size(), &r, 1, &isect_brute);
+    // check the test gets the mesh we expect
+    EXPECT_EQ(isect_brute.shapeid, mesh0.shape->GetId());
+    // does the accelerated radeon rays match the test
+    EXPECT_EQ(isect.shapeid, isect_brute.shapeid);
+    EXPECT_LE(std::fabs(isect.uvwt.w - 10.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance.shape));
+    ASSERT_NO_THROW(api_->DetachShape(mesh0.shape));
+    ASSERT_NO_THROW(api_->DetachShape(mesh1.shape));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+
+}
+TEST_F(ApiBackendHost, Intersection_1Ray_TransformedInstance2)
+{
+    // this test uses a single mesh, it added into the world as itself
+    // at <0,-1,1000> AND as an instance at <0,0,-2>
+    // ray from <0,0,-10> along the pos z should hit the instanced mesh
+
+    std::vector<TestShape> shapes = { TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1),
+        TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1),
+        TestShape(vertices(), 3, indices(), 3, numfaceverts(), 1) };
+    TestShape& mesh0 = shapes[0];
+    TestShape& mesh1 = shapes[1];
+    TestShape& instance = shapes[2];
+
+    // Create meshes
+    // NOTE mesh in world and as a instance upsets the simple TestIntersection API call 
+    ASSERT_NO_THROW(mesh0.shape = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh0.shape != nullptr);
+    ASSERT_NO_THROW(mesh1.shape = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh1.shape != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh0.shape));
+    // Create instance of a triangle
+    ASSERT_NO_THROW(instance.shape = api_->CreateInstance(mesh1.shape));
+
+    //
+    const matrix m = translation(float3(0, 0, -2));
+    const matrix minv = inverse(m);
+    ASSERT_NO_THROW(instance.shape->SetTransform(m, minv));
+
+    // Prepare the ray
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+
+    // Commit geometry update
+    EXPECT_NO_THROW(api_->Commit());
+
+    ASSERT_NO_THROW(api_->AttachShape(instance.shape));
+
+    // Intersection and hit data
+    Intersection isect;
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results for 1st ray
+    Intersection isect_brute;
+    TestIntersections(shapes.data(), (int)shapes.size(), &r, 1, &isect_brute);
+    // check the test gets the mesh we expect
+    EXPECT_EQ(isect_brute.shapeid, instance.shape->GetId());
+    // does the accelerated radeon rays match the test
+    EXPECT_EQ(isect.shapeid, isect_brute.shapeid);
+    EXPECT_LE(std::fabs(isect.uvwt.w - 8.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance.shape));
+    ASSERT_NO_THROW(api_->DetachShape(mesh0.shape));
+    ASSERT_NO_THROW(api_->DetachShape(mesh1.shape));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+
+TEST_F(ApiBackendHost, Intersection_1Ray_TransformedInstanceFlat)
+{
+
+    // Set flattening
+    api_->SetOption("bvh.forceflat", 1.f);
+    
+    Shape* mesh = nullptr;
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3*sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Prepare the ray
+    ray r;
+    r.o = float3(0.f,0.f,-10.f, 1000.f);
+    r.d = float3(0.f,0.f,1.f);
+
+    // Intersection and hit data
+    Intersection isect;
+    
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+    
+    // Create instance of a triangle
+    Shape* instance = nullptr;
+    ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+    
+    matrix m = translation(float3(0,0,-2));
+    matrix minv = inverse(m);
+    ASSERT_NO_THROW(instance->SetTransform(m, minv));
+    
+    ASSERT_NO_THROW(api_->AttachShape(instance));
+    
+    // Prepare the ray
+    r.o = float3(0.f,0.f,-10.f, 1000.f);
+    r.d = float3(0.f,0.f,1.f);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+    
+    // Check results
+    ASSERT_EQ(isect.shapeid, instance->GetId());
+    ASSERT_LE(std::fabs(isect.uvwt.w - 8.f), 0.01f);
+    
+    //
+    m = translation(float3(0,0,2));
+    minv = inverse(m);
+    ASSERT_NO_THROW(instance->SetTransform(m, minv));
+
+    // Prepare the ray
+    r.o = float3(0.f,0.f,-10.f, 1000.f);
+    r.d = float3(0.f,0.f,1.f);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr ));
+    
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+    ASSERT_LE(std::fabs(isect.uvwt.w - 10.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+// Test is checking if mesh transform is working as expected
+// DK: #22 repro case : Commit throws if base shape has not been attached
+TEST_F(ApiBackendHost, Intersection_1Ray_InstanceNoShape)
+{
+
+    Shape* mesh = nullptr;
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Attach the mesh to the scene
+    //ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    // Prepare the ray
+    ray r;
+    r.o = float3(0.f, 0.f, -10.f, 1000.f);
+    r.d = float3(0.f, 0.f, 1.f);
+
+    // Intersection and hit data
+    Intersection isect;
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    // Create instance of a triangle
+    Shape* instance = nullptr;
+    ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+
+    matrix m = translation(float3(0, 0, 2));
+    matrix minv = inverse(m);
+    ASSERT_NO_THROW(instance->SetTransform(m, minv));
+
+    ASSERT_NO_THROW(api_->AttachShape(instance));
+
+    // Prepare the ray
+    r.o = float3(0.f, 0.f, -10.f, 1000.f);
+    r.d = float3(0.f, 0.f, 1.f);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, instance->GetId());
+    ASSERT_LE(std::fabs(isect.uvwt.w - 12.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+// The test checks that transform and instance changes in 2 level BVH are picked up
+TEST_F(ApiBackendHost, Intersection_1Ray_TwoLevelRefit)
+{
+    api_->SetOption("bvh.force2level", 1.f);
+
+    Shape* mesh = nullptr;
+    Shape* instance = nullptr;
+
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+
+    matrix m = translation(float3(0, 0, 5));
+    ASSERT_NO_THROW(mesh->SetTransform(m, inverse(m)));
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    auto query = [&](Intersection& isect)
+    {
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+        Intersection* tmp = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+        Wait();
+        isect = *tmp;
+        ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+        Wait();
+    };
+
+    Intersection isect;
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 15.f), 0.01f);
+
+    // Attaching an instance keeps mesh BVH
+    m = translation(float3(0, 0, 2));
+    ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+    ASSERT_NO_THROW(api_->AttachShape(instance));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, instance->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 12.f), 0.01f);
+
+    // Transform changes rebuild top level only
+    m = translation(float3(0, 0, 8));
+    ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 15.f), 0.01f);
+
+    m = translation(float3(0, 0, 1));
+    ASSERT_NO_THROW(mesh->SetTransform(m, inverse(m)));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, mesh->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 11.f), 0.01f);
+
+    // Detaching the mesh leaves disabled base shape for the instance
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    query(isect);
+    EXPECT_EQ(isect.shapeid, instance->GetId());
+    EXPECT_LE(std::fabs(isect.uvwt.w - 18.f), 0.01f);
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, Occlusion_2Rays)
+{
+    Shape* mesh = CreateTriangle();
+    ASSERT_TRUE(mesh != nullptr);
+
+    // First ray hits the triangle, second one misses it
+    ray r[] = {
+        ray(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f),
+        ray(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, -1.f), 10000.f)
+    };
+
+    auto ray_buffer = api_->CreateBuffer(2 * sizeof(ray), r);
+    auto hit_buffer = api_->CreateBuffer(2 * sizeof(int), nullptr);
+
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, 2, hit_buffer, nullptr, &e_));
+    Wait();
+
+    int hits[2];
+    ReadBuffer(hit_buffer, hits, 2);
+
+    ASSERT_EQ(hits[0], 1);
+    ASSERT_EQ(hits[1], -1);
+
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+// Queries with different sizes are issued without waiting in between,
+// every query should see its own ray count
+TEST_F(ApiBackendHost, Occlusion_BackToBackQueries)
+{
+    Shape* mesh = CreateTriangle();
+    ASSERT_TRUE(mesh != nullptr);
+
+    // More queries than counter slots to exercise slot reuse
+    auto const kNumQueries = 20;
+    auto const kNumRays = kNumQueries;
+
+    std::vector<ray> rays(kNumRays, ray(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f));
+    std::vector<int> zeros(kNumRays, 0);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+
+    std::vector<Buffer*> hit_buffers(kNumQueries);
+    for (auto& buffer : hit_buffers)
+    {
+        buffer = api_->CreateBuffer(kNumRays * sizeof(int), zeros.data());
+    }
+
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Each query depends on the previous one
+    std::vector<Event*> events(kNumQueries, nullptr);
+    for (auto i = 0; i < kNumQueries; ++i)
+    {
+        auto wait_event = i > 0 ? events[i - 1] : nullptr;
+        ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, i + 1, hit_buffers[i], wait_event, &events[i]));
+    }
+
+    for (auto i = 0; i < kNumQueries; ++i)
+    {
+        e_ = events[i];
+        Wait();
+
+        std::vector<int> hits(kNumRays);
+        ReadBuffer(hit_buffers[i], hits.data(), kNumRays);
+
+        for (auto j = 0; j < kNumRays; ++j)
+        {
+            ASSERT_EQ(hits[j], j <= i ? 1 : 0);
+        }
+    }
+
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    for (auto buffer : hit_buffers)
+    {
+        ASSERT_NO_THROW(api_->DeleteBuffer(buffer));
+    }
+}
+
+TEST_F(ApiBackendHost, Intersection_1Ray_TransformedInstance)
+{
+    // Instances are traversed through the two-level BVH by the host backend
+    Shape* mesh = nullptr;
+    Shape* instance = nullptr;
+
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+
+    matrix m = translation(float3(0, 0, 2));
+    ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+    ASSERT_NO_THROW(api_->AttachShape(instance));
+
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection isect;
+    ReadBuffer(isect_buffer, &isect, 1);
+
+    ASSERT_EQ(isect.shapeid, instance->GetId());
+    ASSERT_NEAR(isect.uvwt.w, 12.f, 1e-5f);
+
+    ASSERT_NO_THROW(api_->DetachShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(instance));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, Occluded2dCellString)
+{
+    Shape* mesh = CreateTriangle();
+    ASSERT_TRUE(mesh != nullptr);
+
+    // First point lies right below the triangle, the rest are off to the side
+    float4 origins[] = {
+        float4(0.f, 0.f, -1.f, 1000.f),
+        float4(5.f, 5.f, -1.f, 1000.f),
+        float4(6.f, 5.f, -1.f, 1000.f)
+    };
+
+    float4 directions[] = {
+        float4(0.f, 0.f, 1.f),
+        float4(0.f, 0.f, -1.f)
+    };
+
+    // Cell string 0 covers points [0, 2), cell string 1 covers [2, 3)
+    int cell_string_inds[] = { 0, 2, 2, 3 };
+
+    auto origin_buffer = api_->CreateBuffer(sizeof(origins), origins);
+    auto direction_buffer = api_->CreateBuffer(sizeof(directions), directions);
+    auto inds_buffer = api_->CreateBuffer(sizeof(cell_string_inds), cell_string_inds);
+    auto hit_buffer = api_->CreateBuffer(4 * sizeof(float), nullptr);
+
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, 3, 2, inds_buffer, 2, hit_buffer, nullptr, &e_));
+    Wait();
+
+    float hits[4];
+    ReadBuffer(hit_buffer, hits, 4);
+
+    // Results are laid out as cell_string + direction * num_cell_strings
+    ASSERT_EQ(hits[0], 1.f);
+    ASSERT_EQ(hits[1], 0.f);
+    ASSERT_EQ(hits[2], 0.f);
+    ASSERT_EQ(hits[3], 0.f);
+
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+TEST_F(ApiBackendHost, Occluded2dSumLinear2)
+{
+    Shape* mesh = CreateTriangle();
+    ASSERT_TRUE(mesh != nullptr);
+
+    float4 origins[] = {
+        float4(0.f, 0.f, -1.f, 1000.f),
+        float4(5.f, 5.f, -1.f, 1000.f)
+    };
+
+    float4 directions[] = {
+        float4(0.f, 0.f, 1.f),
+        float4(0.f, 0.f, -1.f)
+    };
+
+    // x, z are accumulated on hit, y, w on miss
+    float4 koefs[] = {
+        float4(1.f, 2.f, 3.f, 4.f),
+        float4(10.f, 20.f, 30.f, 40.f)
+    };
+
+    int offsets[] = { 0, 0 };
+    float zeros[4] = { 0.f, 0.f, 0.f, 0.f };
+
+    auto origin_buffer = api_->CreateBuffer(sizeof(origins), origins);
+    auto direction_buffer = api_->CreateBuffer(sizeof(directions), directions);
+    auto koef_buffer = api_->CreateBuffer(sizeof(koefs), koefs);
+    auto offset_buffer = api_->CreateBuffer(sizeof(offsets), offsets);
+    auto hit_buffer = api_->CreateBuffer(sizeof(zeros), zeros);
+
+    ASSERT_NO_THROW(api_->Commit());
+    // Stride of 1 sums all directions into a single slot per origin
+    ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, offset_buffer, offset_buffer, 2, 2, 1, hit_buffer, nullptr, &e_));
+    Wait();
+
+    float hits[4];
+    ReadBuffer(hit_buffer, hits, 4);
+
+    ASSERT_EQ(hits[0], 1.f + 20.f);
+    ASSERT_EQ(hits[1], 3.f + 40.f);
+    ASSERT_EQ(hits[2], 2.f + 20.f);
+    ASSERT_EQ(hits[3], 4.f + 40.f);
+
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+TEST_F(ApiBackendHost, Occluded2d_Instanced_MatchesFlattened)
+{
+    Shape* mesh = nullptr;
+    std::vector<Shape*> instances;
+
+    // Base mesh is not attached, only a row of its instances is
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        Shape* instance = nullptr;
+        ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+
+        matrix m = translation(float3(3.f * i, 0.f, 1.f));
+        ASSERT_NO_THROW(instance->SetTransform(m, inverse(m)));
+        ASSERT_NO_THROW(api_->AttachShape(instance));
+        instances.push_back(instance);
+    }
+
+    // Points along the row, three per cell string
+    int const kNumCellStrings = 8;
+    std::vector<float4> origins;
+    std::vector<int> cell_string_inds;
+    for (int i = 0; i < kNumCellStrings; ++i)
+    {
+        cell_string_inds.push_back((int)origins.size());
+        for (int j = 0; j < 3; ++j)
+        {
+            origins.push_back(float4(-1.f + 1.5f * i + 0.5f * j, 0.f, 0.f, 1000.f));
+        }
+        cell_string_inds.push_back((int)origins.size());
+    }
+
+    float4 directions[] = {
+        float4(0.f, 0.f, 1.f),
+        float4(0.3f, 0.f, 1.f),
+        float4(-0.3f, 0.2f, 1.f),
+        float4(0.f, 0.f, -1.f)
+    };
+    int const kNumDirections = sizeof(directions) / sizeof(float4);
+
+    std::vector<float4> koefs(kNumDirections, float4(1.f, 2.f, 4.f, 8.f));
+    std::vector<int> offsets(origins.size(), 0);
+    int const kNumOutputs = kNumCellStrings * kNumDirections;
+
+    auto origin_buffer = api_->CreateBuffer(origins.size() * sizeof(float4), origins.data());
+    auto direction_buffer = api_->CreateBuffer(sizeof(directions), directions);
+    auto inds_buffer = api_->CreateBuffer(cell_string_inds.size() * sizeof(int), cell_string_inds.data());
+    auto koef_buffer = api_->CreateBuffer(koefs.size() * sizeof(float4), koefs.data());
+    auto offset_buffer = api_->CreateBuffer(offsets.size() * sizeof(int), offsets.data());
+    auto cs_hit_buffer = api_->CreateBuffer(kNumOutputs * sizeof(float), nullptr);
+    auto sl_hit_buffer = api_->CreateBuffer(origins.size() * 2 * sizeof(float), nullptr);
+
+    // Runs both queries and reads back the results
+    auto run_queries = [&](std::vector<float>& cs_hits, std::vector<float>& sl_hits)
+    {
+        std::vector<float> zeros(origins.size() * 2, 0.f);
+        float* tmp = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(sl_hit_buffer, kMapWrite, 0, zeros.size() * sizeof(float), (void**)&tmp, &e_));
+        Wait();
+        std::copy(zeros.begin(), zeros.end(), tmp);
+        ASSERT_NO_THROW(api_->UnmapBuffer(sl_hit_buffer, tmp, &e_));
+        Wait();
+
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+            inds_buffer, kNumCellStrings, cs_hit_buffer, nullptr, &e_));
+        Wait();
+        ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, offset_buffer, offset_buffer,
+            (int)origins.size(), kNumDirections, 1, sl_hit_buffer, nullptr, &e_));
+        Wait();
+
+        cs_hits.resize(kNumOutputs);
+        sl_hits.resize(origins.size() * 2);
+        ReadBuffer(cs_hit_buffer, cs_hits.data(), (int)cs_hits.size());
+        ReadBuffer(sl_hit_buffer, sl_hits.data(), (int)sl_hits.size());
+    };
+
+    std::vector<float> cs_instanced, sl_instanced;
+    run_queries(cs_instanced, sl_instanced);
+
+    // Instances are flattened into a single mesh with this option
+    api_->SetOption("bvh.forceflat", 1.f);
+
+    std::vector<float> cs_flat, sl_flat;
+    run_queries(cs_flat, sl_flat);
+
+    // Both occluded and visible strings are present
+    ASSERT_NE(std::count(cs_instanced.begin(), cs_instanced.end(), 1.f), 0);
+    ASSERT_NE(std::count(cs_instanced.begin(), cs_instanced.end(), 0.f), 0);
+
+    for (int i = 0; i < kNumOutputs; ++i)
+    {
+        ASSERT_EQ(cs_instanced[i], cs_flat[i]);
+    }
+
+    // Koefs are small integers, so the sums are exact in any order
+    for (auto i = 0U; i < sl_flat.size(); ++i)
+    {
+        ASSERT_EQ(sl_instanced[i], sl_flat[i]);
+    }
+
+    for (auto instance : instances)
+    {
+        ASSERT_NO_THROW(api_->DetachShape(instance));
+        ASSERT_NO_THROW(api_->DeleteShape(instance));
+    }
+
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(cs_hit_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(sl_hit_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_10000RaysRandom_ClosestHit_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    api_->SetOption("bvh.builder", "sah");
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+    FindReferenceHits(test_shapes, rays, isect_brute);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    ASSERT_NO_THROW(api_->Commit());
+    CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, Heightfield_ParallelBuild_ClosestHit_Bruteforce)
+{
+    // Big enough to fork subtrees and bin top level nodes in parallel
+    auto const kGridSize = 200;
+    auto const kNumRays = 32;
+
+    std::vector<float> positions;
+    std::vector<int> indices;
+
+    for (auto z = 0; z < kGridSize; ++z)
+    {
+        for (auto x = 0; x < kGridSize; ++x)
+        {
+            positions.push_back((float)x / kGridSize * 10.f - 5.f);
+            positions.push_back(0.5f * std::sin(0.3f * x) * std::cos(0.2f * z));
+            positions.push_back((float)z / kGridSize * 10.f - 5.f);
+        }
+    }
+
+    for (auto z = 0; z < kGridSize - 1; ++z)
+    {
+        for (auto x = 0; x < kGridSize - 1; ++x)
+        {
+            auto idx = z * kGridSize + x;
+            int const quad[] = { idx, idx + 1, idx + kGridSize, idx + 1, idx + kGridSize + 1, idx + kGridSize };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    Shape* shape = nullptr;
+    ASSERT_NO_THROW(shape = api_->CreateMesh(positions.data(), (int)positions.size() / 3, 3 * sizeof(float),
+        indices.data(), 0, nullptr, (int)indices.size() / 3));
+
+    TestShape test_shape(positions.data(), (int)positions.size() / 3, indices.data(), (int)indices.size(), nullptr, (int)indices.size() / 3);
+    test_shape.shape = shape;
+
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute(kNumRays);
+    std::vector<Intersection> isect(kNumRays);
+
+    std::srand(0xABCDEF12);
+    for (auto& r : rays)
+    {
+        r = ray(float3(rand_float() * 8.f - 4.f, 2.f, rand_float() * 8.f - 4.f),
+            normalize(float3(rand_float() - 0.5f, -1.f, rand_float() - 0.5f)), 1000.f);
+    }
+
+    TestIntersections(&test_shape, 1, rays.data(), kNumRays, isect_brute.data());
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    struct BuildConfig
+    {
+        char const* builder;
+        float use_splits;
+        float restructure_iterations;
+    };
+
+    // Device builder runs bottom-up passes over many leaves in parallel
+    BuildConfig const configs[] = { { "sah", 0.f, 0.f }, { "sah", 1.f, 0.f }, { "hlbvh", 0.f, 0.f }, { "hlbvh", 0.f, 2.f } };
+
+    for (auto const& config : configs)
+    {
+        api_->SetOption("bvh.builder", config.builder);
+        api_->SetOption("bvh.sah.use_splits", config.use_splits);
+        api_->SetOption("bvh.hlbvh.restructure_iterations", config.restructure_iterations);
+
+        // Reattach to force the rebuild with new options
+        ASSERT_NO_THROW(api_->DetachShape(shape));
+        ASSERT_NO_THROW(api_->AttachShape(shape));
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, kNumRays, isect_buffer, nullptr, &e_));
+        Wait();
+
+        ReadBuffer(isect_buffer, isect.data(), kNumRays);
+
+        for (auto i = 0; i < kNumRays; ++i)
+        {
+            ASSERT_EQ(isect_brute[i].shapeid, isect[i].shapeid);
+
+            if (isect[i].shapeid != kNullId)
+            {
+                ASSERT_EQ(isect_brute[i].primid, isect[i].primid);
+                ASSERT_NEAR(isect_brute[i].uvwt.w, isect[i].uvwt.w, 1e-3f);
+            }
+        }
+    }
+
+    ASSERT_NO_THROW(api_->DetachShape(shape));
+    ASSERT_NO_THROW(api_->DeleteShape(shape));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_Occluded2dCellString_TraversalModes)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    auto const kNumCellStrings = 256;
+    auto const kMaxPointsPerString = 40;
+    auto const kNumDirections = 16;
+    auto const kNumResults = kNumCellStrings * kNumDirections;
+
+    // Strings of nearby points with uneven lengths scattered over the box
+    std::vector<float4> origins;
+    std::vector<int> cell_string_inds;
+    std::srand(0xABCDEF12);
+    for (auto i = 0; i < kNumCellStrings; ++i)
+    {
+        float3 c(rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f);
+        cell_string_inds.push_back((int)origins.size());
+        auto num_points = std::rand() % kMaxPointsPerString;
+        for (auto j = 0; j < num_points; ++j)
+        {
+            origins.push_back(float4(c.x + 0.02f * j, c.y, c.z + rand_float() * 0.05f, 1000.f));
+        }
+        cell_string_inds.push_back((int)origins.size());
+    }
+
+    std::vector<float4> directions(kNumDirections);
+    for (auto& d : directions)
+    {
+        d = normalize(float3(rand_float() * 2.f - 1.f, rand_float() * 2.f - 1.f, rand_float() * 2.f - 1.f));
+    }
+
+    auto origin_buffer = api_->CreateBuffer(origins.size() * sizeof(float4), origins.data());
+    auto direction_buffer = api_->CreateBuffer(directions.size() * sizeof(float4), directions.data());
+    auto inds_buffer = api_->CreateBuffer(cell_string_inds.size() * sizeof(int), cell_string_inds.data());
+    auto hit_buffer = api_->CreateBuffer(kNumResults * sizeof(float), nullptr);
+
+    // Strings overlapping the next one, so the total number of points exceeds the origins
+    std::vector<int> overlapping_inds(cell_string_inds);
+    for (auto i = 0; i < kNumCellStrings - 1; ++i)
+    {
+        overlapping_inds[i * 2 + 1] = cell_string_inds[i * 2 + 3];
+    }
+
+    auto overlapping_inds_buffer = api_->CreateBuffer(overlapping_inds.size() * sizeof(int), overlapping_inds.data());
+
+    std::vector<float> hits_serial(kNumResults);
+    std::vector<float> hits_overlapping(kNumResults);
+    std::vector<float> hits(kNumResults);
+
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+        inds_buffer, kNumCellStrings, hit_buffer, nullptr, &e_));
+    Wait();
+    ReadBuffer(hit_buffer, hits_serial.data(), kNumResults);
+
+    // Reference from plain occlusion rays, serial traversal reuses occluders
+    // of neighbouring strings and must not change the result, counting
+    // traversal should agree with it point by point
+    {
+        std::vector<ray> rays;
+        for (auto d = 0; d < kNumDirections; ++d)
+        {
+            for (auto& o : origins)
+            {
+                rays.push_back(ray(float3(o.x, o.y, o.z), directions[d], o.w));
+            }
+        }
+
+        auto ray_buffer = api_->CreateBuffer(rays.size() * sizeof(ray), rays.data());
+        auto occlusion_buffer = api_->CreateBuffer(rays.size() * sizeof(int), nullptr);
+        ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, (int)rays.size(), occlusion_buffer, nullptr, &e_));
+        Wait();
+
+        std::vector<int> occluded(rays.size());
+        ReadBuffer(occlusion_buffer, occluded.data(), rays.size());
+
+        for (auto d = 0; d < kNumDirections; ++d)
+        {
+            for (auto i = 0; i < kNumCellStrings; ++i)
+            {
+                float expected = 0.f;
+                for (auto j = cell_string_inds[i * 2]; j < cell_string_inds[i * 2 + 1]; ++j)
+                {
+                    expected = occluded[d * origins.size() + j] == 1 ? 1.f : expected;
+                }
+
+                ASSERT_EQ(expected, hits_serial[i + d * kNumCellStrings]);
+
+                expected = 0.f;
+                for (auto j = overlapping_inds[i * 2]; j < overlapping_inds[i * 2 + 1]; ++j)
+                {
+                    expected = occluded[d * origins.size() + j] == 1 ? 1.f : expected;
+                }
+
+                hits_overlapping[i + d * kNumCellStrings] = expected;
+            }
+        }
+
+        // Counts and point bits in the same pass, bits are both set and cleared
+        auto const num_words = (rays.size() + 31) / 32;
+        std::vector<std::uint32_t> masks(num_words, 0xAAAAAAAAu);
+        auto mask_buffer = api_->CreateBuffer(num_words * sizeof(std::uint32_t), masks.data());
+        std::vector<float> counts(kNumResults);
+
+        ASSERT_NO_THROW(api_->QueryOccluded2dCellStringCount(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+            inds_buffer, kNumCellStrings, hit_buffer, mask_buffer, nullptr, &e_));
+        Wait();
+        ReadBuffer(hit_buffer, counts.data(), kNumResults);
+        ReadBuffer(mask_buffer, masks.data(), num_words);
+
+        for (auto d = 0; d < kNumDirections; ++d)
+        {
+            for (auto i = 0; i < kNumCellStrings; ++i)
+            {
+                int expected = 0;
+                for (auto j = cell_string_inds[i * 2]; j < cell_string_inds[i * 2 + 1]; ++j)
+                {
+                    auto const bit = d * origins.size() + j;
+                    bool const point_occluded = occluded[bit] == 1;
+                    expected += point_occluded ? 1 : 0;
+                    ASSERT_EQ(point_occluded, ((masks[bit / 32] >> (bit % 32)) & 1u) != 0);
+                }
+
+                ASSERT_EQ((float)expected, counts[i + d * kNumCellStrings]);
+            }
+        }
+
+        // Mask buffer has to cover every (point, direction) pair
+        auto short_mask_buffer = api_->CreateBuffer((num_words - 1) * sizeof(std::uint32_t), nullptr);
+        ASSERT_THROW(api_->QueryOccluded2dCellStringCount(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+            inds_buffer, kNumCellStrings, hit_buffer, short_mask_buffer, nullptr, nullptr), Exception);
+
+        ASSERT_NO_THROW(api_->DeleteBuffer(short_mask_buffer));
+        ASSERT_NO_THROW(api_->DeleteBuffer(mask_buffer));
+        ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+        ASSERT_NO_THROW(api_->DeleteBuffer(occlusion_buffer));
+    }
+
+    for (auto mode : { "frustum", "flat" })
+    {
+        api_->SetOption("bvh.cellstring.traversal", mode);
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+            inds_buffer, kNumCellStrings, hit_buffer, nullptr, &e_));
+        Wait();
+        ReadBuffer(hit_buffer, hits.data(), kNumResults);
+
+        for (auto i = 0; i < kNumResults; ++i)
+        {
+            ASSERT_EQ(hits_serial[i], hits[i]);
+        }
+    }
+
+    // Flat traversal in small tiles, the last one strides over the points
+    // the tiles sized from the number of origins can't cover
+    api_->SetOption("bvh.2d.rays_per_dispatch", 777.f);
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+        inds_buffer, kNumCellStrings, hit_buffer, nullptr, &e_));
+    Wait();
+    ReadBuffer(hit_buffer, hits.data(), kNumResults);
+
+    for (auto i = 0; i < kNumResults; ++i)
+    {
+        ASSERT_EQ(hits_serial[i], hits[i]);
+    }
+
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, (int)origins.size(), kNumDirections,
+        overlapping_inds_buffer, kNumCellStrings, hit_buffer, nullptr, &e_));
+    Wait();
+    ReadBuffer(hit_buffer, hits.data(), kNumResults);
+
+    for (auto i = 0; i < kNumResults; ++i)
+    {
+        ASSERT_EQ(hits_overlapping[i], hits[i]);
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(overlapping_inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_Occluded2dSumLinear2_Deterministic)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    auto const kNumOrigins = 500;
+    auto const kNumDirections = 64;
+    // Several directions share each output slot
+    auto const kStride = 8;
+    auto const kNumResults = kNumOrigins * kStride * 2;
+
+    std::srand(0xABCDEF12);
+    std::vector<float4> origins(kNumOrigins);
+    for (auto& o : origins)
+    {
+        o = float4(rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, 1000.f);
+    }
+
+    std::vector<float4> directions(kNumDirections);
+    std::vector<float4> koefs(kNumDirections);
+    for (auto i = 0; i < kNumDirections; ++i)
+    {
+        directions[i] = normalize(float3(rand_float() * 2.f - 1.f, rand_float() * 2.f - 1.f, rand_float() * 2.f - 1.f));
+        koefs[i] = float4(rand_float(), rand_float(), rand_float(), rand_float());
+    }
+
+    std::vector<int> offsets(kNumOrigins, 0);
+    std::vector<float> zeros(kNumResults, 0.f);
+
+    auto origin_buffer = api_->CreateBuffer(origins.size() * sizeof(float4), origins.data());
+    auto direction_buffer = api_->CreateBuffer(directions.size() * sizeof(float4), directions.data());
+    auto koef_buffer = api_->CreateBuffer(koefs.size() * sizeof(float4), koefs.data());
+    auto offset_buffer = api_->CreateBuffer(offsets.size() * sizeof(int), offsets.data());
+    auto hit_buffer = api_->CreateBuffer(kNumResults * sizeof(float), nullptr);
+
+    auto query = [&](std::vector<float>& hits)
+    {
+        float* data = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(hit_buffer, kMapWrite, 0, kNumResults * sizeof(float), (void**)&data, &e_));
+        Wait();
+        std::copy(zeros.begin(), zeros.end(), data);
+        ASSERT_NO_THROW(api_->UnmapBuffer(hit_buffer, data, &e_));
+        Wait();
+
+        ASSERT_NO_THROW(api_->Commit());
+        ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, offset_buffer, offset_buffer,
+            kNumOrigins, kNumDirections, kStride, hit_buffer, nullptr, &e_));
+        Wait();
+
+        hits.resize(kNumResults);
+        ReadBuffer(hit_buffer, hits.data(), kNumResults);
+    };
+
+    std::vector<float> hits_atomic;
+    std::vector<float> hits_deterministic;
+    std::vector<float> hits_deterministic2;
+
+    query(hits_atomic);
+
+    api_->SetOption("bvh.sumlinear.accumulation", "deterministic");
+    query(hits_deterministic);
+    query(hits_deterministic2);
+
+    for (auto i = 0; i < kNumResults; ++i)
+    {
+        ASSERT_NEAR(hits_atomic[i], hits_deterministic[i], 1e-4f);
+        // Reproducible bit for bit
+        ASSERT_EQ(hits_deterministic[i], hits_deterministic2[i]);
+    }
+
+    // Split ray space into tiles which cut through directions
+    std::vector<float> hits_tiled_atomic;
+    std::vector<float> hits_tiled_deterministic;
+    std::vector<float> hits_tiled_deterministic2;
+
+    api_->SetOption("bvh.2d.rays_per_dispatch", 777.f);
+    query(hits_tiled_deterministic);
+    query(hits_tiled_deterministic2);
+
+    api_->SetOption("bvh.sumlinear.accumulation", "atomic");
+    query(hits_tiled_atomic);
+
+    for (auto i = 0; i < kNumResults; ++i)
+    {
+        ASSERT_NEAR(hits_atomic[i], hits_tiled_atomic[i], 1e-4f);
+        ASSERT_NEAR(hits_deterministic[i], hits_tiled_deterministic[i], 1e-4f);
+        ASSERT_EQ(hits_tiled_deterministic[i], hits_tiled_deterministic2[i]);
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+// Reference sky patch directions, see SkyPatches for the enumeration
+static std::vector<float4> GenerateSkyDirections(SkyPatches const& sky, float3 const& zenith, float3 const& azimuth)
+{
+    int const tregenza_ring_patches[] = { 30, 30, 24, 24, 18, 12, 6 };
+    float const pi = 3.14159265358979323846f;
+    float3 const bitangent = cross(zenith, azimuth);
+
+    std::vector<float> heights;
+    std::vector<int> ring_patches;
+    if (sky.type == SkyPatches::kReinhart)
+    {
+        int const num_rings = 7 * sky.subdivision;
+        for (auto ring = 0; ring < num_rings; ++ring)
+        {
+            heights.push_back(std::sin((ring + 0.5f) * 0.5f * pi / (num_rings + 0.5f)));
+            ring_patches.push_back(tregenza_ring_patches[ring / sky.subdivision] * sky.subdivision);
+        }
+    }
+    else
+    {
+        for (auto ring = 0; ring < sky.subdivision; ++ring)
+        {
+            heights.push_back((ring + 0.5f) / sky.subdivision);
+            ring_patches.push_back(sky.num_azimuths);
+        }
+    }
+
+    std::vector<float4> directions;
+    for (auto ring = 0U; ring < heights.size(); ++ring)
+    {
+        float const z = heights[ring];
+        float const r = std::sqrt(std::max(1.f - z * z, 0.f));
+        for (auto i = 0; i < ring_patches[ring]; ++i)
+        {
+            float const phi = 2.f * pi * (i + 0.5f) / ring_patches[ring];
+            float3 const d = azimuth * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + zenith * z;
+            directions.push_back(float4(d.x, d.y, d.z, 0.f));
+        }
+    }
+
+    if (sky.type == SkyPatches::kReinhart)
+    {
+        directions.push_back(float4(zenith.x, zenith.y, zenith.z, 0.f));
+    }
+
+    return directions;
+}
+
+// Generated sky directions should give the same sums as explicitly passed ones
+TEST_F(ApiBackendHost, CornellBox_Occluded2dSumLinearSky_MatchesExplicitDirections)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    SkyPatches tregenza;
+    ASSERT_EQ(tregenza.GetNumPatches(), 145);
+
+    SkyPatches reinhart;
+    reinhart.subdivision = 2;
+    ASSERT_EQ(reinhart.GetNumPatches(), 577);
+
+    SkyPatches equal_area;
+    equal_area.type = SkyPatches::kEqualArea;
+    equal_area.subdivision = 4;
+    equal_area.num_azimuths = 16;
+    ASSERT_EQ(equal_area.GetNumPatches(), 64);
+
+    auto const kNumOrigins = 200;
+    auto const kStride = 8;
+    auto const kNumResults = kNumOrigins * kStride * 2;
+    auto const kMaxDirections = reinhart.GetNumPatches();
+
+    std::srand(0x5EED5EED);
+    std::vector<float4> origins(kNumOrigins);
+    for (auto& o : origins)
+    {
+        o = float4(rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, rand_float() * 3.f - 1.5f, 1000.f);
+    }
+
+    // Odd origins use the frame with Y zenith and Z zero azimuth
+    float3 const frame_zenith(0.f, 1.f, 0.f);
+    float3 const frame_azimuth(0.f, 0.f, 1.f);
+    std::vector<float4> frames(kNumOrigins * 2);
+    for (auto i = 0; i < kNumOrigins; ++i)
+    {
+        frames[i * 2] = (i & 1) ? frame_zenith : float3(0.f, 0.f, 1.f);
+        frames[i * 2 + 1] = (i & 1) ? frame_azimuth : float3(1.f, 0.f, 0.f);
+    }
+
+    std::vector<float4> koefs(kMaxDirections);
+    for (auto& k : koefs)
+    {
+        k = float4(rand_float(), rand_float(), rand_float(), rand_float());
+    }
+
+    std::vector<int> koef_offsets(kNumOrigins, 0);
+    std::vector<float> zeros(kNumResults, 0.f);
+
+    auto origin_buffer = api_->CreateBuffer(origins.size() * sizeof(float4), origins.data());
+    auto frame_buffer = api_->CreateBuffer(frames.size() * sizeof(float4), frames.data());
+    auto koef_buffer = api_->CreateBuffer(koefs.size() * sizeof(float4), koefs.data());
+    auto koef_offset_buffer = api_->CreateBuffer(koef_offsets.size() * sizeof(int), koef_offsets.data());
+    auto hit_buffer = api_->CreateBuffer(kNumResults * sizeof(float), nullptr);
+
+    auto clear = [&]()
+    {
+        float* data = nullptr;
+        ASSERT_NO_THROW(api_->MapBuffer(hit_buffer, kMapWrite, 0, kNumResults * sizeof(float), (void**)&data, &e_));
+        Wait();
+        std::copy(zeros.begin(), zeros.end(), data);
+        ASSERT_NO_THROW(api_->UnmapBuffer(hit_buffer, data, &e_));
+        Wait();
+    };
+
+    auto check = [&](SkyPatches const& sky, bool use_frames)
+    {
+        auto const num_directions = sky.GetNumPatches();
+
+        // Explicit directions for both frames, origins pick theirs by offset
+        std::vector<float4> directions = GenerateSkyDirections(sky, float3(0.f, 0.f, 1.f), float3(1.f, 0.f, 0.f));
+        std::vector<float4> frame_directions = GenerateSkyDirections(sky, frame_zenith, frame_azimuth);
+        ASSERT_EQ((int)directions.size(), num_directions);
+        directions.insert(directions.end(), frame_directions.begin(), frame_directions.end());
+
+        std::vector<int> direction_offsets(kNumOrigins);
+        for (auto i = 0; i < kNumOrigins; ++i)
+        {
+            direction_offsets[i] = use_frames && (i & 1) ? num_directions : 0;
+        }
+
+        auto direction_buffer = api_->CreateBuffer(directions.size() * sizeof(float4), directions.data());
+        auto direction_offset_buffer = api_->CreateBuffer(direction_offsets.size() * sizeof(int), direction_offsets.data());
+
+        std::vector<float> hits_explicit(kNumResults);
+        std::vector<float> hits_sky(kNumResults);
+
+        clear();
+        ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, direction_offset_buffer, koef_offset_buffer,
+            kNumOrigins, num_directions, kStride, hit_buffer, nullptr, &e_));
+        Wait();
+        ReadBuffer(hit_buffer, hits_explicit.data(), kNumResults);
+
+        clear();
+        ASSERT_NO_THROW(api_->QueryOccluded2dSumLinearSky(origin_buffer, sky, use_frames ? frame_buffer : nullptr, koef_buffer, koef_offset_buffer,
+            kNumOrigins, kStride, hit_buffer, nullptr, &e_));
+        Wait();
+        ReadBuffer(hit_buffer, hits_sky.data(), kNumResults);
+
+        for (auto i = 0; i < kNumResults; ++i)
+        {
+            ASSERT_NEAR(hits_explicit[i], hits_sky[i], 1e-3f);
+        }
+
+        ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+        ASSERT_NO_THROW(api_->DeleteBuffer(direction_offset_buffer));
+    };
+
+    ASSERT_NO_THROW(api_->Commit());
+
+    check(tregenza, false);
+    check(reinhart, true);
+    check(equal_area, false);
+    check(equal_area, true);
+
+    api_->SetOption("bvh.sumlinear.accumulation", "deterministic");
+    ASSERT_NO_THROW(api_->Commit());
+
+    check(reinhart, false);
+    check(equal_area, true);
+
+    // Tiles split directions of an origin
+    api_->SetOption("bvh.2d.rays_per_dispatch", 1001.f);
+    ASSERT_NO_THROW(api_->Commit());
+
+    check(reinhart, true);
+
+    // Two-level BVH generates the same directions
+    api_->SetOption("bvh.force2level", 1.f);
+    ASSERT_NO_THROW(api_->Commit());
+
+    check(tregenza, true);
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(frame_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(hit_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_TransformUpdate_ClosestHit_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Small moves keep the tree and refit it, large ones force the rebuild
+    for (auto offset : { float3(0.05f, 0.1f, -0.05f), float3(0.f, 1.f, 0.f), float3(0.f, 5.f, 0.f) })
+    {
+        for (auto i = 0u; i < test_shapes.size(); i += 2)
+        {
+            // Reference intersections use shape transforms as well
+            ASSERT_NO_THROW(test_shapes[i].shape->SetTransform(translation(offset), inverse(translation(offset))));
+        }
+
+        FindReferenceHits(test_shapes, rays, isect_brute);
+
+        ASSERT_NO_THROW(api_->Commit());
+        CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_IncrementalUpdate_ClosestHit_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes, false);
+
+    ASSERT_GT(test_shapes.size(), 2u);
+
+    for (auto i = 0u; i < test_shapes.size(); ++i)
+    {
+        ASSERT_NO_THROW(test_shapes[i].shape->SetId(i));
+    }
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    // Compare against the shapes currently attached
+    auto check = [&](std::vector<TestShape> const& attached)
+    {
+        FindReferenceHits(attached, rays, isect_brute);
+
+        ASSERT_NO_THROW(api_->Commit());
+        CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+    };
+
+    // Full build for the first half, then attach the rest one by one
+    std::vector<TestShape> attached;
+    for (auto i = 0u; i < test_shapes.size(); ++i)
+    {
+        ASSERT_NO_THROW(api_->AttachShape(test_shapes[i].shape));
+        attached.push_back(test_shapes[i]);
+
+        if (i >= test_shapes.size() / 2)
+        {
+            check(attached);
+        }
+    }
+
+    // ID changes only patch faces
+    for (auto i = 0u; i < attached.size(); i += 2)
+    {
+        ASSERT_NO_THROW(attached[i].shape->SetId(100 + i));
+    }
+
+    check(attached);
+
+    // Detached faces are patched out of the tree
+    ASSERT_NO_THROW(api_->DetachShape(attached[1].shape));
+    attached.erase(attached.begin() + 1);
+
+    check(attached);
+
+    // Refit and append have to skip dead slots left by detached shapes
+    ASSERT_NO_THROW(attached[0].shape->SetTransform(translation(float3(0.05f, 0.f, 0.f)), inverse(translation(float3(0.05f, 0.f, 0.f)))));
+
+    check(attached);
+
+    ASSERT_NO_THROW(api_->AttachShape(test_shapes[1].shape));
+    attached.push_back(test_shapes[1]);
+
+    check(attached);
+
+    // Too many dead slots rebuild the tree
+    while (attached.size() > 1)
+    {
+        ASSERT_NO_THROW(api_->DetachShape(attached.back().shape));
+        attached.pop_back();
+
+        check(attached);
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_MaxLeafPrims_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes, false);
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+    FindReferenceHits(test_shapes, rays, isect_brute);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+    auto occluded_buffer = api_->CreateBuffer(kNumRays * sizeof(int), nullptr);
+
+    for (auto builder : { "median", "sah" })
+    {
+        for (auto max_leaf_prims : { 1.f, 4.f, 8.f, 15.f })
+        {
+            api_->SetOption("bvh.builder", builder);
+            api_->SetOption("bvh.max_leaf_prims", max_leaf_prims);
+
+            // Reattach to force the rebuild with new options
+            for (auto& test_shape : test_shapes)
+            {
+                ASSERT_NO_THROW(api_->DetachShape(test_shape.shape));
+                ASSERT_NO_THROW(api_->AttachShape(test_shape.shape));
+            }
+
+            ASSERT_NO_THROW(api_->Commit());
+            CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+            CheckOcclusion(ray_buffer, occluded_buffer, isect_brute);
+        }
+    }
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(occluded_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_QuantizedNodes_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+    auto occluded_buffer = api_->CreateBuffer(kNumRays * sizeof(int), nullptr);
+
+    api_->SetOption("bvh.node_format", "quantized");
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Build, refit and rebuild should all keep bounds conservative
+    for (auto offset : { float3(0.f, 0.f, 0.f), float3(0.05f, 0.1f, -0.05f), float3(0.f, 5.f, 0.f) })
+    {
+        for (auto i = 0u; i < test_shapes.size(); i += 2)
+        {
+            ASSERT_NO_THROW(test_shapes[i].shape->SetTransform(translation(offset), inverse(translation(offset))));
+        }
+
+        FindReferenceHits(test_shapes, rays, isect_brute);
+
+        ASSERT_NO_THROW(api_->Commit());
+        CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+        CheckOcclusion(ray_buffer, occluded_buffer, isect_brute);
+    }
+
+    api_->SetOption("bvh.node_format", "full");
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(occluded_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_DeviceBuilder_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+    LoadCornellBox(shapes, test_shapes);
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+    auto occluded_buffer = api_->CreateBuffer(kNumRays * sizeof(int), nullptr);
+
+    // Quantized format is ignored by the device builder
+    api_->SetOption("bvh.builder", "hlbvh");
+    api_->SetOption("bvh.node_format", "quantized");
+
+    // Initial build and rebuilds after transform and ID changes, with and without restructuring
+    for (auto offset : { float3(0.f, 0.f, 0.f), float3(0.05f, 0.1f, -0.05f), float3(0.f, 5.f, 0.f) })
+    {
+        for (auto iterations : { 0.f, 3.f })
+        {
+            api_->SetOption("bvh.hlbvh.restructure_iterations", iterations);
+
+            for (auto i = 0u; i < test_shapes.size(); i += 2)
+            {
+                ASSERT_NO_THROW(test_shapes[i].shape->SetTransform(translation(offset), inverse(translation(offset))));
+            }
+
+            ASSERT_NO_THROW(test_shapes[1].shape->SetId(test_shapes[1].shape->GetId() + 100));
+
+            FindReferenceHits(test_shapes, rays, isect_brute);
+
+            ASSERT_NO_THROW(api_->Commit());
+            CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+            CheckOcclusion(ray_buffer, occluded_buffer, isect_brute);
+        }
+    }
+
+    api_->SetOption("bvh.builder", "median");
+    api_->SetOption("bvh.node_format", "full");
+
+    DeleteShapes(test_shapes);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(occluded_buffer));
+}
+
+TEST_F(ApiBackendHost, CornellBox_SaveLoadAccelerationStructure_Bruteforce)
+{
+    std::vector<shape_t> shapes;
+    std::vector<TestShape> test_shapes;
+
+    auto const kNumRays = 10000;
+    std::vector<ray> rays(kNumRays);
+    std::vector<Intersection> isect_brute;
+    GenerateRandomRays(rays);
+
+    auto ray_buffer = api_->CreateBuffer(kNumRays * sizeof(ray), rays.data());
+    auto isect_buffer = api_->CreateBuffer(kNumRays * sizeof(Intersection), nullptr);
+
+    char const* filename = "cornellbox_bvh.rras";
+
+    // Save committed scene
+    LoadCornellBox(shapes, test_shapes);
+    FindReferenceHits(test_shapes, rays, isect_brute);
+    ASSERT_THROW(api_->SaveAccelerationStructure(filename), Exception);
+    ASSERT_NO_THROW(api_->Commit());
+    ASSERT_NO_THROW(api_->SaveAccelerationStructure(filename));
+
+    // Recreate the same scene and load it instead of Commit
+    DeleteShapes(test_shapes);
+    api_->ResetIdCounter();
+    CreateCornellBox(shapes, test_shapes);
+    ASSERT_NO_THROW(api_->LoadAccelerationStructure(filename));
+    CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+
+    // Moved shape does not match the file anymore
+    matrix m = translation(float3(0.f, 0.5f, 0.f));
+    test_shapes[0].shape->SetTransform(m, inverse(m));
+    ASSERT_THROW(api_->LoadAccelerationStructure(filename), Exception);
+
+    // Loaded structure should be refitted properly after moving the shape back
+    test_shapes[0].shape->SetTransform(matrix(), matrix());
+    ASSERT_NO_THROW(api_->Commit());
+    CheckClosestHits(ray_buffer, isect_buffer, isect_brute);
+
+    DeleteShapes(test_shapes);
+    std::remove(filename);
+
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+}
+
+void ApiBackendHost::Perform_1Ray_Masked_Test()
+{
+    Shape* mesh = nullptr;
+    Shape* mesh2 = nullptr;
+
+    // Create mesh
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh != nullptr);
+
+    // Set mesh Id
+    ASSERT_NO_THROW(mesh->SetId(0));
+
+    // Attach the mesh to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh));
+
+    float const vertices2[] = {
+        -1.f,-1.f,1.f,
+        0.f,1.f,1.f,
+        1.f,-1.f,1.f,
+    };
+
+    ASSERT_NO_THROW(mesh2 = api_->CreateMesh(vertices2, 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+
+    ASSERT_TRUE(mesh2 != nullptr);
+
+    // Set mesh Id
+    ASSERT_NO_THROW(mesh2->SetId(10));
+
+    // Attach mesh2 to the scene
+    ASSERT_NO_THROW(api_->AttachShape(mesh2));
+
+    // Prepare the ray
+    ray r(float3(0.f, 0.f, -10.f), float3(0.f, 0.f, 1.f), 10000.f);
+    r.SetMask(-1);
+
+    // Intersection and hit data
+    Intersection isect;
+
+    auto ray_buffer = api_->CreateBuffer(sizeof(ray), &r);
+    auto isect_buffer = api_->CreateBuffer(sizeof(Intersection), nullptr);
+    auto isect_flag_buffer = api_->CreateBuffer(sizeof(int), nullptr);
+
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    Intersection* tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh->GetId());
+
+    r.SetMask(0);
+
+    // Update ray buffer
+    ray* rr = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(ray_buffer, kMapWrite, 0, sizeof(ray), (void**)&rr, &e_));
+    Wait();
+    *rr = r;
+    ASSERT_NO_THROW(api_->UnmapBuffer(ray_buffer, rr, &e_));
+    Wait();
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryIntersection(ray_buffer, 1, isect_buffer, nullptr, nullptr));
+
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_buffer, kMapRead, 0, sizeof(Intersection), (void**)&tmp, &e_));
+    Wait();
+    isect = *tmp;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_buffer, tmp, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_EQ(isect.shapeid, mesh2->GetId());
+
+    mesh->SetId(1);
+
+    // Detach mesh2 from the scene
+    ASSERT_NO_THROW(api_->DetachShape(mesh2));
+
+    int result = kNullId;
+    // Commit geometry update
+    ASSERT_NO_THROW(api_->Commit());
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, 1, isect_flag_buffer, nullptr, nullptr));
+
+    int* isect_flag = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_flag_buffer, kMapRead, 0, sizeof(int), (void**)&isect_flag, &e_));
+    Wait();
+    result = *isect_flag;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_flag_buffer, isect_flag, &e_));
+    Wait();
+
+    // Check results
+    ASSERT_GT(result, 0);
+
+    r.SetMask(1);
+
+    // Update ray buffer
+    rr = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(ray_buffer, kMapWrite, 0, sizeof(ray), (void**)&rr, &e_));
+    Wait();
+    *rr = r;
+    ASSERT_NO_THROW(api_->UnmapBuffer(ray_buffer, rr, &e_));
+    Wait();
+
+    // Intersect
+    ASSERT_NO_THROW(api_->QueryOcclusion(ray_buffer, 1, isect_flag_buffer, nullptr, nullptr));
+
+    isect_flag = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(isect_flag_buffer, kMapRead, 0, sizeof(int), (void**)&isect_flag, &e_));
+    Wait();
+    result = *isect_flag;
+    ASSERT_NO_THROW(api_->UnmapBuffer(isect_flag_buffer, isect_flag, &e_));
+    Wait();
+    // Check results
+    ASSERT_EQ(result, kNullId);
+
+
+    // Bail out
+    ASSERT_NO_THROW(api_->DetachShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteShape(mesh2));
+    ASSERT_NO_THROW(api_->DeleteBuffer(ray_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(isect_flag_buffer));
+}
+
+void ApiBackendHost::Perform_2d_Queries_Test(bool instanced)
+{
+    Shape* mesh = nullptr;
+    Shape* instance = nullptr;
+
+    ASSERT_NO_THROW(mesh = api_->CreateMesh(vertices(), 3, 3 * sizeof(float), indices(), 0, numfaceverts(), 1));
+    ASSERT_TRUE(mesh != nullptr);
+
+    if (instanced)
+    {
+        // Base mesh stays out of the scene, only the shifted instance is visible
+        ASSERT_NO_THROW(instance = api_->CreateInstance(mesh));
+        matrix m = translation(float3(0.f, 0.f, 0.5f));
+        matrix minv = inverse(m);
+        ASSERT_NO_THROW(instance->SetTransform(m, minv));
+        ASSERT_NO_THROW(api_->AttachShape(instance));
+    }
+    else
+    {
+        ASSERT_NO_THROW(api_->AttachShape(mesh));
+    }
+
+    // First point lies right below the triangle, the rest are off to the side
+    float4 origins[] = {
+        float4(0.f, 0.f, -1.f, 1000.f),
+        float4(5.f, 5.f, -1.f, 1000.f),
+        float4(6.f, 5.f, -1.f, 1000.f)
+    };
+
+    float4 directions[] = {
+        float4(0.f, 0.f, 1.f),
+        float4(0.f, 0.f, -1.f)
+    };
+
+    // Cell string 0 covers points [0, 2), cell string 1 covers [2, 3)
+    int cell_string_inds[] = { 0, 2, 2, 3 };
+
+    // x, z are accumulated on hit, y, w on miss
+    float4 koefs[] = {
+        float4(1.f, 2.f, 3.f, 4.f),
+        float4(10.f, 20.f, 30.f, 40.f)
+    };
+
+    int offsets[] = { 0, 0 };
+    float zeros[4] = { 0.f, 0.f, 0.f, 0.f };
+
+    auto origin_buffer = api_->CreateBuffer(sizeof(origins), origins);
+    auto direction_buffer = api_->CreateBuffer(sizeof(directions), directions);
+    auto inds_buffer = api_->CreateBuffer(sizeof(cell_string_inds), cell_string_inds);
+    auto koef_buffer = api_->CreateBuffer(sizeof(koefs), koefs);
+    auto offset_buffer = api_->CreateBuffer(sizeof(offsets), offsets);
+    auto cs_hit_buffer = api_->CreateBuffer(4 * sizeof(float), nullptr);
+    auto sl_hit_buffer = api_->CreateBuffer(sizeof(zeros), zeros);
+
+    ASSERT_NO_THROW(api_->Commit());
+
+    ASSERT_NO_THROW(api_->QueryOccluded2dCellString(origin_buffer, direction_buffer, 3, 2, inds_buffer, 2, cs_hit_buffer, nullptr, &e_));
+    Wait();
+
+    float* tmp = nullptr;
+    float hits[4];
+    ASSERT_NO_THROW(api_->MapBuffer(cs_hit_buffer, kMapRead, 0, sizeof(hits), (void**)&tmp, &e_));
+    Wait();
+    std::copy(tmp, tmp + 4, hits);
+    ASSERT_NO_THROW(api_->UnmapBuffer(cs_hit_buffer, tmp, &e_));
+    Wait();
+
+    // Results are laid out as cell_string + direction * num_cell_strings
+    ASSERT_EQ(hits[0], 1.f);
+    ASSERT_EQ(hits[1], 0.f);
+    ASSERT_EQ(hits[2], 0.f);
+    ASSERT_EQ(hits[3], 0.f);
+
+    // Stride of 1 sums all directions into a single slot per origin
+    ASSERT_NO_THROW(api_->QueryOccluded2dSumLinear2(origin_buffer, direction_buffer, koef_buffer, offset_buffer, offset_buffer, 2, 2, 1, sl_hit_buffer, nullptr, &e_));
+    Wait();
+
+    tmp = nullptr;
+    ASSERT_NO_THROW(api_->MapBuffer(sl_hit_buffer, kMapRead, 0, sizeof(hits), (void**)&tmp, &e_));
+    Wait();
+    std::copy(tmp, tmp + 4, hits);
+    ASSERT_NO_THROW(api_->UnmapBuffer(sl_hit_buffer, tmp, &e_));
+    Wait();
+
+    ASSERT_EQ(hits[0], 1.f + 20.f);
+    ASSERT_EQ(hits[1], 3.f + 40.f);
+    ASSERT_EQ(hits[2], 2.f + 20.f);
+    ASSERT_EQ(hits[3], 4.f + 40.f);
+
+    // Bail out
+    if (instanced)
+    {
+        ASSERT_NO_THROW(api_->DetachShape(instance));
+        ASSERT_NO_THROW(api_->DeleteShape(instance));
+    }
+    else
+    {
+        ASSERT_NO_THROW(api_->DetachShape(mesh));
+    }
+
+    ASSERT_NO_THROW(api_->DeleteShape(mesh));
+    ASSERT_NO_THROW(api_->DeleteBuffer(origin_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(direction_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(inds_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(koef_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(offset_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(cs_hit_buffer));
+    ASSERT_NO_THROW(api_->DeleteBuffer(sl_hit_buffer));
+}
+
+#endif // USE_HOST
@@ -36,6 +36,11 @@ THE SOFTWARE.
 //#include "radeon_rays_performance_test_vk.h"
 #endif
 
+#if USE_HOST
+#include "calc_test_host.h"
+#include "radeon_rays_apitest_host.h"
+#endif
+
 #if USE_EMBREE
 #include "radeon_rays_apitest_embree.h"
 #include "radeon_rays_conformance_test_embree.h"